@@ -4,6 +4,10 @@
 #  LIBZIP_FOUND - system has the zip library
 #  LIBZIP_INCLUDE_DIR - the zip include directory
 #  LIBZIP_LIBRARY - Link this to use the zip library
+#  LIBZIP_VERSION - the libzip version, from zipconf.h
+#
+# A version passed to find_package is the minimum accepted, and a libzip
+# whose zipconf.h gives no version is taken to be older than any.
 #
 # Copyright (c) 2006, Pino Toscano, <toscano.pino@tiscali.it>
 #
@@ -24,13 +28,40 @@ else (LIBZIP_LIBRARY AND LIBZIP_INCLUDE_DIR)
     ${GNUWIN32_DIR}/lib
   )
 
+  # zipconf.h sits next to zip.h, or in the library dir in old releases
+  if (LIBZIP_LIBRARY)
+    get_filename_component(_libzip_lib_dir ${LIBZIP_LIBRARY} PATH)
+  endif (LIBZIP_LIBRARY)
+  find_path(LIBZIP_CONF_INCLUDE_DIR zipconf.h
+    ${LIBZIP_INCLUDE_DIR}
+    ${_libzip_lib_dir}/libzip/include
+    ${GNUWIN32_DIR}/include
+  )
+
+  set(LIBZIP_VERSION)
+  if (LIBZIP_CONF_INCLUDE_DIR)
+    file(READ ${LIBZIP_CONF_INCLUDE_DIR}/zipconf.h _libzip_conf)
+    string(REGEX MATCH "#define LIBZIP_VERSION \"[^\"]*\"" _libzip_version "${_libzip_conf}")
+    if (_libzip_version)
+      string(REGEX REPLACE ".*\"([^\"]*)\"" "\\1" LIBZIP_VERSION "${_libzip_version}")
+    endif (_libzip_version)
+  endif (LIBZIP_CONF_INCLUDE_DIR)
+
+  if (LibZip_FIND_VERSION AND LIBZIP_LIBRARY AND LIBZIP_INCLUDE_DIR)
+    if (NOT LIBZIP_VERSION OR LIBZIP_VERSION VERSION_LESS LibZip_FIND_VERSION)
+      message(STATUS "libzip ${LIBZIP_VERSION} found, but ${LibZip_FIND_VERSION} or newer is required")
+      set(LIBZIP_LIBRARY LIBZIP_LIBRARY-NOTFOUND)
+    endif (NOT LIBZIP_VERSION OR LIBZIP_VERSION VERSION_LESS LibZip_FIND_VERSION)
+  endif (LibZip_FIND_VERSION AND LIBZIP_LIBRARY AND LIBZIP_INCLUDE_DIR)
+
   include(FindPackageHandleStandardArgs)
   FIND_PACKAGE_HANDLE_STANDARD_ARGS(LibZip DEFAULT_MSG LIBZIP_LIBRARY LIBZIP_INCLUDE_DIR)
 
     # ensure that they are cached
     set(LIBZIP_INCLUDE_DIR ${LIBZIP_INCLUDE_DIR} CACHE INTERNAL "The libzip include path")
     set(LIBZIP_LIBRARY ${LIBZIP_LIBRARY} CACHE INTERNAL "The libraries needed to use libzip")
+    set(LIBZIP_VERSION ${LIBZIP_VERSION} CACHE INTERNAL "The libzip version")
 
 endif (LIBZIP_LIBRARY AND LIBZIP_INCLUDE_DIR)
 
-mark_as_advanced(LIBZIP_INCLUDE_DIR LIBZIP_LIBRARY)
+mark_as_advanced(LIBZIP_INCLUDE_DIR LIBZIP_CONF_INCLUDE_DIR LIBZIP_LIBRARY)
@@ -0,0 +1,99 @@
+#include "epublib.h"
+
+// The first block's size, doubled for each block up to the last one's
+#define ARENA_FIRST_BLOCK 4096
+#define ARENA_MAX_BLOCK (256 * 1024)
+
+// A block of the arena, its bytes following the struct
+struct arenaBlock {
+  struct arenaBlock *next;
+};
+
+struct arena *_arena_new(void) {
+  struct arena *arena = malloc(sizeof(struct arena));
+
+  if (! arena)
+    return NULL;
+
+  arena->blocks = NULL;
+  arena->next = NULL;
+  arena->left = 0;
+  arena->blockSize = ARENA_FIRST_BLOCK;
+
+  return arena;
+}
+
+// Takes size bytes from the current block, starting a new block when
+// it can't hold them. Sizes beyond the block size get a block of their
+// own.
+static void *_arena_take(struct arena *arena, size_t size) {
+  struct arenaBlock *block;
+  size_t blockSize;
+  void *ret;
+
+  if (size > arena->left) {
+    blockSize = arena->blockSize;
+    if (size > blockSize)
+      blockSize = size;
+
+    block = malloc(sizeof(struct arenaBlock) + blockSize);
+    if (! block)
+      return NULL;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->next = (char *)(block + 1);
+    arena->left = blockSize;
+
+    if (arena->blockSize < ARENA_MAX_BLOCK)
+      arena->blockSize *= 2;
+  }
+
+  ret = arena->next;
+  arena->next += size;
+  arena->left -= size;
+
+  return ret;
+}
+
+void *_arena_alloc(struct arena *arena, size_t size) {
+  size_t pad = (size_t)arena->next % sizeof(double);
+
+  // keep structs aligned, strings are taken unaligned
+  if (pad && arena->left >= sizeof(double) - pad) {
+    arena->next += sizeof(double) - pad;
+    arena->left -= sizeof(double) - pad;
+  } else if (pad) {
+    arena->left = 0;
+  }
+
+  return _arena_take(arena, (size + sizeof(double) - 1) &
+                     ~(sizeof(double) - 1));
+}
+
+xmlChar *_arena_strndup(struct arena *arena, const xmlChar *str, int len) {
+  xmlChar *ret;
+
+  if (! str || len < 0)
+    return NULL;
+
+  ret = _arena_take(arena, len + 1);
+  if (! ret)
+    return NULL;
+  memcpy(ret, str, len);
+  ret[len] = 0;
+
+  return ret;
+}
+
+void _arena_free(struct arena *arena) {
+  struct arenaBlock *block, *next;
+
+  if (! arena)
+    return;
+
+  for (block = arena->blocks; block; block = next) {
+    next = block->next;
+    free(block);
+  }
+  free(arena);
+}
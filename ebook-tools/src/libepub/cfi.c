@@ -0,0 +1,865 @@
+#include "epub.h"
+#include "epublib.h"
+
+// The longest id kept for an assertion
+#define CFI_ID_MAX 63
+// The most steps a cfi path may have
+#define CFI_STEPS_MAX 64
+
+// A content document is walked byte by byte, so it is never held or
+// parsed as a whole. Only what cfi paths count is tracked: elements,
+// with their ids, and the characters of the text between them.
+enum cfiState {
+  CFI_DATA,
+  CFI_ENTITY,
+  CFI_TAG,       // after '<'
+  CFI_NAME,      // the element name of a start tag
+  CFI_ATTRS,     // between attributes
+  CFI_ATTR_NAME,
+  CFI_ATTR_EQ,   // after an attribute name
+  CFI_ATTR_VALUE,
+  CFI_END,       // an end tag
+  CFI_BANG,      // after "<!"
+  CFI_COMMENT,
+  CFI_CDATA,
+  CFI_DECL,
+  CFI_PI
+};
+
+// An open element while building a cfi
+struct cfiLevel {
+  int children; // element children so far
+  int chars;    // characters since the last child element
+  char id[CFI_ID_MAX + 1];
+};
+
+struct cfiWalker {
+  enum cfiState state;
+  int base;     // document offset of the current chunk
+  int tagStart;
+  int slash;    // the tag ends with "/>"
+  char quote;
+  char name[3];
+  int nameLen;
+  int isId;
+  char id[CFI_ID_MAX + 1];
+  int idLen;    // -1 if the id is too long to keep
+  char keyword[8];
+  int keywordLen;
+  int brackets; // pending ']' of cdata, or open '[' of a declaration
+  int dashes;
+  int cr;
+
+  int level;    // open elements, the root element is level 1
+  int rootDone;
+  int done;     // 1 when found, -1 when there's no such position
+
+  // resolving a path
+  const int *steps;
+  int count;
+  int offset;
+  int matched;  // level of the deepest element on the path
+  int children;
+  int chars;
+  int result;
+
+  // building a path for the target offset, which is -1 when resolving
+  int target;
+  struct cfiLevel *levels;
+  int size;
+  char *path;
+
+  // collecting the element ids instead
+  struct fragmentIndex *ids;
+  int idsSize;
+};
+
+static int _cfi_is_space(char c) {
+  return (c == ' ' || c == '\n' || c == '\t' || c == '\r');
+}
+
+// Writes src with the characters cfis reserve escaped, returns its length
+static int _cfi_escape(char *dst, const char *src) {
+  char *start = dst;
+
+  for (; *src; src++) {
+    if (strchr("^[](),;=", *src))
+      *dst++ = '^';
+    *dst++ = *src;
+  }
+  *dst = 0;
+
+  return dst - start;
+}
+
+// Skips an assertion, copying its unescaped value to id if given. An
+// id too long for the buffer leaves it empty, as if not asserted.
+static const char *_cfi_assertion(const char *p, char *id) {
+  int len = 0;
+
+  p++;
+  while (*p && *p != ']') {
+    if (*p == '^' && p[1])
+      p++;
+    if (id && len < CFI_ID_MAX) {
+      id[len++] = *p;
+    } else if (id) {
+      id[0] = 0;
+      id = NULL;
+    }
+    p++;
+  }
+  if (id)
+    id[len] = 0;
+
+  return (*p == ']')?p + 1:p;
+}
+
+static const char *_cfi_number(const char *p, int *value) {
+  long v = 0;
+
+  if (*p < '0' || *p > '9')
+    return NULL;
+
+  while (*p >= '0' && *p <= '9') {
+    v = v * 10 + (*p++ - '0');
+    if (v > 0x7FFFFFF)
+      return NULL;
+  }
+  *value = (int)v;
+
+  return p;
+}
+
+// Parses a cfi into the two package steps, the spine item's idref
+// assertion and the content document's steps with the character offset
+// of the last one (-1 if there's none). Of a range only the start is
+// kept, spatial and temporal offsets are ignored.
+static int _cfi_parse(const char *cfi, int *pkg, char *idref,
+                      int *steps, int *count, int *offset) {
+  const char *p = cfi;
+  int *side = pkg, pkgCount = 0, *n = &pkgCount, ranges = 0, i;
+
+  *count = 0;
+  *offset = -1;
+  idref[0] = 0;
+
+  if (strncmp(p, "epubcfi(", 8) == 0)
+    p += 8;
+
+  while (p && *p && *p != ')') {
+    switch (*p) {
+    case '/':
+      if (*n == CFI_STEPS_MAX || (side == pkg && *n == 2))
+        return 0;
+      p = _cfi_number(p + 1, &side[*n]);
+      if (! p || side[*n] == 0)
+        return 0;
+      (*n)++;
+      *offset = -1;
+      if (*p == '[')
+        p = _cfi_assertion(p, (side == pkg && *n == 2)?idref:NULL);
+      break;
+    case '!':
+      // documents referenced from content documents aren't supported
+      if (side != pkg)
+        return 0;
+      side = steps;
+      n = count;
+      p++;
+      break;
+    case ':':
+      p = _cfi_number(p + 1, offset);
+      if (! p)
+        return 0;
+      if (*p == '[')
+        p = _cfi_assertion(p, NULL);
+      break;
+    case '~':
+    case '@':
+      p++;
+      while ((*p >= '0' && *p <= '9') || *p == '.' || *p == ':')
+        p++;
+      break;
+    case '[':
+      p = _cfi_assertion(p, NULL);
+      break;
+    case ',':
+      if (ranges++)
+        p = NULL;
+      else
+        p++;
+      break;
+    default:
+      return 0;
+    }
+  }
+
+  if (pkgCount != 2 || pkg[1] % 2)
+    return 0;
+
+  // only the last step may point at text
+  for (i = 0; i + 1 < *count; i++)
+    if (steps[i] % 2)
+      return 0;
+
+  return 1;
+}
+
+static void _cfi_found(struct cfiWalker *w, int pos) {
+  w->result = pos;
+  w->done = 1;
+}
+
+// The step the children of the deepest element on the path are
+// matched against
+static int _cfi_step(struct cfiWalker *w) {
+  return w->steps[w->matched - 1];
+}
+
+static int _cfi_last(struct cfiWalker *w) {
+  return (w->matched == w->count);
+}
+
+static struct cfiLevel *_cfi_push(struct cfiWalker *w) {
+  if (w->level + 1 >= w->size) {
+    int size = w->size?2 * w->size:16;
+    struct cfiLevel *levels = realloc(w->levels, size * sizeof(struct cfiLevel));
+
+    if (! levels) {
+      w->done = -1;
+      return NULL;
+    }
+    w->levels = levels;
+    w->size = size;
+  }
+
+  w->level++;
+  return &w->levels[w->level];
+}
+
+static void _cfi_add_id(struct cfiWalker *w, int pos) {
+  struct fragment *item;
+
+  if (w->ids->count == w->idsSize) {
+    int size = w->idsSize?2 * w->idsSize:64;
+    struct fragment *items = realloc(w->ids->items, size * sizeof(struct fragment));
+
+    if (! items) {
+      w->done = -1;
+      return;
+    }
+    w->ids->items = items;
+    w->idsSize = size;
+  }
+
+  item = &w->ids->items[w->ids->count];
+  item->id = strdup(w->id);
+  if (! item->id) {
+    w->done = -1;
+    return;
+  }
+  item->offset = pos;
+  item->textOffset = 0;
+  w->ids->count++;
+}
+
+static void _cfi_start(struct cfiWalker *w, int pos, int empty) {
+  struct cfiLevel *level;
+
+  if (w->ids) {
+    if (w->idLen > 0)
+      _cfi_add_id(w, pos);
+    return;
+  }
+
+  if (w->level == 0 && w->rootDone)
+    return;
+
+  if (w->target >= 0) {
+    if (w->level > 0) {
+      w->levels[w->level].children++;
+      w->levels[w->level].chars = 0;
+    }
+    if (! empty && (level = _cfi_push(w))) {
+      level->children = 0;
+      level->chars = 0;
+      strcpy(level->id, (w->idLen > 0)?w->id:"");
+    }
+    return;
+  }
+
+  if (w->level == 0) {
+    w->matched = 1;
+  } else if (w->level == w->matched) {
+    int step = _cfi_step(w);
+
+    // this child ends the text the step points at
+    if (step % 2 && (step - 1) / 2 == w->children) {
+      _cfi_found(w, pos);
+      return;
+    }
+
+    w->children++;
+    w->chars = 0;
+    if (step == 2 * w->children) {
+      if (_cfi_last(w)) {
+        _cfi_found(w, pos);
+        return;
+      }
+      if (empty) {
+        w->done = -1;
+        return;
+      }
+      w->matched++;
+      w->children = 0;
+    }
+  }
+
+  if (! empty)
+    w->level++;
+}
+
+static void _cfi_end(struct cfiWalker *w, int pos) {
+  if (w->level == 0 || w->ids)
+    return;
+
+  if (w->target < 0 && w->level == w->matched) {
+    int step = _cfi_step(w);
+
+    // the element ends with the text the step points at, or without
+    // the element it points at
+    if (step % 2 && (step - 1) / 2 == w->children)
+      _cfi_found(w, pos);
+    else
+      w->done = -1;
+    return;
+  }
+
+  w->level--;
+  if (w->level == 0)
+    w->rootDone = 1;
+}
+
+static void _cfi_char(struct cfiWalker *w, int pos, int units) {
+  if (w->level == 0 || w->ids)
+    return;
+
+  if (w->target >= 0) {
+    w->levels[w->level].chars += units;
+    return;
+  }
+
+  if (w->level != w->matched)
+    return;
+
+  if (_cfi_last(w)) {
+    int step = _cfi_step(w);
+
+    if (step % 2 && (step - 1) / 2 == w->children &&
+        w->offset < w->chars + units) {
+      _cfi_found(w, pos);
+      return;
+    }
+  }
+  w->chars += units;
+}
+
+// Builds the path of the current position: the elements open, the text
+// after the last child of the innermost and the characters into it
+static void _cfi_snapshot(struct cfiWalker *w) {
+  char *p;
+  int i;
+
+  w->done = -1;
+  if (w->rootDone)
+    return;
+
+  w->path = malloc((w->level + 1) * (2 * CFI_ID_MAX + 16) + 16);
+  if (! w->path)
+    return;
+
+  p = w->path;
+  if (w->level == 0) {
+    strcpy(p, "/1:0");
+    w->done = 1;
+    return;
+  }
+
+  for (i = 2; i <= w->level; i++) {
+    p += sprintf(p, "/%d", 2 * w->levels[i - 1].children);
+    if (w->levels[i].id[0]) {
+      *p++ = '[';
+      p += _cfi_escape(p, w->levels[i].id);
+      *p++ = ']';
+    }
+  }
+  sprintf(p, "/%d:%d", 2 * w->levels[w->level].children + 1,
+          w->levels[w->level].chars);
+  w->done = 1;
+}
+
+static void _cfi_walk(struct cfiWalker *w, const char *buf, int len) {
+  int i, pos;
+
+  for (i = 0; i < len && ! w->done; i++) {
+    unsigned char c = (unsigned char)buf[i];
+
+    pos = w->base + i;
+    if (w->target >= 0 && pos >= w->target) {
+      _cfi_snapshot(w);
+      break;
+    }
+
+    switch (w->state) {
+    case CFI_ENTITY:
+      if (c == ';') {
+        w->state = CFI_DATA;
+        break;
+      }
+      if (c != '<')
+        break;
+      // fall through
+    case CFI_DATA:
+      if (c == '<') {
+        w->state = CFI_TAG;
+        w->tagStart = pos;
+      } else if (c == '&') {
+        w->state = CFI_ENTITY;
+        _cfi_char(w, pos, 1);
+      } else if (c == '\n' && w->cr) {
+        // xml reads "\r\n" as one line feed
+      } else if ((c & 0xC0) != 0x80) {
+        // utf-16 code units, as cfi offsets are counted
+        _cfi_char(w, pos, (c >= 0xF0)?2:1);
+      }
+      w->cr = (c == '\r');
+      break;
+    case CFI_TAG:
+      w->slash = 0;
+      w->idLen = 0;
+      if (c == '/') {
+        w->state = CFI_END;
+      } else if (c == '!') {
+        w->state = CFI_BANG;
+        w->keywordLen = 0;
+      } else if (c == '?') {
+        w->state = CFI_PI;
+        w->dashes = 0;
+      } else {
+        w->state = CFI_NAME;
+      }
+      break;
+    case CFI_NAME:
+    case CFI_ATTRS:
+    case CFI_ATTR_NAME:
+    case CFI_ATTR_EQ:
+      if (c == '>') {
+        w->state = CFI_DATA;
+        _cfi_start(w, w->tagStart, w->slash);
+      } else if (c == '/') {
+        w->slash = 1;
+      } else if (_cfi_is_space(c)) {
+        if (w->state == CFI_NAME)
+          w->state = CFI_ATTRS;
+        else if (w->state == CFI_ATTR_NAME)
+          w->state = CFI_ATTR_EQ;
+      } else if (c == '=' && w->state != CFI_NAME) {
+        w->isId = (w->nameLen == 2 && memcmp(w->name, "id", 2) == 0);
+        w->state = CFI_ATTR_EQ;
+      } else if ((c == '"' || c == '\'') && w->state == CFI_ATTR_EQ) {
+        w->quote = c;
+        w->state = CFI_ATTR_VALUE;
+        if (w->isId)
+          w->idLen = 0;
+      } else if (w->state != CFI_NAME) {
+        w->slash = 0;
+        if (w->state != CFI_ATTR_NAME) {
+          w->state = CFI_ATTR_NAME;
+          w->nameLen = 0;
+          w->isId = 0;
+        }
+        if (w->nameLen < 3)
+          w->name[w->nameLen] = c;
+        w->nameLen++;
+      }
+      break;
+    case CFI_ATTR_VALUE:
+      if (c == (unsigned char)w->quote) {
+        if (w->isId && w->idLen >= 0)
+          w->id[w->idLen] = 0;
+        w->isId = 0;
+        w->state = CFI_ATTRS;
+      } else if (w->isId && w->idLen >= 0) {
+        if (w->idLen < CFI_ID_MAX)
+          w->id[w->idLen++] = c;
+        else
+          w->idLen = -1;
+      }
+      break;
+    case CFI_END:
+      if (c == '>') {
+        w->state = CFI_DATA;
+        _cfi_end(w, w->tagStart);
+      }
+      break;
+    case CFI_BANG:
+      w->keyword[w->keywordLen++] = c;
+      if (w->keywordLen == 2 && memcmp(w->keyword, "--", 2) == 0) {
+        w->state = CFI_COMMENT;
+        w->dashes = 0;
+      } else if (w->keywordLen == 7 && memcmp(w->keyword, "[CDATA[", 7) == 0) {
+        w->state = CFI_CDATA;
+        w->brackets = 0;
+      } else if (memcmp(w->keyword, "--", (w->keywordLen < 2)?w->keywordLen:2) &&
+                 memcmp(w->keyword, "[CDATA[", w->keywordLen)) {
+        w->state = CFI_DECL;
+        w->brackets = 0;
+        if (c == '>')
+          w->state = CFI_DATA;
+      }
+      break;
+    case CFI_COMMENT:
+      if (c == '>' && w->dashes >= 2)
+        w->state = CFI_DATA;
+      w->dashes = (c == '-')?w->dashes + 1:0;
+      break;
+    case CFI_CDATA:
+      // "]" is text unless it is part of "]]>"
+      if (c == ']') {
+        w->brackets++;
+        break;
+      }
+      if (c == '>' && w->brackets >= 2) {
+        for (; w->brackets > 2 && ! w->done; w->brackets--)
+          _cfi_char(w, pos - w->brackets, 1);
+        w->state = CFI_DATA;
+        break;
+      }
+      for (; w->brackets > 0 && ! w->done; w->brackets--)
+        _cfi_char(w, pos - w->brackets, 1);
+      if (! w->done && (c & 0xC0) != 0x80)
+        _cfi_char(w, pos, (c >= 0xF0)?2:1);
+      break;
+    case CFI_DECL:
+      if (c == '[')
+        w->brackets++;
+      else if (c == ']' && w->brackets > 0)
+        w->brackets--;
+      else if (c == '>' && w->brackets == 0)
+        w->state = CFI_DATA;
+      break;
+    case CFI_PI:
+      if (c == '>' && w->dashes)
+        w->state = CFI_DATA;
+      w->dashes = (c == '?');
+      break;
+    }
+  }
+
+  w->base += len;
+}
+
+// Walks a spine document until the walker is done
+static int _cfi_walk_document(struct epub *epub, int index,
+                              struct cfiWalker *w) {
+  struct textdoc *doc;
+  zip_int64_t size;
+  char *buf;
+
+  doc = _text_open(epub, index);
+  if (! doc)
+    return 0;
+
+  buf = malloc(TEXT_CHUNK_SIZE);
+  if (! buf) {
+    _epub_err_set_oom(&epub->error);
+    _text_close(doc);
+    return 0;
+  }
+
+  while (! w->done && (size = _text_read(doc, buf, TEXT_CHUNK_SIZE)) > 0)
+    _cfi_walk(w, buf, (int)size);
+
+  free(buf);
+  _text_close(doc);
+  return 1;
+}
+
+static int _cfi_spine_by_idref(struct epub *epub, const char *idref) {
+  struct spine *item;
+  int i;
+
+  for (i = 0; i < epub->opf->spine->Size; i++) {
+    item = GetItem(epub->opf->spine, i);
+    if (item && item->idref && strcmp((char *)item->idref, idref) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+int epub_cfi_resolve(struct epub *epub, const char *cfi,
+                     int *spine_index, int *offset) {
+  int pkg[2], steps[CFI_STEPS_MAX];
+  char idref[CFI_ID_MAX + 1];
+  struct cfiWalker w;
+  struct spine *item;
+  int index;
+
+  if (!epub || !cfi) {
+    return 0;
+  }
+
+  memset(&w, 0, sizeof(struct cfiWalker));
+  if (! _cfi_parse(cfi, pkg, idref, steps, &w.count, &w.offset)) {
+    _epub_print_debug(epub, DEBUG_INFO, "malformed cfi %s", cfi);
+    return 0;
+  }
+
+  // the idref assertion wins over the step, as the spec suggests
+  index = pkg[1] / 2 - 1;
+  item = GetItem(epub->opf->spine, index);
+  if (idref[0] && (! item || ! item->idref ||
+                   strcmp((char *)item->idref, idref) != 0))
+    index = _cfi_spine_by_idref(epub, idref);
+  if (index < 0 || index >= epub->opf->spine->Size)
+    return 0;
+
+  w.steps = steps;
+  w.target = -1;
+  if (w.offset < 0)
+    w.offset = 0;
+  if (w.count == 0)
+    _cfi_found(&w, 0);
+
+  if (! w.done && ! _cfi_walk_document(epub, index, &w))
+    return 0;
+  if (w.done != 1) {
+    _epub_print_debug(epub, DEBUG_INFO, "cfi %s is not in spine document %d",
+                      cfi, index);
+    return 0;
+  }
+
+  if (spine_index)
+    *spine_index = index;
+  if (offset)
+    *offset = w.result;
+  return 1;
+}
+
+char *epub_cfi_from_position(struct epub *epub, int spine_index, int offset) {
+  struct cfiWalker w;
+  struct spine *item;
+  char *cfi = NULL, *p;
+
+  if (!epub) {
+    return NULL;
+  }
+
+  item = GetItem(epub->opf->spine, spine_index);
+  if (! item || ! item->idref || offset < 0)
+    return NULL;
+
+  memset(&w, 0, sizeof(struct cfiWalker));
+  w.target = offset;
+  if (_cfi_walk_document(epub, spine_index, &w) && ! w.done)
+    _cfi_snapshot(&w);
+
+  if (w.done == 1) {
+    // the spine is the third child of the package
+    cfi = malloc(2 * strlen((char *)item->idref) + strlen(w.path) + 32);
+    if (cfi) {
+      p = cfi + sprintf(cfi, "epubcfi(/6/%d[", 2 * (spine_index + 1));
+      p += _cfi_escape(p, (char *)item->idref);
+      sprintf(p, "]!%s)", w.path);
+    } else {
+      _epub_err_set_oom(&epub->error);
+    }
+  }
+
+  free(w.path);
+  free(w.levels);
+  return cfi;
+}
+
+static int _cfi_cmp_fragment(const void *a, const void *b) {
+  const struct fragment *f1 = a, *f2 = b;
+  int res = strcmp(f1->id, f2->id);
+
+  // the first of duplicate ids wins
+  return res?res:(f1->offset - f2->offset);
+}
+
+static void _cfi_free_fragment_index(struct fragmentIndex *index) {
+  int i;
+
+  if (! index)
+    return;
+
+  for (i = 0; i < index->count; i++)
+    free(index->items[i].id);
+  free(index->items);
+  free(index);
+}
+
+// Counts the characters the text extractor makes of in[0, len)
+static int _cfi_text_chars(struct textparser *parser, const char *in, int len,
+                           char *out) {
+  int i, chars = 0;
+
+  len = _text_parse(parser, in, len, out);
+  for (i = 0; i < len; i++)
+    if ((out[i] & 0xC0) != 0x80)
+      chars++;
+
+  return chars;
+}
+
+// Returns the element ids of a spine document, reading it the first
+// time they are asked for
+struct fragmentIndex *_cfi_fragments(struct epub *epub, int index) {
+  struct fragmentIndex *ids;
+  struct textparser parser;
+  struct cfiWalker w;
+  struct textdoc *doc;
+  zip_int64_t size;
+  char *in = NULL, *out = NULL;
+  int i, from, fed, chars = 0;
+
+  if (index < 0 || index >= epub->opf->spine->Size)
+    return NULL;
+
+  if (! epub->fragments) {
+    epub->fragments = calloc(epub->opf->spine->Size,
+                             sizeof(struct fragmentIndex *));
+    if (! epub->fragments) {
+      _epub_err_set_oom(&epub->error);
+      return NULL;
+    }
+  }
+
+  if (epub->fragments[index])
+    return epub->fragments[index];
+
+  doc = _text_open(epub, index);
+  if (! doc)
+    return NULL;
+
+  memset(&w, 0, sizeof(struct cfiWalker));
+  w.target = -1;
+  ids = w.ids = calloc(1, sizeof(struct fragmentIndex));
+  in = malloc(TEXT_CHUNK_SIZE);
+  out = malloc(TEXT_OUT_SIZE(TEXT_CHUNK_SIZE));
+  if (! ids || ! in || ! out)
+    w.done = -1;
+
+  // the text offsets come from feeding the text extractor the pieces
+  // of each chunk up to the elements found in it
+  _text_init(&parser);
+  while (! w.done && (size = _text_read(doc, in, TEXT_CHUNK_SIZE)) > 0) {
+    from = ids->count;
+    _cfi_walk(&w, in, (int)size);
+
+    fed = 0;
+    for (i = from; i < ids->count; i++) {
+      int pos = ids->items[i].offset - (w.base - (int)size);
+
+      if (pos > fed) {
+        chars += _cfi_text_chars(&parser, in + fed, pos - fed, out);
+        fed = pos;
+      }
+      ids->items[i].textOffset = chars;
+    }
+    chars += _cfi_text_chars(&parser, in + fed, (int)size - fed, out);
+  }
+
+  _text_close(doc);
+  free(in);
+  free(out);
+
+  if (w.done) {
+    _epub_err_set_oom(&epub->error);
+    _cfi_free_fragment_index(ids);
+    return NULL;
+  }
+
+  qsort(ids->items, ids->count, sizeof(struct fragment), _cfi_cmp_fragment);
+  epub->fragments[index] = ids;
+  return ids;
+}
+
+void _cfi_free_fragments(struct epub *epub) {
+  int i;
+
+  if (! epub->fragments)
+    return;
+
+  for (i = 0; i < epub->opf->spine->Size; i++)
+    _cfi_free_fragment_index(epub->fragments[i]);
+  free(epub->fragments);
+  epub->fragments = NULL;
+}
+
+int epub_build_fragment_index(struct epub *epub) {
+  int i, res = 1;
+
+  if (!epub) {
+    return 0;
+  }
+
+  for (i = 0; i < epub->opf->spine->Size; i++)
+    if (! _cfi_fragments(epub, i))
+      res = 0;
+
+  return res;
+}
+
+int epub_resolve_fragment(struct epub *epub, const char *href,
+                          int *spine_index, int *offset, int *text_offset) {
+  struct fragmentIndex *ids;
+  const char *fragment;
+  int index, low, high, mid, res;
+
+  if (!epub || !href) {
+    return 0;
+  }
+
+  index = _opf_spine_index_by_link(epub->opf, NULL, href, &fragment);
+  if (index < 0)
+    return 0;
+
+  if (spine_index)
+    *spine_index = index;
+  if (offset)
+    *offset = 0;
+  if (text_offset)
+    *text_offset = 0;
+  if (! fragment)
+    return 1;
+
+  ids = _cfi_fragments(epub, index);
+  if (! ids)
+    return 0;
+
+  // the first item with the id
+  low = 0;
+  high = ids->count;
+  while (low < high) {
+    mid = (low + high) / 2;
+    if (strcmp(ids->items[mid].id, fragment) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  res = (low < ids->count && strcmp(ids->items[low].id, fragment) == 0);
+  if (res) {
+    if (offset)
+      *offset = ids->items[low].offset;
+    if (text_offset)
+      *text_offset = ids->items[low].textOffset;
+  }
+
+  return res;
+}
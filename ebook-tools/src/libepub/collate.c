@@ -0,0 +1,287 @@
+#include "epub.h"
+#include "epublib.h"
+
+// A sort key is the string case folded, with diacritics, apostrophes
+// and the leading article dropped. Runs of other punctuation and
+// spaces become COLLATE_SPACE, which sorts words before longer ones,
+// and numbers become COLLATE_NUMBER plus their digit count followed by
+// the digits, which sorts them by value and before letters. Keys end
+// in a 0 and have no other, so strcmp orders them.
+#define COLLATE_SPACE 0x01
+#define COLLATE_NUMBER 0x10
+#define COLLATE_MAX_DIGITS 15
+
+// The base letters of U+00C0 to U+00FF; '*' marks two letter ones and
+// ' ' punctuation
+static const char _collate_latin1[] =
+  "aaaaaa*ceeeeiiiidnooooo ouuuuy**aaaaaa*ceeeeiiiidnooooo ouuuuy*y";
+
+// The base letters of U+0100 to U+017F, '*' marking two letter ones
+static const char _collate_latin_ext[] =
+  "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiii**jjkkklllllllll"
+  "lnnnnnnnnnoooooo**rrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+
+// Leading articles by language, ending in ' for elided ones
+struct collateArticles {
+  const char *lang;
+  const char *articles[8];
+};
+
+static const struct collateArticles _collate_articles[] = {
+  { "en", { "the", "a", "an", NULL } },
+  { "fr", { "le", "la", "les", "l'", "un", "une", NULL } },
+  { "de", { "der", "die", "das", "ein", "eine", NULL } },
+  { "es", { "el", "la", "los", "las", "un", "una", NULL } },
+  { "it", { "il", "lo", "la", "i", "gli", "le", "l'", NULL } },
+  { "pt", { "o", "a", "os", "as", "um", "uma", NULL } },
+  { "nl", { "de", "het", "een", NULL } },
+  { NULL, { NULL } }
+};
+
+// Decodes the character at str, setting len to its bytes
+static unsigned int _collate_char(const unsigned char *str, int *len) {
+  unsigned int c = str[0];
+  int i, n;
+
+  *len = 1;
+  if (c < 0x80)
+    return c;
+  if (c >= 0xC2 && c < 0xE0)
+    n = 1;
+  else if (c >= 0xE0 && c < 0xF0)
+    n = 2;
+  else if (c >= 0xF0 && c < 0xF5)
+    n = 3;
+  else
+    return 0xFFFD;
+
+  c &= 0x3F >> n;
+  for (i = 1; i <= n; i++) {
+    if ((str[i] & 0xC0) != 0x80)
+      return 0xFFFD;
+    c = (c << 6) | (str[i] & 0x3F);
+  }
+  *len = n + 1;
+
+  return c;
+}
+
+static int _collate_utf8(unsigned int c, unsigned char *out) {
+  if (c < 0x80) {
+    out[0] = c;
+    return 1;
+  }
+  if (c < 0x800) {
+    out[0] = 0xC0 | (c >> 6);
+    out[1] = 0x80 | (c & 0x3F);
+    return 2;
+  }
+  if (c < 0x10000) {
+    out[0] = 0xE0 | (c >> 12);
+    out[1] = 0x80 | ((c >> 6) & 0x3F);
+    out[2] = 0x80 | (c & 0x3F);
+    return 3;
+  }
+  out[0] = 0xF0 | (c >> 18);
+  out[1] = 0x80 | ((c >> 12) & 0x3F);
+  out[2] = 0x80 | ((c >> 6) & 0x3F);
+  out[3] = 0x80 | (c & 0x3F);
+  return 4;
+}
+
+// Writes the folded form of a letter to out and returns its bytes, 0
+// if it is dropped and -1 if it separates words
+static int _collate_fold(unsigned int c, unsigned char *out) {
+  const char *two = NULL;
+  char base = 0;
+
+  if (c < 0x80) {
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+    if (c >= 'a' && c <= 'z') {
+      out[0] = c;
+      return 1;
+    }
+    return (c == '\'')?0:-1;
+  }
+
+  if (c < 0xC0 || c == 0xFFFD)
+    return -1;
+  if (c < 0x100) {
+    base = _collate_latin1[c - 0xC0];
+    if (base == '*')
+      two = (c == 0xC6 || c == 0xE6)?"ae":((c == 0xDF)?"ss":"th");
+  } else if (c < 0x180) {
+    base = _collate_latin_ext[c - 0x100];
+    if (base == '*')
+      two = (c < 0x140)?"ij":"oe";
+  } else if (c >= 0x300 && c < 0x370) { // combining marks
+    return 0;
+  } else if (c >= 0x391 && c <= 0x3A9) {
+    c += 0x20;
+  } else if (c == 0x386) {
+    c = 0x3AC;
+  } else if (c >= 0x388 && c <= 0x38A) {
+    c += 0x25;
+  } else if (c == 0x38C || c == 0x38E || c == 0x38F) {
+    c += (c == 0x38C)?0x40:0x3F;
+  } else if (c == 0x3C2) { // final sigma
+    c = 0x3C3;
+  } else if (c == 0x401 || c == 0x451) {
+    c = 0x435;
+  } else if (c >= 0x400 && c < 0x410) {
+    c += 0x50;
+  } else if (c >= 0x410 && c < 0x430) {
+    c += 0x20;
+  } else if (c == 0x2018 || c == 0x2019) {
+    return 0;
+  } else if ((c >= 0x2000 && c < 0x2070) || c == 0x3000 ||
+             (c >= 0x3001 && c < 0x3004)) {
+    return -1;
+  }
+
+  if (two) {
+    out[0] = two[0];
+    out[1] = two[1];
+    return 2;
+  }
+  if (base == ' ')
+    return -1;
+  if (base) {
+    out[0] = base;
+    return 1;
+  }
+
+  return _collate_utf8(c, out);
+}
+
+// Returns the bytes of the string's leading article and the space after
+// it, or 0 if it has none or nothing follows it
+static int _collate_article(const xmlChar *str, const xmlChar *lang) {
+  const struct collateArticles *set = _collate_articles;
+  const char *article;
+  int i, len, n, skip;
+
+  // the language's primary subtag picks the articles, english otherwise
+  for (i = 0; lang && _collate_articles[i].lang; i++)
+    if (xmlStrncasecmp(lang, (xmlChar *)_collate_articles[i].lang, 2) == 0 &&
+        (lang[2] == 0 || lang[2] == '-' || lang[2] == '_')) {
+      set = &_collate_articles[i];
+      break;
+    }
+
+  for (i = 0; (article = set->articles[i]); i++) {
+    len = strlen(article);
+    n = len;
+    if (article[len - 1] == '\'')
+      n--;
+    if (xmlStrncasecmp(str, (xmlChar *)article, n) != 0)
+      continue;
+
+    if (n < len) {
+      if (str[n] == '\'')
+        skip = n + 1;
+      else if (str[n] == 0xE2 && str[n + 1] == 0x80 && str[n + 2] == 0x99)
+        skip = n + 3;
+      else
+        continue;
+    } else {
+      if (str[n] != ' ' && str[n] != '\t' && str[n] != '\n' && str[n] != '\r')
+        continue;
+      skip = n + 1;
+    }
+
+    while (str[skip] == ' ' || str[skip] == '\t' || str[skip] == '\n' ||
+           str[skip] == '\r')
+      skip++;
+    return (str[skip])?skip:0;
+  }
+
+  return 0;
+}
+
+xmlChar *_collate_key(const xmlChar *str, const xmlChar *lang) {
+  unsigned char *key, *out, folded[4];
+  const unsigned char *p;
+  int len, n, digits, space = 0;
+
+  while (*str == ' ' || *str == '\t' || *str == '\n' || *str == '\r')
+    str++;
+  str += _collate_article(str, lang);
+
+  // a character never folds to more bytes than it has, save for the two
+  // letter ones and a number's digit count
+  key = malloc(xmlStrlen(str) * 2 + 2);
+  if (! key)
+    return NULL;
+  out = key;
+
+  for (p = str; *p; ) {
+    if (*p >= '0' && *p <= '9') {
+      while (*p == '0' && p[1] >= '0' && p[1] <= '9')
+        p++;
+      for (digits = 0; p[digits] >= '0' && p[digits] <= '9'; digits++)
+        ;
+      if (space && out > key)
+        *out++ = COLLATE_SPACE;
+      space = 0;
+      *out++ = COLLATE_NUMBER + ((digits < COLLATE_MAX_DIGITS)?
+                                 digits:COLLATE_MAX_DIGITS);
+      memcpy(out, p, digits);
+      out += digits;
+      p += digits;
+      continue;
+    }
+
+    n = _collate_fold(_collate_char(p, &len), folded);
+    p += len;
+    if (n < 0) {
+      space = 1;
+    } else if (n > 0) {
+      if (space && out > key)
+        *out++ = COLLATE_SPACE;
+      space = 0;
+      memcpy(out, folded, n);
+      out += n;
+    }
+  }
+  *out = 0;
+
+  return key;
+}
+
+// Sets the sort keys of the main title and the first creator
+void _collate_metadata(struct opf *opf) {
+  struct metadata *meta = opf->metadata;
+  const xmlChar *lang = GetItem(meta->lang, 0), *str;
+  struct creator *creator;
+  struct meta *ref;
+  int i, title = 0;
+
+  // the title marked as the main one or the first
+  for (i = 0; i < meta->title->Size; i++) {
+    ref = _opf_refinement(opf, EPUB_TITLE, i, "title-type");
+    if (ref && ref->value && xmlStrcmp(ref->value, (xmlChar *)"main") == 0) {
+      title = i;
+      break;
+    }
+  }
+  str = GetItem(meta->title, title);
+  if (str) {
+    ref = _opf_refinement(opf, EPUB_TITLE, title, "file-as");
+    if (ref && ref->value)
+      str = ref->value;
+    meta->titleKey = _collate_key(str, lang);
+  }
+
+  creator = GetItem(meta->creator, 0);
+  if (creator) {
+    str = creator->fileAs;
+    if (! str) {
+      ref = _opf_refinement(opf, EPUB_CREATOR, 0, "file-as");
+      str = (ref && ref->value)?ref->value:creator->name;
+    }
+    if (str)
+      meta->creatorKey = _collate_key(str, lang);
+  }
+}
@@ -4,10 +4,13 @@
 
 const char _epub_error_oom[] = "out of memory";
 
-struct epub *epub_open(const char *filename, int debug) {
+static struct epub *_epub_open(const char *filename,
+                               const struct epub_io *io, int debug,
+                               int metadataOnly) {
   char *opfName = NULL;
   char *opfStr = NULL;
   char *pathsep_index = NULL;
+  int opfSize;
 
   struct epub *epub = malloc(sizeof(struct epub));
   if (! epub) {
@@ -15,13 +18,15 @@ struct epub *epub_open(const char *filename, int debug) {
   }
   epub->ocf = NULL;
   epub->opf = NULL;
+  epub->offsetMap = NULL;
+  epub->fragments = NULL;
   _epub_err_set_str(&epub->error, "", 0);
   epub->debug = debug;
   _epub_print_debug(epub, DEBUG_INFO, "opening '%s'", filename);
   
   LIBXML_TEST_VERSION;
   
-  if (! (epub->ocf = _ocf_parse(epub, filename))) {
+  if (! (epub->ocf = _ocf_parse(epub, filename, io))) {
     epub_close(epub);
     return NULL;
   }
@@ -45,7 +50,7 @@ struct epub *epub_open(const char *filename, int debug) {
 
   _epub_print_debug(epub, DEBUG_INFO, "data path is %s", epub->ocf->datapath );
 
-  _ocf_get_file(epub->ocf, opfName, &opfStr);
+  opfSize = _ocf_get_file(epub->ocf, opfName, &opfStr);
   free(opfName);
     
 
@@ -54,7 +59,10 @@ struct epub *epub_open(const char *filename, int debug) {
     return NULL;
   }
 
-  epub->opf = _opf_parse(epub, opfStr);
+  if (metadataOnly)
+    epub->opf = _opf_parse_metadata_only(epub, opfStr, opfSize);
+  else
+    epub->opf = _sax_parse_opf(epub, opfStr);
   if (!epub->opf) {
     free(opfStr);
     epub_close(epub);
@@ -66,6 +74,32 @@ struct epub *epub_open(const char *filename, int debug) {
   return epub;
 }
 
+struct epub *epub_open(const char *filename, int debug) {
+  return _epub_open(filename, NULL, debug, 0);
+}
+
+struct epub *epub_open_metadata(const char *filename, int debug) {
+  return _epub_open(filename, NULL, debug, 1);
+}
+
+struct epub *epub_open_io(const struct epub_io *io, const char *name,
+                          int debug) {
+  if (!io || !io->size || !io->read_at) {
+    return NULL;
+  }
+
+  return _epub_open(name?name:"", io, debug, 0);
+}
+
+struct epub *epub_open_io_metadata(const struct epub_io *io,
+                                   const char *name, int debug) {
+  if (!io || !io->size || !io->read_at) {
+    return NULL;
+  }
+
+  return _epub_open(name?name:"", io, debug, 1);
+}
+
 xmlChar *_getXmlStr(void *str) {
   return xmlStrdup((xmlChar *)str); 
 }
@@ -114,86 +148,51 @@ xmlChar *_getRoleStr(void *creator) {
   return xmlStrdup(buff);
 }
 
+// Returns the list of the metadata of the given type
+static vectorPtr _epub_metadata_list(struct epub *epub,
+                                     enum epub_metadata type) {
+  vectorPtr list;
+
+  if (!epub || !epub->opf || !epub->opf->metadata) {
+    _epub_print_debug(epub, DEBUG_INFO, "no metadata information available");
+    return NULL;
+  }
+
+  list = _opf_metadata_list(epub->opf->metadata, type);
+  if (!list)
+    _epub_print_debug(epub, DEBUG_INFO, "fetching metadata: unknown type %d", type);
+
+  return list;
+}
+
 xmlChar **epub_get_metadata(struct epub *epub, enum epub_metadata type, 
                             int *size) {
   xmlChar **data = NULL;
-  listPtr list = NULL;
+  vectorPtr list = NULL;
   xmlChar *(*getStr)(void *) = NULL;
   int i;
 
-  if (!epub || !epub->opf || !epub->opf->metadata) {
-    _epub_print_debug(epub, DEBUG_INFO, "no metadata information available");
+  list = _epub_metadata_list(epub, type);
+  if (!list)
     return NULL;
-  }
 
   switch(type) {
   case EPUB_ID:
-    list = epub->opf->metadata->id;
     getStr = _getIdStr;
     break;
-  case EPUB_TITLE:
-    list = epub->opf->metadata->title;
-    getStr = _getXmlStr;
-    break;
-  case EPUB_SUBJECT:
-    list = epub->opf->metadata->subject;
-    getStr = _getXmlStr;
-    break;
-  case EPUB_PUBLISHER:
-    list = epub->opf->metadata->publisher;
-    getStr = _getXmlStr;
-    break;
-  case EPUB_DESCRIPTION:
-    list = epub->opf->metadata->description;
-    getStr = _getXmlStr;
-    break;
   case EPUB_DATE:
-    list = epub->opf->metadata->date;
     getStr = _getDateStr;
     break;
-  case EPUB_TYPE:
-    list = epub->opf->metadata->type;
-    getStr = _getXmlStr;
-    break;
-  case EPUB_FORMAT:
-    list = epub->opf->metadata->format;
-    getStr = _getXmlStr;
-    break;
-  case EPUB_SOURCE:
-    list = epub->opf->metadata->source;
-    getStr = _getXmlStr;
-    break;
-  case EPUB_LANG:
-    list = epub->opf->metadata->lang;
-    getStr = _getXmlStr;
-    break;
-  case EPUB_RELATION:
-    list = epub->opf->metadata->relation;
-    getStr = _getXmlStr;
-    break;
-  case EPUB_COVERAGE:
-    list = epub->opf->metadata->coverage;
-    getStr = _getXmlStr;
-    break;
-  case EPUB_RIGHTS:
-    list = epub->opf->metadata->rights;
-    getStr = _getXmlStr;
-    break;
   case EPUB_CREATOR:
-    list = epub->opf->metadata->creator;
-    getStr = _getRoleStr;
-    break;
   case EPUB_CONTRIB:
-    list = epub->opf->metadata->contrib;
     getStr = _getRoleStr;
     break;
   case EPUB_META:
-    list = epub->opf->metadata->meta;
     getStr = _getMetaStr;
     break;
   default:
-    _epub_print_debug(epub, DEBUG_INFO, "fetching metadata: unknown type %d", type);
-    return NULL;
+    getStr = _getXmlStr;
+    break;
   }
 
   if (list->Size <= 0)
@@ -207,58 +206,289 @@ xmlChar **epub_get_metadata(struct epub *epub, enum epub_metadata type,
   if (size) {
     *size = list->Size;
   }
-  list->Current = list->Head;
-
-  data[0] = getStr(GetNode(list));
-  for (i=1;i<list->Size;i++) {
-    data[i] = getStr(NextNode(list));
+  for (i=0;i<list->Size;i++) {
+    data[i] = getStr(GetItem(list, i));
   }
 
   return data;
 }
 
-// returns the next node that the iterator should return
-// if init also check if the current node is good
+// Returns the value of the first meta refining the element with the
+// property
+static const char *_epub_refinement_value(struct epub *epub,
+                                          enum epub_metadata type, int index,
+                                          const char *property) {
+  struct meta *meta = _opf_refinement(epub->opf, type, index, property);
+
+  return (meta?(const char *)meta->value:NULL);
+}
+
+int epub_get_metadata_count(struct epub *epub, enum epub_metadata type) {
+  vectorPtr list;
+
+  if (!epub) {
+    return 0;
+  }
+
+  list = _epub_metadata_list(epub, type);
+  return (list?list->Size:0);
+}
+
+const char *epub_get_metadata_item(struct epub *epub,
+                                   enum epub_metadata type, int index) {
+  void *item;
+
+  if (!epub) {
+    return NULL;
+  }
+
+  item = GetItem(_epub_metadata_list(epub, type), index);
+  if (!item) {
+    return NULL;
+  }
+
+  switch(type) {
+  case EPUB_ID:
+    return (const char *)((struct id *)item)->string;
+  case EPUB_DATE:
+    return (const char *)((struct date *)item)->date;
+  case EPUB_CREATOR:
+  case EPUB_CONTRIB:
+    return (const char *)((struct creator *)item)->name;
+  case EPUB_META:
+    return (const char *)((struct meta *)item)->value;
+  default:
+    return (const char *)item;
+  }
+}
+
+int epub_get_identifier(struct epub *epub, int index,
+                        struct epub_identifier *identifier) {
+  struct id *item;
+
+  if (!epub || !identifier) {
+    return 0;
+  }
+
+  item = GetItem(_epub_metadata_list(epub, EPUB_ID), index);
+  if (!item) {
+    return 0;
+  }
+
+  identifier->value = (const char *)item->string;
+  identifier->scheme = (const char *)item->scheme;
+  identifier->id = (const char *)item->id;
+  if (!identifier->scheme)
+    identifier->scheme = _epub_refinement_value(epub, EPUB_ID, index,
+                                                "identifier-type");
+  return 1;
+}
+
+int epub_get_creator(struct epub *epub, enum epub_metadata type, int index,
+                     struct epub_creator *creator) {
+  struct creator *item;
+
+  if (!epub || !creator || (type != EPUB_CREATOR && type != EPUB_CONTRIB)) {
+    return 0;
+  }
+
+  item = GetItem(_epub_metadata_list(epub, type), index);
+  if (!item) {
+    return 0;
+  }
+
+  creator->name = (const char *)item->name;
+  creator->fileAs = (const char *)item->fileAs;
+  creator->role = (const char *)item->role;
+  if (!creator->fileAs)
+    creator->fileAs = _epub_refinement_value(epub, type, index, "file-as");
+  if (!creator->role)
+    creator->role = _epub_refinement_value(epub, type, index, "role");
+  return 1;
+}
+
+int epub_get_date(struct epub *epub, int index, struct epub_date *date) {
+  struct date *item;
+
+  if (!epub || !date) {
+    return 0;
+  }
+
+  item = GetItem(_epub_metadata_list(epub, EPUB_DATE), index);
+  if (!item) {
+    return 0;
+  }
+
+  date->date = (const char *)item->date;
+  date->event = (const char *)item->event;
+  return 1;
+}
+
+int epub_get_meta(struct epub *epub, int index, struct epub_meta *meta) {
+  struct meta *item;
+
+  if (!epub || !meta) {
+    return 0;
+  }
+
+  item = GetItem(_epub_metadata_list(epub, EPUB_META), index);
+  if (!item) {
+    return 0;
+  }
+
+  meta->name = (const char *)item->name;
+  meta->content = (const char *)item->content;
+  meta->property = (const char *)item->property;
+  meta->value = (const char *)item->value;
+  meta->refines = (const char *)item->refines;
+  meta->id = (const char *)item->id;
+  return 1;
+}
+
+int epub_get_refinement_count(struct epub *epub, enum epub_metadata type,
+                              int index) {
+  int first;
+
+  if (!epub || !_epub_metadata_list(epub, type)) {
+    return 0;
+  }
+
+  return _opf_refinements(epub->opf, type, index, &first);
+}
+
+int epub_get_refinement(struct epub *epub, enum epub_metadata type, int index,
+                        int n, struct epub_meta *meta) {
+  struct meta *item;
+  int first, count;
+
+  if (!epub || !meta || !_epub_metadata_list(epub, type)) {
+    return 0;
+  }
+
+  count = _opf_refinements(epub->opf, type, index, &first);
+  if (n < 0 || n >= count) {
+    return 0;
+  }
+
+  item = GetItem(epub->opf->metadata->refines, first + n);
+  meta->name = (const char *)item->name;
+  meta->content = (const char *)item->content;
+  meta->property = (const char *)item->property;
+  meta->value = (const char *)item->value;
+  meta->refines = (const char *)item->refines;
+  meta->id = (const char *)item->id;
+
+  return 1;
+}
+
+const char *epub_get_refinement_value(struct epub *epub,
+                                      enum epub_metadata type, int index,
+                                      const char *property) {
+  if (!epub || !property || !_epub_metadata_list(epub, type)) {
+    return NULL;
+  }
+
+  return _epub_refinement_value(epub, type, index, property);
+}
+
+int epub_get_metadata_by_id(struct epub *epub, const char *id,
+                            enum epub_metadata *type, int *index) {
+  enum epub_metadata t;
+  int i;
+
+  if (!epub || !id || !epub->opf || !epub->opf->metadata) {
+    return 0;
+  }
+
+  // like a refines, a fragment link names the id after the '#'
+  if (id[0] == '#')
+    id++;
+  if (!_opf_metadata_by_id(epub->opf, (xmlChar *)id, &t, &i)) {
+    return 0;
+  }
+
+  if (type)
+    *type = t;
+  if (index)
+    *index = i;
+  return 1;
+}
+
+const unsigned char *epub_get_sort_key(struct epub *epub,
+                                       enum epub_metadata type, int *size) {
+  xmlChar *key = NULL;
+
+  if (size)
+    *size = 0;
+
+  if (!epub || !epub->opf || !epub->opf->metadata) {
+    return NULL;
+  }
+
+  if (type == EPUB_TITLE)
+    key = epub->opf->metadata->titleKey;
+  else if (type == EPUB_CREATOR)
+    key = epub->opf->metadata->creatorKey;
+
+  if (key && size)
+    *size = xmlStrlen(key);
+  return key;
+}
+
+unsigned char *epub_make_sort_key(const char *str, const char *lang,
+                                  int *size) {
+  xmlChar *key;
+
+  if (size)
+    *size = 0;
+
+  if (!str) {
+    return NULL;
+  }
+
+  key = _collate_key((xmlChar *)str, (xmlChar *)lang);
+  if (key && size)
+    *size = xmlStrlen(key);
+  return key;
+}
+
+// returns the spine index that the iterator should return
+// if init also check if the current index is good
 // if linear is 0 return non linear else return linear
-listnodePtr _get_spine_it_next(listnodePtr curr, int linear, int init) {
+int _get_spine_it_next(vectorPtr spine, int curr, int linear, int init) {
   struct spine *node; 
 
-  if (! curr)
-    return NULL;
+  if (curr < 0)
+    return -1;
   
   if ( ! init) {
-    curr = curr->Next;
+    curr++;
   }
 
-  node = (struct spine *)GetNodeData(curr);
-  
-  while(curr) {
+  for (; curr < spine->Size; curr++) {
+    node = (struct spine *)GetItem(spine, curr);
     if (! node)
-      return NULL;
-    
-    node = (struct spine *)GetNodeData(curr);
+      return -1;
     
     if (node->linear == linear)
       return curr;
-    
-    curr = curr->Next;
   }
 
-  return NULL;
+  return -1;
 }
 
-char *_get_spine_it_url(struct eiterator *it) {
+char *_get_spine_url(struct epub *epub, int index) {
   struct manifest *tmp;
   void *data;
 
-  if (!it) 
+  data = GetItem(epub->opf->spine, index);
+  if (!data)
 	  return NULL;
-  
-  data = GetNodeData(it->curr);
-  tmp = _opf_manifest_get_by_id(it->epub->opf, 
+
+  tmp = _opf_manifest_get_by_id(epub->opf, 
                                 ((struct spine *)data)->idref);
   if (!tmp) {
-	  _epub_print_debug(it->epub, DEBUG_ERROR, 
+	  _epub_print_debug(epub, DEBUG_ERROR, 
 						"spine parsing error idref %s is not in the manifest",
 						((struct spine *)data)->idref);
 	  return NULL;
@@ -267,6 +497,46 @@ char *_get_spine_it_url(struct eiterator *it) {
   return (char *)tmp->href;
 }
 
+char *_get_spine_it_url(struct eiterator *it) {
+  if (!it) 
+	  return NULL;
+  
+  return _get_spine_url(it->epub, it->curr);
+}
+
+// first spine index an iterator of the given type visits or -1
+int _get_spine_it_first(struct epub *epub, enum eiterator_type type) {
+  switch (type) {
+  case EITERATOR_SPINE:
+    return (epub->opf->spine->Size > 0)?0:-1;
+  case EITERATOR_NONLINEAR:
+    return _get_spine_it_next(epub->opf->spine, 0, 0, 1); 
+  case EITERATOR_LINEAR:
+    return _get_spine_it_next(epub->opf->spine, 0, 1, 1); 
+  }
+
+  return -1;
+}
+
+// spine index an iterator of the given type visits after curr or -1
+int _get_spine_it_step(struct epub *epub, enum eiterator_type type, 
+                       int curr) {
+  if (curr < 0)
+    return -1;
+
+  switch (type) {
+  case EITERATOR_SPINE:
+    curr++;
+    return (curr < epub->opf->spine->Size)?curr:-1;
+  case EITERATOR_NONLINEAR:
+    return _get_spine_it_next(epub->opf->spine, curr, 0, 0); 
+  case EITERATOR_LINEAR:
+    return _get_spine_it_next(epub->opf->spine, curr, 1, 0); 
+  }
+
+  return -1;
+}
+
 struct eiterator *epub_get_iterator(struct epub *epub, 
                                     enum eiterator_type type, int opt) {
 
@@ -285,19 +555,7 @@ struct eiterator *epub_get_iterator(struct epub *epub,
   it->epub = epub;
   it->opt = opt;
   it->cache = NULL;
-
-  switch (type) {
-  case EITERATOR_SPINE:
-    it->curr = epub->opf->spine->Head;
-    break;
-  case EITERATOR_NONLINEAR:
-    it->curr = _get_spine_it_next(epub->opf->spine->Head, 0, 1); 
-    break;
-  case EITERATOR_LINEAR:
-    it->curr = _get_spine_it_next(epub->opf->spine->Head, 1, 1); 
-    break;
-  }
-
+  it->curr = _get_spine_it_first(epub, type);
 
   return it;
 }
@@ -329,9 +587,17 @@ char *epub_it_get_curr_url(struct eiterator *it) {
   return NULL;
 }
 
+int epub_it_get_curr_index(struct eiterator *it) {
+  if (!it) {
+    return -1;
+  }
+
+  return it->curr;
+}
+
 char *epub_it_get_curr(struct eiterator *it) {
 
-  if (!it || !it->curr)
+  if (!it || it->curr < 0)
     return NULL;
 
   if (!it->cache) {
@@ -357,23 +623,10 @@ char *epub_it_get_next(struct eiterator *it) {
     it->cache = NULL;
   }
 
-  if (!it->curr)
+  if (it->curr < 0)
     return NULL;
 
-  switch (it->type) {
-
-  case EITERATOR_SPINE:
-    it->curr = it->curr->Next;
-    break;
-    
-  case EITERATOR_NONLINEAR:
-    it->curr = _get_spine_it_next(it->curr, 0, 0); 
-    break;
-
-  case EITERATOR_LINEAR:
-    it->curr = _get_spine_it_next(it->curr, 1, 0); 
-    break;
-  }
+  it->curr = _get_spine_it_step(it->epub, it->type, it->curr);
   
   return epub_it_get_curr(it);
 }
@@ -386,9 +639,13 @@ int epub_close(struct epub *epub) {
   if (epub->ocf)
     _ocf_close(epub->ocf);
 
+  _cfi_free_fragments(epub);
+
   if (epub->opf)
     _opf_close(epub->opf);
 
+  _offsets_free(epub->offsetMap);
+
   if (epub)
     free(epub);
 
@@ -440,49 +697,219 @@ void _epub_print_debug(struct epub *epub, int debug, const char *format, ...) {
 }
 
 int epub_tit_next(struct titerator *tit) {
-  listnodePtr curr = NULL;
-
-  if (!tit) {
+  if (!tit || !tit->valid) {
     return 0;
   }
 
-  curr = tit->next;
-  if (! curr) {
+  tit->curr++;
+  if (tit->curr >= tit->flat->size) {
     tit->valid = 0;
     return 0;
   }
 
-  tit->next = curr->Next;
-  
-  switch (tit->type) {
-    struct guide* guide;
-    struct tocItem *ti;
+  return 1;
+}
 
-  case TITERATOR_GUIDE:
-    guide = GetNodeData(curr);
-    tit->cache.label = (char *)guide->title;
-    tit->cache.link = (char *)guide->href;
-    tit->cache.depth = 1;
+struct textiterator *epub_get_text_iterator(struct epub *epub, 
+                                            enum eiterator_type type, int opt) {
+  struct textiterator *it = NULL;
 
-    break;
+  if (!epub) {
+    return NULL;
+  }
 
-  case TITERATOR_NAVMAP:
-  case TITERATOR_PAGES:
-    ti = GetNodeData(curr);
-    tit->cache.label = 
-      (char *)_opf_label_get_by_doc_lang(tit->epub->opf, ti->label);
+  it = malloc(sizeof(struct textiterator));
+  if (!it) {
+    _epub_err_set_oom(&epub->error);
+    return NULL;
+  }
+  it->type = type;
+  it->epub = epub;
+  it->opt = opt;
+  it->doc = NULL;
+  it->curr = _get_spine_it_first(epub, type);
+  _text_init(&it->parser);
+
+  it->in = malloc(TEXT_CHUNK_SIZE);
+  it->out = malloc(TEXT_OUT_SIZE(TEXT_CHUNK_SIZE) + 1);
+  if (!it->in || !it->out) {
+    _epub_err_set_oom(&epub->error);
+    epub_free_text_iterator(it);
+    return NULL;
+  }
 
-    if (! tit->cache.label)
-      tit->cache.label = (char *)ti->id;
+  return it;
+}
 
-    tit->cache.depth = ti->depth;
-    tit->cache.link = (char *)ti->src;
-    break;
+const char *epub_text_it_next(struct textiterator *it, int *len) {
+  zip_int64_t size;
+  int textLen;
+
+  if (len)
+    *len = 0;
+
+  if (!it) {
+    return NULL;
+  }
+
+  while (it->curr >= 0) {
+    if (!it->doc) {
+      it->doc = _text_open(it->epub, it->curr);
+      if (!it->doc) {
+        _epub_print_debug(it->epub, DEBUG_WARNING, 
+                          "skipping unreadable spine document %d", it->curr);
+        it->curr = _get_spine_it_step(it->epub, it->type, it->curr);
+        continue;
+      }
+      _text_new_document(&it->parser);
+    }
+
+    size = _text_read(it->doc, it->in, TEXT_CHUNK_SIZE);
+    if (size <= 0) {
+      if (size < 0)
+        _epub_print_debug(it->epub, DEBUG_WARNING, 
+                          "failed reading spine document %d - %s", it->curr,
+                          zip_file_strerror(it->doc->file));
+      _text_close(it->doc);
+      it->doc = NULL;
+      it->curr = _get_spine_it_step(it->epub, it->type, it->curr);
+      continue;
+    }
 
+    textLen = _text_parse(&it->parser, it->in, (int)size, it->out);
+    if (textLen > 0) {
+      it->out[textLen] = 0;
+      if (len)
+        *len = textLen;
+      return it->out;
+    }
   }
 
-  tit->valid = 1;
-  return 1;
+  return NULL;
+}
+
+char *epub_text_it_get_curr_url(struct textiterator *it) {
+  if (!it || it->curr < 0) {
+    return NULL;
+  }
+
+  return _get_spine_url(it->epub, it->curr);
+}
+
+int epub_text_it_get_curr_index(struct textiterator *it) {
+  if (!it) {
+    return -1;
+  }
+
+  return it->curr;
+}
+
+void epub_free_text_iterator(struct textiterator *it) {
+  if (!it) {
+    return;
+  }
+
+  _text_close(it->doc);
+  free(it->in);
+  free(it->out);
+  free(it);
+}
+
+// Appends whole characters of text to the preview until it has
+// max_chars or size bytes, returns 1 once it has them and more text was
+// seen, setting next to the byte that didn't fit
+static int _get_preview_append(char *preview, int size, int *len, int *chars,
+                               int max_chars, const char *text, int textLen,
+                               int flags, char *next) {
+  int i;
+
+  for (i = 0; i < textLen; i++) {
+    char c = text[i];
+
+    // text that isn't utf-8 can have more bytes than characters
+    if (((c & 0xC0) != 0x80 && *chars == max_chars) || *len == size) {
+      *next = c;
+      return 1;
+    }
+    if ((c & 0xC0) != 0x80)
+      (*chars)++;
+    if (c == '\n' && (flags & EPUB_PREVIEW_ONE_LINE))
+      c = ' ';
+    preview[(*len)++] = c;
+  }
+
+  return 0;
+}
+
+char *epub_get_preview(struct epub *epub, int max_chars, int flags) {
+  struct textparser parser;
+  struct textdoc *doc;
+  char *preview, *in, *out;
+  int len = 0, chars = 0, full = 0, read = 0;
+  int curr, textLen, previewSize;
+  char next = 0;
+  zip_int64_t size;
+
+  if (!epub || max_chars < 0 || max_chars > PREVIEW_MAX_CHARS) {
+    return NULL;
+  }
+
+  // a character, separators included, takes at most 4 bytes, then the 0
+  previewSize = 4 * max_chars;
+  preview = malloc(previewSize + 1);
+  in = malloc(PREVIEW_READ_SIZE);
+  out = malloc(TEXT_OUT_SIZE(PREVIEW_READ_SIZE));
+  if (!preview || !in || !out) {
+    _epub_err_set_oom(&epub->error);
+    free(preview);
+    free(in);
+    free(out);
+    return NULL;
+  }
+
+  curr = _get_spine_it_first(epub, EITERATOR_LINEAR);
+  for (; !full && curr >= 0; 
+       curr = _get_spine_it_step(epub, EITERATOR_LINEAR, curr)) {
+    int docLen = len;
+
+    doc = _text_open(epub, curr);
+    if (!doc)
+      continue;
+
+    _text_init(&parser);
+    while (!full && (size = _text_read(doc, in, PREVIEW_READ_SIZE)) > 0) {
+      read += size;
+      textLen = _text_parse(&parser, in, size, out);
+      if (textLen > 0 && len == docLen && len > 0) {
+        // documents with text are separated by a line
+        full = _get_preview_append(preview, previewSize, &len, &chars,
+                                   max_chars, "\n", 1, flags, &next);
+      }
+      if (!full)
+        full = _get_preview_append(preview, previewSize, &len, &chars,
+                                   max_chars, out, textLen, flags, &next);
+    }
+    _text_close(doc);
+  }
+
+  // cut a cut word, which it is unless the text went on with a space
+  if (full && (flags & EPUB_PREVIEW_WORDS) && next != ' ' && next != '\n') {
+    int end = len;
+
+    while (end > 0 && preview[end - 1] != ' ' && preview[end - 1] != '\n')
+      end--;
+    if (end > 0)
+      len = end;
+  }
+  while (len > 0 && (preview[len - 1] == ' ' || preview[len - 1] == '\n'))
+    len--;
+  preview[len] = 0;
+
+  _epub_print_debug(epub, DEBUG_INFO, "preview of %d bytes from %d bytes read",
+                    len, read);
+  free(in);
+  free(out);
+  return preview;
 }
 
 struct titerator *epub_get_titerator(struct epub *epub, 
@@ -503,7 +930,7 @@ struct titerator *epub_get_titerator(struct epub *epub,
       return NULL;
     break;
   case TITERATOR_PAGES:
-    if (! epub->opf->toc || epub->opf->toc->pageList)
+    if (! epub->opf->toc || ! epub->opf->toc->pageList)
       return NULL;
     break;
   }
@@ -516,45 +943,10 @@ struct titerator *epub_get_titerator(struct epub *epub,
   it->type = type;
   it->epub = epub;
   it->opt = opt;
-  it->next = NULL;
-  it->valid = 0;
-
-  it->cache.label = NULL;
-  it->cache.link = NULL;
-  it->cache.depth = -1;
-
-
-  switch (type) {
-  case TITERATOR_NAVMAP:
-    it->next = epub->opf->toc->navMap->items->Head;
-    if (epub->opf->toc->navMap->label) {
-      it->cache.label = 
-        (char *)_opf_label_get_by_doc_lang(epub->opf, 
-                                           epub->opf->toc->navMap->label);
-      it->cache.depth = 0;
-    }
-    it->valid = 1;
-    break;
+  it->flat = _toc_get_flat(epub->opf, type);
+  it->curr = 0;
+  it->valid = (it->flat && it->flat->size > 0);
 
-  case TITERATOR_GUIDE:
-    it->next = epub->opf->guide->Head;
-    break;
-    
-  case TITERATOR_PAGES:
-    it->next = epub->opf->toc->pageList->items->Head;
-    if (epub->opf->toc->pageList->label) {
-      it->cache.label = 
-        (char *)_opf_label_get_by_doc_lang(epub->opf, 
-                                           epub->opf->toc->pageList->label);
-      it->cache.depth = 1;
-    }
-    it->valid = 1;
-    break;
-  }
-  
-  if ( ! it->cache.label)
-    epub_tit_next(it);
-  
   return it;
 }
 
@@ -566,33 +958,42 @@ int epub_tit_curr_valid(struct titerator *tit) {
   return tit->valid;
 }
 
+const struct epub_toc_entry *epub_tit_get_curr_entry(struct titerator *tit) {
+  if (!tit || !tit->valid) {
+    return NULL;
+  }
+
+  return &tit->flat->entries[tit->curr];
+}
+
 char *epub_tit_get_curr_label(struct titerator *tit) {
-  if (!tit) {
+  const struct epub_toc_entry *entry = epub_tit_get_curr_entry(tit);
+
+  if (!entry || !entry->label) {
     return NULL;
   }
 
-  // FIXME how can there be unlabeled curr?
-  return tit->cache.label?strdup(tit->cache.label):NULL;
+  return strdup(entry->label);
 }
 
 int epub_tit_get_curr_depth(struct titerator *tit) {
-  if (!tit) {
+  const struct epub_toc_entry *entry = epub_tit_get_curr_entry(tit);
+
+  if (!entry) {
     return 0;
   }
 
-  return tit->cache.depth;
+  return entry->depth;
 }
 
 char *epub_tit_get_curr_link(struct titerator *tit) {
-  if (!tit) {
-    return NULL;
-  }
+  const struct epub_toc_entry *entry = epub_tit_get_curr_entry(tit);
 
-  if (!tit->cache.link) {
+  if (!entry || !entry->link) {
 	  return NULL;
   }
   
-  return strdup(tit->cache.link);
+  return strdup(entry->link);
 
 }
 
@@ -603,7 +1004,55 @@ void epub_free_titerator(struct titerator *tit) {
 
   free(tit);
 }
+
+const struct epub_toc_entry *epub_toc_get_flat(struct epub *epub,
+                                               enum titerator_type type,
+                                               int *size) {
+  struct tocFlat *flat;
+
+  if (size)
+    *size = 0;
+
+  if (!epub || !epub->opf) {
+    return NULL;
+  }
+
+  flat = _toc_get_flat(epub->opf, type);
+  if (!flat) {
+    return NULL;
+  }
+
+  if (size)
+    *size = flat->size;
+
+  return flat->entries;
+}
   
+int epub_toc_entry_for_position(struct epub *epub, int spine_index,
+                                const char *fragment) {
+  if (!epub || !epub->opf) {
+    return -1;
+  }
+
+  return _toc_entry_for_position(epub->opf, spine_index, fragment);
+}
+
+const char *epub_page_target(struct epub *epub, const char *label) {
+  if (!epub || !epub->opf || !label) {
+    return NULL;
+  }
+
+  return _toc_page_target(epub->opf, label);
+}
+
+const char *epub_page_for_target(struct epub *epub, const char *link) {
+  if (!epub || !epub->opf || !link) {
+    return NULL;
+  }
+
+  return _toc_page_for_target(epub->opf, link);
+}
+
 int epub_get_ocf_file(struct epub *epub, const char *filename, char **data) {
   if (!epub) {
     return -1;
@@ -620,6 +1069,133 @@ int epub_get_data(struct epub *epub, const char *name, char **data) {
   return _ocf_get_data_file(epub->ocf, name, data);
 }
 
+int epub_get_entry_info(struct epub *epub, const char *filename, 
+                        struct epub_entry_info *info) {
+  if (!epub || !filename || !info) {
+    return 0;
+  }
+
+  return _ocf_entry_info(epub->ocf, filename, info);
+}
+
+int epub_get_data_info(struct epub *epub, const char *name, 
+                       struct epub_entry_info *info) {
+  if (!epub || !name || !info) {
+    return 0;
+  }
+
+  return _ocf_data_entry_info(epub->ocf, name, info);
+}
+
+struct epub_entry_info *epub_spine_sizes(struct epub *epub, int *size) {
+  struct epub_entry_info *infos;
+  int i, count;
+
+  if (size)
+    *size = 0;
+
+  if (!epub) {
+    return NULL;
+  }
+
+  count = epub->opf->spine->Size;
+  infos = malloc((count?count:1) * sizeof(struct epub_entry_info));
+  if (!infos) {
+    _epub_err_set_oom(&epub->error);
+    return NULL;
+  }
+
+  for (i = 0; i < count; i++) {
+    if (! _ocf_data_entry_info(epub->ocf, _get_spine_url(epub, i), 
+                               &infos[i])) {
+      infos[i].index = -1;
+      infos[i].size = -1;
+      infos[i].compressedSize = -1;
+      infos[i].method = -1;
+      infos[i].crc = 0;
+    }
+  }
+
+  if (size)
+    *size = count;
+  return infos;
+}
+
+int epub_get_cover(struct epub *epub, const char **href, 
+                   const char **media_type) {
+  if (href)
+    *href = NULL;
+  if (media_type)
+    *media_type = NULL;
+
+  if (!epub) {
+    return 0;
+  }
+
+  if (! epub->opf->coverSearched) {
+    epub->opf->cover = _opf_get_cover(epub->opf);
+    epub->opf->coverSearched = 1;
+  }
+
+  if (! epub->opf->cover)
+    return 0;
+
+  if (href)
+    *href = (const char *)epub->opf->cover->href;
+  if (media_type)
+    *media_type = (const char *)epub->opf->cover->type;
+  return 1;
+}
+
+struct epub_stream *epub_open_data_stream(struct epub *epub, const char *name) {
+  struct epub_stream *stream;
+
+  if (!epub || !name) {
+    return NULL;
+  }
+
+  stream = malloc(sizeof(struct epub_stream));
+  if (!stream) {
+    _epub_err_set_oom(&epub->error);
+    return NULL;
+  }
+
+  stream->epub = epub;
+  stream->file = _ocf_open_data_file(epub->ocf, name);
+  if (! stream->file) {
+    free(stream);
+    return NULL;
+  }
+
+  return stream;
+}
+
+int epub_stream_read(struct epub_stream *stream, char *buf, int len) {
+  zip_int64_t size;
+
+  if (!stream || !buf || len < 0) {
+    return -1;
+  }
+
+  size = zip_fread(stream->file, buf, len);
+  if (size < 0) {
+    _epub_print_debug(stream->epub, DEBUG_INFO, "%s", 
+                      zip_file_strerror(stream->file));
+    return -1;
+  }
+
+  return (int)size;
+}
+
+void epub_stream_close(struct epub_stream *stream) {
+  if (!stream) {
+    return;
+  }
+
+  zip_fclose(stream->file);
+  free(stream);
+}
+
 void epub_dump(struct epub *epub) {
   if (!epub) {
     return;
@@ -629,7 +1205,58 @@ void epub_dump(struct epub *epub) {
   _opf_dump(epub->opf);
 }
 
+// Readers this thread keeps for reuse, resetting one is cheaper than
+// setting up a new parser context and dictionary. Parsing the toc
+// nests in parsing the opf, so there's more than one.
+#define READER_POOL_SIZE 4
+#ifdef EPUB_THREAD_LOCAL
+static EPUB_THREAD_LOCAL xmlTextReaderPtr _epub_readers[READER_POOL_SIZE];
+static EPUB_THREAD_LOCAL int _epub_reader_count;
+#endif
+
+xmlTextReaderPtr _epub_reader_new(const char *buffer, int size, const char *url) {
+#ifdef EPUB_THREAD_LOCAL
+  xmlTextReaderPtr reader;
+
+  // a reset reader doesn't look for a byte order mark, so only documents
+  // starting out in ascii are given one
+  while (_epub_reader_count > 0 && size >= 2 && buffer[1] != 0 &&
+         (buffer[0] == '<' || buffer[0] == ' ' || buffer[0] == '\t' ||
+          buffer[0] == '\n' || buffer[0] == '\r')) {
+    reader = _epub_readers[--_epub_reader_count];
+    if (xmlReaderNewMemory(reader, buffer, size, url, NULL, 0) == 0)
+      return reader;
+    xmlFreeTextReader(reader);
+  }
+#endif
+
+  return xmlReaderForMemory(buffer, size, url, NULL, 0);
+}
+
+void _epub_reader_free(xmlTextReaderPtr reader) {
+  if (! reader)
+    return;
+
+#ifdef EPUB_THREAD_LOCAL
+  if (_epub_reader_count < READER_POOL_SIZE) {
+    xmlTextReaderClose(reader);
+    _epub_readers[_epub_reader_count++] = reader;
+    return;
+  }
+#endif
+
+  xmlFreeTextReader(reader);
+}
+
+void epub_thread_cleanup() {
+#ifdef EPUB_THREAD_LOCAL
+  while (_epub_reader_count > 0)
+    xmlFreeTextReader(_epub_readers[--_epub_reader_count]);
+#endif
+}
+
 void epub_cleanup() {
+  epub_thread_cleanup();
   xmlCleanupParser();
 }
 
@@ -8,6 +8,17 @@ struct epub;
 /** \struct eiterator is a private iterator struct */
 struct eiterator;
 struct titerator;
+/** \struct textiterator is a private text iterator struct */
+struct textiterator;
+/** \struct epub_index is a private struct of an opened search index */
+struct epub_index;
+/** \struct epub_stream is a private struct of a file opened for reading */
+struct epub_stream;
+/** \struct epub_library is a private struct of a metadata index over
+    many books */
+struct epub_library;
+/** \struct epub_bitmap is a private struct of a set of library ids */
+struct epub_bitmap;
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,6 +34,75 @@ extern "C" {
       
   */
   EPUB_EXPORT struct epub *epub_open(const char *filename, int debug);
+
+  /**
+     This function opens an epub for its metadata alone, which it reads
+     straight from the opf without parsing it where it can. The epub's
+     manifest, spine and table of contents are left empty, so only
+     epub_get_metadata and the like are of use on it.
+
+     @param filename the name of the file to open
+     @param debug is the debug level (0=none, 1=errors, 2=warnings, 3=info)
+     @return epub struct with the metadata of the file or NULL on error
+  */
+  EPUB_EXPORT struct epub *epub_open_metadata(const char *filename,
+                                              int debug);
+
+  /**
+     This function opens an epub read through io's callbacks rather than
+     from a file. Reads of a few bytes are made in blocks of 64k, so a
+     file and its zip header usually take one read. The callbacks and
+     their data are used until the epub is closed.
+
+     @param io the callbacks reading the container
+     @param name the name the epub goes by in messages and default index
+     names, or NULL
+     @param debug is the debug level (0=none, 1=errors, 2=warnings, 3=info)
+     @return epub struct with the information of the file or NULL on error
+  */
+  EPUB_EXPORT struct epub *epub_open_io(const struct epub_io *io,
+                                        const char *name, int debug);
+
+  /**
+     epub_open_metadata for an epub read through io's callbacks, see
+     epub_open_io. Only the end of the zip, container.xml and the opf
+     are read.
+
+     @param io the callbacks reading the container
+     @param name the name the epub goes by in messages, or NULL
+     @param debug is the debug level (0=none, 1=errors, 2=warnings, 3=info)
+     @return epub struct with the metadata of the file or NULL on error
+  */
+  EPUB_EXPORT struct epub *epub_open_io_metadata(const struct epub_io *io,
+                                                 const char *name, int debug);
+
+  /**
+     Returns io callbacks reading a local file, which count the reads
+     made and the bytes read. It's meant for trying out epub_open_io.
+
+     @param filename the file
+     @return the callbacks or NULL on error. They have to be freed with
+     epub_io_file_free once no epub uses them.
+  */
+  EPUB_EXPORT struct epub_io *epub_io_file_new(const char *filename);
+
+  /**
+     Returns the number of reads made through callbacks from
+     epub_io_file_new and the bytes they read.
+
+     @param io the callbacks
+     @param requests if not NULL, set to the number of reads
+     @param bytes if not NULL, set to the number of bytes read
+  */
+  EPUB_EXPORT void epub_io_file_counts(struct epub_io *io, int *requests,
+                                       long long *bytes);
+
+  /**
+     Frees callbacks from epub_io_file_new, closing the file.
+
+     @param io the callbacks
+  */
+  EPUB_EXPORT void epub_io_file_free(struct epub_io *io);
   
   /**
      This function sets the debug level to the given level.
@@ -42,6 +122,116 @@ extern "C" {
   */
   EPUB_EXPORT int epub_get_ocf_file(struct epub *epub, const char *filename, char **data);
   
+  /**
+     Looks up a file of the epub in the zip central directory, without
+     reading or inflating it.
+
+     @param epub struct of the epub file
+     @param filename the name of the file in the archive
+     @param info pointer to where the file's information is stored
+     @return 1 if the file exists and 0 otherwise
+  */
+  EPUB_EXPORT int epub_get_entry_info(struct epub *epub, const char *filename,
+                                      struct epub_entry_info *info);
+
+  /**
+     Looks up a file of the epub's data directory in the zip central
+     directory, without reading or inflating it.
+
+     @param epub struct of the epub file
+     @param name the name of the file in the data directory
+     @param info pointer to where the file's information is stored
+     @return 1 if the file exists and 0 otherwise
+  */
+  EPUB_EXPORT int epub_get_data_info(struct epub *epub, const char *name,
+                                     struct epub_entry_info *info);
+
+  /**
+     Returns what the zip central directory says about every spine
+     document, without reading or inflating any. Missing documents have
+     a size of -1.
+
+     @param epub struct of the epub file
+     @param size pointer to where the number of spine items is stored
+     @return the array by spine index, which the caller should free, or
+     NULL on error
+  */
+  EPUB_EXPORT struct epub_entry_info *epub_spine_sizes(struct epub *epub, int *size);
+
+  /**
+     Finds the book's cover image: the manifest item with the
+     cover-image property, the one the cover meta data names, the image
+     the cover guide reference points at or shows, or else an image
+     called cover. Only the last but one may read a file.
+
+     @param epub struct of the epub file
+     @param href pointer to where the image's href (relative to the data
+     directory) is stored
+     @param media_type pointer to where the image's media type is stored
+     @return 1 if there's a cover and 0 otherwise. The strings belong to
+     the epub and stay valid until it is closed.
+  */
+  EPUB_EXPORT int epub_get_cover(struct epub *epub, const char **href,
+                                 const char **media_type);
+
+  /**
+     Reads the pixel size of an image from its header, inflating only
+     the first bytes of the file rather than decoding it. Jpeg, png,
+     gif, webp and svg (from the root element's width and height or
+     its viewBox) are recognized.
+
+     @param epub struct of the epub file
+     @param href the image's href, relative to the data directory
+     @param width pointer to where the width is stored, -1 if unknown
+     @param height pointer to where the height is stored, -1 if unknown
+     @param format pointer to where the format is stored
+     @return 1 if the size was found and 0 otherwise
+  */
+  EPUB_EXPORT int epub_get_image_info(struct epub *epub, const char *href,
+                                      int *width, int *height,
+                                      enum epub_image_format *format);
+
+  /**
+     Reads the pixel sizes of all manifest items of an image media
+     type as epub_get_image_info does.
+
+     @param epub struct of the epub file
+     @param size pointer to where the number of images is stored
+     @return the array in manifest order, which the caller should free,
+     or NULL on error. Its strings belong to the epub.
+  */
+  EPUB_EXPORT struct epub_image_info *epub_get_images_info(struct epub *epub,
+                                                           int *size);
+
+  /**
+     Opens a file of the data directory for reading it in pieces, so it
+     need not be held in memory as a whole (with epub_get_data_info
+     telling its size beforehand).
+
+     @param epub struct of the epub file
+     @param name the name of the file in the data directory
+     @return the stream or NULL if there's no such file
+  */
+  EPUB_EXPORT struct epub_stream *epub_open_data_stream(struct epub *epub,
+                                                        const char *name);
+
+  /**
+     Reads the next piece of a stream.
+
+     @param stream the stream
+     @param buf where the data is stored
+     @param len the most bytes to read
+     @return the number of bytes read, 0 at the end and -1 on error
+  */
+  EPUB_EXPORT int epub_stream_read(struct epub_stream *stream, char *buf, int len);
+
+  /**
+     Closes a stream.
+
+     @param stream the stream
+  */
+  EPUB_EXPORT void epub_stream_close(struct epub_stream *stream);
+
   /** 
       Frees the memory held by the given iterator
       
@@ -73,6 +263,174 @@ extern "C" {
   EPUB_EXPORT unsigned char **epub_get_metadata(struct epub *epub, enum epub_metadata type,
                                                 int *size);
 
+  /**
+     Returns the number of metadata elements of the given type.
+
+     @param epub the struct .
+     @param type the type of metadata
+     @return the number of elements, 0 if there are none
+  */
+  EPUB_EXPORT int epub_get_metadata_count(struct epub *epub,
+                                          enum epub_metadata type);
+
+  /**
+     Returns the text of a metadata element without formatting or copying
+     it: the identifier, date, creator's name or meta's value for those
+     types. It belongs to the epub and is valid until it is closed.
+
+     @param epub the struct .
+     @param type the type of metadata
+     @param index the element's index, below epub_get_metadata_count
+     @return the text or NULL if there is no such element or it is empty
+  */
+  EPUB_EXPORT const char *epub_get_metadata_item(struct epub *epub,
+                                                 enum epub_metadata type,
+                                                 int index);
+
+  /**
+     Fills identifier with the fields of an identifier, the scheme coming
+     from an identifier-type refinement if the element has none. The
+     strings belong to the epub and are valid until it is closed.
+
+     @param epub the struct .
+     @param index the identifier's index, below the EPUB_ID count
+     @param identifier the struct to fill
+     @return 1 on success, 0 if there is no such identifier
+  */
+  EPUB_EXPORT int epub_get_identifier(struct epub *epub, int index,
+                                      struct epub_identifier *identifier);
+
+  /**
+     Fills creator with the fields of a creator or contributor. An epub 3
+     file-as or role refinement stands in for a missing attribute. The
+     strings belong to the epub and are valid until it is closed.
+
+     @param epub the struct .
+     @param type EPUB_CREATOR or EPUB_CONTRIB
+     @param index the creator's index, below the count of type
+     @param creator the struct to fill
+     @return 1 on success, 0 if there is no such creator
+  */
+  EPUB_EXPORT int epub_get_creator(struct epub *epub, enum epub_metadata type,
+                                   int index, struct epub_creator *creator);
+
+  /**
+     Fills date with the fields of a date. The strings belong to the
+     epub and are valid until it is closed.
+
+     @param epub the struct .
+     @param index the date's index, below the EPUB_DATE count
+     @param date the struct to fill
+     @return 1 on success, 0 if there is no such date
+  */
+  EPUB_EXPORT int epub_get_date(struct epub *epub, int index,
+                                struct epub_date *date);
+
+  /**
+     Fills meta with the fields of a meta element. The strings belong to
+     the epub and are valid until it is closed.
+
+     @param epub the struct .
+     @param index the meta element's index, below the EPUB_META count
+     @param meta the struct to fill
+     @return 1 on success, 0 if there is no such element
+  */
+  EPUB_EXPORT int epub_get_meta(struct epub *epub, int index,
+                                struct epub_meta *meta);
+
+  /**
+     Returns the number of epub 3 meta elements refining a metadata
+     element, which are looked up by the element's id.
+
+     @param epub the struct .
+     @param type the type of the refined element
+     @param index the element's index, below the count of type
+     @return the number of refinements, 0 if there are none
+  */
+  EPUB_EXPORT int epub_get_refinement_count(struct epub *epub,
+                                            enum epub_metadata type,
+                                            int index);
+
+  /**
+     Fills meta with a meta element refining a metadata element, in the
+     order of the opf. The strings belong to the epub and are valid until
+     it is closed.
+
+     @param epub the struct .
+     @param type the type of the refined element
+     @param index the element's index, below the count of type
+     @param n the refinement's index, below epub_get_refinement_count
+     @param meta the struct to fill
+     @return 1 on success, 0 if there is no such refinement
+  */
+  EPUB_EXPORT int epub_get_refinement(struct epub *epub,
+                                      enum epub_metadata type, int index,
+                                      int n, struct epub_meta *meta);
+
+  /**
+     Returns the value of the first refinement of a metadata element with
+     the given property, like file-as, title-type or display-seq. It
+     belongs to the epub and is valid until it is closed.
+
+     @param epub the struct .
+     @param type the type of the refined element
+     @param index the element's index, below the count of type
+     @param property the property looked for
+     @return the value or NULL if there is no such refinement
+  */
+  EPUB_EXPORT const char *epub_get_refinement_value(struct epub *epub,
+                                                    enum epub_metadata type,
+                                                    int index,
+                                                    const char *property);
+
+  /**
+     Finds the metadata element with an id, as a refines attribute names
+     it. A belongs-to-collection meta, for one, is found by the id its
+     collection-type and group-position refinements refine.
+
+     @param epub the struct .
+     @param id the id, with or without a leading '#'
+     @param type where to put the element's type, if not NULL
+     @param index where to put its index in the list of its type, if not
+     NULL
+     @return 1 if found, 0 otherwise
+  */
+  EPUB_EXPORT int epub_get_metadata_by_id(struct epub *epub, const char *id,
+                                          enum epub_metadata *type,
+                                          int *index);
+
+  /**
+     Returns the sort key of the book's title or first creator. The title
+     is the one refined as the main one, or the first; its file-as
+     refinement is used if it has one. The creator's file-as is used if
+     it has one, and its name otherwise. Keys are case folded, without
+     diacritics or a leading article of the book's language (english if
+     it has none), and order numbers by value. A key ends in a 0 and has
+     no other, so keys can be sorted with strcmp, or memcmp over the
+     shorter one's size plus one.
+
+     @param epub struct of the epub file
+     @param type EPUB_TITLE or EPUB_CREATOR
+     @param size if not NULL, set to the key's size without the 0
+     @return the key or NULL if the book has no such metadata. The epub
+     handles the freeing of the memory.
+  */
+  EPUB_EXPORT const unsigned char *epub_get_sort_key(struct epub *epub,
+                                                     enum epub_metadata type,
+                                                     int *size);
+
+  /**
+     Returns the sort key of any string, the way epub_get_sort_key makes
+     them.
+
+     @param str the utf-8 string
+     @param lang the language whose articles are dropped, or NULL
+     @param size if not NULL, set to the key's size without the 0
+     @return the key or NULL on error. It has to be freed.
+  */
+  EPUB_EXPORT unsigned char *epub_make_sort_key(const char *str,
+                                                const char *lang, int *size);
+
   /** 
       returns the file with the give filename. The file is looked
       for in the data directory. (Useful for getting book files). 
@@ -84,6 +442,22 @@ extern "C" {
   */
   EPUB_EXPORT int epub_get_data(struct epub *epub, const char *name, char **data);
 
+  /**
+     Reads several files of the data directory, like the chapters about
+     to be shown. They are read in the order they lie in the zip, files
+     close to each other in one read, so a book opened with
+     epub_open_io takes a few requests instead of one per file.
+
+     @param epub struct of the epub file
+     @param names the names of the files, as for epub_get_data
+     @param count the number of names
+     @param callback called for every file, in the order they are read
+     @param data passed to the callback
+     @return the number of files read or -1 on error
+  */
+  EPUB_EXPORT int epub_fetch_many(struct epub *epub, const char **names,
+                                  int count, epub_fetch_callback callback,
+                                  void *data);
   
   /** 
       Returns a book iterator of the requested type
@@ -124,6 +498,490 @@ extern "C" {
   */
   EPUB_EXPORT char *epub_it_get_curr_url(struct eiterator *it);
 
+  /**
+     Returns the spine index of the iterator's current data.
+     
+     @param it the iterator
+     @return the current spine index or -1 if there is none
+  */
+  EPUB_EXPORT int epub_it_get_curr_index(struct eiterator *it);
+
+  /** 
+      Returns an iterator over the text of the spine documents of the
+      requested type. The text is extracted while the documents are
+      read, in pieces: markup, scripts, styles and the head are
+      dropped, entities decoded and whitespace collapsed, and block
+      elements put on lines of their own. Documents in another
+      encoding are transcoded, and the text and all offsets into it
+      are in utf-8.
+      
+      @param epub struct of the epub file
+      @param type the iterator type
+      @param opt other options (ignored for now)
+      @return text iterator to the epub book
+  */
+  EPUB_EXPORT struct textiterator *epub_get_text_iterator(struct epub *epub, 
+                                                          enum eiterator_type type,
+                                                          int opt);
+
+  /**
+     Returns the next piece of text. Pieces never span documents and
+     every document's text starts in a new piece, without a separator
+     from the previous document's. The text is nul terminated and
+     belongs to the iterator; it stays valid until the next call.
+     
+     @param it the iterator
+     @param len pointer to where the text's length is stored
+     @return pointer to the text or NULL at the end of the book
+  */
+  EPUB_EXPORT const char *epub_text_it_next(struct textiterator *it, int *len);
+
+  /**
+     Returns a pointer to the url of the document the current piece of
+     text is from. the iterator handles the freeing of the memory.
+     
+     @param it the iterator
+     @return pointer to the current document's url
+  */
+  EPUB_EXPORT char *epub_text_it_get_curr_url(struct textiterator *it);
+
+  /**
+     Returns the spine index of the document the current piece of text
+     is from.
+     
+     @param it the iterator
+     @return the current spine index or -1 at the end of the book
+  */
+  EPUB_EXPORT int epub_text_it_get_curr_index(struct textiterator *it);
+
+  /** 
+      Frees the memory held by the given iterator
+      
+      @param it the iterator
+  */
+  EPUB_EXPORT void epub_free_text_iterator(struct textiterator *it);
+
+  /**
+     Returns the beginning of the book's text, from the linear spine
+     documents as epub_get_text_iterator extracts it. Only as much of
+     the documents is read and inflated as the preview needs.
+
+     @param epub struct of the epub file
+     @param max_chars the most (utf-8) characters to return, at most
+     a quarter of INT_MAX
+     @param flags EPUB_PREVIEW_* flags or 0
+     @return the text, which the caller should free, or NULL on error
+  */
+  EPUB_EXPORT char *epub_get_preview(struct epub *epub, int max_chars, int flags);
+
+  /**
+     Computes the figures of the book and of each spine document in one
+     pass over the spine, reading the documents as
+     epub_get_text_iterator does. Words are runs of text without
+     whitespace that have a letter or a digit.
+
+     @param epub struct of the epub file
+     @param opt other options (ignored for now)
+     @return the figures, to be freed with epub_free_stats, or NULL on
+     error
+  */
+  EPUB_EXPORT struct epub_stats *epub_compute_stats(struct epub *epub, int opt);
+
+  /**
+     Frees figures returned by epub_compute_stats
+
+     @param stats the figures
+  */
+  EPUB_EXPORT void epub_free_stats(struct epub_stats *stats);
+
+  /**
+     Computes where the text of every linear spine document starts in
+     the book's text, unless that is known already. The other offset
+     functions call it when needed. Offsets count the (utf-8)
+     characters of the documents' text as epub_get_text_iterator
+     extracts it, with nothing between documents.
+
+     @param epub struct of the epub file
+     @return 1 on success and 0 otherwise
+  */
+  EPUB_EXPORT int epub_build_offset_map(struct epub *epub);
+
+  /**
+     Saves the offset map to a file, to be loaded the next time the
+     book is opened.
+
+     @param epub struct of the epub file
+     @param filename the file
+     @return 1 on success and 0 otherwise
+  */
+  EPUB_EXPORT int epub_save_offset_map(struct epub *epub, const char *filename);
+
+  /**
+     Loads an offset map saved by epub_save_offset_map. Maps of other
+     books, or of documents that changed since, are refused.
+
+     @param epub struct of the epub file
+     @param filename the file
+     @return 1 on success and 0 otherwise
+  */
+  EPUB_EXPORT int epub_load_offset_map(struct epub *epub, const char *filename);
+
+  /**
+     Returns the number of characters of the linear spine's text.
+
+     @param epub struct of the epub file
+     @return the length or -1 on error
+  */
+  EPUB_EXPORT long long epub_get_text_length(struct epub *epub);
+
+  /**
+     Finds the linear spine document and the offset in its text of a
+     character offset in the book's text.
+
+     @param epub struct of the epub file
+     @param offset the book text offset, from 0 to its length
+     @param spine_index pointer to where the spine index is stored
+     @param doc_offset pointer to where the document text offset is
+     stored
+     @return 1 on success and 0 if the offset is out of the book
+  */
+  EPUB_EXPORT int epub_position_from_offset(struct epub *epub, long long offset,
+                                            int *spine_index, int *doc_offset);
+
+  /**
+     Returns the book text offset of a character of a linear spine
+     document's text.
+
+     @param epub struct of the epub file
+     @param spine_index the document's spine index
+     @param doc_offset the offset in the document's text
+     @return the book text offset or -1 if there is no such position
+  */
+  EPUB_EXPORT long long epub_offset_from_position(struct epub *epub, int spine_index,
+                                                  int doc_offset);
+
+  /**
+     Resolves an epub canonical fragment identifier to a spine document
+     and a byte offset in it. The document is read only as far as the
+     position, without building its tree. Of a range the start is
+     resolved, and an idref assertion on the spine step wins over the
+     step's index. Character offsets past the end of a text are
+     clamped to its end.
+
+     @param epub struct of the epub file
+     @param cfi the cfi, with or without "epubcfi(...)" around it
+     @param spine_index pointer to where the spine index is stored
+     @param offset pointer to where the byte offset is stored
+     @return 1 on success and 0 otherwise
+  */
+  EPUB_EXPORT int epub_cfi_resolve(struct epub *epub, const char *cfi,
+                                   int *spine_index, int *offset);
+
+  /**
+     Returns the epub canonical fragment identifier of a byte offset in
+     a spine document. An offset inside markup gets the position of the
+     text before it.
+
+     @param epub struct of the epub file
+     @param spine_index the document's spine index
+     @param offset the byte offset in the document
+     @return the cfi, which the caller should free, or NULL on error
+  */
+  EPUB_EXPORT char *epub_cfi_from_position(struct epub *epub, int spine_index,
+                                           int offset);
+
+  /**
+     Finds the spine document and the element a link points at, as for
+     following a footnote. The element ids of a document are indexed
+     the first time one of them is asked for.
+
+     @param epub struct of the epub file
+     @param href the link, relative to the data path, with or without a
+     fragment
+     @param spine_index pointer to where the spine index is stored
+     @param offset pointer to where the byte offset of the element's
+     start tag is stored, 0 if there's no fragment
+     @param text_offset pointer to where the element's offset in the
+     document's text is stored, as in epub_offset_from_position, or NULL
+     @return 1 on success and 0 if there's no such document or element
+  */
+  EPUB_EXPORT int epub_resolve_fragment(struct epub *epub, const char *href,
+                                        int *spine_index, int *offset,
+                                        int *text_offset);
+
+  /**
+     Indexes the element ids of all spine documents now rather than
+     when epub_resolve_fragment first needs them.
+
+     @param epub struct of the epub file
+     @return 1 on success and 0 if a document could not be read
+  */
+  EPUB_EXPORT int epub_build_fragment_index(struct epub *epub);
+
+  /**
+     Finds every occurrence of a string in the text of the spine
+     documents, as epub_get_text_iterator extracts it, while reading
+     the documents. Matches don't overlap and whitespace in the text is
+     collapsed, so the pattern should not have runs of it.
+
+     @param epub struct of the epub file
+     @param pattern the string to find
+     @param flags EPUB_SEARCH_* flags or 0 for an exact search
+     @param callback called for every match in reading order
+     @param data passed to the callback
+     @return the number of matches reported or -1 on error
+  */
+  EPUB_EXPORT int epub_search(struct epub *epub, const char *pattern, int flags,
+                              epub_search_callback callback, void *data);
+
+  /**
+     Builds a search index of the words in the text of the spine
+     documents and writes it to a file. Words are runs of letters and
+     digits, ascii letters lowercased; the index keeps where each one
+     occurs, delta encoded and compressed with zlib.
+
+     @param epub struct of the epub file
+     @param filename the index file, or NULL for the epub's file name
+     with ".idx" appended
+     @return the number of distinct words or -1 on error
+  */
+  EPUB_EXPORT int epub_index_build(struct epub *epub, const char *filename);
+
+  /**
+     Opens a search index written by epub_index_build. Only its
+     dictionary is read; postings are read as queries need them. An
+     opened index must not be queried from more than one thread at a
+     time.
+
+     @param filename the index file
+     @return the index or NULL if it can't be read
+  */
+  EPUB_EXPORT struct epub_index *epub_index_open(const char *filename);
+
+  /**
+     Finds a word or a phrase in an index. The query is split into words
+     the way the text was; a hit is where all of them follow each other
+     in one document.
+
+     @param index the index
+     @param query the word or phrase
+     @param callback called for every hit in reading order
+     @param data passed to the callback
+     @return the number of hits reported or -1 on error
+  */
+  EPUB_EXPORT int epub_index_query(struct epub_index *index, const char *query,
+                                   epub_index_callback callback, void *data);
+
+  /**
+     Closes an index opened with epub_index_open.
+
+     @param index the index
+  */
+  EPUB_EXPORT void epub_index_close(struct epub_index *index);
+
+  /**
+     Returns a new empty library. A library indexes the languages,
+     subjects, publishers, creator names and dates of the books added to
+     it, so that the books with a value, or dated in a range, can be
+     found without opening them.
+
+     @return the library or NULL on error
+  */
+  EPUB_EXPORT struct epub_library *epub_library_new();
+
+  /**
+     Adds a book's metadata to a library. Books get ids 0, 1, 2... in
+     the order they are added.
+
+     @param library the library
+     @param epub struct of the epub file
+     @param name stored with the book, e.g. its file name; can be NULL
+     @return the book's id or -1 on error
+  */
+  EPUB_EXPORT int epub_library_add(struct epub_library *library,
+                                   struct epub *epub, const char *name);
+
+  /**
+     Opens a file's metadata with epub_open_metadata and adds it to a
+     library under the file name.
+
+     @param library the library
+     @param filename the epub file
+     @return the book's id or -1 on error
+  */
+  EPUB_EXPORT int epub_library_add_file(struct epub_library *library,
+                                        const char *filename);
+
+  /**
+     @param library the library
+     @return the number of books in the library
+  */
+  EPUB_EXPORT int epub_library_count(struct epub_library *library);
+
+  /**
+     @param library the library
+     @param id a book's id
+     @return the name the book was added with or NULL. The library
+     handles the freeing of the memory.
+  */
+  EPUB_EXPORT const char *epub_library_get_name(struct epub_library *library,
+                                                int id);
+
+  /**
+     Returns the sort key a book was added with, see epub_get_sort_key.
+
+     @param library the library
+     @param id a book's id
+     @param type EPUB_TITLE or EPUB_CREATOR
+     @param size if not NULL, set to the key's size without the 0
+     @return the key or NULL. The library handles the freeing of the
+     memory.
+  */
+  EPUB_EXPORT const unsigned char *epub_library_get_sort_key(struct epub_library *library,
+                                                             int id,
+                                                             enum epub_metadata type,
+                                                             int *size);
+
+  /**
+     Sorts books by their title or creator sort keys, books without one
+     last and books with the same one by id.
+
+     @param library the library
+     @param type EPUB_TITLE or EPUB_CREATOR
+     @param ids the books' ids, sorted in place
+     @param size the number of ids
+     @return 1 on success, 0 on error
+  */
+  EPUB_EXPORT int epub_library_sort(struct epub_library *library,
+                                    enum epub_metadata type, int *ids,
+                                    int size);
+
+  /**
+     Returns the number of distinct values of a metadata type in a
+     library. EPUB_LANG, EPUB_SUBJECT, EPUB_PUBLISHER and EPUB_CREATOR
+     are indexed.
+
+     @param library the library
+     @param type the metadata type
+     @return the number of values
+  */
+  EPUB_EXPORT int epub_library_value_count(struct epub_library *library,
+                                           enum epub_metadata type);
+
+  /**
+     Returns one of the values of a metadata type, in strcmp order.
+
+     @param library the library
+     @param type the metadata type
+     @param index the value's index
+     @param docs if not NULL, set to the number of books with the value
+     @return the value or NULL. The library handles the freeing of the
+     memory.
+  */
+  EPUB_EXPORT const char *epub_library_get_value(struct epub_library *library,
+                                                 enum epub_metadata type,
+                                                 int index, int *docs);
+
+  /**
+     Returns the books having a value. Values are compared as they are
+     in the metadata, case included.
+
+     @param library the library
+     @param type the metadata type
+     @param value the value
+     @return the books' ids, empty if none has it, or NULL on error. It
+     has to be freed with epub_bitmap_free.
+  */
+  EPUB_EXPORT struct epub_bitmap *epub_library_lookup(struct epub_library *library,
+                                                      enum epub_metadata type,
+                                                      const char *value);
+
+  /**
+     Returns the books dated in a range. A book's date is its
+     publication date, or its first one if none is marked as such.
+     Dates are YYYY, YYYY-MM or YYYY-MM-DD; a partial from starts at the
+     beginning of its year or month and a partial to includes all of it.
+
+     @param library the library
+     @param from the first date or NULL
+     @param to the last date or NULL
+     @return the books' ids or NULL on error. It has to be freed with
+     epub_bitmap_free.
+  */
+  EPUB_EXPORT struct epub_bitmap *epub_library_date_range(struct epub_library *library,
+                                                          const char *from,
+                                                          const char *to);
+
+  /**
+     Writes a library to a file.
+
+     @param library the library
+     @param filename the file
+     @return 1 on success, 0 on error
+  */
+  EPUB_EXPORT int epub_library_save(struct epub_library *library,
+                                    const char *filename);
+
+  /**
+     Reads a library written by epub_library_save. Books can still be
+     added to it.
+
+     @param filename the file
+     @return the library or NULL if it can't be read
+  */
+  EPUB_EXPORT struct epub_library *epub_library_load(const char *filename);
+
+  /**
+     Frees a library.
+
+     @param library the library
+  */
+  EPUB_EXPORT void epub_library_free(struct epub_library *library);
+
+  /**
+     Returns the books in both sets.
+
+     @param a a set of ids
+     @param b a set of ids
+     @return a new set or NULL on error. It has to be freed with
+     epub_bitmap_free.
+  */
+  EPUB_EXPORT struct epub_bitmap *epub_bitmap_and(struct epub_bitmap *a,
+                                                  struct epub_bitmap *b);
+
+  /**
+     Returns the books in either set.
+
+     @param a a set of ids
+     @param b a set of ids
+     @return a new set or NULL on error. It has to be freed with
+     epub_bitmap_free.
+  */
+  EPUB_EXPORT struct epub_bitmap *epub_bitmap_or(struct epub_bitmap *a,
+                                                 struct epub_bitmap *b);
+
+  /**
+     @param bitmap a set of ids
+     @return the number of ids in the set
+  */
+  EPUB_EXPORT int epub_bitmap_count(struct epub_bitmap *bitmap);
+
+  /**
+     Returns the ids in a set in increasing order.
+
+     @param bitmap a set of ids
+     @param size set to the number of ids
+     @return the ids or NULL on error. It has to be freed.
+  */
+  EPUB_EXPORT int *epub_bitmap_ids(struct epub_bitmap *bitmap, int *size);
+
+  /**
+     Frees a set of ids.
+
+     @param bitmap the set
+  */
+  EPUB_EXPORT void epub_bitmap_free(struct epub_bitmap *bitmap);
+
   /** 
       Returns a book toc iterator of the requested type
       for the given epub struct.
@@ -172,12 +1030,35 @@ extern "C" {
   */
   EPUB_EXPORT char *epub_tit_get_curr_label(struct titerator *tit);
 
+  /**
+     Returns the toc iterator's current entry without copying it.
+     The entry belongs to the epub.
+     
+     @param tit the iterator
+     @return pointer to the current entry or NULL if it is not valid
+  */
+  EPUB_EXPORT const struct epub_toc_entry *epub_tit_get_curr_entry(struct titerator *tit);
+
   /** 
       Frees the memory held by the given iterator
       
       @param tit the iterator
   */
   EPUB_EXPORT void epub_free_titerator(struct titerator *tit);
+
+  /**
+     Returns the whole toc of the requested type as one array, in the
+     order a toc iterator walks it. Labels are already chosen by the
+     book's language. The array belongs to the epub.
+
+     @param epub struct of the epub file
+     @param type the toc type
+     @param size pointer to where the number of entries is stored
+     @return the entries or NULL if the book has no such toc
+  */
+  EPUB_EXPORT const struct epub_toc_entry *epub_toc_get_flat(struct epub *epub,
+                                                             enum titerator_type type,
+                                                             int *size);
   
   /**
      updates the iterator to the next element.
@@ -187,6 +1068,53 @@ extern "C" {
   */
   EPUB_EXPORT int epub_tit_next(struct titerator *tit);
 
+  /**
+     Returns the navMap entry of the chapter that a position in the book
+     belongs to: the deepest entry that starts at or before the given
+     fragment of the given spine document. Entries linking into the same
+     document are taken to be in document order. A position before any
+     entry of its document belongs to the previous document's chapter.
+
+     @param epub struct of the epub file
+     @param spine_index the position's spine index
+     @param fragment the position's fragment id or NULL for the
+     document's start. Fragments the toc does not link to are taken as
+     the document's start.
+     @return index into epub_toc_get_flat(epub, TITERATOR_NAVMAP, ...) 
+     or -1 if no entry starts before the position
+  */
+  EPUB_EXPORT int epub_toc_entry_for_position(struct epub *epub, int spine_index,
+                                              const char *fragment);
+
+  /**
+     Looks up a print page of the book's page list.
+     The returned string belongs to the epub.
+
+     @param epub struct of the epub file
+     @param label the page's label, e.g. "347"
+     @return the page's target link as given in the page list or NULL
+     if there is no such page
+  */
+  EPUB_EXPORT const char *epub_page_target(struct epub *epub, const char *label);
+
+  /**
+     Looks up the print page a link of the book's page list points to.
+     The returned string belongs to the epub.
+
+     @param epub struct of the epub file
+     @param link the target link as given in the page list
+     @return the label of the first page with that target or NULL if 
+     there is none
+  */
+  EPUB_EXPORT const char *epub_page_for_target(struct epub *epub, const char *link);
+
+  /**
+     Frees the xml readers the calling thread keeps for reuse. Threads
+     that opened epubs should call this before they end; epub_cleanup
+     does it for the thread calling it.
+  */
+  EPUB_EXPORT void epub_thread_cleanup();
+
   /**
      Cleans up after the library. Call this when you are done with the library. 
   */
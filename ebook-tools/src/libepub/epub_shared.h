@@ -52,6 +52,205 @@ enum titerator_type {
   TITERATOR_PAGES /**< The pages of the ebook */
 };
 
+/**
+   An entry of a flattened table of content. The strings belong to the
+   epub and stay valid until it is closed.
+*/
+struct epub_toc_entry {
+  const char *label; /**< the entry's label in the book's language */
+  const char *link; /**< the entry's link (NULL for category labels) */
+  int depth; /**< the entry's depth */
+  int parent; /**< index of the enclosing entry or -1 */
+  int end; /**< index one past the last entry of this entry's subtree */
+};
+
+/**
+   Search flags
+*/
+enum epub_search_flags {
+  EPUB_SEARCH_CASELESS = 1 /**< ignore the case of ascii letters */
+};
+
+/**
+   Preview flags
+*/
+enum epub_preview_flags {
+  EPUB_PREVIEW_WORDS = 1, /**< don't end in the middle of a word */
+  EPUB_PREVIEW_ONE_LINE = 2 /**< put the text on one line */
+};
+
+/**
+   A match found by epub_search. The strings belong to the search and
+   are only valid during the callback.
+*/
+struct epub_search_result {
+  int spine; /**< spine index of the document */
+  int offset; /**< byte offset of the match in the document's text */
+  const char *context; /**< the text around the match on one line */
+  int contextOffset; /**< byte offset of the match in the context */
+};
+
+/**
+   Called by epub_search for every match, returns non zero to stop
+*/
+typedef int (*epub_search_callback)(const struct epub_search_result *result,
+                                    void *data);
+
+/**
+   A word or phrase found by epub_index_query
+*/
+struct epub_index_hit {
+  int spine; /**< spine index of the document */
+  int position; /**< number of the first word in the document */
+  int offset; /**< byte offset of the first word in the document's text */
+  int length; /**< byte length of the words in the document's text */
+};
+
+/**
+   Called by epub_index_query for every hit, returns non zero to stop
+*/
+typedef int (*epub_index_callback)(const struct epub_index_hit *hit,
+                                   void *data);
+
+/**
+   Figures of a spine document or the whole book
+*/
+struct epub_spine_stats {
+  int size; /**< bytes of the documents */
+  int chars; /**< (utf-8) characters of their text, spaces included */
+  int words; /**< words of their text */
+  int images; /**< img and svg image elements */
+};
+
+/**
+   Figures computed by epub_compute_stats
+*/
+struct epub_stats {
+  struct epub_spine_stats total; /**< the whole book */
+  int readingMinutes; /**< reading time at 250 words a minute */
+  int spineCount; /**< number of spine items */
+  struct epub_spine_stats *spine; /**< the figures by spine index */
+};
+
+/**
+   What the zip central directory says about a file in the epub.
+   Fields it doesn't have are -1.
+*/
+struct epub_entry_info {
+  int index; /**< the file's index in the zip archive */
+  long long size; /**< uncompressed bytes */
+  long long compressedSize; /**< compressed bytes */
+  int method; /**< zip compression method, 0 stored and 8 deflated */
+  unsigned long crc; /**< crc-32 of the uncompressed data (0 if unknown) */
+};
+
+/**
+   Image formats epub_get_image_info recognizes
+*/
+enum epub_image_format {
+  EPUB_IMAGE_UNKNOWN,
+  EPUB_IMAGE_JPEG,
+  EPUB_IMAGE_PNG,
+  EPUB_IMAGE_GIF,
+  EPUB_IMAGE_WEBP,
+  EPUB_IMAGE_SVG
+};
+
+/**
+   An image of the manifest as epub_get_images_info returns it
+*/
+struct epub_image_info {
+  const char *href; /**< the image's href, relative to the data directory */
+  const char *mediaType; /**< its media type from the manifest */
+  int width; /**< width in pixels or -1 if unknown */
+  int height; /**< height in pixels or -1 if unknown */
+  enum epub_image_format format; /**< the format its header shows */
+};
+
+/**
+   An identifier as epub_get_identifier returns it. Like the strings of
+   the other metadata structs, its strings belong to the epub and are
+   NULL where the opf leaves them out.
+*/
+struct epub_identifier {
+  const char *value; /**< the identifier itself */
+  const char *scheme; /**< its scheme, like ISBN */
+  const char *id; /**< the id of its element */
+};
+
+/**
+   A creator or contributor as epub_get_creator returns it
+*/
+struct epub_creator {
+  const char *name; /**< the name as displayed */
+  const char *fileAs; /**< the name to sort by */
+  const char *role; /**< the marc relator code, like aut */
+};
+
+/**
+   A date as epub_get_date returns it
+*/
+struct epub_date {
+  const char *date; /**< the date, as given */
+  const char *event; /**< what happened then, like publication */
+};
+
+/**
+   A meta element as epub_get_meta returns it, an opf 2 one having a
+   name and content and an epub 3 one a property and value
+*/
+struct epub_meta {
+  const char *name; /**< the name attribute */
+  const char *content; /**< the content attribute */
+  const char *property; /**< the property attribute */
+  const char *value; /**< the element's text */
+  const char *refines; /**< the element it refines, like #creator01 */
+  const char *id; /**< the id of the element */
+};
+
+/**
+   A range of bytes of a container
+*/
+struct epub_range {
+  long long offset; /**< the first byte */
+  long long length; /**< the number of bytes */
+};
+
+/**
+   Callbacks reading an epub from elsewhere than a local file, like an
+   object store, for epub_open_io. Only the end of the zip, its central
+   directory and the files asked for are read.
+*/
+struct epub_io {
+  /** returns the size of the container in bytes or -1 on error */
+  long long (*size)(void *data);
+  /** reads length bytes from offset on into buf, returning the bytes
+      read, fewer only at the end, or -1 on error */
+  long long (*read_at)(void *data, long long offset, long long length,
+                       void *buf);
+  /** can be NULL; tells which ranges are about to be read so they can
+      be fetched together. Returns 0 on error, which is ignored */
+  int (*prefetch)(void *data, const struct epub_range *ranges, int count);
+  void *data; /**< passed to the callbacks */
+};
+
+/**
+   A file read by epub_fetch_many
+*/
+struct epub_fetched {
+  const char *name; /**< the name asked for */
+  int index; /**< its index in the names asked for */
+  const char *data; /**< its bytes, valid during the callback, or NULL
+                       if it couldn't be read */
+  int size; /**< bytes of data or -1 */
+};
+
+/**
+   Called by epub_fetch_many for every file, returns non zero to stop
+*/
+typedef int (*epub_fetch_callback)(const struct epub_fetched *file,
+                                   void *data);
+
 /**
    The page-spread-* properties
 */
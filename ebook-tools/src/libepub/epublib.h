@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 // For opening the zip file
 #include <zip.h>
@@ -14,6 +15,7 @@
 
 // For list stuff
 #include "linklist.h"
+#include "vector.h"
 #include "epub_shared.h"
 
 // General definitions
@@ -29,6 +31,12 @@
 # define PRINTF_FORMAT(si, ftc)
 #endif
 
+#if defined(__GNUC__)
+# define EPUB_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+# define EPUB_THREAD_LOCAL __declspec(thread)
+#endif
+
 // MSVC-specific definitions
 #ifdef _MSC_VER
 # define strdup _strdup
@@ -60,6 +68,8 @@ struct ocf {
   char *mimetype; // For debugging 
   listPtr roots; // list of OCF roots
   struct epub *epub; // back pointer
+  struct epub_io *io; // the backend when not opened from a file
+  struct fetchDirectory *directory; // read on the first epub_fetch_many
 };
 
 struct meta {
@@ -67,6 +77,8 @@ struct meta {
   xmlChar *content;
   xmlChar *property;
   xmlChar *value;
+  xmlChar *refines; // the epub 3 element this one refines, like #creator
+  const xmlChar *id; // its id, borrowed from the metadata ids
 };
 
 struct id {
@@ -87,22 +99,42 @@ struct creator {
 };
 
 struct metadata {
-  listPtr id;
-  listPtr title;
-  listPtr creator;
-  listPtr contrib;
-  listPtr subject;
-  listPtr publisher;
-  listPtr description;
-  listPtr date;
-  listPtr type;
-  listPtr format;
-  listPtr source;
-  listPtr lang;
-  listPtr relation;
-  listPtr coverage;
-  listPtr rights;
-  listPtr meta;
+  vectorPtr id;
+  vectorPtr title;
+  vectorPtr creator;
+  vectorPtr contrib;
+  vectorPtr subject;
+  vectorPtr publisher;
+  vectorPtr description;
+  vectorPtr date;
+  vectorPtr type;
+  vectorPtr format;
+  vectorPtr source;
+  vectorPtr lang;
+  vectorPtr relation;
+  vectorPtr coverage;
+  vectorPtr rights;
+  vectorPtr meta;
+
+  // the elements with an id and the metas refining one, both sorted by
+  // that id once the metadata is parsed, and the ids again sorted by
+  // their element
+  vectorPtr ids;
+  vectorPtr refines;
+  vectorPtr elementIds;
+
+  // the sort keys of the title and the first creator
+  xmlChar *titleKey;
+  xmlChar *creatorKey;
+};
+
+// An element of the metadata that has an id
+struct metadataId {
+  xmlChar *id;
+  enum epub_metadata type;
+  int index; // its index in the list of its type
+  int firstRefinement; // the metas refining it in the refines vector
+  int refinements;
 };
 
 struct manifest {
@@ -113,6 +145,7 @@ struct manifest {
   xmlChar *type;
   xmlChar *fallback;
   xmlChar *fbStyle;
+  xmlChar *properties;
 
 };
     
@@ -130,7 +163,7 @@ struct site {
 struct tour {
   xmlChar *id;
   xmlChar *title;
-  listPtr sites;
+  vectorPtr sites;
 };
 
 // Struct for navLabel and navInfo
@@ -146,7 +179,7 @@ struct tocItem {
   xmlChar *src;
   xmlChar *class;
   xmlChar *type; //pages
-  listPtr label;
+  vectorPtr label;
   int depth;
   int playOrder;
   int value;
@@ -156,9 +189,9 @@ struct tocItem {
 struct tocCategory {
   xmlChar *id;
   xmlChar *class;
-  listPtr info; //tocLabel
-  listPtr label; //tocLabel
-  listPtr items; //tocItem
+  vectorPtr info; //tocLabel
+  vectorPtr label; //tocLabel
+  vectorPtr items; //tocItem
 };
 
 // General toc struct
@@ -166,7 +199,43 @@ struct toc {
   struct tocCategory *navMap; 
   struct tocCategory *pageList;
   struct tocCategory *navList;
-  listPtr playOrder;
+  vectorPtr playOrder;
+};
+
+// A toc category compiled into one array, all strings in one blob
+struct tocFlat {
+  struct epub_toc_entry *entries;
+  int size;
+  char *strings;
+};
+
+// A toc entry's place in the reading order
+struct tocPosition {
+  int spine; // spine index of the linked document
+  int order; // 0 for the document's start, else the fragment's rank
+  int entry; // index of the entry in the flat navMap
+  const char *fragment; // the link's fragment or NULL
+};
+
+// navMap entries sorted by position, and by fragment for lookups
+struct tocIndex {
+  struct tocPosition *positions;
+  struct tocPosition **fragments;
+  int size;
+  int fragmentCount;
+};
+
+// pageList entries with links sorted by label and by link
+struct pageIndex {
+  struct epub_toc_entry **byLabel;
+  struct epub_toc_entry **byLink;
+  int size;
+};
+
+// Spine document href for lookups from links
+struct spineHref {
+  const xmlChar *href; // owned by the manifest
+  int index;
 };
 
 struct spine {
@@ -175,19 +244,44 @@ struct spine {
   enum page_spread_position spreadPosition;
 };
 
+// Memory handed out in blocks and all freed at once
+struct arena {
+  struct arenaBlock *blocks; // the current block first
+  char *next;
+  size_t left; // bytes left in the current block
+  size_t blockSize; // size of the next block
+};
+
 struct opf {
   char *name;
   xmlChar *tocName;
   struct epub *epub;
   struct metadata *metadata;
   struct toc *toc; // must in opf 2.0
-  listPtr manifest;
-  listPtr spine;
+  vectorPtr manifest;
+  vectorPtr spine;
   int linearCount;
     
   // might be NULL
-  listPtr guide;
-  listPtr tours;
+  vectorPtr guide;
+  vectorPtr tours;
+
+  // flattened navMap, guide and pageList indexed by titerator_type
+  struct tocFlat *tocFlat[3];
+  struct tocIndex *tocIndex;
+  struct pageIndex *pageIndex;
+
+  // spine documents sorted by href
+  struct spineHref *spineHrefs;
+  int spineHrefCount;
+
+  // the cover image, looked for when first asked for
+  struct manifest *cover;
+  int coverSearched;
+
+  // when set, the parsed items and their strings are in it, and only the
+  // vectors holding them are freed on their own
+  struct arena *arena;
 };
 
 struct epuberr {
@@ -212,9 +306,34 @@ extern const char _epub_error_oom[];
 #define _epub_err_set_oom(_epub_err) _epub_err_set_const_str(_epub_err, _epub_error_oom)
 
 // general structs
+// Where the text of each linear spine document starts in the book's text
+struct offsetMap {
+  int count; // linear documents
+  int *spine; // their spine indexes
+  unsigned long *crcs; // their crc, to check a loaded map
+  long long *starts; // their first character, and the total at count
+  int *bySpine; // map index by spine index or -1
+  int spineCount;
+};
+
+// An element id of a spine document
+struct fragment {
+  char *id;
+  int offset; // of the element's start tag
+  int textOffset; // in the document's text
+};
+
+// The element ids of a spine document, sorted
+struct fragmentIndex {
+  struct fragment *items;
+  int count;
+};
+
 struct epub {
   struct ocf *ocf;
   struct opf *opf;
+  struct offsetMap *offsetMap; // built when first needed
+  struct fragmentIndex **fragments; // by spine index, built when first needed
   struct epuberr error;
   int debug;
 
@@ -232,32 +351,102 @@ struct eiterator {
   enum eiterator_type type;
   struct epub *epub;
   int opt;
-  listnodePtr curr;
+  int curr; // spine index, -1 when done
   char *cache;
 };
 
-struct tit_info {
-  char *label;
-  int depth;
-  char *link;
-};
-
 struct titerator {
   enum titerator_type type;
   struct epub *epub;
   int opt;
-  listnodePtr next;
-  struct tit_info cache;
+  struct tocFlat *flat;
+  int curr; // index of the current entry
   int valid;
 };
 
+// Longest tag name and entity the text extractor looks at
+#define TEXT_NAME_MAX 15
+#define TEXT_ENTITY_MAX 31
+
+// Bytes read from a document at a time
+#define TEXT_CHUNK_SIZE 16384
+
+// Bytes read at a time for a preview, which usually needs few
+#define PREVIEW_READ_SIZE 4096
+
+// Most characters a preview can take, so that its bytes, 4 for each
+// character and the 0, fit an int
+#define PREVIEW_MAX_CHARS ((INT_MAX - 1) / 4)
+
+// Room _text_parse needs to write the text of len bytes
+#define TEXT_OUT_SIZE(len) (2 * (len) + TEXT_ENTITY_MAX + 8)
+
+// State of the markup stripping text extractor, kept between pieces
+struct textparser {
+  int state;
+  int root; // whether the root element started
+  int skip; // depth of elements whose content is no text
+  int pre; // depth of elements keeping their whitespace
+  int started; // whether any text was written
+  int space; // separator pending before the next text
+  int closing; // whether the current tag is an end tag
+  int empty; // whether the current tag is an empty element tag
+  int marks; // '-', ']' or '?' seen at a possible end of markup
+  int images; // img and svg image elements seen
+  char quote; // quote of the current attribute value
+  char name[TEXT_NAME_MAX + 2];
+  int nameLen;
+  char entity[TEXT_ENTITY_MAX + 1];
+  int entityLen;
+};
+
+// Bytes of a document looked at for its encoding
+#define TEXT_DETECT_SIZE 1024
+
+// A spine document read as utf-8 whatever its encoding
+struct textdoc {
+  struct epub *epub;
+  int index; // spine index
+  struct zip_file *file;
+  xmlCharEncodingHandlerPtr encoder; // NULL when it is utf-8
+  xmlBufferPtr raw; // bytes read and not decoded yet
+  xmlBufferPtr decoded; // text decoded and not read yet
+  char head[TEXT_DETECT_SIZE]; // the start, read to find the encoding
+  int headLen;
+};
+
+struct textiterator {
+  enum eiterator_type type;
+  struct epub *epub;
+  int opt;
+  int curr; // spine index, -1 when done
+  struct textdoc *doc; // the current document while reading it
+  struct textparser parser;
+  char *in;
+  char *out;
+};
+
+struct epub_stream {
+  struct epub *epub;
+  struct zip_file *file;
+};
+
 // Ocf functions
-struct ocf *_ocf_parse(struct epub *epub, const char *filename);
+struct ocf *_ocf_parse(struct epub *epub, const char *filename,
+                       const struct epub_io *io);
 void _ocf_dump(struct ocf *ocf);
 void _ocf_close(struct ocf *ocf);
 struct zip *_ocf_open(struct ocf *ocf, const char *fileName);
+zip_source_t *_io_source_new(const struct epub_io *io, zip_error_t *error);
 int _ocf_get_file(struct ocf *ocf, const char *filename, char **fileStr);
 int _ocf_get_data_file(struct ocf *ocf, const char *filename, char **fileStr);
+char *_ocf_data_name(struct ocf *ocf, const char *filename);
+void _fetch_free_directory(struct fetchDirectory *dir);
+struct zip_file *_ocf_open_data_file(struct ocf *ocf, const char *filename);
+int _ocf_entry_info(struct ocf *ocf, const char *filename, 
+                    struct epub_entry_info *info);
+int _ocf_data_entry_info(struct ocf *ocf, const char *filename,
+                         struct epub_entry_info *info);
 int _ocf_check_file(struct ocf *ocf, const char *filename);
 char *_ocf_root_by_type(struct ocf *ocf, const char *type);
 char *_ocf_root_fullpath_by_type(struct ocf *ocf, const char *type);
@@ -268,10 +457,32 @@ int _ocf_parse_mimetype(struct ocf *ocf);
 
 // parsing opf
 struct opf *_opf_parse(struct epub *epub, char *opfStr);
+struct opf *_opf_parse_metadata_only(struct epub *epub, char *opfStr,
+                                     int size);
 void _opf_dump(struct opf *opf);
 void _opf_close(struct opf *opf);
 
 void _opf_parse_metadata(struct opf *opf, xmlTextReaderPtr reader);
+void _opf_init_metadata(struct opf *opf);
+void _opf_free_metadata(struct opf *opf, struct metadata *meta);
+void *_opf_alloc(struct opf *opf, size_t size);
+void _opf_build_indexes(struct opf *opf);
+
+// copies an attribute of a metadata element, the opf prefixed one if
+// opf is set
+typedef xmlChar *(*opfAttributeFunc)(void *source, const char *name, int opf);
+void _opf_add_metadata(struct opf *opf, const xmlChar *local,
+                       xmlChar *string, opfAttributeFunc attribute,
+                       void *source);
+int _meta_scan(struct opf *opf, const char *opfStr, int size);
+vectorPtr _opf_metadata_list(struct metadata *meta, enum epub_metadata type);
+void _opf_index_metadata(struct opf *opf);
+int _opf_metadata_by_id(struct opf *opf, const xmlChar *id,
+                        enum epub_metadata *type, int *index);
+int _opf_refinements(struct opf *opf, enum epub_metadata type, int index,
+                     int *first);
+struct meta *_opf_refinement(struct opf *opf, enum epub_metadata type,
+                             int index, const char *property);
 void _opf_parse_spine(struct opf *opf, xmlTextReaderPtr reader);
 void _opf_parse_manifest(struct opf *opf, xmlTextReaderPtr reader);
 void _opf_parse_guide(struct opf *opf, xmlTextReaderPtr reader);
@@ -283,19 +494,75 @@ void _opf_parse_navlist(struct opf *opf, xmlTextReaderPtr reader);
 void _opf_parse_navmap(struct opf *opf, xmlTextReaderPtr reader);
 void _opf_parse_pagelist(struct opf *opf, xmlTextReaderPtr reader);
 struct tocLabel *_opf_parse_navlabel(struct opf *opf, xmlTextReaderPtr reader);
-void _opf_free_toc_category(struct tocCategory *tc);
-void _opf_free_toc(struct toc *toc);
+void _opf_free_toc_category(struct opf *opf, struct tocCategory *tc);
+void _opf_free_toc(struct opf *opf, struct toc *toc);
 struct toc *_opf_init_toc();
 struct tocCategory *_opf_init_toc_category();
 
-xmlChar *_opf_label_get_by_lang(struct opf *opf, listPtr label, char *lang);
-xmlChar *_opf_label_get_by_doc_lang(struct opf *opf, listPtr label);
+// parsing the opf and toc with sax, in an arena
+struct opf *_sax_parse_opf(struct epub *epub, char *opfStr);
+
+xmlChar *_opf_label_get_by_lang(struct opf *opf, vectorPtr label, char *lang);
+xmlChar *_opf_label_get_by_doc_lang(struct opf *opf, vectorPtr label);
 
 struct manifest *_opf_manifest_get_by_id(struct opf *opf, xmlChar* id);
+struct manifest *_opf_manifest_get_by_href(struct opf *opf, const char *href);
+struct manifest *_opf_get_cover(struct opf *opf);
+char *_opf_link_path(struct opf *opf, const char *base, const char *link,
+                     int len);
+void _opf_build_spine_index(struct opf *opf);
+int _opf_spine_index_by_href(struct opf *opf, const char *href, int len);
+int _opf_spine_index_by_link(struct opf *opf, const char *base,
+                             const char *link, const char **fragment);
+
+// arena allocation
+struct arena *_arena_new(void);
+void *_arena_alloc(struct arena *arena, size_t size);
+xmlChar *_arena_strndup(struct arena *arena, const xmlChar *str, int len);
+void _arena_free(struct arena *arena);
+
+// flattened toc
+void _toc_build_flat(struct opf *opf);
+struct tocFlat *_toc_get_flat(struct opf *opf, enum titerator_type type);
+void _toc_free_flat(struct tocFlat *flat);
+void _toc_build_index(struct opf *opf);
+int _toc_entry_for_position(struct opf *opf, int spine, const char *fragment);
+void _toc_free_index(struct tocIndex *index);
+void _toc_build_page_index(struct opf *opf);
+const char *_toc_page_target(struct opf *opf, const char *label);
+const char *_toc_page_for_target(struct opf *opf, const char *link);
+void _toc_free_page_index(struct pageIndex *index);
+
+// text extraction
+void _text_init(struct textparser *p);
+void _text_new_document(struct textparser *p);
+int _text_parse(struct textparser *p, const char *in, int len, char *out);
+struct textdoc *_text_open(struct epub *epub, int index);
+zip_int64_t _text_read(struct textdoc *doc, char *buf, int len);
+void _text_close(struct textdoc *doc);
+
+// statistics and offsets
+int _stats_document(struct epub *epub, int index, char *in, char *out,
+                    struct epub_spine_stats *stats);
+void _offsets_free(struct offsetMap *map);
+
+// sort keys
+xmlChar *_collate_key(const xmlChar *str, const xmlChar *lang);
+void _collate_metadata(struct opf *opf);
+
+// cfis and fragments
+struct fragmentIndex *_cfi_fragments(struct epub *epub, int index);
+void _cfi_free_fragments(struct epub *epub);
 
 // epub functions
 struct epub *epub_open(const char *filename, int debug);
+char *_get_spine_url(struct epub *epub, int index);
+int _get_spine_it_next(vectorPtr spine, int curr, int linear, int init);
+int _get_spine_it_first(struct epub *epub, enum eiterator_type type);
+int _get_spine_it_step(struct epub *epub, enum eiterator_type type, int curr);
 void _epub_print_debug(struct epub *epub, int debug, const char *format, ...) PRINTF_FORMAT(3, 4);
+xmlTextReaderPtr _epub_reader_new(const char *buffer, int size, const char *url);
+void _epub_reader_free(xmlTextReaderPtr reader);
 char *epub_last_errStr(struct epub *epub);
 
 // List operations
@@ -305,19 +572,28 @@ void _list_free_creator(struct creator *data);
 void _list_free_date(struct date *date);
 void _list_free_id(struct id *id);
 void _list_free_meta(struct meta *meta);
+void _list_free_metadata_id(struct metadataId *id);
 
 void _list_free_spine(struct spine *spine);
 void _list_free_manifest(struct manifest *manifest);
 void _list_free_guide(struct guide *guide);
 void _list_free_tours(struct tour *tour);
+void _list_free_tour_sites(struct tour *tour);
 
 void _list_free_toc_label(struct tocLabel *tl);
 void _list_free_toc_item(struct tocItem *ti);
+void _list_free_toc_item_labels(struct tocItem *ti);
 
 int _list_cmp_root_by_mediatype(struct root *root1, struct root *root2);
 int _list_cmp_manifest_by_id(struct manifest *m1, struct manifest *m2);
 int _list_cmp_toc_by_playorder(struct tocItem *t1, struct tocItem *t2);
 int _list_cmp_label_by_lang(struct tocLabel *t1, struct tocLabel *t2);
+int _list_cmp_metadata_id_by_element(struct metadataId *id1,
+                                     struct metadataId *id2);
+int _list_cmp_metadata_id_by_id(struct metadataId *id1,
+                                struct metadataId *id2);
+int _list_cmp_meta_by_refines(struct meta *m1, struct meta *m2);
+const xmlChar *_list_meta_refines_id(struct meta *meta);
 
 void _list_dump_root(struct root *root);
 
@@ -0,0 +1,389 @@
+#include "epub.h"
+#include "epublib.h"
+
+// The end of a zip that its end of central directory record is looked
+// for in, the record plus the longest comment
+#define FETCH_TAIL_SIZE (22 + 65535)
+
+// Files less than this apart are read together, the bytes between them
+// costing less than another seek
+#define FETCH_GAP 65536
+
+// Reads of several files aren't made longer than this
+#define FETCH_MAX_READ (4 * 1024 * 1024)
+
+// The central directory, read when first needed, for the local header
+// offsets libzip doesn't tell
+struct fetchDirectory {
+  unsigned char *data;
+  int size;
+  int *records; // offsets of the records in data, by zip index
+  int count;
+};
+
+// A file asked for
+struct fetchItem {
+  int request; // its index in the names
+  zip_int64_t index;
+  long long offset; // of its local header, -1 if left to libzip
+  long long end; // of its data, as far as the central directory tells
+  long long compressedSize;
+  long long size;
+  int method;
+  unsigned long crc;
+};
+
+// Where the bytes come from
+struct fetchReader {
+  struct epub_io *io;
+  FILE *file;
+};
+
+static unsigned int _fetch_le16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long _fetch_le32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | ((unsigned long)p[2] << 16) |
+    ((unsigned long)p[3] << 24);
+}
+
+static long long _fetch_size(struct fetchReader *r) {
+  long size;
+
+  if (r->io)
+    return r->io->size(r->io->data);
+
+  if (fseek(r->file, 0, SEEK_END) != 0 || (size = ftell(r->file)) < 0)
+    return -1;
+  return size;
+}
+
+// Reads exactly length bytes at offset, returning 0 if it can't
+static int _fetch_read(struct fetchReader *r, long long offset,
+                       long long length, void *buf) {
+  if (r->io)
+    return (r->io->read_at(r->io->data, offset, length, buf) == length);
+
+  return (fseek(r->file, (long)offset, SEEK_SET) == 0 &&
+          fread(buf, 1, (size_t)length, r->file) == (size_t)length);
+}
+
+void _fetch_free_directory(struct fetchDirectory *dir) {
+  if (! dir)
+    return;
+
+  free(dir->data);
+  free(dir->records);
+  free(dir);
+}
+
+static struct fetchDirectory *_fetch_read_directory(struct epub *epub,
+                                                    struct fetchReader *r) {
+  struct fetchDirectory *dir;
+  unsigned char *tail = NULL, *eocd = NULL, *p;
+  long long size, tailSize, cdOffset = 0, cdSize = 0;
+  int entries = 0, i;
+
+  size = _fetch_size(r);
+  if (size < 22)
+    return NULL;
+
+  tailSize = (size < FETCH_TAIL_SIZE)?size:FETCH_TAIL_SIZE;
+  tail = malloc(tailSize);
+  if (! tail || ! _fetch_read(r, size - tailSize, tailSize, tail)) {
+    free(tail);
+    return NULL;
+  }
+
+  // the last record whose comment runs to the end
+  for (p = tail + tailSize - 22; p >= tail; p--)
+    if (_fetch_le32(p) == 0x06054b50 &&
+        p + 22 + _fetch_le16(p + 20) == tail + tailSize) {
+      eocd = p;
+      break;
+    }
+  if (eocd) {
+    entries = _fetch_le16(eocd + 10);
+    cdSize = _fetch_le32(eocd + 12);
+    cdOffset = _fetch_le32(eocd + 16);
+  }
+
+  // zip64 archives are left to libzip
+  dir = NULL;
+  if (eocd && entries != 0xFFFF && cdOffset != 0xFFFFFFFFL &&
+      cdOffset + cdSize <= size - (tail + tailSize - eocd) &&
+      (dir = malloc(sizeof(struct fetchDirectory)))) {
+    memset(dir, 0, sizeof(struct fetchDirectory));
+    dir->size = cdSize;
+    dir->data = malloc(cdSize + 1);
+    dir->records = malloc((entries + 1) * sizeof(int));
+    if (dir->data && dir->records) {
+      if (cdOffset >= size - tailSize)
+        memcpy(dir->data, tail + (cdOffset - (size - tailSize)), cdSize);
+      else if (! _fetch_read(r, cdOffset, cdSize, dir->data))
+        entries = -1;
+
+      for (i = 0, p = dir->data; i < entries; i++) {
+        if (p + 46 > dir->data + cdSize || _fetch_le32(p) != 0x02014b50)
+          break;
+        dir->records[i] = p - dir->data;
+        p += 46 + _fetch_le16(p + 28) + _fetch_le16(p + 30) +
+          _fetch_le16(p + 32);
+        if (p > dir->data + cdSize)
+          break;
+      }
+      dir->count = i;
+    }
+    if (! dir->data || ! dir->records || dir->count != entries) {
+      _fetch_free_directory(dir);
+      dir = NULL;
+    }
+  }
+  free(tail);
+
+  if (! dir)
+    _epub_print_debug(epub, DEBUG_INFO,
+                      "central directory not read, files left to libzip");
+  return dir;
+}
+
+// Sets the item's local header offset from the central directory if it
+// can be read without libzip
+static void _fetch_locate(struct ocf *ocf, struct fetchItem *item) {
+  struct fetchDirectory *dir = ocf->directory;
+  struct zip_stat st;
+  const unsigned char *p;
+  const char *name;
+  unsigned int nameLen;
+
+  item->offset = -1;
+  zip_stat_init(&st);
+  if (! dir || item->index >= dir->count ||
+      zip_stat_index(ocf->arch, item->index, 0, &st) == -1 ||
+      ! (st.valid & ZIP_STAT_SIZE) || ! (st.valid & ZIP_STAT_COMP_SIZE) ||
+      ! (st.valid & ZIP_STAT_COMP_METHOD) || ! (st.valid & ZIP_STAT_CRC) ||
+      ((st.valid & ZIP_STAT_ENCRYPTION_METHOD) && st.encryption_method != 0) ||
+      (st.comp_method != ZIP_CM_STORE && st.comp_method != ZIP_CM_DEFLATE) ||
+      st.size >= 0x7FFFFFFF)
+    return;
+
+  // the record must be the one libzip has under that index
+  p = dir->data + dir->records[item->index];
+  nameLen = _fetch_le16(p + 28);
+  name = zip_get_name(ocf->arch, item->index, 0);
+  if (! name || strlen(name) != nameLen || memcmp(name, p + 46, nameLen) ||
+      _fetch_le32(p + 20) != st.comp_size || _fetch_le32(p + 42) == 0xFFFFFFFFL)
+    return;
+
+  item->offset = _fetch_le32(p + 42);
+  item->end = item->offset + 30 + nameLen + _fetch_le16(p + 30) +
+    st.comp_size;
+  item->compressedSize = st.comp_size;
+  item->size = st.size;
+  item->method = st.comp_method;
+  item->crc = st.crc;
+}
+
+static int _fetch_cmp_items(const void *a, const void *b) {
+  const struct fetchItem *i1 = a, *i2 = b;
+
+  if (i1->offset != i2->offset)
+    return (i1->offset < i2->offset)?-1:1;
+  return i1->request - i2->request;
+}
+
+// Returns the item's bytes from the local header at buf, reading what
+// the buffer lacks, or NULL if they can't be had
+static char *_fetch_extract(struct fetchReader *r, struct fetchItem *item,
+                            const unsigned char *buf, long long bufSize) {
+  const unsigned char *data;
+  unsigned char *own = NULL;
+  long long start;
+  char *out;
+  z_stream s;
+  int ok;
+
+  if (bufSize < 30 || _fetch_le32(buf) != 0x04034b50)
+    return NULL;
+  start = 30 + _fetch_le16(buf + 26) + _fetch_le16(buf + 28);
+
+  // the local extra field can be longer than the central one
+  data = buf + start;
+  if (start + item->compressedSize > bufSize) {
+    own = malloc(item->compressedSize + 1);
+    if (! own || ! _fetch_read(r, item->offset + start,
+                               item->compressedSize, own)) {
+      free(own);
+      return NULL;
+    }
+    data = own;
+  }
+
+  out = malloc(item->size + 1);
+  if (! out) {
+    free(own);
+    return NULL;
+  }
+
+  if (item->method == ZIP_CM_STORE) {
+    ok = (item->compressedSize == item->size);
+    if (ok)
+      memcpy(out, data, item->size);
+  } else {
+    memset(&s, 0, sizeof(z_stream));
+    ok = (inflateInit2(&s, -MAX_WBITS) == Z_OK);
+    if (ok) {
+      s.next_in = (Bytef *)data;
+      s.avail_in = item->compressedSize;
+      s.next_out = (Bytef *)out;
+      s.avail_out = item->size;
+      ok = (inflate(&s, Z_FINISH) == Z_STREAM_END &&
+            s.total_out == (uLong)item->size);
+      inflateEnd(&s);
+    }
+  }
+  free(own);
+
+  if (! ok ||
+      crc32(crc32(0L, Z_NULL, 0), (Bytef *)out, item->size) != item->crc) {
+    free(out);
+    return NULL;
+  }
+
+  out[item->size] = 0;
+  return out;
+}
+
+int epub_fetch_many(struct epub *epub, const char **names, int count,
+                    epub_fetch_callback callback, void *data) {
+  struct fetchReader reader;
+  struct fetchItem *items;
+  struct epub_range *ranges;
+  struct epub_fetched file;
+  unsigned char *buf = NULL;
+  char *fullname;
+  int *runs;
+  int i, j, run, runCount = 0, fetched = 0, stop = 0;
+
+  if (!epub || !names || count < 0 || !callback) {
+    return -1;
+  }
+
+  items = malloc((count + 1) * sizeof(struct fetchItem));
+  runs = malloc((count + 1) * sizeof(int));
+  ranges = malloc((count + 1) * sizeof(struct epub_range));
+  if (!items || !runs || !ranges) {
+    _epub_err_set_oom(&epub->error);
+    free(items);
+    free(runs);
+    free(ranges);
+    return -1;
+  }
+
+  reader.io = epub->ocf->io;
+  reader.file = NULL;
+  if (! reader.io)
+    reader.file = fopen(epub->ocf->filename, "rb");
+  if (! epub->ocf->directory && (reader.io || reader.file))
+    epub->ocf->directory = _fetch_read_directory(epub, &reader);
+
+  for (i = 0; i < count; i++) {
+    items[i].request = i;
+    items[i].index = -1;
+    items[i].offset = -1;
+    fullname = names[i]?_ocf_data_name(epub->ocf, names[i]):NULL;
+    if (fullname)
+      items[i].index = zip_name_locate(epub->ocf->arch, fullname, 0);
+    free(fullname);
+    if (items[i].index >= 0)
+      _fetch_locate(epub->ocf, &items[i]);
+  }
+
+  // the files in the order they lie in, split into runs read at once;
+  // the ones left to libzip come last
+  qsort(items, count, sizeof(struct fetchItem), _fetch_cmp_items);
+  for (i = 0; i < count && items[i].offset < 0; i++)
+    ;
+  for (; i < count; i++) {
+    if (runCount > 0 &&
+        items[i].offset - ranges[runCount - 1].offset -
+        ranges[runCount - 1].length <= FETCH_GAP &&
+        items[i].end - ranges[runCount - 1].offset <= FETCH_MAX_READ) {
+      if (items[i].end > ranges[runCount - 1].offset +
+          ranges[runCount - 1].length)
+        ranges[runCount - 1].length = items[i].end -
+          ranges[runCount - 1].offset;
+      continue;
+    }
+    runs[runCount] = i;
+    ranges[runCount].offset = items[i].offset;
+    ranges[runCount].length = items[i].end - items[i].offset;
+    runCount++;
+  }
+  runs[runCount] = count;
+  _epub_print_debug(epub, DEBUG_INFO, "fetching %d files in %d reads",
+                    count, runCount);
+
+  if (reader.io && reader.io->prefetch && runCount > 0)
+    reader.io->prefetch(reader.io->data, ranges, runCount);
+
+  for (run = 0; run < runCount && ! stop; run++) {
+    buf = malloc(ranges[run].length + 1);
+    if (buf && ! _fetch_read(&reader, ranges[run].offset, ranges[run].length,
+                             buf)) {
+      free(buf);
+      buf = NULL;
+    }
+
+    for (j = runs[run]; j < runs[run + 1] && ! stop; j++) {
+      file.name = names[items[j].request];
+      file.index = items[j].request;
+      file.data = buf?_fetch_extract(&reader, &items[j],
+                                     buf + (items[j].offset -
+                                            ranges[run].offset),
+                                     ranges[run].offset +
+                                     ranges[run].length - items[j].offset):NULL;
+      file.size = items[j].size;
+      if (! file.data) {
+        _epub_print_debug(epub, DEBUG_INFO,
+                          "%s not read at once, left to libzip", file.name);
+        file.size = _ocf_get_data_file(epub->ocf, file.name,
+                                       (char **)&file.data);
+      }
+
+      if (file.data)
+        fetched++;
+      else
+        file.size = -1;
+      stop = callback(&file, data);
+      free((char *)file.data);
+    }
+    free(buf);
+  }
+
+  // the files libzip has to read
+  for (i = 0; i < count && items[i].offset < 0 && ! stop; i++) {
+    file.name = names[items[i].request];
+    file.index = items[i].request;
+    file.data = NULL;
+    file.size = -1;
+    if (items[i].index >= 0)
+      file.size = _ocf_get_data_file(epub->ocf, file.name,
+                                     (char **)&file.data);
+    if (file.data)
+      fetched++;
+    else
+      file.size = -1;
+    stop = callback(&file, data);
+    free((char *)file.data);
+  }
+
+  if (reader.file)
+    fclose(reader.file);
+  free(items);
+  free(runs);
+  free(ranges);
+
+  return fetched;
+}
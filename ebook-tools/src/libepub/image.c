@@ -0,0 +1,339 @@
+#include "epub.h"
+#include "epublib.h"
+
+// Bytes an image header is looked for in; jpeg segments before the
+// frame header are skipped rather than buffered
+#define IMAGE_READ_SIZE 4096
+
+// The beginning of an image file, read as far as the header needs
+struct imageReader {
+  struct zip_file *file;
+  unsigned char buf[IMAGE_READ_SIZE];
+  int len;
+  int pos;
+  int eof;
+};
+
+// Makes sure need bytes are buffered from pos on
+static int _image_fill(struct imageReader *r, int need) {
+  zip_int64_t size;
+
+  if (r->len - r->pos >= need)
+    return 1;
+
+  if (r->pos > 0) {
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+  }
+
+  while (! r->eof && r->len < need) {
+    size = zip_fread(r->file, r->buf + r->len, IMAGE_READ_SIZE - r->len);
+    if (size <= 0)
+      r->eof = 1;
+    else
+      r->len += size;
+  }
+
+  return (r->len >= need);
+}
+
+static int _image_skip(struct imageReader *r, int count) {
+  while (count > r->len - r->pos) {
+    count -= r->len - r->pos;
+    r->pos = r->len;
+    if (! _image_fill(r, 1))
+      return 0;
+  }
+  r->pos += count;
+
+  return 1;
+}
+
+static int _image_be16(const unsigned char *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static int _image_le16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static int _image_le24(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static long _image_be32(const unsigned char *p) {
+  return ((long)p[0] << 24) | ((long)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Walks the segments up to the frame header
+static int _image_jpeg(struct imageReader *r, int *width, int *height) {
+  unsigned char marker;
+  int len;
+
+  r->pos += 2;
+  for (;;) {
+    if (! _image_fill(r, 2) || r->buf[r->pos] != 0xFF)
+      return 0;
+
+    marker = r->buf[r->pos + 1];
+    if (marker == 0xFF) { // fill byte
+      r->pos++;
+      continue;
+    }
+    r->pos += 2;
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+      continue;
+    if (marker == 0xD9 || marker == 0xDA)
+      return 0;
+
+    if (! _image_fill(r, 2))
+      return 0;
+    len = _image_be16(r->buf + r->pos);
+
+    // start of frame, but not DHT, JPG and DAC
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+        marker != 0xC8 && marker != 0xCC) {
+      if (! _image_fill(r, 7))
+        return 0;
+      *height = _image_be16(r->buf + r->pos + 3);
+      *width = _image_be16(r->buf + r->pos + 5);
+      return 1;
+    }
+
+    if (len < 2 || ! _image_skip(r, len))
+      return 0;
+  }
+}
+
+static int _image_webp(struct imageReader *r, int *width, int *height) {
+  const unsigned char *p;
+
+  if (! _image_fill(r, 30))
+    return 0;
+  p = r->buf + r->pos;
+
+  if (memcmp(p + 12, "VP8X", 4) == 0) {
+    *width = _image_le24(p + 24) + 1;
+    *height = _image_le24(p + 27) + 1;
+  } else if (memcmp(p + 12, "VP8L", 4) == 0 && p[20] == 0x2F) {
+    *width = (p[21] | ((p[22] & 0x3F) << 8)) + 1;
+    *height = ((p[22] >> 6) | (p[23] << 2) | ((p[24] & 0x0F) << 10)) + 1;
+  } else if (memcmp(p + 12, "VP8 ", 4) == 0 &&
+             p[23] == 0x9D && p[24] == 0x01 && p[25] == 0x2A) {
+    *width = _image_le16(p + 26) & 0x3FFF;
+    *height = _image_le16(p + 28) & 0x3FFF;
+  } else {
+    return 0;
+  }
+
+  return 1;
+}
+
+// Returns the value of an svg length attribute in pixels or -1
+static int _image_svg_length(const char *tag, const char *name) {
+  const char *p = tag;
+  double value;
+  char *end;
+  int len = strlen(name);
+
+  while ((p = strstr(p, name))) {
+    if ((p == tag || p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n' ||
+         p[-1] == '\r') && p[len] == '=' &&
+        (p[len + 1] == '"' || p[len + 1] == '\''))
+      break;
+    p += len;
+  }
+  if (! p)
+    return -1;
+
+  value = strtod(p + len + 2, &end);
+  if (end == p + len + 2 || value <= 0)
+    return -1;
+
+  // css absolute units, relative ones are left to the viewBox
+  if (strncmp(end, "pt", 2) == 0)
+    value = value * 96 / 72;
+  else if (strncmp(end, "pc", 2) == 0)
+    value = value * 16;
+  else if (strncmp(end, "in", 2) == 0)
+    value = value * 96;
+  else if (strncmp(end, "cm", 2) == 0)
+    value = value * 96 / 2.54;
+  else if (strncmp(end, "mm", 2) == 0)
+    value = value * 96 / 25.4;
+  else if (*end != '"' && *end != '\'' && strncmp(end, "px", 2) != 0)
+    return -1;
+
+  return (int)(value + 0.5);
+}
+
+// Takes the size from the root element's width and height or viewBox
+static int _image_svg(struct imageReader *r, int *width, int *height) {
+  char *tag, *end, *box;
+  double w, h;
+
+  _image_fill(r, IMAGE_READ_SIZE);
+  r->buf[(r->len < IMAGE_READ_SIZE)?r->len:IMAGE_READ_SIZE - 1] = 0;
+
+  tag = (char *)r->buf;
+  while ((tag = strchr(tag, '<')) && strncmp(tag + 1, "svg", 3) != 0 &&
+         strncmp(tag + 1, "svg:svg", 7) != 0)
+    tag++;
+  if (! tag || ! (end = strchr(tag, '>')))
+    return 0;
+  *end = 0;
+
+  *width = _image_svg_length(tag, "width");
+  *height = _image_svg_length(tag, "height");
+  if (*width > 0 && *height > 0)
+    return 1;
+
+  box = strstr(tag, "viewBox=");
+  if (! box)
+    return 0;
+  // min-x, min-y, width and height, separated by spaces or commas
+  box += 9;
+  strtod(box, &box);
+  while (*box == ' ' || *box == ',')
+    box++;
+  strtod(box, &box);
+  while (*box == ' ' || *box == ',')
+    box++;
+  w = strtod(box, &box);
+  while (*box == ' ' || *box == ',')
+    box++;
+  h = strtod(box, &box);
+  if (w <= 0 || h <= 0)
+    return 0;
+
+  // keep the viewBox's aspect ratio if one length was given
+  if (*width > 0)
+    *height = (int)(*width * h / w + 0.5);
+  else if (*height > 0)
+    *width = (int)(*height * w / h + 0.5);
+  else {
+    *width = (int)(w + 0.5);
+    *height = (int)(h + 0.5);
+  }
+
+  return 1;
+}
+
+static int _image_info(struct epub *epub, const char *href, int *width,
+                       int *height, enum epub_image_format *format) {
+  struct imageReader *r;
+  const unsigned char *p;
+  int res = 0;
+
+  *width = -1;
+  *height = -1;
+  *format = EPUB_IMAGE_UNKNOWN;
+
+  r = malloc(sizeof(struct imageReader));
+  if (! r) {
+    _epub_err_set_oom(&epub->error);
+    return 0;
+  }
+  r->len = r->pos = r->eof = 0;
+  r->file = _ocf_open_data_file(epub->ocf, href);
+  if (! r->file) {
+    free(r);
+    return 0;
+  }
+
+  _image_fill(r, 32);
+  p = r->buf;
+  if (r->len >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF) {
+    *format = EPUB_IMAGE_JPEG;
+    res = _image_jpeg(r, width, height);
+  } else if (r->len >= 24 && memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0) {
+    *format = EPUB_IMAGE_PNG;
+    *width = (int)_image_be32(p + 16);
+    *height = (int)_image_be32(p + 20);
+    res = 1;
+  } else if (r->len >= 10 && (memcmp(p, "GIF87a", 6) == 0 ||
+                              memcmp(p, "GIF89a", 6) == 0)) {
+    *format = EPUB_IMAGE_GIF;
+    *width = _image_le16(p + 6);
+    *height = _image_le16(p + 8);
+    res = 1;
+  } else if (r->len >= 16 && memcmp(p, "RIFF", 4) == 0 &&
+             memcmp(p + 8, "WEBP", 4) == 0) {
+    *format = EPUB_IMAGE_WEBP;
+    res = _image_webp(r, width, height);
+  } else if (r->len > 0) {
+    res = _image_svg(r, width, height);
+    if (res)
+      *format = EPUB_IMAGE_SVG;
+  }
+
+  if (! res) {
+    *width = -1;
+    *height = -1;
+    _epub_print_debug(epub, DEBUG_INFO, "no image size found in %s", href);
+  }
+
+  zip_fclose(r->file);
+  free(r);
+  return res;
+}
+
+int epub_get_image_info(struct epub *epub, const char *href, int *width,
+                        int *height, enum epub_image_format *format) {
+  enum epub_image_format fmt;
+  int w, h, res;
+
+  if (!epub || !href) {
+    return 0;
+  }
+
+  res = _image_info(epub, href, &w, &h, &fmt);
+  if (width)
+    *width = w;
+  if (height)
+    *height = h;
+  if (format)
+    *format = fmt;
+
+  return res;
+}
+
+struct epub_image_info *epub_get_images_info(struct epub *epub, int *size) {
+  struct epub_image_info *infos;
+  struct manifest *item;
+  vectorPtr manifest;
+  int i, count = 0;
+
+  if (size)
+    *size = 0;
+
+  if (!epub) {
+    return NULL;
+  }
+
+  manifest = epub->opf->manifest;
+  infos = malloc(((manifest?manifest->Size:0) + 1) *
+                 sizeof(struct epub_image_info));
+  if (!infos) {
+    _epub_err_set_oom(&epub->error);
+    return NULL;
+  }
+
+  for (i = 0; manifest && i < manifest->Size; i++) {
+    item = GetItem(manifest, i);
+    if (! item || ! item->href || ! item->type ||
+        xmlStrncasecmp(item->type, (xmlChar *)"image/", 6) != 0)
+      continue;
+
+    infos[count].href = (const char *)item->href;
+    infos[count].mediaType = (const char *)item->type;
+    _image_info(epub, infos[count].href, &infos[count].width,
+                &infos[count].height, &infos[count].format);
+    count++;
+  }
+
+  if (size)
+    *size = count;
+  return infos;
+}
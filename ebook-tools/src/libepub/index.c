@@ -0,0 +1,958 @@
+#include "epub.h"
+#include "epublib.h"
+
+// The index file is a header, zlib compressed blocks of postings and
+// a zlib compressed dictionary. Numbers are little endian.
+//
+// header: "EPUBIDX1", u32 version, u32 terms, u32 blocks,
+//         u32 dictionary size, u64 dictionary offset,
+//         u64 compressed dictionary size
+// dictionary: per block u64 offset, u32 size, u32 raw size, then per
+//             term in byte order varints of the prefix shared with the
+//             previous term, the suffix length, the suffix, the block,
+//             the postings' offset and size in the raw block and their
+//             count
+// postings: per occurrence varints of the spine index delta, then the
+//           word position and text offset, as deltas within a spine
+#define INDEX_MAGIC "EPUBIDX1"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 40
+
+// Raw bytes of postings compressed together
+#define INDEX_BLOCK_SIZE 65536
+
+// Longer words are cut
+#define INDEX_TERM_MAX 64
+
+// Splits text into words, ascii lowercased, carrying a partial word
+// from one piece of text to the next
+struct indexTokenizer {
+  char word[INDEX_TERM_MAX];
+  int len;
+  int cut; // whether the word got too long
+  int start; // text offset of the word
+  unsigned char seq[4]; // the utf-8 character being read
+  int seqLen;
+  int seqNeed;
+  int seqStart;
+  void (*emit)(void *ctx, const char *word, int len, int offset);
+  void *ctx;
+};
+
+struct indexTerm {
+  char *term;
+  int len;
+  unsigned int hash;
+  unsigned char *postings;
+  int size;
+  int alloc;
+  int count;
+  int lastSpine;
+  int lastPosition;
+  int lastOffset;
+};
+
+struct indexBuilder {
+  struct epub *epub;
+  struct indexTerm **table; // open addressing by hash
+  int tableSize;
+  int termCount;
+  int spine;
+  int position;
+  int failed;
+};
+
+struct indexBlock {
+  unsigned long offset;
+  unsigned int size;
+  unsigned int rawSize;
+};
+
+struct indexEntry {
+  const char *term;
+  int len;
+  int block;
+  unsigned int offset;
+  unsigned int size;
+  int count;
+};
+
+struct epub_index {
+  FILE *file;
+  int termCount;
+  int blockCount;
+  struct indexBlock *blocks;
+  struct indexEntry *terms;
+  char *strings;
+  unsigned char *cache; // the last block read
+  int cacheBlock;
+  unsigned char *zbuf;
+  unsigned int zbufSize;
+};
+
+// An occurrence of a term
+struct indexPosting {
+  int spine;
+  int position;
+  int offset;
+};
+
+static int _index_put_varint(unsigned char *buf, unsigned long value) {
+  int len = 0;
+
+  while (value >= 0x80) {
+    buf[len++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  buf[len++] = (unsigned char)value;
+
+  return len;
+}
+
+// Reads a varint from [*pos, end), returns 0 if it is cut short
+static int _index_get_varint(const unsigned char **pos,
+                             const unsigned char *end, unsigned long *value) {
+  int shift = 0;
+
+  *value = 0;
+  while (*pos < end && shift < 35) {
+    unsigned char c = *(*pos)++;
+
+    *value |= (unsigned long)(c & 0x7F) << shift;
+    if (! (c & 0x80))
+      return 1;
+    shift += 7;
+  }
+
+  return 0;
+}
+
+static void _index_put_u32(unsigned char *buf, unsigned long value) {
+  buf[0] = (unsigned char)value;
+  buf[1] = (unsigned char)(value >> 8);
+  buf[2] = (unsigned char)(value >> 16);
+  buf[3] = (unsigned char)(value >> 24);
+}
+
+static unsigned long _index_get_u32(const unsigned char *buf) {
+  return (unsigned long)buf[0] | ((unsigned long)buf[1] << 8) |
+    ((unsigned long)buf[2] << 16) | ((unsigned long)buf[3] << 24);
+}
+
+static void _index_put_u64(unsigned char *buf, unsigned long value) {
+  _index_put_u32(buf, value & 0xFFFFFFFFUL);
+  _index_put_u32(buf + 4, (value >> 16) >> 16);
+}
+
+static unsigned long _index_get_u64(const unsigned char *buf) {
+  return _index_get_u32(buf) | ((_index_get_u32(buf + 4) << 16) << 16);
+}
+
+// Whether a non ascii character separates words
+static int _index_is_separator(unsigned long c) {
+  return ((c >= 0x80 && c <= 0xBF) || c == 0xD7 || c == 0xF7 ||
+          (c >= 0x2000 && c <= 0x206F) || (c >= 0x2E00 && c <= 0x2E7F) ||
+          (c >= 0x3000 && c <= 0x303F) || c == 0xFEFF);
+}
+
+static void _index_tok_flush(struct indexTokenizer *tok) {
+  if (tok->len > 0)
+    tok->emit(tok->ctx, tok->word, tok->len, tok->start);
+  tok->len = 0;
+  tok->cut = 0;
+}
+
+static void _index_tok_append(struct indexTokenizer *tok, const char *bytes,
+                              int len, int offset) {
+  if (tok->len == 0)
+    tok->start = offset;
+
+  // the rest of a long word is dropped, cut at a character
+  if (tok->cut || tok->len + len > INDEX_TERM_MAX) {
+    tok->cut = 1;
+    return;
+  }
+
+  memcpy(tok->word + tok->len, bytes, len);
+  tok->len += len;
+}
+
+static void _index_tok_init(struct indexTokenizer *tok,
+                            void (*emit)(void *, const char *, int, int),
+                            void *ctx) {
+  memset(tok, 0, sizeof(struct indexTokenizer));
+  tok->emit = emit;
+  tok->ctx = ctx;
+}
+
+// Splits a piece of text starting at text offset base
+static void _index_tokenize(struct indexTokenizer *tok, const char *text,
+                            int len, int base) {
+  int i;
+
+  for (i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)text[i];
+
+    if (tok->seqNeed) {
+      if ((c & 0xC0) == 0x80) {
+        tok->seq[tok->seqLen++] = c;
+        if (tok->seqLen == tok->seqNeed) {
+          unsigned long code = tok->seq[0] & (0x7F >> tok->seqNeed);
+          int j;
+
+          for (j = 1; j < tok->seqLen; j++)
+            code = (code << 6) | (tok->seq[j] & 0x3F);
+
+          if (_index_is_separator(code))
+            _index_tok_flush(tok);
+          else
+            _index_tok_append(tok, (char *)tok->seq, tok->seqLen,
+                              tok->seqStart);
+          tok->seqNeed = 0;
+        }
+        continue;
+      }
+      // a broken character separates words
+      tok->seqNeed = 0;
+      _index_tok_flush(tok);
+    }
+
+    if (c < 0x80) {
+      if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+        _index_tok_append(tok, (char *)&c, 1, base + i);
+      } else if (c >= 'A' && c <= 'Z') {
+        c = c - 'A' + 'a';
+        _index_tok_append(tok, (char *)&c, 1, base + i);
+      } else {
+        _index_tok_flush(tok);
+      }
+    } else if (c >= 0xC2 && c <= 0xF4) {
+      tok->seq[0] = c;
+      tok->seqLen = 1;
+      tok->seqNeed = (c >= 0xF0)?4:(c >= 0xE0)?3:2;
+      tok->seqStart = base + i;
+    } else {
+      _index_tok_flush(tok);
+    }
+  }
+}
+
+// Ends the text, emitting the last word
+static void _index_tok_end(struct indexTokenizer *tok) {
+  tok->seqNeed = 0;
+  _index_tok_flush(tok);
+}
+
+static unsigned int _index_hash(const char *term, int len) {
+  unsigned int hash = 2166136261U;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char)term[i];
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+static int _index_grow_table(struct indexBuilder *b) {
+  struct indexTerm **table;
+  int size = b->tableSize?b->tableSize * 2:1024;
+  int i, slot;
+
+  table = calloc(size, sizeof(struct indexTerm *));
+  if (! table)
+    return 0;
+
+  for (i = 0; i < b->tableSize; i++) {
+    if (! b->table[i])
+      continue;
+    slot = b->table[i]->hash & (size - 1);
+    while (table[slot])
+      slot = (slot + 1) & (size - 1);
+    table[slot] = b->table[i];
+  }
+
+  free(b->table);
+  b->table = table;
+  b->tableSize = size;
+  return 1;
+}
+
+static struct indexTerm *_index_get_term(struct indexBuilder *b,
+                                         const char *term, int len) {
+  unsigned int hash = _index_hash(term, len);
+  struct indexTerm *t;
+  int slot;
+
+  if (b->termCount * 2 >= b->tableSize && ! _index_grow_table(b))
+    return NULL;
+
+  slot = hash & (b->tableSize - 1);
+  while ((t = b->table[slot])) {
+    if (t->hash == hash && t->len == len && memcmp(t->term, term, len) == 0)
+      return t;
+    slot = (slot + 1) & (b->tableSize - 1);
+  }
+
+  t = calloc(1, sizeof(struct indexTerm));
+  if (! t)
+    return NULL;
+  t->term = malloc(len);
+  if (! t->term) {
+    free(t);
+    return NULL;
+  }
+  memcpy(t->term, term, len);
+  t->len = len;
+  t->hash = hash;
+
+  b->table[slot] = t;
+  b->termCount++;
+  return t;
+}
+
+static void _index_add(void *ctx, const char *word, int len, int offset) {
+  struct indexBuilder *b = ctx;
+  struct indexTerm *t;
+  unsigned char *pos;
+
+  if (b->failed)
+    return;
+
+  t = _index_get_term(b, word, len);
+  if (t && t->size + 15 > t->alloc) {
+    int alloc = t->alloc?t->alloc * 2:16;
+    unsigned char *postings = realloc(t->postings, alloc);
+
+    if (postings) {
+      t->postings = postings;
+      t->alloc = alloc;
+    } else {
+      t = NULL;
+    }
+  }
+  if (! t) {
+    b->failed = 1;
+    return;
+  }
+
+  pos = t->postings + t->size;
+  if (b->spine != t->lastSpine) {
+    pos += _index_put_varint(pos, b->spine - t->lastSpine);
+    t->lastPosition = 0;
+    t->lastOffset = 0;
+  } else {
+    pos += _index_put_varint(pos, 0);
+  }
+  pos += _index_put_varint(pos, b->position - t->lastPosition);
+  pos += _index_put_varint(pos, offset - t->lastOffset);
+  t->size = pos - t->postings;
+
+  t->lastSpine = b->spine;
+  t->lastPosition = b->position;
+  t->lastOffset = offset;
+  t->count++;
+  b->position++;
+}
+
+static int _index_cmp_terms(const void *a, const void *b) {
+  const struct indexTerm *t1 = *(struct indexTerm * const *)a;
+  const struct indexTerm *t2 = *(struct indexTerm * const *)b;
+  int res = memcmp(t1->term, t2->term, (t1->len < t2->len)?t1->len:t2->len);
+
+  return res?res:t1->len - t2->len;
+}
+
+// Compresses and writes a block of postings, returns 0 on failure
+static int _index_write_block(FILE *file, const unsigned char *raw,
+                              unsigned int rawSize, struct indexBlock *block) {
+  uLongf size = compressBound(rawSize);
+  unsigned char *buf = malloc(size);
+  int ret;
+
+  if (! buf)
+    return 0;
+
+  block->offset = ftell(file);
+  block->rawSize = rawSize;
+  ret = (compress2(buf, &size, raw, rawSize, Z_BEST_SPEED) == Z_OK &&
+         fwrite(buf, 1, size, file) == size);
+  block->size = size;
+
+  free(buf);
+  return ret;
+}
+
+// Writes the sorted terms' postings and dictionary
+static int _index_write(struct indexBuilder *b, struct indexTerm **terms,
+                        FILE *file) {
+  unsigned char header[INDEX_HEADER_SIZE];
+  struct indexBlock *blocks = NULL;
+  unsigned char *raw = NULL, *dict = NULL, *zdict = NULL, *pos;
+  unsigned int rawSize = 0;
+  int *termBlock = NULL;
+  unsigned int *termOffset = NULL;
+  int blockCount = 0, i, j, ok = 0;
+  unsigned long dictSize, dictOffset;
+  uLongf zdictSize;
+
+  memset(header, 0, INDEX_HEADER_SIZE);
+  if (fwrite(header, 1, INDEX_HEADER_SIZE, file) != INDEX_HEADER_SIZE)
+    return 0;
+
+  // at most one block per term, and one for the small ones in between
+  blocks = malloc((2 * b->termCount + 1) * sizeof(struct indexBlock));
+  raw = malloc(INDEX_BLOCK_SIZE);
+  termBlock = malloc((b->termCount + 1) * sizeof(int));
+  termOffset = malloc((b->termCount + 1) * sizeof(unsigned int));
+  if (! blocks || ! raw || ! termBlock || ! termOffset)
+    goto out;
+
+  for (i = 0; i < b->termCount; i++) {
+    struct indexTerm *t = terms[i];
+
+    if (rawSize > 0 && rawSize + t->size > INDEX_BLOCK_SIZE) {
+      if (! _index_write_block(file, raw, rawSize, &blocks[blockCount++]))
+        goto out;
+      rawSize = 0;
+    }
+
+    if (t->size > INDEX_BLOCK_SIZE) {
+      // large postings get a block of their own
+      termBlock[i] = blockCount;
+      termOffset[i] = 0;
+      if (! _index_write_block(file, t->postings, t->size,
+                               &blocks[blockCount++]))
+        goto out;
+    } else {
+      termBlock[i] = blockCount;
+      termOffset[i] = rawSize;
+      memcpy(raw + rawSize, t->postings, t->size);
+      rawSize += t->size;
+    }
+  }
+  if (rawSize > 0 &&
+      ! _index_write_block(file, raw, rawSize, &blocks[blockCount++]))
+    goto out;
+
+  // varints of a term take at most 5 bytes each
+  dictSize = blockCount * 16;
+  for (i = 0; i < b->termCount; i++)
+    dictSize += terms[i]->len + 30;
+  dict = malloc(dictSize);
+  if (! dict)
+    goto out;
+
+  pos = dict;
+  for (i = 0; i < blockCount; i++) {
+    _index_put_u64(pos, blocks[i].offset);
+    _index_put_u32(pos + 8, blocks[i].size);
+    _index_put_u32(pos + 12, blocks[i].rawSize);
+    pos += 16;
+  }
+  for (i = 0; i < b->termCount; i++) {
+    struct indexTerm *t = terms[i];
+    int prefix = 0;
+
+    if (i > 0)
+      for (j = (t->len < terms[i - 1]->len)?t->len:terms[i - 1]->len;
+           prefix < j && t->term[prefix] == terms[i - 1]->term[prefix];
+           prefix++)
+        ;
+
+    pos += _index_put_varint(pos, prefix);
+    pos += _index_put_varint(pos, t->len - prefix);
+    memcpy(pos, t->term + prefix, t->len - prefix);
+    pos += t->len - prefix;
+    pos += _index_put_varint(pos, termBlock[i]);
+    pos += _index_put_varint(pos, termOffset[i]);
+    pos += _index_put_varint(pos, t->size);
+    pos += _index_put_varint(pos, t->count);
+  }
+  dictSize = pos - dict;
+
+  zdictSize = compressBound(dictSize);
+  zdict = malloc(zdictSize);
+  if (! zdict ||
+      compress2(zdict, &zdictSize, dict, dictSize, Z_BEST_SPEED) != Z_OK)
+    goto out;
+
+  dictOffset = ftell(file);
+  if (fwrite(zdict, 1, zdictSize, file) != zdictSize)
+    goto out;
+
+  memcpy(header, INDEX_MAGIC, 8);
+  _index_put_u32(header + 8, INDEX_VERSION);
+  _index_put_u32(header + 12, b->termCount);
+  _index_put_u32(header + 16, blockCount);
+  _index_put_u32(header + 20, dictSize);
+  _index_put_u64(header + 24, dictOffset);
+  _index_put_u64(header + 32, zdictSize);
+  if (fseek(file, 0, SEEK_SET) == 0 &&
+      fwrite(header, 1, INDEX_HEADER_SIZE, file) == INDEX_HEADER_SIZE)
+    ok = 1;
+
+ out:
+  free(blocks);
+  free(raw);
+  free(termBlock);
+  free(termOffset);
+  free(dict);
+  free(zdict);
+  return ok;
+}
+
+static void _index_free_builder(struct indexBuilder *b) {
+  int i;
+
+  for (i = 0; i < b->tableSize; i++) {
+    if (b->table[i]) {
+      free(b->table[i]->term);
+      free(b->table[i]->postings);
+      free(b->table[i]);
+    }
+  }
+  free(b->table);
+}
+
+int epub_index_build(struct epub *epub, const char *filename) {
+  struct indexBuilder b;
+  struct indexTokenizer tok;
+  struct textiterator *it;
+  struct indexTerm **terms = NULL;
+  const char *text;
+  char *name = NULL;
+  FILE *file = NULL;
+  int len, base = 0, i, j, ret = -1;
+
+  if (!epub) {
+    return -1;
+  }
+
+  memset(&b, 0, sizeof(struct indexBuilder));
+  b.epub = epub;
+  b.spine = -1;
+  _index_tok_init(&tok, _index_add, &b);
+
+  it = epub_get_text_iterator(epub, EITERATOR_SPINE, 0);
+  if (! it)
+    return -1;
+
+  while ((text = epub_text_it_next(it, &len))) {
+    int spine = epub_text_it_get_curr_index(it);
+
+    if (spine != b.spine) {
+      _index_tok_end(&tok);
+      b.spine = spine;
+      b.position = 0;
+      base = 0;
+    }
+    _index_tokenize(&tok, text, len, base);
+    base += len;
+  }
+  _index_tok_end(&tok);
+  epub_free_text_iterator(it);
+
+  if (b.failed) {
+    _epub_err_set_oom(&epub->error);
+    goto out;
+  }
+
+  terms = malloc((b.termCount + 1) * sizeof(struct indexTerm *));
+  if (! terms) {
+    _epub_err_set_oom(&epub->error);
+    goto out;
+  }
+  for (i = 0, j = 0; i < b.tableSize; i++)
+    if (b.table[i])
+      terms[j++] = b.table[i];
+  qsort(terms, b.termCount, sizeof(struct indexTerm *), _index_cmp_terms);
+
+  if (! filename) {
+    name = malloc(strlen(epub->ocf->filename) + 5);
+    if (! name) {
+      _epub_err_set_oom(&epub->error);
+      goto out;
+    }
+    strcpy(name, epub->ocf->filename);
+    strcat(name, ".idx");
+    filename = name;
+  }
+
+  file = fopen(filename, "wb");
+  if (! file) {
+    _epub_print_debug(epub, DEBUG_ERROR, "%s - %s", filename, strerror(errno));
+    goto out;
+  }
+
+  if (_index_write(&b, terms, file))
+    ret = b.termCount;
+  else
+    _epub_print_debug(epub, DEBUG_ERROR, "failed writing index %s", filename);
+
+  if (fclose(file) != 0)
+    ret = -1;
+  if (ret < 0)
+    remove(filename);
+  else
+    _epub_print_debug(epub, DEBUG_INFO, "indexed %d terms into %s",
+                      b.termCount, filename);
+
+ out:
+  free(name);
+  free(terms);
+  _index_free_builder(&b);
+  return ret;
+}
+
+// Reads and checks the dictionary, returns 0 if it is broken
+static int _index_read_dict(struct epub_index *index,
+                            const unsigned char *dict, unsigned long size) {
+  const unsigned char *pos = dict, *end = dict + size, *terms;
+  unsigned long strings = 0, last = 0, prefix, suffix, value;
+  char *str;
+  int i, j;
+
+  if (size < (unsigned long)index->blockCount * 16)
+    return 0;
+
+  for (i = 0; i < index->blockCount; i++) {
+    index->blocks[i].offset = _index_get_u64(pos);
+    index->blocks[i].size = _index_get_u32(pos + 8);
+    index->blocks[i].rawSize = _index_get_u32(pos + 12);
+    if (index->blocks[i].size > index->zbufSize)
+      index->zbufSize = index->blocks[i].size;
+    pos += 16;
+  }
+
+  // front coding lets the terms take more than the dictionary, so a
+  // first pass checks their lengths and adds them up
+  terms = pos;
+  for (i = 0; i < index->termCount; i++) {
+    if (! _index_get_varint(&pos, end, &prefix) ||
+        ! _index_get_varint(&pos, end, &suffix) ||
+        suffix > (unsigned long)(end - pos) ||
+        prefix > last || prefix + suffix > INDEX_TERM_MAX)
+      return 0;
+    pos += suffix;
+    last = prefix + suffix;
+    strings += last;
+
+    // block, offset, size and count
+    for (j = 0; j < 4; j++)
+      if (! _index_get_varint(&pos, end, &value))
+        return 0;
+  }
+
+  index->strings = malloc(strings + 1);
+  if (! index->strings)
+    return 0;
+
+  pos = terms;
+  str = index->strings;
+  for (i = 0; i < index->termCount; i++) {
+    struct indexEntry *entry = &index->terms[i];
+
+    _index_get_varint(&pos, end, &prefix);
+    _index_get_varint(&pos, end, &suffix);
+    if (prefix > 0)
+      memcpy(str, index->terms[i - 1].term, prefix);
+    memcpy(str + prefix, pos, suffix);
+    pos += suffix;
+    entry->term = str;
+    entry->len = prefix + suffix;
+    str += entry->len;
+
+    _index_get_varint(&pos, end, &value);
+    if (value >= (unsigned long)index->blockCount)
+      return 0;
+    entry->block = value;
+    _index_get_varint(&pos, end, &value);
+    entry->offset = value;
+    _index_get_varint(&pos, end, &value);
+    if (entry->offset + value > index->blocks[entry->block].rawSize)
+      return 0;
+    entry->size = value;
+    _index_get_varint(&pos, end, &value);
+    entry->count = value;
+  }
+
+  return 1;
+}
+
+struct epub_index *epub_index_open(const char *filename) {
+  struct epub_index *index;
+  unsigned char header[INDEX_HEADER_SIZE];
+  unsigned char *zdict = NULL, *dict = NULL;
+  unsigned long dictOffset;
+  uLongf dictSize, zdictSize;
+  int ok = 0;
+
+  if (!filename) {
+    return NULL;
+  }
+
+  index = calloc(1, sizeof(struct epub_index));
+  if (! index)
+    return NULL;
+  index->cacheBlock = -1;
+
+  index->file = fopen(filename, "rb");
+  if (! index->file ||
+      fread(header, 1, INDEX_HEADER_SIZE, index->file) != INDEX_HEADER_SIZE ||
+      memcmp(header, INDEX_MAGIC, 8) != 0 ||
+      _index_get_u32(header + 8) != INDEX_VERSION)
+    goto out;
+
+  index->termCount = _index_get_u32(header + 12);
+  index->blockCount = _index_get_u32(header + 16);
+  dictSize = _index_get_u32(header + 20);
+  dictOffset = _index_get_u64(header + 24);
+  zdictSize = _index_get_u64(header + 32);
+  if (index->termCount < 0 || index->blockCount < 0)
+    goto out;
+
+  index->blocks = malloc((index->blockCount + 1) * sizeof(struct indexBlock));
+  index->terms = malloc((index->termCount + 1) * sizeof(struct indexEntry));
+  zdict = malloc(zdictSize + 1);
+  dict = malloc(dictSize + 1);
+  if (! index->blocks || ! index->terms || ! zdict || ! dict)
+    goto out;
+
+  if (fseek(index->file, dictOffset, SEEK_SET) != 0 ||
+      fread(zdict, 1, zdictSize, index->file) != zdictSize ||
+      uncompress(dict, &dictSize, zdict, zdictSize) != Z_OK ||
+      ! _index_read_dict(index, dict, dictSize))
+    goto out;
+
+  index->zbuf = malloc(index->zbufSize + 1);
+  if (index->zbuf)
+    ok = 1;
+
+ out:
+  free(zdict);
+  free(dict);
+  if (! ok) {
+    epub_index_close(index);
+    return NULL;
+  }
+
+  return index;
+}
+
+void epub_index_close(struct epub_index *index) {
+  if (!index) {
+    return;
+  }
+
+  if (index->file)
+    fclose(index->file);
+  free(index->blocks);
+  free(index->terms);
+  free(index->strings);
+  free(index->cache);
+  free(index->zbuf);
+  free(index);
+}
+
+static struct indexEntry *_index_find(struct epub_index *index,
+                                      const char *term, int len) {
+  int low = 0, high = index->termCount - 1, mid, res;
+  struct indexEntry *entry;
+
+  while (low <= high) {
+    mid = (low + high) / 2;
+    entry = &index->terms[mid];
+    res = memcmp(entry->term, term, (entry->len < len)?entry->len:len);
+    if (! res)
+      res = entry->len - len;
+    if (res == 0)
+      return entry;
+    if (res < 0)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+
+  return NULL;
+}
+
+// Returns the raw block, reading it unless it was the last one read
+static unsigned char *_index_read_block(struct epub_index *index, int i) {
+  struct indexBlock *block = &index->blocks[i];
+  uLongf size = block->rawSize;
+  unsigned char *raw;
+
+  if (index->cacheBlock == i)
+    return index->cache;
+
+  raw = realloc(index->cache, block->rawSize + 1);
+  if (! raw)
+    return NULL;
+  index->cache = raw;
+  index->cacheBlock = -1;
+
+  if (fseek(index->file, block->offset, SEEK_SET) != 0 ||
+      fread(index->zbuf, 1, block->size, index->file) != block->size ||
+      uncompress(raw, &size, index->zbuf, block->size) != Z_OK ||
+      size != block->rawSize)
+    return NULL;
+
+  index->cacheBlock = i;
+  return raw;
+}
+
+// Decodes a term's postings, returns how many or -1
+static int _index_postings(struct epub_index *index, struct indexEntry *entry,
+                           struct indexPosting **postings) {
+  const unsigned char *pos, *end;
+  struct indexPosting *list, last = {0, 0, 0};
+  unsigned long spine, position, offset;
+  unsigned char *raw;
+  int i;
+
+  *postings = NULL;
+  raw = _index_read_block(index, entry->block);
+  if (! raw)
+    return -1;
+
+  list = malloc((entry->count + 1) * sizeof(struct indexPosting));
+  if (! list)
+    return -1;
+
+  pos = raw + entry->offset;
+  end = pos + entry->size;
+  for (i = 0; i < entry->count; i++) {
+    if (! _index_get_varint(&pos, end, &spine) ||
+        ! _index_get_varint(&pos, end, &position) ||
+        ! _index_get_varint(&pos, end, &offset)) {
+      free(list);
+      return -1;
+    }
+
+    if (spine) {
+      last.spine += spine;
+      last.position = 0;
+      last.offset = 0;
+    }
+    last.position += position;
+    last.offset += offset;
+    list[i] = last;
+  }
+
+  *postings = list;
+  return entry->count;
+}
+
+// Collects the words of a query
+struct indexQuery {
+  char *words;
+  int *lens;
+  int count;
+  int size;
+};
+
+static void _index_query_word(void *ctx, const char *word, int len,
+                              int offset) {
+  struct indexQuery *q = ctx;
+
+  (void)offset;
+  memcpy(q->words + q->size, word, len);
+  q->lens[q->count] = len;
+  q->size += len;
+  q->count++;
+}
+
+int epub_index_query(struct epub_index *index, const char *query,
+                     epub_index_callback callback, void *data) {
+  struct indexTokenizer tok;
+  struct indexQuery q;
+  struct indexPosting **lists = NULL;
+  int *sizes = NULL, *next = NULL;
+  int qlen, i, k, hits = 0, ret = -1;
+  const char *word;
+
+  if (!index || !query || !callback) {
+    return -1;
+  }
+
+  qlen = strlen(query);
+  memset(&q, 0, sizeof(struct indexQuery));
+  q.words = malloc(qlen + 1);
+  q.lens = malloc((qlen + 1) * sizeof(int));
+  if (! q.words || ! q.lens)
+    goto out;
+
+  _index_tok_init(&tok, _index_query_word, &q);
+  _index_tokenize(&tok, query, qlen, 0);
+  _index_tok_end(&tok);
+  if (q.count == 0) {
+    ret = 0;
+    goto out;
+  }
+
+  lists = calloc(q.count, sizeof(struct indexPosting *));
+  sizes = calloc(q.count, sizeof(int));
+  next = calloc(q.count, sizeof(int));
+  if (! lists || ! sizes || ! next)
+    goto out;
+
+  for (i = 0, word = q.words; i < q.count; word += q.lens[i], i++) {
+    struct indexEntry *entry = _index_find(index, word, q.lens[i]);
+
+    if (! entry) {
+      ret = 0;
+      goto out;
+    }
+    sizes[i] = _index_postings(index, entry, &lists[i]);
+    if (sizes[i] < 0)
+      goto out;
+  }
+
+  // a phrase is where the words follow each other in one document
+  for (i = 0; i < sizes[0]; i++) {
+    struct indexPosting *first = &lists[0][i];
+    struct epub_index_hit hit;
+
+    for (k = 1; k < q.count; k++) {
+      struct indexPosting *p;
+
+      while (next[k] < sizes[k]) {
+        p = &lists[k][next[k]];
+        if (p->spine > first->spine ||
+            (p->spine == first->spine && p->position >= first->position + k))
+          break;
+        next[k]++;
+      }
+      if (next[k] == sizes[k])
+        break;
+      p = &lists[k][next[k]];
+      if (p->spine != first->spine || p->position != first->position + k)
+        break;
+    }
+    if (k < q.count)
+      continue;
+
+    hit.spine = first->spine;
+    hit.position = first->position;
+    hit.offset = first->offset;
+    hit.length = (q.count > 1)?lists[q.count - 1][next[q.count - 1]].offset +
+      q.lens[q.count - 1] - first->offset:q.lens[0];
+    hits++;
+    if (callback(&hit, data))
+      break;
+  }
+  ret = hits;
+
+ out:
+  if (lists)
+    for (i = 0; i < q.count; i++)
+      free(lists[i]);
+  free(lists);
+  free(sizes);
+  free(next);
+  free(q.words);
+  free(q.lens);
+  return ret;
+}
@@ -0,0 +1,294 @@
+#include "epub.h"
+#include "epublib.h"
+
+// Reads smaller than this fetch this much, so that a file's local
+// header, its data and its neighbours usually come in one request
+#define IO_BLOCK_SIZE 65536
+
+// The end of a zip that its end of central directory record is looked
+// for in, the record plus the longest comment
+#define IO_TAIL_SIZE (22 + 65535)
+
+// A libzip source reading through an epub_io
+struct ioSource {
+  struct epub_io io;
+  zip_int64_t size; // -1 until asked for
+  zip_uint64_t offset;
+
+  // the bytes last fetched in a block, and the end of the zip once read
+  unsigned char *block;
+  zip_uint64_t blockOffset;
+  zip_int64_t blockLength;
+  unsigned char *tail;
+  zip_uint64_t tailOffset;
+  zip_int64_t tailLength;
+
+  zip_error_t error;
+};
+
+// The file backend
+struct ioFile {
+  struct epub_io io;
+  FILE *file;
+  int requests;
+  long long bytes;
+};
+
+static zip_int64_t _io_size(struct ioSource *src) {
+  if (src->size < 0) {
+    src->size = src->io.size(src->io.data);
+    if (src->size < 0)
+      zip_error_set(&src->error, ZIP_ER_READ, 0);
+  }
+
+  return src->size;
+}
+
+// Copies what buf has of the bytes from offset on to out
+static zip_uint64_t _io_cached(const unsigned char *buf, zip_uint64_t bufOffset,
+                               zip_int64_t bufLength, zip_uint64_t offset,
+                               unsigned char *out, zip_uint64_t len) {
+  if (! buf || offset < bufOffset ||
+      offset >= bufOffset + (zip_uint64_t)bufLength)
+    return 0;
+
+  if (len > bufOffset + bufLength - offset)
+    len = bufOffset + bufLength - offset;
+  memcpy(out, buf + (offset - bufOffset), len);
+
+  return len;
+}
+
+static zip_int64_t _io_read(struct ioSource *src, unsigned char *buf,
+                            zip_uint64_t len) {
+  zip_uint64_t done = 0, n;
+  zip_int64_t size;
+
+  if ((zip_int64_t)src->offset >= src->size)
+    return 0;
+  if (len > (zip_uint64_t)src->size - src->offset)
+    len = src->size - src->offset;
+
+  while (done < len) {
+    n = _io_cached(src->block, src->blockOffset, src->blockLength,
+                   src->offset, buf + done, len - done);
+    if (! n)
+      n = _io_cached(src->tail, src->tailOffset, src->tailLength,
+                     src->offset, buf + done, len - done);
+    if (n) {
+      done += n;
+      src->offset += n;
+      continue;
+    }
+
+    // large reads go straight to buf, the one reaching the end being
+    // kept for the files stored there
+    if (len - done >= IO_BLOCK_SIZE) {
+      size = src->io.read_at(src->io.data, src->offset, len - done,
+                             buf + done);
+      if (size <= 0)
+        break;
+      if (src->offset + size == (zip_uint64_t)src->size && ! src->tail &&
+          (src->tail = malloc(size))) {
+        memcpy(src->tail, buf + done, size);
+        src->tailOffset = src->offset;
+        src->tailLength = size;
+      }
+      done += size;
+      src->offset += size;
+      continue;
+    }
+
+    if (! src->block && ! (src->block = malloc(IO_BLOCK_SIZE))) {
+      zip_error_set(&src->error, ZIP_ER_MEMORY, 0);
+      return -1;
+    }
+    size = src->size - src->offset;
+    if (size > IO_BLOCK_SIZE)
+      size = IO_BLOCK_SIZE;
+    if (src->tail && src->offset < src->tailOffset &&
+        (zip_int64_t)(src->tailOffset - src->offset) < size)
+      size = src->tailOffset - src->offset;
+    src->blockOffset = src->offset;
+    src->blockLength = src->io.read_at(src->io.data, src->offset, size,
+                                       src->block);
+    if (src->blockLength <= 0) {
+      size = src->blockLength;
+      src->blockLength = 0;
+      break;
+    }
+  }
+
+  if (done < len && size < 0) {
+    zip_error_set(&src->error, ZIP_ER_READ, 0);
+    return -1;
+  }
+
+  return done;
+}
+
+static zip_int64_t _io_callback(void *state, void *data, zip_uint64_t len,
+                                zip_source_cmd_t cmd) {
+  struct ioSource *src = state;
+  struct epub_range tail;
+  zip_stat_t *st;
+  zip_int64_t offset;
+
+  switch (cmd) {
+  case ZIP_SOURCE_OPEN:
+    if (_io_size(src) < 0)
+      return -1;
+    src->offset = 0;
+
+    // libzip starts with the end of central directory
+    if (src->io.prefetch) {
+      tail.length = (src->size < IO_TAIL_SIZE)?src->size:IO_TAIL_SIZE;
+      tail.offset = src->size - tail.length;
+      src->io.prefetch(src->io.data, &tail, 1);
+    }
+    return 0;
+
+  case ZIP_SOURCE_READ:
+    return _io_read(src, data, len);
+
+  case ZIP_SOURCE_CLOSE:
+    return 0;
+
+  case ZIP_SOURCE_STAT:
+    if (len < sizeof(zip_stat_t) || _io_size(src) < 0)
+      return -1;
+    st = data;
+    zip_stat_init(st);
+    st->size = src->size;
+    st->valid |= ZIP_STAT_SIZE;
+    return sizeof(zip_stat_t);
+
+  case ZIP_SOURCE_ERROR:
+    return zip_error_to_data(&src->error, data, len);
+
+  case ZIP_SOURCE_FREE:
+    free(src->block);
+    free(src->tail);
+    zip_error_fini(&src->error);
+    free(src);
+    return 0;
+
+  case ZIP_SOURCE_SEEK:
+    offset = zip_source_seek_compute_offset(src->offset, src->size, data,
+                                            len, &src->error);
+    if (offset < 0)
+      return -1;
+    src->offset = offset;
+    return 0;
+
+  case ZIP_SOURCE_TELL:
+    return src->offset;
+
+  case ZIP_SOURCE_SUPPORTS:
+    return zip_source_make_command_bitmap(ZIP_SOURCE_OPEN, ZIP_SOURCE_READ,
+                                          ZIP_SOURCE_CLOSE, ZIP_SOURCE_STAT,
+                                          ZIP_SOURCE_ERROR, ZIP_SOURCE_FREE,
+                                          ZIP_SOURCE_SEEK, ZIP_SOURCE_TELL,
+                                          ZIP_SOURCE_SUPPORTS, -1);
+
+  default:
+    zip_error_set(&src->error, ZIP_ER_OPNOTSUPP, 0);
+    return -1;
+  }
+}
+
+zip_source_t *_io_source_new(const struct epub_io *io, zip_error_t *error) {
+  struct ioSource *src;
+  zip_source_t *source;
+
+  src = malloc(sizeof(struct ioSource));
+  if (! src) {
+    zip_error_set(error, ZIP_ER_MEMORY, 0);
+    return NULL;
+  }
+  memset(src, 0, sizeof(struct ioSource));
+  src->io = *io;
+  src->size = -1;
+  zip_error_init(&src->error);
+
+  source = zip_source_function_create(_io_callback, src, error);
+  if (! source) {
+    zip_error_fini(&src->error);
+    free(src);
+  }
+
+  return source;
+}
+
+static long long _io_file_size(void *data) {
+  struct ioFile *f = data;
+  long size;
+
+  if (fseek(f->file, 0, SEEK_END) != 0 || (size = ftell(f->file)) < 0)
+    return -1;
+
+  return size;
+}
+
+static long long _io_file_read_at(void *data, long long offset,
+                                  long long length, void *buf) {
+  struct ioFile *f = data;
+  size_t size;
+
+  if (fseek(f->file, (long)offset, SEEK_SET) != 0)
+    return -1;
+  size = fread(buf, 1, (size_t)length, f->file);
+  if (size < (size_t)length && ferror(f->file))
+    return -1;
+
+  f->requests++;
+  f->bytes += size;
+  return size;
+}
+
+struct epub_io *epub_io_file_new(const char *filename) {
+  struct ioFile *f;
+
+  if (!filename) {
+    return NULL;
+  }
+
+  f = malloc(sizeof(struct ioFile));
+  if (!f) {
+    return NULL;
+  }
+  memset(f, 0, sizeof(struct ioFile));
+
+  f->file = fopen(filename, "rb");
+  if (!f->file) {
+    free(f);
+    return NULL;
+  }
+  f->io.size = _io_file_size;
+  f->io.read_at = _io_file_read_at;
+  f->io.data = f;
+
+  return &f->io;
+}
+
+void epub_io_file_counts(struct epub_io *io, int *requests,
+                         long long *bytes) {
+  struct ioFile *f = io?io->data:NULL;
+
+  if (requests)
+    *requests = f?f->requests:0;
+  if (bytes)
+    *bytes = f?f->bytes:0;
+}
+
+void epub_io_file_free(struct epub_io *io) {
+  struct ioFile *f;
+
+  if (!io) {
+    return;
+  }
+
+  f = io->data;
+  fclose(f->file);
+  free(f);
+}
@@ -0,0 +1,1186 @@
+#include "epub.h"
+#include "epublib.h"
+
+// A saved library is "EPUBLIB2", u32 documents and per document its
+// name, its u32 date and its title and creator sort keys, each string
+// as its u32 length plus one (0 for none) and its bytes, then u32
+// facets and per facet its u32 type, u32 values and per value its u32
+// length, the value and its bitmap. A bitmap is u32 containers
+// and per container u32 key, u32 cardinality and either cardinality
+// u16 values or the u64 words of its bits. Numbers are little endian.
+#define LIBRARY_MAGIC "EPUBLIB2"
+
+// A container holds the ids sharing their upper 16 bits, as a sorted
+// array while there are few of them and as a bitset once there are more
+#define BITMAP_ARRAY_MAX 4096
+#define BITMAP_WORDS 1024
+
+// The metadata a library indexes
+#define LIBRARY_FACETS 4
+static const enum epub_metadata _library_facet_types[LIBRARY_FACETS] = {
+  EPUB_LANG, EPUB_SUBJECT, EPUB_PUBLISHER, EPUB_CREATOR
+};
+
+struct bitmapContainer {
+  unsigned int key;
+  int cardinality;
+  int alloc; // slots of the array
+  unsigned short *array;
+  unsigned long long *words;
+};
+
+struct epub_bitmap {
+  struct bitmapContainer *containers; // sorted by key
+  int count;
+  int alloc;
+};
+
+struct libraryValue {
+  char *value;
+  struct epub_bitmap *docs;
+};
+
+struct libraryFacet {
+  struct libraryValue *values; // sorted by value
+  int count;
+  int alloc;
+};
+
+struct libraryDate {
+  long date;
+  int doc;
+};
+
+struct libraryDoc {
+  char *name;
+  long date; // yyyymmdd or -1
+  xmlChar *titleKey;
+  xmlChar *creatorKey;
+};
+
+struct epub_library {
+  struct libraryDoc *docs;
+  int count;
+  int alloc;
+  struct libraryFacet facets[LIBRARY_FACETS];
+
+  // the documents with a date sorted by it, built when first queried
+  struct libraryDate *byDate;
+  int byDateCount;
+};
+
+static int _bitmap_popcount(unsigned long long word) {
+#ifdef __GNUC__
+  return __builtin_popcountll(word);
+#else
+  int count = 0;
+
+  for (; word; count++)
+    word &= word - 1;
+  return count;
+#endif
+}
+
+static struct epub_bitmap *_bitmap_new() {
+  return calloc(1, sizeof(struct epub_bitmap));
+}
+
+static void _bitmap_free_container(struct bitmapContainer *c) {
+  free(c->array);
+  free(c->words);
+}
+
+// Turns an array container into a bitset one
+static int _bitmap_to_words(struct bitmapContainer *c) {
+  int i;
+
+  c->words = calloc(BITMAP_WORDS, sizeof(unsigned long long));
+  if (! c->words)
+    return 0;
+
+  for (i = 0; i < c->cardinality; i++)
+    c->words[c->array[i] >> 6] |= 1ULL << (c->array[i] & 63);
+  free(c->array);
+  c->array = NULL;
+
+  return 1;
+}
+
+// Turns a bitset container into an array one
+static int _bitmap_to_array(struct bitmapContainer *c) {
+  unsigned long long word;
+  int i, n = 0;
+
+  c->alloc = c->cardinality + 1;
+  c->array = malloc(c->alloc * sizeof(unsigned short));
+  if (! c->array)
+    return 0;
+
+  for (i = 0; i < BITMAP_WORDS; i++)
+    for (word = c->words[i]; word; word &= word - 1) {
+      int bit = 0;
+
+      while (! (word & (1ULL << bit)))
+        bit++;
+      c->array[n++] = (unsigned short)(i * 64 + bit);
+    }
+  free(c->words);
+  c->words = NULL;
+
+  return 1;
+}
+
+// Appends a container, taking over its array or words
+static int _bitmap_append(struct epub_bitmap *b, struct bitmapContainer *c) {
+  struct bitmapContainer *tmp;
+
+  if (b->count == b->alloc) {
+    tmp = realloc(b->containers, (b->alloc * 2 + 4) *
+                  sizeof(struct bitmapContainer));
+    if (! tmp)
+      return 0;
+    b->containers = tmp;
+    b->alloc = b->alloc * 2 + 4;
+  }
+  b->containers[b->count++] = *c;
+
+  return 1;
+}
+
+static struct bitmapContainer *_bitmap_get_container(struct epub_bitmap *b,
+                                                     unsigned int key) {
+  struct bitmapContainer c;
+  int low = 0, high = b->count, mid;
+
+  // ids mostly come in increasing order
+  if (b->count > 0 && b->containers[b->count - 1].key < key)
+    low = b->count;
+
+  while (low < high) {
+    mid = (low + high) / 2;
+    if (b->containers[mid].key < key)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if (low < b->count && b->containers[low].key == key)
+    return &b->containers[low];
+
+  memset(&c, 0, sizeof(struct bitmapContainer));
+  c.key = key;
+  if (! _bitmap_append(b, &c))
+    return NULL;
+  memmove(&b->containers[low + 1], &b->containers[low],
+          (b->count - 1 - low) * sizeof(struct bitmapContainer));
+  b->containers[low] = c;
+
+  return &b->containers[low];
+}
+
+static int _bitmap_add(struct epub_bitmap *b, int id) {
+  struct bitmapContainer *c = _bitmap_get_container(b, (unsigned int)id >> 16);
+  unsigned short value = id & 0xFFFF, *tmp;
+  int low, high, mid;
+
+  if (! c)
+    return 0;
+
+  if (c->words) {
+    if (! (c->words[value >> 6] & (1ULL << (value & 63)))) {
+      c->words[value >> 6] |= 1ULL << (value & 63);
+      c->cardinality++;
+    }
+    return 1;
+  }
+
+  low = 0;
+  high = c->cardinality;
+  if (c->cardinality > 0 && c->array[c->cardinality - 1] < value)
+    low = high;
+  while (low < high) {
+    mid = (low + high) / 2;
+    if (c->array[mid] < value)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if (low < c->cardinality && c->array[low] == value)
+    return 1;
+
+  if (c->cardinality == BITMAP_ARRAY_MAX) {
+    if (! _bitmap_to_words(c))
+      return 0;
+    c->words[value >> 6] |= 1ULL << (value & 63);
+    c->cardinality++;
+    return 1;
+  }
+
+  if (c->cardinality == c->alloc) {
+    tmp = realloc(c->array, (c->alloc * 2 + 4) * sizeof(unsigned short));
+    if (! tmp)
+      return 0;
+    c->array = tmp;
+    c->alloc = c->alloc * 2 + 4;
+  }
+  memmove(&c->array[low + 1], &c->array[low],
+          (c->cardinality - low) * sizeof(unsigned short));
+  c->array[low] = value;
+  c->cardinality++;
+
+  return 1;
+}
+
+static int _bitmap_and_container(struct bitmapContainer *a,
+                                 struct bitmapContainer *b,
+                                 struct bitmapContainer *out) {
+  int i, j, n = 0;
+
+  memset(out, 0, sizeof(struct bitmapContainer));
+  out->key = a->key;
+
+  if (a->words && b->words) {
+    out->words = malloc(BITMAP_WORDS * sizeof(unsigned long long));
+    if (! out->words)
+      return 0;
+    for (i = 0; i < BITMAP_WORDS; i++) {
+      out->words[i] = a->words[i] & b->words[i];
+      n += _bitmap_popcount(out->words[i]);
+    }
+    out->cardinality = n;
+    return (n > BITMAP_ARRAY_MAX || _bitmap_to_array(out));
+  }
+
+  out->alloc = ((a->cardinality < b->cardinality)?
+                a->cardinality:b->cardinality) + 1;
+  out->array = malloc(out->alloc * sizeof(unsigned short));
+  if (! out->array)
+    return 0;
+
+  if (a->words || b->words) {
+    struct bitmapContainer *arr = a->words?b:a, *set = a->words?a:b;
+
+    for (i = 0; i < arr->cardinality; i++)
+      if (set->words[arr->array[i] >> 6] & (1ULL << (arr->array[i] & 63)))
+        out->array[n++] = arr->array[i];
+  } else {
+    for (i = j = 0; i < a->cardinality && j < b->cardinality; ) {
+      if (a->array[i] < b->array[j])
+        i++;
+      else if (a->array[i] > b->array[j])
+        j++;
+      else {
+        out->array[n++] = a->array[i];
+        i++;
+        j++;
+      }
+    }
+  }
+  out->cardinality = n;
+
+  return 1;
+}
+
+static int _bitmap_or_container(struct bitmapContainer *a,
+                                struct bitmapContainer *b,
+                                struct bitmapContainer *out) {
+  int i, j, n = 0;
+
+  memset(out, 0, sizeof(struct bitmapContainer));
+  out->key = a->key;
+
+  if (! a->words && ! b->words &&
+      a->cardinality + b->cardinality <= BITMAP_ARRAY_MAX) {
+    out->alloc = a->cardinality + b->cardinality + 1;
+    out->array = malloc(out->alloc * sizeof(unsigned short));
+    if (! out->array)
+      return 0;
+    for (i = j = 0; i < a->cardinality || j < b->cardinality; ) {
+      if (j == b->cardinality ||
+          (i < a->cardinality && a->array[i] < b->array[j]))
+        out->array[n++] = a->array[i++];
+      else if (i == a->cardinality || a->array[i] > b->array[j])
+        out->array[n++] = b->array[j++];
+      else {
+        out->array[n++] = a->array[i];
+        i++;
+        j++;
+      }
+    }
+    out->cardinality = n;
+    return 1;
+  }
+
+  out->words = calloc(BITMAP_WORDS, sizeof(unsigned long long));
+  if (! out->words)
+    return 0;
+  for (j = 0; j < 2; j++) {
+    struct bitmapContainer *c = j?b:a;
+
+    if (c->words)
+      for (i = 0; i < BITMAP_WORDS; i++)
+        out->words[i] |= c->words[i];
+    else
+      for (i = 0; i < c->cardinality; i++)
+        out->words[c->array[i] >> 6] |= 1ULL << (c->array[i] & 63);
+  }
+  for (i = 0; i < BITMAP_WORDS; i++)
+    n += _bitmap_popcount(out->words[i]);
+  out->cardinality = n;
+
+  return (n > BITMAP_ARRAY_MAX || _bitmap_to_array(out));
+}
+
+static int _bitmap_copy_container(struct bitmapContainer *c,
+                                  struct bitmapContainer *out) {
+  *out = *c;
+  if (c->words) {
+    out->words = malloc(BITMAP_WORDS * sizeof(unsigned long long));
+    if (! out->words)
+      return 0;
+    memcpy(out->words, c->words, BITMAP_WORDS * sizeof(unsigned long long));
+  } else {
+    out->alloc = c->cardinality + 1;
+    out->array = malloc(out->alloc * sizeof(unsigned short));
+    if (! out->array)
+      return 0;
+    memcpy(out->array, c->array, c->cardinality * sizeof(unsigned short));
+  }
+
+  return 1;
+}
+
+static struct epub_bitmap *_bitmap_copy(struct epub_bitmap *b) {
+  struct epub_bitmap *copy = _bitmap_new();
+  struct bitmapContainer c;
+  int i;
+
+  for (i = 0; copy && i < b->count; i++) {
+    if (! _bitmap_copy_container(&b->containers[i], &c) ||
+        ! _bitmap_append(copy, &c)) {
+      _bitmap_free_container(&c);
+      epub_bitmap_free(copy);
+      return NULL;
+    }
+  }
+
+  return copy;
+}
+
+struct epub_bitmap *epub_bitmap_and(struct epub_bitmap *a,
+                                    struct epub_bitmap *b) {
+  struct epub_bitmap *res;
+  struct bitmapContainer c;
+  int i = 0, j = 0;
+
+  if (!a || !b) {
+    return NULL;
+  }
+
+  res = _bitmap_new();
+  while (res && i < a->count && j < b->count) {
+    if (a->containers[i].key < b->containers[j].key) {
+      i++;
+    } else if (a->containers[i].key > b->containers[j].key) {
+      j++;
+    } else {
+      if (! _bitmap_and_container(&a->containers[i], &b->containers[j], &c) ||
+          (c.cardinality > 0 && ! _bitmap_append(res, &c))) {
+        _bitmap_free_container(&c);
+        epub_bitmap_free(res);
+        return NULL;
+      }
+      if (c.cardinality == 0)
+        _bitmap_free_container(&c);
+      i++;
+      j++;
+    }
+  }
+
+  return res;
+}
+
+struct epub_bitmap *epub_bitmap_or(struct epub_bitmap *a,
+                                   struct epub_bitmap *b) {
+  struct epub_bitmap *res;
+  struct bitmapContainer c;
+  int i = 0, j = 0, ok;
+
+  if (!a || !b) {
+    return NULL;
+  }
+
+  res = _bitmap_new();
+  while (res && (i < a->count || j < b->count)) {
+    if (j == b->count ||
+        (i < a->count && a->containers[i].key < b->containers[j].key))
+      ok = _bitmap_copy_container(&a->containers[i++], &c);
+    else if (i == a->count || a->containers[i].key > b->containers[j].key)
+      ok = _bitmap_copy_container(&b->containers[j++], &c);
+    else
+      ok = _bitmap_or_container(&a->containers[i++], &b->containers[j++], &c);
+
+    if (! ok || ! _bitmap_append(res, &c)) {
+      _bitmap_free_container(&c);
+      epub_bitmap_free(res);
+      return NULL;
+    }
+  }
+
+  return res;
+}
+
+int epub_bitmap_count(struct epub_bitmap *bitmap) {
+  int i, count = 0;
+
+  if (!bitmap) {
+    return 0;
+  }
+
+  for (i = 0; i < bitmap->count; i++)
+    count += bitmap->containers[i].cardinality;
+
+  return count;
+}
+
+int *epub_bitmap_ids(struct epub_bitmap *bitmap, int *size) {
+  struct bitmapContainer *c;
+  unsigned long long word;
+  int *ids, i, j, n = 0;
+
+  if (size)
+    *size = 0;
+
+  if (!bitmap) {
+    return NULL;
+  }
+
+  ids = malloc((epub_bitmap_count(bitmap) + 1) * sizeof(int));
+  if (!ids) {
+    return NULL;
+  }
+
+  for (i = 0; i < bitmap->count; i++) {
+    c = &bitmap->containers[i];
+    if (! c->words) {
+      for (j = 0; j < c->cardinality; j++)
+        ids[n++] = (int)(c->key << 16) | c->array[j];
+      continue;
+    }
+    for (j = 0; j < BITMAP_WORDS; j++)
+      for (word = c->words[j]; word; word &= word - 1) {
+        int bit = 0;
+
+        while (! (word & (1ULL << bit)))
+          bit++;
+        ids[n++] = (int)(c->key << 16) | (j * 64 + bit);
+      }
+  }
+
+  if (size)
+    *size = n;
+  return ids;
+}
+
+void epub_bitmap_free(struct epub_bitmap *bitmap) {
+  int i;
+
+  if (!bitmap) {
+    return;
+  }
+
+  for (i = 0; i < bitmap->count; i++)
+    _bitmap_free_container(&bitmap->containers[i]);
+  free(bitmap->containers);
+  free(bitmap);
+}
+
+// Returns yyyymmdd of a date like 2001, 2001-05 or 2001-05-03T..., the
+// missing parts being filled with fill, or -1 if it isn't one
+static long _library_date(const char *date, int fill) {
+  long year = 0, month = fill, day = fill;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    if (date[i] < '0' || date[i] > '9')
+      return -1;
+    year = year * 10 + date[i] - '0';
+  }
+  if (date[4] == '-' && date[5] >= '0' && date[5] <= '9' &&
+      date[6] >= '0' && date[6] <= '9') {
+    month = (date[5] - '0') * 10 + date[6] - '0';
+    if (date[7] == '-' && date[8] >= '0' && date[8] <= '9' &&
+        date[9] >= '0' && date[9] <= '9')
+      day = (date[8] - '0') * 10 + date[9] - '0';
+  }
+
+  return year * 10000 + month * 100 + day;
+}
+
+static int _library_facet(enum epub_metadata type) {
+  int i;
+
+  for (i = 0; i < LIBRARY_FACETS; i++)
+    if (_library_facet_types[i] == type)
+      return i;
+
+  return -1;
+}
+
+// Returns the index of the value in the facet, or where it would go
+static int _library_find(struct libraryFacet *facet, const char *value,
+                         int *found) {
+  int low = 0, high = facet->count, mid, cmp;
+
+  *found = 0;
+  while (low < high) {
+    mid = (low + high) / 2;
+    cmp = strcmp(facet->values[mid].value, value);
+    if (cmp == 0) {
+      *found = 1;
+      return mid;
+    }
+    if (cmp < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+static int _library_add_value(struct libraryFacet *facet, const char *value,
+                              int doc) {
+  struct libraryValue *tmp;
+  int i, found;
+
+  i = _library_find(facet, value, &found);
+  if (! found) {
+    if (facet->count == facet->alloc) {
+      tmp = realloc(facet->values, (facet->alloc * 2 + 16) *
+                    sizeof(struct libraryValue));
+      if (! tmp)
+        return 0;
+      facet->values = tmp;
+      facet->alloc = facet->alloc * 2 + 16;
+    }
+    memmove(&facet->values[i + 1], &facet->values[i],
+            (facet->count - i) * sizeof(struct libraryValue));
+    facet->values[i].value = strdup(value);
+    facet->values[i].docs = _bitmap_new();
+    facet->count++;
+    if (! facet->values[i].value || ! facet->values[i].docs)
+      return 0;
+  }
+
+  return _bitmap_add(facet->values[i].docs, doc);
+}
+
+struct epub_library *epub_library_new() {
+  return calloc(1, sizeof(struct epub_library));
+}
+
+void epub_library_free(struct epub_library *library) {
+  int i, j;
+
+  if (!library) {
+    return;
+  }
+
+  for (i = 0; i < library->count; i++) {
+    free(library->docs[i].name);
+    free(library->docs[i].titleKey);
+    free(library->docs[i].creatorKey);
+  }
+  free(library->docs);
+  for (i = 0; i < LIBRARY_FACETS; i++) {
+    for (j = 0; j < library->facets[i].count; j++) {
+      free(library->facets[i].values[j].value);
+      epub_bitmap_free(library->facets[i].values[j].docs);
+    }
+    free(library->facets[i].values);
+  }
+  free(library->byDate);
+  free(library);
+}
+
+// Adds a document, returning its id or -1
+static int _library_new_doc(struct epub_library *library, const char *name,
+                            long date, const xmlChar *titleKey,
+                            const xmlChar *creatorKey) {
+  struct libraryDoc *doc;
+
+  if (library->count == library->alloc) {
+    doc = realloc(library->docs, (library->alloc * 2 + 16) *
+                  sizeof(struct libraryDoc));
+    if (! doc)
+      return -1;
+    library->docs = doc;
+    library->alloc = library->alloc * 2 + 16;
+  }
+
+  doc = &library->docs[library->count];
+  doc->name = name?strdup(name):NULL;
+  doc->date = date;
+  doc->titleKey = titleKey?xmlStrdup(titleKey):NULL;
+  doc->creatorKey = creatorKey?xmlStrdup(creatorKey):NULL;
+  if ((name && ! doc->name) || (titleKey && ! doc->titleKey) ||
+      (creatorKey && ! doc->creatorKey)) {
+    free(doc->name);
+    free(doc->titleKey);
+    free(doc->creatorKey);
+    return -1;
+  }
+
+  free(library->byDate);
+  library->byDate = NULL;
+
+  return library->count++;
+}
+
+int epub_library_add(struct epub_library *library, struct epub *epub,
+                     const char *name) {
+  struct metadata *meta;
+  struct date *date = NULL, *tmp;
+  vectorPtr list;
+  void *item;
+  int doc, i, j;
+
+  if (!library || !epub || !epub->opf) {
+    return -1;
+  }
+
+  // the publication date, or the first if none is marked as it
+  meta = epub->opf->metadata;
+  for (i = 0; meta && i < meta->date->Size; i++) {
+    tmp = GetItem(meta->date, i);
+    if (! tmp->date)
+      continue;
+    if (! date)
+      date = tmp;
+    if (tmp->event &&
+        xmlStrcasecmp(tmp->event, (xmlChar *)"publication") == 0) {
+      date = tmp;
+      break;
+    }
+  }
+
+  doc = _library_new_doc(library, name,
+                         date?_library_date((char *)date->date, 0):-1,
+                         meta?meta->titleKey:NULL,
+                         meta?meta->creatorKey:NULL);
+  if (doc < 0) {
+    _epub_err_set_oom(&epub->error);
+    return -1;
+  }
+
+  for (i = 0; meta && i < LIBRARY_FACETS; i++) {
+    list = _opf_metadata_list(meta, _library_facet_types[i]);
+    for (j = 0; j < list->Size; j++) {
+      item = GetItem(list, j);
+      if (_library_facet_types[i] == EPUB_CREATOR)
+        item = ((struct creator *)item)->name;
+      if (! item)
+        continue;
+
+      if (! _library_add_value(&library->facets[i], item, doc)) {
+        _epub_err_set_oom(&epub->error);
+        return -1;
+      }
+    }
+  }
+
+  return doc;
+}
+
+int epub_library_add_file(struct epub_library *library,
+                          const char *filename) {
+  struct epub *epub;
+  int doc;
+
+  if (!library || !filename) {
+    return -1;
+  }
+
+  epub = epub_open_metadata(filename, 0);
+  if (!epub) {
+    return -1;
+  }
+
+  doc = epub_library_add(library, epub, filename);
+  epub_close(epub);
+
+  return doc;
+}
+
+int epub_library_count(struct epub_library *library) {
+  return (library?library->count:0);
+}
+
+const char *epub_library_get_name(struct epub_library *library, int id) {
+  if (!library || id < 0 || id >= library->count) {
+    return NULL;
+  }
+
+  return library->docs[id].name;
+}
+
+const unsigned char *epub_library_get_sort_key(struct epub_library *library,
+                                               int id,
+                                               enum epub_metadata type,
+                                               int *size) {
+  xmlChar *key = NULL;
+
+  if (size)
+    *size = 0;
+
+  if (!library || id < 0 || id >= library->count) {
+    return NULL;
+  }
+
+  if (type == EPUB_TITLE)
+    key = library->docs[id].titleKey;
+  else if (type == EPUB_CREATOR)
+    key = library->docs[id].creatorKey;
+
+  if (key && size)
+    *size = xmlStrlen(key);
+  return key;
+}
+
+struct librarySortItem {
+  const xmlChar *key;
+  int id;
+};
+
+// Orders by key, the ones without last, then by id
+static int _library_cmp_sort_items(const void *a, const void *b) {
+  const struct librarySortItem *i1 = a, *i2 = b;
+  int cmp;
+
+  if (i1->key && i2->key)
+    cmp = strcmp((char *)i1->key, (char *)i2->key);
+  else
+    cmp = (i1->key != NULL) - (i2->key != NULL);
+  if (cmp != 0)
+    return (i1->key && i2->key)?cmp:-cmp;
+
+  return i1->id - i2->id;
+}
+
+int epub_library_sort(struct epub_library *library, enum epub_metadata type,
+                      int *ids, int size) {
+  struct librarySortItem *items;
+  int i;
+
+  if (!library || !ids || size < 0 ||
+      (type != EPUB_TITLE && type != EPUB_CREATOR)) {
+    return 0;
+  }
+
+  items = malloc((size + 1) * sizeof(struct librarySortItem));
+  if (!items) {
+    return 0;
+  }
+
+  for (i = 0; i < size; i++) {
+    if (ids[i] < 0 || ids[i] >= library->count) {
+      free(items);
+      return 0;
+    }
+    items[i].key = epub_library_get_sort_key(library, ids[i], type, NULL);
+    items[i].id = ids[i];
+  }
+  qsort(items, size, sizeof(struct librarySortItem), _library_cmp_sort_items);
+  for (i = 0; i < size; i++)
+    ids[i] = items[i].id;
+  free(items);
+
+  return 1;
+}
+
+int epub_library_value_count(struct epub_library *library,
+                             enum epub_metadata type) {
+  int facet = _library_facet(type);
+
+  if (!library || facet < 0) {
+    return 0;
+  }
+
+  return library->facets[facet].count;
+}
+
+const char *epub_library_get_value(struct epub_library *library,
+                                   enum epub_metadata type, int index,
+                                   int *docs) {
+  int facet = _library_facet(type);
+
+  if (!library || facet < 0 || index < 0 ||
+      index >= library->facets[facet].count) {
+    return NULL;
+  }
+
+  if (docs)
+    *docs = epub_bitmap_count(library->facets[facet].values[index].docs);
+  return library->facets[facet].values[index].value;
+}
+
+struct epub_bitmap *epub_library_lookup(struct epub_library *library,
+                                        enum epub_metadata type,
+                                        const char *value) {
+  int facet = _library_facet(type), i, found;
+
+  if (!library || !value || facet < 0) {
+    return NULL;
+  }
+
+  i = _library_find(&library->facets[facet], value, &found);
+  if (! found)
+    return _bitmap_new();
+
+  return _bitmap_copy(library->facets[facet].values[i].docs);
+}
+
+static int _library_cmp_dates(const void *a, const void *b) {
+  const struct libraryDate *d1 = a, *d2 = b;
+
+  if (d1->date != d2->date)
+    return (d1->date < d2->date)?-1:1;
+  return d1->doc - d2->doc;
+}
+
+static int _library_cmp_ids(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+struct epub_bitmap *epub_library_date_range(struct epub_library *library,
+                                            const char *from,
+                                            const char *to) {
+  struct epub_bitmap *res;
+  long low = 0, high = 99999999;
+  int first, last, mid, i, *ids;
+
+  if (!library) {
+    return NULL;
+  }
+
+  if ((from && (low = _library_date(from, 0)) < 0) ||
+      (to && (high = _library_date(to, 99)) < 0)) {
+    return NULL;
+  }
+
+  if (! library->byDate) {
+    library->byDate = malloc((library->count + 1) *
+                             sizeof(struct libraryDate));
+    if (! library->byDate)
+      return NULL;
+    library->byDateCount = 0;
+    for (i = 0; i < library->count; i++) {
+      if (library->docs[i].date < 0)
+        continue;
+      library->byDate[library->byDateCount].date = library->docs[i].date;
+      library->byDate[library->byDateCount].doc = i;
+      library->byDateCount++;
+    }
+    qsort(library->byDate, library->byDateCount, sizeof(struct libraryDate),
+          _library_cmp_dates);
+  }
+
+  // the documents from the first dated low on to before the first
+  // dated after high
+  for (first = 0, last = library->byDateCount; first < last; ) {
+    mid = (first + last) / 2;
+    if (library->byDate[mid].date < low)
+      first = mid + 1;
+    else
+      last = mid;
+  }
+  for (last = library->byDateCount, mid = first; mid < last; ) {
+    i = (mid + last) / 2;
+    if (library->byDate[i].date <= high)
+      mid = i + 1;
+    else
+      last = i;
+  }
+
+  res = _bitmap_new();
+  ids = malloc((last - first + 1) * sizeof(int));
+  if (! res || ! ids) {
+    epub_bitmap_free(res);
+    free(ids);
+    return NULL;
+  }
+  for (i = first; i < last; i++)
+    ids[i - first] = library->byDate[i].doc;
+  qsort(ids, last - first, sizeof(int), _library_cmp_ids);
+  for (i = 0; i < last - first; i++)
+    if (! _bitmap_add(res, ids[i])) {
+      epub_bitmap_free(res);
+      res = NULL;
+      break;
+    }
+  free(ids);
+
+  return res;
+}
+
+static int _library_write(FILE *file, unsigned long long value, int bytes) {
+  int i;
+
+  for (i = 0; i < bytes; i++)
+    if (putc((int)((value >> (8 * i)) & 0xFF), file) == EOF)
+      return 0;
+
+  return 1;
+}
+
+static int _library_write_string(FILE *file, const char *str, int plusOne) {
+  int len = str?strlen(str):0;
+
+  if (! _library_write(file, len + ((str && plusOne)?1:0), 4))
+    return 0;
+
+  return (len == 0 || fwrite(str, 1, len, file) == (size_t)len);
+}
+
+static int _library_write_bitmap(FILE *file, struct epub_bitmap *b) {
+  struct bitmapContainer *c;
+  int i, j, ok;
+
+  ok = _library_write(file, b->count, 4);
+  for (i = 0; ok && i < b->count; i++) {
+    c = &b->containers[i];
+    ok = (_library_write(file, c->key, 4) &&
+          _library_write(file, c->cardinality, 4));
+    if (c->words)
+      for (j = 0; ok && j < BITMAP_WORDS; j++)
+        ok = _library_write(file, c->words[j], 8);
+    else
+      for (j = 0; ok && j < c->cardinality; j++)
+        ok = _library_write(file, c->array[j], 2);
+  }
+
+  return ok;
+}
+
+int epub_library_save(struct epub_library *library, const char *filename) {
+  struct libraryFacet *facet;
+  FILE *file;
+  int i, j, ok;
+
+  if (!library || !filename) {
+    return 0;
+  }
+
+  file = fopen(filename, "wb");
+  if (!file) {
+    return 0;
+  }
+
+  ok = (fwrite(LIBRARY_MAGIC, 1, 8, file) == 8 &&
+        _library_write(file, library->count, 4));
+  for (i = 0; ok && i < library->count; i++)
+    ok = (_library_write_string(file, library->docs[i].name, 1) &&
+          _library_write(file, (unsigned long)library->docs[i].date, 4) &&
+          _library_write_string(file, (char *)library->docs[i].titleKey, 1) &&
+          _library_write_string(file, (char *)library->docs[i].creatorKey, 1));
+
+  ok = ok && _library_write(file, LIBRARY_FACETS, 4);
+  for (i = 0; ok && i < LIBRARY_FACETS; i++) {
+    facet = &library->facets[i];
+    ok = (_library_write(file, _library_facet_types[i], 4) &&
+          _library_write(file, facet->count, 4));
+    for (j = 0; ok && j < facet->count; j++)
+      ok = (_library_write_string(file, facet->values[j].value, 0) &&
+            _library_write_bitmap(file, facet->values[j].docs));
+  }
+
+  if (fclose(file) != 0)
+    ok = 0;
+  if (!ok)
+    remove(filename);
+
+  return ok;
+}
+
+// The bytes of a saved library being read, ok turning 0 once they run
+// out
+struct libraryReader {
+  const unsigned char *pos;
+  const unsigned char *end;
+  int ok;
+};
+
+static unsigned long long _library_read(struct libraryReader *r, int bytes) {
+  unsigned long long value = 0;
+  int i;
+
+  if (! r->ok || r->end - r->pos < bytes) {
+    r->ok = 0;
+    return 0;
+  }
+
+  for (i = 0; i < bytes; i++)
+    value |= (unsigned long long)r->pos[i] << (8 * i);
+  r->pos += bytes;
+
+  return value;
+}
+
+static char *_library_read_string(struct libraryReader *r, unsigned long len) {
+  char *str;
+
+  if (! r->ok || (unsigned long)(r->end - r->pos) < len) {
+    r->ok = 0;
+    return NULL;
+  }
+
+  str = malloc(len + 1);
+  if (! str) {
+    r->ok = 0;
+    return NULL;
+  }
+  memcpy(str, r->pos, len);
+  str[len] = 0;
+  r->pos += len;
+
+  return str;
+}
+
+static struct epub_bitmap *_library_read_bitmap(struct libraryReader *r) {
+  struct epub_bitmap *b = _bitmap_new();
+  struct bitmapContainer c;
+  unsigned long count, i;
+  int j;
+
+  count = _library_read(r, 4);
+  for (i = 0; b && r->ok && i < count; i++) {
+    memset(&c, 0, sizeof(struct bitmapContainer));
+    c.key = _library_read(r, 4);
+    c.cardinality = _library_read(r, 4);
+    if (! r->ok || c.key > 0xFFFF || c.cardinality <= 0 ||
+        c.cardinality > 65536 ||
+        (b->count > 0 && b->containers[b->count - 1].key >= c.key)) {
+      r->ok = 0;
+      break;
+    }
+
+    if (c.cardinality > BITMAP_ARRAY_MAX) {
+      c.words = malloc(BITMAP_WORDS * sizeof(unsigned long long));
+      for (j = 0; c.words && j < BITMAP_WORDS; j++)
+        c.words[j] = _library_read(r, 8);
+    } else {
+      c.alloc = c.cardinality;
+      c.array = malloc(c.alloc * sizeof(unsigned short));
+      for (j = 0; c.array && j < c.cardinality; j++)
+        c.array[j] = _library_read(r, 2);
+    }
+
+    if (! r->ok || (! c.words && ! c.array) || ! _bitmap_append(b, &c)) {
+      _bitmap_free_container(&c);
+      r->ok = 0;
+    }
+  }
+
+  if (! r->ok) {
+    epub_bitmap_free(b);
+    return NULL;
+  }
+
+  return b;
+}
+
+struct epub_library *epub_library_load(const char *filename) {
+  struct epub_library *library;
+  struct libraryFacet *facet;
+  struct libraryReader r;
+  unsigned char *data;
+  unsigned long count, i, j;
+  long size, date;
+  char *name, *titleKey, *creatorKey;
+  FILE *file;
+  int f;
+
+  if (!filename) {
+    return NULL;
+  }
+
+  file = fopen(filename, "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  data = NULL;
+  if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 8 &&
+      fseek(file, 0, SEEK_SET) == 0 && (data = malloc(size)) &&
+      fread(data, 1, size, file) != (size_t)size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  if (!data) {
+    return NULL;
+  }
+
+  library = epub_library_new();
+  r.pos = data + 8;
+  r.end = data + size;
+  r.ok = (library && memcmp(data, LIBRARY_MAGIC, 8) == 0);
+
+  count = _library_read(&r, 4);
+  for (i = 0; r.ok && i < count; i++) {
+    j = _library_read(&r, 4);
+    name = j?_library_read_string(&r, j - 1):NULL;
+    date = (long)(int)_library_read(&r, 4);
+    j = _library_read(&r, 4);
+    titleKey = j?_library_read_string(&r, j - 1):NULL;
+    j = _library_read(&r, 4);
+    creatorKey = j?_library_read_string(&r, j - 1):NULL;
+    if (r.ok && _library_new_doc(library, name, date, (xmlChar *)titleKey,
+                                 (xmlChar *)creatorKey) < 0)
+      r.ok = 0;
+    free(name);
+    free(titleKey);
+    free(creatorKey);
+  }
+
+  if (_library_read(&r, 4) != LIBRARY_FACETS)
+    r.ok = 0;
+  for (f = 0; r.ok && f < LIBRARY_FACETS; f++) {
+    facet = &library->facets[f];
+    if (_library_read(&r, 4) != (unsigned long)_library_facet_types[f])
+      r.ok = 0;
+    count = _library_read(&r, 4);
+    if (! r.ok || count > (unsigned long)(r.end - r.pos))
+      break;
+
+    facet->values = malloc((count + 1) * sizeof(struct libraryValue));
+    if (! facet->values)
+      break;
+    facet->alloc = count + 1;
+    for (i = 0; r.ok && i < count; i++) {
+      name = _library_read_string(&r, _library_read(&r, 4));
+      if (! name)
+        break;
+      // the values must stay sorted for lookups
+      if (facet->count > 0 &&
+          strcmp(facet->values[facet->count - 1].value, name) >= 0) {
+        free(name);
+        r.ok = 0;
+        break;
+      }
+      facet->values[facet->count].value = name;
+      facet->values[facet->count].docs = _library_read_bitmap(&r);
+      facet->count++;
+      if (! facet->values[facet->count - 1].docs)
+        r.ok = 0;
+    }
+  }
+  free(data);
+
+  if (!r.ok || f < LIBRARY_FACETS) {
+    epub_library_free(library);
+    return NULL;
+  }
+
+  return library;
+}
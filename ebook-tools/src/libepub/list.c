@@ -42,9 +42,20 @@ void _list_free_meta(struct meta *data) {
     free(data->name);
   if (data->content)
     free(data->content);
+  if (data->property)
+    free(data->property);
+  if (data->value)
+    free(data->value);
+  if (data->refines)
+    free(data->refines);
   free(data);
 }
 
+void _list_free_metadata_id(struct metadataId *id) {
+  free(id->id);
+  free(id);
+}
+
 void _list_free_spine(struct spine *spine) {
   if (spine->idref)
     free(spine->idref);
@@ -75,10 +86,15 @@ void _list_free_tours(struct tour *tour) {
   if (tour->title)
     free(tour->title);
       
-  FreeList(tour->sites, (ListFreeFunc)_list_free_site);
+  FreeVector(tour->sites, (ListFreeFunc)_list_free_site);
   free(tour);
 }
 
+// Frees what a tour kept in an arena holds outside of it
+void _list_free_tour_sites(struct tour *tour) {
+  FreeVector(tour->sites, NULL);
+}
+
 void _list_free_manifest(struct manifest *manifest) {
 
   if (manifest->nspace)
@@ -95,6 +111,8 @@ void _list_free_manifest(struct manifest *manifest) {
     free(manifest->fallback);
   if (manifest->fbStyle)
     free(manifest->fbStyle);
+  if (manifest->properties)
+    free(manifest->properties);
 
   free(manifest);
 } 
@@ -120,11 +138,16 @@ void _list_free_toc_item(struct tocItem *ti) {
   if (ti->type)
     free(ti->type);
 
-  FreeList(ti->label, (ListFreeFunc)_list_free_toc_label);
+  FreeVector(ti->label, (ListFreeFunc)_list_free_toc_label);
 
   free(ti);
 }
 
+// Frees what a toc item kept in an arena holds outside of it
+void _list_free_toc_item_labels(struct tocItem *ti) {
+  FreeVector(ti->label, NULL);
+}
+
 // Compare 2 root structs by mediatype field
 int _list_cmp_root_by_mediatype(struct root *root1, struct root *root2) {
 
@@ -148,6 +171,30 @@ int _list_cmp_label_by_lang(struct tocLabel *t1, struct tocLabel *t2) {
   return strcmp((char *)t1->lang, (char *)t2->lang);;
 }
 
+int _list_cmp_metadata_id_by_id(struct metadataId *id1,
+                                struct metadataId *id2) {
+  return xmlStrcmp(id1->id, id2->id);
+}
+
+int _list_cmp_metadata_id_by_element(struct metadataId *id1,
+                                     struct metadataId *id2) {
+  if (id1->type != id2->type)
+    return (id1->type < id2->type)?-1:1;
+  return id1->index - id2->index;
+}
+
+// The id of the element a meta refines, a refines that isn't a fragment
+// being taken as it is
+const xmlChar *_list_meta_refines_id(struct meta *meta) {
+  if (meta->refines[0] == '#')
+    return meta->refines + 1;
+  return meta->refines;
+}
+
+int _list_cmp_meta_by_refines(struct meta *m1, struct meta *m2) {
+  return xmlStrcmp(_list_meta_refines_id(m1), _list_meta_refines_id(m2));
+}
+
 int _list_cmp_toc_by_playorder(struct tocItem *t1, struct tocItem *t2) {
   
   if ((t1 == NULL) || (t2 == NULL))
@@ -274,5 +321,5 @@ void _list_dump_site(struct site *site) {
 
 void _list_dump_tour(struct tour *tour) {
   printf("Tour %s(%s):\n", tour->title, tour->id);
-  DumpList(tour->sites, (ListDumpFunc)_list_dump_site);
+  DumpVector(tour->sites, (ListDumpFunc)_list_dump_site);
 }
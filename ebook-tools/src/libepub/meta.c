@@ -0,0 +1,445 @@
+#include "epub.h"
+#include "epublib.h"
+
+// Attributes and namespace prefixes the scanner keeps track of, with
+// anything beyond them left to the reader
+#define META_ATTRS_MAX 16
+#define META_PREFIXES_MAX 8
+#define META_NAME_MAX 64
+
+struct metaAttr {
+  const char *name;
+  int nameLen;
+  const char *value;
+  int valueLen;
+};
+
+// The start tag just scanned, pointing into the opf
+struct metaElement {
+  const char *name;
+  int nameLen;
+  struct metaAttr attrs[META_ATTRS_MAX];
+  int count;
+};
+
+// The namespace prefixes declared so far
+struct metaPrefixes {
+  const char *names[META_PREFIXES_MAX];
+  int lens[META_PREFIXES_MAX];
+  int count;
+};
+
+static int _meta_space(char c) {
+  return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+static const char *_meta_find(const char *p, const char *end,
+                              const char *str) {
+  int len = strlen(str);
+
+  while ((p = memchr(p, str[0], end - p))) {
+    if (end - p < len)
+      return NULL;
+    if (memcmp(p, str, len) == 0)
+      return p;
+    p++;
+  }
+
+  return NULL;
+}
+
+static int _meta_utf8(unsigned long code, xmlChar *out) {
+  if (code < 0x80) {
+    out[0] = code;
+    return 1;
+  } else if (code < 0x800) {
+    out[0] = 0xC0 | (code >> 6);
+    out[1] = 0x80 | (code & 0x3F);
+    return 2;
+  } else if (code < 0x10000) {
+    out[0] = 0xE0 | (code >> 12);
+    out[1] = 0x80 | ((code >> 6) & 0x3F);
+    out[2] = 0x80 | (code & 0x3F);
+    return 3;
+  }
+  out[0] = 0xF0 | (code >> 18);
+  out[1] = 0x80 | ((code >> 12) & 0x3F);
+  out[2] = 0x80 | ((code >> 6) & 0x3F);
+  out[3] = 0x80 | (code & 0x3F);
+  return 4;
+}
+
+// Copies text or an attribute value as the parser would hand it out,
+// with the predefined and character references replaced and the line
+// ends normalized. Fails on any other reference.
+static int _meta_decode(const char *s, int len, int attr, xmlChar **out) {
+  const char *end = s + len, *semi;
+  unsigned long code;
+  xmlChar *buf, *d;
+  char *num;
+
+  // nothing decodes into more bytes than it is written with
+  buf = d = malloc(len + 1);
+  if (! buf)
+    return 0;
+
+  while (s < end) {
+    if (*s == '&') {
+      semi = memchr(s, ';', end - s);
+      if (! semi)
+        break;
+
+      if (s[1] == '#') {
+        // strtoul would take signs, spaces and 0x too
+        if (s[2] == 'x' && ((s[3] >= '0' && s[3] <= '9') ||
+                            (s[3] >= 'a' && s[3] <= 'f') ||
+                            (s[3] >= 'A' && s[3] <= 'F')))
+          code = strtoul(s + 3, &num, 16);
+        else if (s[2] >= '0' && s[2] <= '9')
+          code = strtoul(s + 2, &num, 10);
+        else
+          break;
+        if (num != semi ||
+            (code < 0x20 && code != 0x9 && code != 0xA && code != 0xD) ||
+            (code >= 0xD800 && code < 0xE000) || code == 0xFFFE ||
+            code == 0xFFFF || code > 0x10FFFF)
+          break;
+        d += _meta_utf8(code, d);
+      } else if (semi - s == 3 && strncmp(s, "&lt", 3) == 0) {
+        *d++ = '<';
+      } else if (semi - s == 3 && strncmp(s, "&gt", 3) == 0) {
+        *d++ = '>';
+      } else if (semi - s == 4 && strncmp(s, "&amp", 4) == 0) {
+        *d++ = '&';
+      } else if (semi - s == 5 && strncmp(s, "&quot", 5) == 0) {
+        *d++ = '"';
+      } else if (semi - s == 5 && strncmp(s, "&apos", 5) == 0) {
+        *d++ = '\'';
+      } else {
+        break;
+      }
+      s = semi + 1;
+    } else if (*s == '\r') {
+      *d++ = attr?' ':'\n';
+      s++;
+      if (s < end && *s == '\n')
+        s++;
+    } else if (attr && (*s == '\n' || *s == '\t')) {
+      *d++ = ' ';
+      s++;
+    } else {
+      *d++ = *s++;
+    }
+  }
+
+  if (s < end) {
+    free(buf);
+    return 0;
+  }
+
+  *d = 0;
+  *out = buf;
+  return 1;
+}
+
+// Scans the start tag whose name begins at p. Returns where it ends or
+// NULL if it is not one the scanner takes.
+static const char *_meta_tag(const char *p, const char *end,
+                             struct metaElement *el, int *empty) {
+  struct metaAttr *attr;
+  const char *q;
+  xmlChar *value;
+
+  el->name = p;
+  while (p < end && ! _meta_space(*p) && *p != '/' && *p != '>')
+    p++;
+  el->nameLen = p - el->name;
+  el->count = 0;
+  if (el->nameLen == 0)
+    return NULL;
+
+  for (;;) {
+    while (p < end && _meta_space(*p))
+      p++;
+    if (p >= end)
+      return NULL;
+
+    if (*p == '>') {
+      *empty = 0;
+      return p + 1;
+    }
+    if (*p == '/') {
+      *empty = 1;
+      return (p + 1 < end && p[1] == '>')?p + 2:NULL;
+    }
+
+    if (el->count == META_ATTRS_MAX)
+      return NULL;
+    attr = &el->attrs[el->count++];
+
+    attr->name = p;
+    while (p < end && ! _meta_space(*p) && *p != '=' && *p != '/' &&
+           *p != '>')
+      p++;
+    attr->nameLen = p - attr->name;
+    while (p < end && _meta_space(*p))
+      p++;
+    if (attr->nameLen == 0 || p >= end || *p != '=')
+      return NULL;
+
+    p++;
+    while (p < end && _meta_space(*p))
+      p++;
+    if (p >= end || (*p != '"' && *p != '\''))
+      return NULL;
+    q = memchr(p + 1, *p, end - p - 1);
+    if (! q || memchr(p + 1, '<', q - p - 1))
+      return NULL;
+    attr->value = p + 1;
+    attr->valueLen = q - p - 1;
+
+    // only copied when asked for, so the references are checked here
+    if (memchr(attr->value, '&', attr->valueLen)) {
+      if (! _meta_decode(attr->value, attr->valueLen, 1, &value))
+        return NULL;
+      free(value);
+    }
+    p = q + 1;
+  }
+}
+
+// Takes the prefixes the element declares and makes sure the ones it
+// uses are declared. The declarations are not scoped, which for an opf
+// only matters if it redeclares a prefix somewhere it is not used.
+static int _meta_namespaces(struct metaPrefixes *prefixes,
+                            struct metaElement *el) {
+  const char *name, *colon;
+  int i, j, len;
+
+  for (i = 0; i < el->count; i++) {
+    if (el->attrs[i].nameLen > 6 &&
+        strncmp(el->attrs[i].name, "xmlns:", 6) == 0) {
+      if (prefixes->count == META_PREFIXES_MAX)
+        return 0;
+      prefixes->names[prefixes->count] = el->attrs[i].name + 6;
+      prefixes->lens[prefixes->count] = el->attrs[i].nameLen - 6;
+      prefixes->count++;
+    }
+  }
+
+  for (i = -1; i < el->count; i++) {
+    name = (i < 0)?el->name:el->attrs[i].name;
+    len = (i < 0)?el->nameLen:el->attrs[i].nameLen;
+    colon = memchr(name, ':', len);
+    if (! colon)
+      continue;
+    if (memchr(colon + 1, ':', name + len - colon - 1))
+      return 0;
+
+    len = colon - name;
+    if ((len == 3 && strncmp(name, "xml", 3) == 0) ||
+        (len == 5 && strncmp(name, "xmlns", 5) == 0))
+      continue;
+
+    for (j = 0; j < prefixes->count; j++)
+      if (prefixes->lens[j] == len &&
+          strncmp(prefixes->names[j], name, len) == 0)
+        break;
+    if (j == prefixes->count)
+      return 0;
+  }
+
+  return 1;
+}
+
+// Copies the name without its prefix, or returns 0 if it is too long to
+// be one of the elements looked for
+static int _meta_local(const char *name, int len, char *local) {
+  const char *colon = memchr(name, ':', len);
+
+  if (colon) {
+    len -= colon + 1 - name;
+    name = colon + 1;
+  }
+  if (len >= META_NAME_MAX)
+    return 0;
+
+  memcpy(local, name, len);
+  local[len] = 0;
+  return 1;
+}
+
+// The elements kept, whose text the scanner must get right
+static int _meta_known(const char *local) {
+  static const char *known[] = {
+    "identifier", "title", "creator", "contributor", "meta", "date",
+    "subject", "publisher", "description", "type", "format", "source",
+    "language", "relation", "coverage", "rights", NULL
+  };
+  int i;
+
+  for (i = 0; known[i]; i++)
+    if (xmlStrcasecmp((xmlChar *)local, (xmlChar *)known[i]) == 0)
+      return 1;
+
+  return 0;
+}
+
+// Returns a copy of an attribute of the scanned element, preferring the
+// opf prefixed one if opf is set
+static xmlChar *_meta_attribute(void *source, const char *name, int opf) {
+  struct metaElement *el = source;
+  struct metaAttr *found = NULL, *attr;
+  int i, len = strlen(name);
+  xmlChar *value;
+
+  for (i = 0; i < el->count; i++) {
+    attr = &el->attrs[i];
+    if (opf && attr->nameLen == len + 4 &&
+        strncmp(attr->name, "opf:", 4) == 0 &&
+        memcmp(attr->name + 4, name, len) == 0) {
+      found = attr;
+      break;
+    }
+    if (! found && attr->nameLen == len && memcmp(attr->name, name, len) == 0)
+      found = attr;
+  }
+
+  if (! found || ! _meta_decode(found->value, found->valueLen, 1, &value))
+    return NULL;
+
+  return value;
+}
+
+// Checks the xml declaration, the scanner only reading utf-8
+static int _meta_declaration(const char *p, const char *end) {
+  const char *q = _meta_find(p, end, "encoding");
+
+  if (! q)
+    return 1;
+
+  q += 8;
+  while (q < end && (_meta_space(*q) || *q == '='))
+    q++;
+  if (q >= end || (*q != '"' && *q != '\''))
+    return 0;
+  q++;
+
+  return (end - q >= 6 && q[5] == q[-1] &&
+          xmlStrncasecmp((xmlChar *)q, (xmlChar *)"utf-8", 5) == 0);
+}
+
+int _meta_scan(struct opf *opf, const char *opfStr, int size) {
+  const char *p = opfStr, *end = opfStr + size, *q;
+  struct metaPrefixes prefixes;
+  struct metaElement el;
+  char local[META_NAME_MAX];
+  xmlChar *string;
+  int inMetadata = 0, empty;
+
+  _epub_print_debug(opf->epub, DEBUG_INFO, "scanning metadata");
+
+  if (size >= 2 && ((p[0] == '\xFE' && p[1] == '\xFF') ||
+                    (p[0] == '\xFF' && p[1] == '\xFE')))
+    return 0;
+  if (size >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+    p += 3;
+  prefixes.count = 0;
+
+  while ((p = memchr(p, '<', end - p))) {
+    if (++p >= end)
+      return 0;
+
+    if (*p == '?') {
+      if (! (q = _meta_find(p, end, "?>")))
+        return 0;
+      if (strncmp(p, "?xml", 4) == 0 && _meta_space(p[4]) &&
+          ! _meta_declaration(p, q))
+        return 0;
+      p = q + 2;
+      continue;
+    }
+
+    if (*p == '!') {
+      if (end - p > 3 && strncmp(p, "!--", 3) == 0) {
+        q = _meta_find(p + 3, end, "-->");
+      } else if (end - p > 8 && strncmp(p, "![CDATA[", 8) == 0) {
+        // between elements, so not part of any text kept
+        q = _meta_find(p + 8, end, "]]>");
+      } else if (end - p > 8 && strncmp(p, "!DOCTYPE", 8) == 0) {
+        // an internal subset can declare entities
+        q = memchr(p, '>', end - p);
+        if (q && memchr(p, '[', q - p))
+          return 0;
+      } else {
+        return 0;
+      }
+      if (! q)
+        return 0;
+      p = q + 1;
+      continue;
+    }
+
+    if (*p == '/') {
+      q = memchr(p, '>', end - p);
+      if (! q)
+        return 0;
+      if (inMetadata) {
+        for (el.name = ++p; p < q && ! _meta_space(*p); p++)
+          ;
+        if (_meta_local(el.name, p - el.name, local) &&
+            xmlStrcasecmp((xmlChar *)local, (xmlChar *)"metadata") == 0)
+          return 1;
+      }
+      p = q + 1;
+      continue;
+    }
+
+    p = _meta_tag(p, end, &el, &empty);
+    if (! p || ! _meta_namespaces(&prefixes, &el))
+      return 0;
+    if (! _meta_local(el.name, el.nameLen, local))
+      continue;
+
+    if (! inMetadata) {
+      if (xmlStrcasecmp((xmlChar *)local, (xmlChar *)"metadata") == 0) {
+        _epub_print_debug(opf->epub, DEBUG_INFO, "parsing metadata");
+        _opf_init_metadata(opf);
+        inMetadata = 1;
+      }
+      continue;
+    }
+
+    // the reader stops at any metadata node as well
+    if (xmlStrcasecmp((xmlChar *)local, (xmlChar *)"metadata") == 0)
+      return 1;
+    if (xmlStrcasecmp((xmlChar *)local, (xmlChar *)"dc-metadata") == 0 ||
+        xmlStrcasecmp((xmlChar *)local, (xmlChar *)"x-metadata") == 0)
+      continue;
+
+    // only text up to the end tag is taken, the elements in anything
+    // else are scanned in turn
+    string = NULL;
+    if (! empty) {
+      q = memchr(p, '<', end - p);
+      if (q && end - q > el.nameLen + 2 && q[1] == '/' &&
+          memcmp(q + 2, el.name, el.nameLen) == 0 &&
+          (q[el.nameLen + 2] == '>' || _meta_space(q[el.nameLen + 2]))) {
+        if (q > p && ! _meta_decode(p, q - p, 0, &string))
+          return 0;
+        p = memchr(q, '>', end - q);
+        if (! p) {
+          free(string);
+          return 0;
+        }
+        p++;
+      } else if (_meta_known(local)) {
+        return 0;
+      }
+    }
+
+    _opf_add_metadata(opf, (xmlChar *)local, string, _meta_attribute, &el);
+  }
+
+  return 0;
+}
@@ -32,8 +32,7 @@ int _ocf_parse_container(struct ocf *ocf) {
   if (_ocf_get_file(ocf, METAINFO_DIR "/" CONTAINER_FILENAME, &containerXml) == -1)
     return 0;
 
-  reader = xmlReaderForMemory(containerXml, strlen(containerXml), 
-                              name, NULL, 0);
+  reader = _epub_reader_new(containerXml, strlen(containerXml), name);
   if (reader != NULL) {
     ret = xmlTextReaderRead(reader);
 
@@ -56,7 +55,7 @@ int _ocf_parse_container(struct ocf *ocf) {
 			struct root *newroot = malloc(sizeof(struct root));
 			if (! newroot) {
 				_epub_print_debug(ocf->epub, DEBUG_ERROR, "No memory left for root");
-				xmlFreeTextReader(reader);
+				_epub_reader_free(reader);
 				free(containerXml);
 				return 0;
 			}
@@ -74,7 +73,7 @@ int _ocf_parse_container(struct ocf *ocf) {
 		ret = xmlTextReaderRead(reader);
 	}
 	
-    xmlFreeTextReader(reader);
+    _epub_reader_free(reader);
     free(containerXml);
     if (ret != 0) {
       _epub_print_debug(ocf->epub, DEBUG_ERROR, "failed to parse %s\n", name);
@@ -111,6 +110,25 @@ struct zip *_ocf_open(struct ocf *ocf, const char *filename) {
   return arch;
 }
 
+// Opens the zip through an io backend
+static struct zip *_ocf_open_io(struct ocf *ocf, const struct epub_io *io) {
+  zip_error_t error;
+  zip_source_t *source;
+  struct zip *arch = NULL;
+
+  zip_error_init(&error);
+  source = _io_source_new(io, &error);
+  if (source && ! (arch = zip_open_from_source(source, ZIP_RDONLY, &error)))
+    zip_source_free(source);
+
+  if (! arch)
+    _epub_print_debug(ocf->epub, DEBUG_ERROR, "%s - %s", ocf->filename,
+                      zip_error_strerror(&error));
+  zip_error_fini(&error);
+
+  return arch;
+}
+
 void _ocf_close(struct ocf *ocf) {
 
   if (ocf->arch) {
@@ -121,7 +139,10 @@ void _ocf_close(struct ocf *ocf) {
   }
   
   FreeList(ocf->roots, (ListFreeFunc)_list_free_root);
+  _fetch_free_directory(ocf->directory);
 
+  if (ocf->io)
+    free(ocf->io);
   if (ocf->filename)
     free(ocf->filename);
   if (ocf->mimetype)
@@ -200,7 +221,8 @@ void _ocf_not_supported(struct ocf *ocf, const char *filename) {
                       "file %s exists but is not supported by this version", filename);
 }
 
-struct ocf *_ocf_parse(struct epub *epub, const char *filename) {
+struct ocf *_ocf_parse(struct epub *epub, const char *filename,
+                       const struct epub_io *io) {
   struct ocf *ocf;
 
   _epub_print_debug(epub, DEBUG_INFO, "building ocf struct");
@@ -223,7 +245,18 @@ struct ocf *_ocf_parse(struct epub *epub, const char *filename) {
 
   strcpy(ocf->filename, filename);
   
-  if (! (ocf->arch = _ocf_open(ocf, ocf->filename))) {
+  if (io) {
+    ocf->io = malloc(sizeof(struct epub_io));
+    if (! ocf->io) {
+      _epub_err_set_oom(&epub->error);
+      _ocf_close(ocf);
+      return NULL;
+    }
+    *ocf->io = *io;
+    ocf->arch = _ocf_open_io(ocf, io);
+  } else
+    ocf->arch = _ocf_open(ocf, ocf->filename);
+  if (! ocf->arch) {
 	  _ocf_close(ocf);
 	  return NULL;
   }
@@ -247,29 +280,104 @@ struct ocf *_ocf_parse(struct epub *epub, const char *filename) {
   return ocf;
 }
 
-int _ocf_get_data_file(struct ocf *ocf, const char *filename, char **fileStr) {
-  int size;
+// Returns the archive name of the data file or NULL
+char *_ocf_data_name(struct ocf *ocf, const char *filename) {
   char *fullname;
 
-  if (! filename) {
-	  return -1;
-  }
-
   fullname = malloc((strlen(filename)+strlen(ocf->datapath)+1)*sizeof(char));
 
   if (!fullname) {
 	  _epub_print_debug(ocf->epub, DEBUG_ERROR, "Failed to allocate memory for file name");
-	  return -1;
+	  return NULL;
   }
 
   strcpy(fullname, ocf->datapath);
   strcat(fullname, filename);
+  return fullname;
+}
+
+int _ocf_get_data_file(struct ocf *ocf, const char *filename, char **fileStr) {
+  int size;
+  char *fullname;
+
+  if (! filename) {
+	  return -1;
+  }
+
+  if (! (fullname = _ocf_data_name(ocf, filename)))
+	  return -1;
+
   size = _ocf_get_file(ocf, fullname, fileStr);
   free(fullname);
 
   return size;
 }
 
+// Opens the data file for reading it in pieces with zip_fread
+struct zip_file *_ocf_open_data_file(struct ocf *ocf, const char *filename) {
+  struct zip_file *file;
+  char *fullname;
+  zip_int64_t index;
+
+  if (! filename) {
+	  return NULL;
+  }
+
+  if (! (fullname = _ocf_data_name(ocf, filename)))
+	  return NULL;
+
+  index = zip_name_locate(ocf->arch, fullname, 0);
+  if (index < 0 || ! (file = zip_fopen_index(ocf->arch, index, 0))) {
+    _epub_print_debug(ocf->epub, DEBUG_INFO, "%s - %s", 
+                      fullname, zip_strerror(ocf->arch));
+    free(fullname);
+    return NULL;
+  }
+
+  free(fullname);
+  return file;
+}
+
+// Fills info from the central directory, returns 0 if there's no file
+int _ocf_entry_info(struct ocf *ocf, const char *filename, 
+                    struct epub_entry_info *info) {
+  struct zip_stat fileStat;
+
+  zip_stat_init(&fileStat);
+  if (zip_stat(ocf->arch, filename, ZIP_FL_UNCHANGED, &fileStat) == -1) {
+    _epub_print_debug(ocf->epub, DEBUG_INFO, "%s - %s", 
+                      filename, zip_strerror(ocf->arch));
+    return 0;
+  }
+
+  info->index = (fileStat.valid & ZIP_STAT_INDEX)?(int)fileStat.index:-1;
+  info->size = (fileStat.valid & ZIP_STAT_SIZE)?(long long)fileStat.size:-1;
+  info->compressedSize = 
+    (fileStat.valid & ZIP_STAT_COMP_SIZE)?(long long)fileStat.comp_size:-1;
+  info->method = 
+    (fileStat.valid & ZIP_STAT_COMP_METHOD)?fileStat.comp_method:-1;
+  info->crc = (fileStat.valid & ZIP_STAT_CRC)?fileStat.crc:0;
+  return 1;
+}
+
+int _ocf_data_entry_info(struct ocf *ocf, const char *filename,
+                         struct epub_entry_info *info) {
+  char *fullname;
+  int ret;
+
+  if (! filename) {
+	  return 0;
+  }
+
+  if (! (fullname = _ocf_data_name(ocf, filename)))
+	  return 0;
+
+  ret = _ocf_entry_info(ocf, fullname, info);
+  free(fullname);
+
+  return ret;
+}
+
 char *_ocf_root_fullpath_by_type(struct ocf *ocf, const char *type) {
   struct root look = {(xmlChar *)type, NULL};
   struct root *res;
@@ -0,0 +1,260 @@
+#include "epub.h"
+#include "epublib.h"
+
+// A saved map is "EPUBOFS1", a u32 count and per linear document its
+// u32 spine index, u32 crc and u64 characters, little endian
+#define OFFSETS_MAGIC "EPUBOFS1"
+
+static struct offsetMap *_offsets_new(struct epub *epub) {
+  struct offsetMap *map;
+  int i, count = 0;
+
+  for (i = _get_spine_it_first(epub, EITERATOR_LINEAR); i >= 0;
+       i = _get_spine_it_step(epub, EITERATOR_LINEAR, i))
+    count++;
+
+  map = calloc(1, sizeof(struct offsetMap));
+  if (! map)
+    return NULL;
+
+  map->count = count;
+  map->spineCount = epub->opf->spine->Size;
+  map->spine = malloc((count + 1) * sizeof(int));
+  map->crcs = malloc((count + 1) * sizeof(unsigned long));
+  map->starts = calloc(count + 1, sizeof(long long));
+  map->bySpine = malloc((map->spineCount + 1) * sizeof(int));
+  if (! map->spine || ! map->crcs || ! map->starts || ! map->bySpine) {
+    _offsets_free(map);
+    return NULL;
+  }
+
+  for (i = 0; i < map->spineCount; i++)
+    map->bySpine[i] = -1;
+
+  count = 0;
+  for (i = _get_spine_it_first(epub, EITERATOR_LINEAR); i >= 0;
+       i = _get_spine_it_step(epub, EITERATOR_LINEAR, i)) {
+    struct epub_entry_info info;
+
+    map->spine[count] = i;
+    map->crcs[count] = 0;
+    if (_ocf_data_entry_info(epub->ocf, _get_spine_url(epub, i), &info))
+      map->crcs[count] = info.crc;
+    map->bySpine[i] = count;
+    count++;
+  }
+
+  return map;
+}
+
+void _offsets_free(struct offsetMap *map) {
+  if (! map)
+    return;
+
+  free(map->spine);
+  free(map->crcs);
+  free(map->starts);
+  free(map->bySpine);
+  free(map);
+}
+
+int epub_build_offset_map(struct epub *epub) {
+  struct offsetMap *map;
+  char *in, *out;
+  int i;
+
+  if (!epub) {
+    return 0;
+  }
+
+  if (epub->offsetMap)
+    return 1;
+
+  map = _offsets_new(epub);
+  in = malloc(TEXT_CHUNK_SIZE);
+  out = malloc(TEXT_OUT_SIZE(TEXT_CHUNK_SIZE));
+  if (! map || ! in || ! out) {
+    _epub_err_set_oom(&epub->error);
+    _offsets_free(map);
+    free(in);
+    free(out);
+    return 0;
+  }
+
+  for (i = 0; i < map->count; i++) {
+    struct epub_spine_stats stats;
+
+    memset(&stats, 0, sizeof(struct epub_spine_stats));
+    if (! _stats_document(epub, map->spine[i], in, out, &stats))
+      _epub_print_debug(epub, DEBUG_WARNING,
+                        "failed reading spine document %d", map->spine[i]);
+    map->starts[i + 1] = map->starts[i] + stats.chars;
+  }
+
+  free(in);
+  free(out);
+  epub->offsetMap = map;
+  return 1;
+}
+
+static int _offsets_write(FILE *file, unsigned long long value, int bytes) {
+  int i;
+
+  for (i = 0; i < bytes; i++)
+    if (putc((int)((value >> (8 * i)) & 0xFF), file) == EOF)
+      return 0;
+
+  return 1;
+}
+
+static int _offsets_read(FILE *file, unsigned long long *value, int bytes) {
+  int i, c;
+
+  *value = 0;
+  for (i = 0; i < bytes; i++) {
+    if ((c = getc(file)) == EOF)
+      return 0;
+    *value |= (unsigned long long)c << (8 * i);
+  }
+
+  return 1;
+}
+
+int epub_save_offset_map(struct epub *epub, const char *filename) {
+  struct offsetMap *map;
+  FILE *file;
+  int i, ok;
+
+  if (!epub || !filename || !epub_build_offset_map(epub)) {
+    return 0;
+  }
+
+  map = epub->offsetMap;
+  file = fopen(filename, "wb");
+  if (! file) {
+    _epub_print_debug(epub, DEBUG_ERROR, "%s - %s", filename, strerror(errno));
+    return 0;
+  }
+
+  ok = (fwrite(OFFSETS_MAGIC, 1, 8, file) == 8 &&
+        _offsets_write(file, map->count, 4));
+  for (i = 0; ok && i < map->count; i++)
+    ok = (_offsets_write(file, map->spine[i], 4) &&
+          _offsets_write(file, map->crcs[i], 4) &&
+          _offsets_write(file, map->starts[i + 1] - map->starts[i], 8));
+
+  if (fclose(file) != 0)
+    ok = 0;
+  if (! ok) {
+    _epub_print_debug(epub, DEBUG_ERROR, "failed writing %s", filename);
+    remove(filename);
+  }
+
+  return ok;
+}
+
+int epub_load_offset_map(struct epub *epub, const char *filename) {
+  struct offsetMap *map;
+  unsigned long long value;
+  char magic[8];
+  FILE *file;
+  int i, ok;
+
+  if (!epub || !filename) {
+    return 0;
+  }
+
+  file = fopen(filename, "rb");
+  if (! file)
+    return 0;
+
+  map = _offsets_new(epub);
+  if (! map) {
+    _epub_err_set_oom(&epub->error);
+    fclose(file);
+    return 0;
+  }
+
+  // the map must be of this book's linear documents as they are now
+  ok = (fread(magic, 1, 8, file) == 8 &&
+        memcmp(magic, OFFSETS_MAGIC, 8) == 0 &&
+        _offsets_read(file, &value, 4) && value == (unsigned long)map->count);
+  for (i = 0; ok && i < map->count; i++) {
+    ok = (_offsets_read(file, &value, 4) && value == (unsigned long)map->spine[i] &&
+          _offsets_read(file, &value, 4) && value == map->crcs[i] &&
+          _offsets_read(file, &value, 8));
+    if (ok)
+      map->starts[i + 1] = map->starts[i] + (long long)value;
+  }
+  fclose(file);
+
+  if (! ok) {
+    _epub_print_debug(epub, DEBUG_INFO, "%s is no offset map of this book",
+                      filename);
+    _offsets_free(map);
+    return 0;
+  }
+
+  _offsets_free(epub->offsetMap);
+  epub->offsetMap = map;
+  return 1;
+}
+
+long long epub_get_text_length(struct epub *epub) {
+  if (!epub || !epub_build_offset_map(epub)) {
+    return -1;
+  }
+
+  return epub->offsetMap->starts[epub->offsetMap->count];
+}
+
+int epub_position_from_offset(struct epub *epub, long long offset,
+                              int *spine_index, int *doc_offset) {
+  struct offsetMap *map;
+  int low, high, mid;
+
+  if (!epub || !epub_build_offset_map(epub)) {
+    return 0;
+  }
+
+  map = epub->offsetMap;
+  if (map->count == 0 || offset < 0 || offset > map->starts[map->count])
+    return 0;
+
+  // the last document starting at or before offset
+  low = 0;
+  high = map->count - 1;
+  while (low <= high) {
+    mid = (low + high) / 2;
+    if (map->starts[mid] <= offset)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+
+  if (spine_index)
+    *spine_index = map->spine[high];
+  if (doc_offset)
+    *doc_offset = (int)(offset - map->starts[high]);
+  return 1;
+}
+
+long long epub_offset_from_position(struct epub *epub, int spine_index,
+                                    int doc_offset) {
+  struct offsetMap *map;
+  int i;
+
+  if (!epub || !epub_build_offset_map(epub)) {
+    return -1;
+  }
+
+  map = epub->offsetMap;
+  if (spine_index < 0 || spine_index >= map->spineCount || doc_offset < 0)
+    return -1;
+
+  i = map->bySpine[spine_index];
+  if (i < 0 || map->starts[i] + doc_offset > map->starts[i + 1])
+    return -1;
+
+  return map->starts[i] + doc_offset;
+}
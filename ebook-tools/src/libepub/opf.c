@@ -15,8 +15,7 @@ struct opf *_opf_parse(struct epub *epub, char *opfStr) {
   memset(opf, 0, sizeof(struct opf));
   opf->epub = epub;
   
-  reader = xmlReaderForMemory(opfStr, strlen(opfStr), 
-                              "OPF", NULL, 0);
+  reader = _epub_reader_new(opfStr, strlen(opfStr), "OPF");
    if (reader != NULL) {
     ret = xmlTextReaderRead(reader);
     while (ret == 1) {
@@ -39,7 +38,7 @@ struct opf *_opf_parse(struct epub *epub, char *opfStr) {
      ret = xmlTextReaderRead(reader);
     }
 
-    xmlFreeTextReader(reader);
+    _epub_reader_free(reader);
     if (ret != 0) {
       _epub_print_debug(opf->epub, DEBUG_ERROR, "failed to parse OPF");
       return NULL;
@@ -52,72 +51,508 @@ struct opf *_opf_parse(struct epub *epub, char *opfStr) {
      return NULL;
    }
 
+   _opf_build_indexes(opf);
+
    return opf;
 }
 
+// Builds the lookups over what was parsed of the opf
+void _opf_build_indexes(struct opf *opf) {
+  if (opf->metadata)
+    _opf_index_metadata(opf);
+  _opf_build_spine_index(opf);
+  _toc_build_flat(opf);
+  _toc_build_index(opf);
+  _toc_build_page_index(opf);
+}
+
+// Builds an opf of just the metadata, with an empty manifest and spine.
+// The metadata is scanned for in the bytes and only parsed by the
+// reader if the scanner leaves it to it.
+struct opf *_opf_parse_metadata_only(struct epub *epub, char *opfStr,
+                                     int size) {
+  struct opf *opf;
+  xmlTextReaderPtr reader;
+  int ret;
+
+  _epub_print_debug(epub, DEBUG_INFO, "building opf struct of metadata");
+
+  if (size < 0) {
+    _epub_print_debug(epub, DEBUG_ERROR, "unable to read OPF");
+    return NULL;
+  }
+
+  opf = malloc(sizeof(struct opf));
+  if (!opf) {
+    _epub_err_set_oom(&epub->error);
+    return NULL;
+  }
+  memset(opf, 0, sizeof(struct opf));
+  opf->epub = epub;
+  opf->manifest = NewVector(NULL);
+  opf->spine = NewVector(NULL);
+
+  if (! _meta_scan(opf, opfStr, size)) {
+    _epub_print_debug(epub, DEBUG_INFO, "metadata left to the parser");
+    if (opf->metadata) {
+      _opf_free_metadata(opf, opf->metadata);
+      opf->metadata = NULL;
+    }
+
+    reader = _epub_reader_new(opfStr, size, "OPF");
+    if (! reader) {
+      _epub_print_debug(epub, DEBUG_ERROR, "unable to open OPF");
+      _opf_close(opf);
+      return NULL;
+    }
+
+    ret = xmlTextReaderRead(reader);
+    while (ret == 1 && xmlStrcmp(xmlTextReaderConstLocalName(reader),
+                                 (xmlChar *)"metadata") != 0)
+      ret = xmlTextReaderRead(reader);
+    if (ret == 1)
+      _opf_parse_metadata(opf, reader);
+    _epub_reader_free(reader);
+
+    if (ret == -1) {
+      _epub_print_debug(epub, DEBUG_ERROR, "failed to parse OPF");
+      _opf_close(opf);
+      return NULL;
+    }
+  }
+
+  // the other functions count on there being metadata
+  if (! opf->metadata)
+    _opf_init_metadata(opf);
+  _opf_build_indexes(opf);
+
+  return opf;
+}
+
+// Returns a copy of the localName attribute with the namespace prefix,
+// or else of the one without a prefix. One pass over the attributes
+// replaces a namespace lookup and two searches with their copies.
 xmlChar *_get_possible_namespace(xmlTextReaderPtr reader, 
                                  const xmlChar * localName, 
                                  const xmlChar * namespace) 
 {
-  xmlChar *tmp, *ns;
-  ns = xmlTextReaderLookupNamespace(reader, namespace);
-  tmp = xmlTextReaderGetAttributeNs(reader, localName, ns);
+  xmlChar *tmp = NULL;
+  const xmlChar *prefix;
+  int ret;
 
-  if (ns)
-    free(ns);
-  
-  if (! tmp)
-    return xmlTextReaderGetAttribute(reader, localName);
+  for (ret = xmlTextReaderMoveToFirstAttribute(reader); ret == 1;
+       ret = xmlTextReaderMoveToNextAttribute(reader)) {
+    if (xmlStrcmp(xmlTextReaderConstLocalName(reader), localName) != 0)
+      continue;
+
+    prefix = xmlTextReaderConstPrefix(reader);
+    if (prefix && xmlStrcmp(prefix, namespace) == 0) {
+      if (tmp)
+        free(tmp);
+      tmp = xmlStrdup(xmlTextReaderConstValue(reader));
+      break;
+    }
+    if (! prefix && ! tmp)
+      tmp = xmlStrdup(xmlTextReaderConstValue(reader));
+  }
+  xmlTextReaderMoveToElement(reader);
   
   return tmp;
 }
 
+// Returns an attribute of the current element without copying it. It
+// is valid until the reader moves on or reads another value.
+const xmlChar *_get_const_attribute(xmlTextReaderPtr reader, 
+                                    const xmlChar *name) {
+  const xmlChar *value = NULL;
+
+  if (xmlTextReaderMoveToAttribute(reader, name) == 1) {
+    value = xmlTextReaderConstValue(reader);
+    xmlTextReaderMoveToElement(reader);
+  }
+
+  return value;
+}
+
 void _opf_init_metadata(struct opf *opf) {
   struct metadata *meta = malloc(sizeof(struct metadata));
 
-  meta->id = NewListAlloc(LIST, NULL, NULL, NULL);  
-  meta->title = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->creator = NewListAlloc(LIST, NULL, NULL, NULL);
-  meta->contrib = NewListAlloc(LIST, NULL, NULL, NULL);
-  meta->subject = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->publisher = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->description = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->date = NewListAlloc(LIST, NULL, NULL, NULL);
-  meta->type = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->format = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->source = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->lang = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->relation = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->coverage = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->rights = NewListAlloc(LIST, NULL, NULL, (NodeCompareFunc)StringCompare);
-  meta->meta = NewListAlloc(LIST, NULL, NULL, NULL);
+  meta->id = NewVector(NULL);  
+  meta->title = NewVector((NodeCompareFunc)StringCompare);
+  meta->creator = NewVector(NULL);
+  meta->contrib = NewVector(NULL);
+  meta->subject = NewVector((NodeCompareFunc)StringCompare);
+  meta->publisher = NewVector((NodeCompareFunc)StringCompare);
+  meta->description = NewVector((NodeCompareFunc)StringCompare);
+  meta->date = NewVector(NULL);
+  meta->type = NewVector((NodeCompareFunc)StringCompare);
+  meta->format = NewVector((NodeCompareFunc)StringCompare);
+  meta->source = NewVector((NodeCompareFunc)StringCompare);
+  meta->lang = NewVector((NodeCompareFunc)StringCompare);
+  meta->relation = NewVector((NodeCompareFunc)StringCompare);
+  meta->coverage = NewVector((NodeCompareFunc)StringCompare);
+  meta->rights = NewVector((NodeCompareFunc)StringCompare);
+  meta->meta = NewVector(NULL);
+  meta->ids = NewVector((NodeCompareFunc)_list_cmp_metadata_id_by_id);
+  meta->refines = NewVector((NodeCompareFunc)_list_cmp_meta_by_refines);
+  meta->elementIds =
+    NewVector((NodeCompareFunc)_list_cmp_metadata_id_by_element);
+  meta->titleKey = NULL;
+  meta->creatorKey = NULL;
 
   opf->metadata = meta;
 }
 
-void _opf_free_metadata(struct metadata *meta) {
-  FreeList(meta->id, (ListFreeFunc)_list_free_id);
-  FreeList(meta->title, free);
-  FreeList(meta->creator, (ListFreeFunc)_list_free_creator);
-  FreeList(meta->contrib, (ListFreeFunc)_list_free_creator);
-  FreeList(meta->subject, free);
-  FreeList(meta->publisher, free);
-  FreeList(meta->description, free);
-  FreeList(meta->date, (ListFreeFunc)_list_free_date);
-  FreeList(meta->type, free);
-  FreeList(meta->format, free);
-  FreeList(meta->source, free);
-  FreeList(meta->lang, free);
-  FreeList(meta->relation, free);
-  FreeList(meta->coverage, free);
-  FreeList(meta->rights, free);
-  FreeList(meta->meta, (ListFreeFunc)_list_free_meta);
+// Returns func, or NULL when the items of the opf go with its arena
+static ListFreeFunc _opf_item_free(struct opf *opf, ListFreeFunc func) {
+  return opf->arena?NULL:func;
+}
+
+// Allocates an item of the opf, in its arena if it has one
+void *_opf_alloc(struct opf *opf, size_t size) {
+  if (opf->arena)
+    return _arena_alloc(opf->arena, size);
+  return malloc(size);
+}
+
+void _opf_free_metadata(struct opf *opf, struct metadata *meta) {
+  ListFreeFunc string = _opf_item_free(opf, free);
+
+  FreeVector(meta->id, _opf_item_free(opf, (ListFreeFunc)_list_free_id));
+  FreeVector(meta->title, string);
+  FreeVector(meta->creator, 
+             _opf_item_free(opf, (ListFreeFunc)_list_free_creator));
+  FreeVector(meta->contrib, 
+             _opf_item_free(opf, (ListFreeFunc)_list_free_creator));
+  FreeVector(meta->subject, string);
+  FreeVector(meta->publisher, string);
+  FreeVector(meta->description, string);
+  FreeVector(meta->date, _opf_item_free(opf, (ListFreeFunc)_list_free_date));
+  FreeVector(meta->type, string);
+  FreeVector(meta->format, string);
+  FreeVector(meta->source, string);
+  FreeVector(meta->lang, string);
+  FreeVector(meta->relation, string);
+  FreeVector(meta->coverage, string);
+  FreeVector(meta->rights, string);
+  FreeVector(meta->meta, _opf_item_free(opf, (ListFreeFunc)_list_free_meta));
+  FreeVector(meta->ids, 
+             _opf_item_free(opf, (ListFreeFunc)_list_free_metadata_id));
+  FreeVector(meta->refines, NULL);
+  FreeVector(meta->elementIds, NULL);
+  free(meta->titleKey);
+  free(meta->creatorKey);
   free(meta);
 }
 
+// Gets a copy of an attribute of the element being added, preferring
+// the opf prefixed one if opf is set
+static xmlChar *_opf_reader_attribute(void *reader, const char *name,
+                                      int opf) {
+  if (opf)
+    return _get_possible_namespace(reader, (xmlChar *)name,
+                                   (xmlChar *)"opf");
+  return xmlTextReaderGetAttribute(reader, (xmlChar *)name);
+}
+
+// The local names of the elements of each epub_metadata type
+static const char *_opf_metadata_locals[] = {
+  "identifier", "title", "creator", "contributor", "subject", "publisher",
+  "description", "date", "type", "format", "source", "language",
+  "relation", "coverage", "rights", "meta"
+};
+
+// Adds the metadata element named local with its text string, taking
+// its attributes from source. Shared by the reader and the scanner.
+void _opf_add_metadata(struct opf *opf, const xmlChar *local,
+                       xmlChar *string, opfAttributeFunc attribute,
+                       void *source) {
+  struct metadataId *id;
+  vectorPtr list;
+  int type;
+
+  if (xmlStrcasecmp(local, (xmlChar *)"identifier") == 0) {
+    struct id *new = _opf_alloc(opf, sizeof(struct id));
+    new->string = string;
+    new->scheme = attribute(source, "scheme", 1);
+    new->id = attribute(source, "id", 0);
+    
+    AddItem(opf->metadata->id, new);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "identifier %s(%s) is: %s", 
+                      new->id, new->scheme, new->string);
+  } else if (xmlStrcasecmp(local, (xmlChar *)"title") == 0) {
+    AddItem(opf->metadata->title, string);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "title is %s", string);
+      
+  } else if (xmlStrcasecmp(local, (xmlChar *)"creator") == 0) {
+    struct creator *new = _opf_alloc(opf, sizeof(struct creator));
+    new->name = string;
+    new->fileAs = attribute(source, "file-as", 1);
+    new->role = attribute(source, "role", 1);
+    AddItem(opf->metadata->creator, new);       
+    _epub_print_debug(opf->epub, DEBUG_INFO, "creator - %s: %s (%s)", 
+                      new->role, new->name, new->fileAs);
+      
+  } else if (xmlStrcasecmp(local, (xmlChar *)"contributor") == 0) {
+    struct creator *new = _opf_alloc(opf, sizeof(struct creator));
+    new->name = string;
+    new->fileAs = attribute(source, "file-as", 1);
+    new->role = attribute(source, "role", 1);
+    AddItem(opf->metadata->contrib, new);     
+    _epub_print_debug(opf->epub, DEBUG_INFO, "contributor - %s: %s (%s)", 
+                      new->role, new->name, new->fileAs);
+    
+  } else if (xmlStrcasecmp(local, (xmlChar *)"meta") == 0) {
+    struct meta *new = _opf_alloc(opf, sizeof(struct meta));
+    new->name = attribute(source, "name", 0);
+    new->content = attribute(source, "content", 0);
+    new->property = attribute(source, "property", 0);
+    new->value = string;
+    new->refines = attribute(source, "refines", 0);
+    new->id = NULL;
+    
+    AddItem(opf->metadata->meta, new);
+    if (new->refines && new->refines[0])
+      AddItem(opf->metadata->refines, new);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "meta is %s: %s", 
+                      new->name, new->content); 
+    if (new->property) {
+      _epub_print_debug(opf->epub, DEBUG_INFO, "meta has property %s: %s", 
+                      new->property, new->value); 
+    }
+  } else if (xmlStrcasecmp(local, (xmlChar *)"date") == 0) {
+    struct date *new = _opf_alloc(opf, sizeof(struct date));
+    new->date = string;
+    new->event = attribute(source, "event", 1);
+    AddItem(opf->metadata->date, new);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "date of %s: %s", 
+                      new->event, new->date); 
+      
+  } else if (xmlStrcasecmp(local, (xmlChar *)"subject") == 0) {
+    AddItem(opf->metadata->subject, string);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "subject is %s", string);
+      
+  } else if (xmlStrcasecmp(local, (xmlChar *)"publisher") == 0) {
+    AddItem(opf->metadata->publisher, string); 
+    _epub_print_debug(opf->epub, DEBUG_INFO, "publisher is %s", string); 
+      
+  } else if (xmlStrcasecmp(local, (xmlChar *)"description") == 0) {
+    AddItem(opf->metadata->description, string);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "description is %s", string);
+      
+  } else if (xmlStrcasecmp(local, (xmlChar *)"type") == 0) {
+    AddItem(opf->metadata->type, string);       
+    _epub_print_debug(opf->epub, DEBUG_INFO, "type is %s", string);
+      
+  } else if (xmlStrcasecmp(local, (xmlChar *)"format") == 0) {
+    AddItem(opf->metadata->format, string);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "format is %s", string); 
+
+  } else if (xmlStrcasecmp(local, (xmlChar *)"source") == 0) {
+    AddItem(opf->metadata->source, string);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "source is %s", string); 
+
+  } else if (xmlStrcasecmp(local, (xmlChar *)"language") == 0) {
+    AddItem(opf->metadata->lang, string);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "language is %s", string); 
+    
+  } else if (xmlStrcasecmp(local, (xmlChar *)"relation") == 0) {
+    AddItem(opf->metadata->relation, string);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "relation is %s", string); 
+
+  } else if (xmlStrcasecmp(local, (xmlChar *)"coverage") == 0) {
+    AddItem(opf->metadata->coverage, string);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "coverage is %s", string); 
+  } else if (xmlStrcasecmp(local, (xmlChar *)"rights") == 0) {
+    AddItem(opf->metadata->rights, string);
+    _epub_print_debug(opf->epub, DEBUG_INFO, "rights is %s", string);
+  } else if (string) {
+    _epub_print_debug(opf->epub, DEBUG_INFO,
+                      "unsupported local %s: %s", local, string); 
+    if (! opf->arena)
+      free(string);
+  }
+
+  // keep the id for the metas refining the element
+  for (type = EPUB_ID; type <= EPUB_META; type++)
+    if (xmlStrcasecmp(local, (xmlChar *)_opf_metadata_locals[type]) == 0)
+      break;
+  if (type > EPUB_META)
+    return;
+
+  list = _opf_metadata_list(opf->metadata, type);
+  id = _opf_alloc(opf, sizeof(struct metadataId));
+  if (! id || ! (id->id = attribute(source, "id", 0))) {
+    if (! opf->arena)
+      free(id);
+    return;
+  }
+  id->type = type;
+  id->index = list->Size - 1;
+  AddItem(opf->metadata->ids, id);
+}
+
+vectorPtr _opf_metadata_list(struct metadata *meta, enum epub_metadata type) {
+  switch(type) {
+  case EPUB_ID:
+    return meta->id;
+  case EPUB_TITLE:
+    return meta->title;
+  case EPUB_CREATOR:
+    return meta->creator;
+  case EPUB_CONTRIB:
+    return meta->contrib;
+  case EPUB_SUBJECT:
+    return meta->subject;
+  case EPUB_PUBLISHER:
+    return meta->publisher;
+  case EPUB_DESCRIPTION:
+    return meta->description;
+  case EPUB_DATE:
+    return meta->date;
+  case EPUB_TYPE:
+    return meta->type;
+  case EPUB_FORMAT:
+    return meta->format;
+  case EPUB_SOURCE:
+    return meta->source;
+  case EPUB_LANG:
+    return meta->lang;
+  case EPUB_RELATION:
+    return meta->relation;
+  case EPUB_COVERAGE:
+    return meta->coverage;
+  case EPUB_RIGHTS:
+    return meta->rights;
+  case EPUB_META:
+    return meta->meta;
+  default:
+    return NULL;
+  }
+}
+
+// Returns the index of the first of the sorted items whose key is not
+// below key
+static int _opf_lower_bound(vectorPtr items, const xmlChar *key,
+                            const xmlChar *(*getKey)(void *)) {
+  int low = 0, high = items->Size, mid;
+
+  while (low < high) {
+    mid = (low + high) / 2;
+    if (xmlStrcmp(getKey(GetItem(items, mid)), key) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+static const xmlChar *_opf_metadata_id_key(void *id) {
+  return ((struct metadataId *)id)->id;
+}
+
+static const xmlChar *_opf_refines_key(void *meta) {
+  return _list_meta_refines_id(meta);
+}
+
+// Sorts the ids and refinements, keeping the document order of equal
+// ones, attaches the refinements to the elements they refine and sets
+// the sort keys
+void _opf_index_metadata(struct opf *opf) {
+  struct metadata *meta = opf->metadata;
+  struct metadataId *id;
+  struct meta *item;
+  int i, last;
+
+  SortVector(meta->ids);
+  SortVector(meta->refines);
+
+  for (i = 0; i < meta->ids->Size; i++) {
+    id = GetItem(meta->ids, i);
+    id->firstRefinement = _opf_lower_bound(meta->refines, id->id,
+                                           _opf_refines_key);
+    for (last = id->firstRefinement; last < meta->refines->Size; last++)
+      if (xmlStrcmp(_list_meta_refines_id(GetItem(meta->refines, last)),
+                    id->id) != 0)
+        break;
+    id->refinements = last - id->firstRefinement;
+
+    if (id->type == EPUB_META && (item = GetItem(meta->meta, id->index)))
+      item->id = id->id;
+    if (AddItem(meta->elementIds, id) != LLIST_NOERROR)
+      _epub_err_set_oom(&opf->epub->error);
+  }
+  SortVector(meta->elementIds);
+
+  _collate_metadata(opf);
+}
+
+// Returns the id of the element or NULL if it has none
+static struct metadataId *_opf_element_id(struct opf *opf,
+                                          enum epub_metadata type,
+                                          int index) {
+  vectorPtr ids = opf->metadata->elementIds;
+  struct metadataId *id;
+  int low = 0, high = ids->Size, mid;
+
+  while (low < high) {
+    mid = (low + high) / 2;
+    id = GetItem(ids, mid);
+    if (id->type == type && id->index == index)
+      return id;
+    if (id->type < type || (id->type == type && id->index < index))
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return NULL;
+}
+
+int _opf_metadata_by_id(struct opf *opf, const xmlChar *id,
+                        enum epub_metadata *type, int *index) {
+  struct metadataId *found;
+
+  found = GetItem(opf->metadata->ids,
+                  _opf_lower_bound(opf->metadata->ids, id,
+                                   _opf_metadata_id_key));
+  if (! found || xmlStrcmp(found->id, id) != 0)
+    return 0;
+
+  *type = found->type;
+  *index = found->index;
+  return 1;
+}
+
+// Returns how many metas refine the element, setting first to the index
+// of the first of them in the refines vector
+int _opf_refinements(struct opf *opf, enum epub_metadata type, int index,
+                     int *first) {
+  struct metadataId *id = _opf_element_id(opf, type, index);
+
+  *first = (id?id->firstRefinement:0);
+  return (id?id->refinements:0);
+}
+
+// Returns the first meta refining the element with the given property
+struct meta *_opf_refinement(struct opf *opf, enum epub_metadata type,
+                             int index, const char *property) {
+  struct meta *meta;
+  int first, count, i;
+
+  count = _opf_refinements(opf, type, index, &first);
+  for (i = 0; i < count; i++) {
+    meta = GetItem(opf->metadata->refines, first + i);
+    if (meta->property && xmlStrcmp(meta->property, (xmlChar *)property) == 0)
+      return meta;
+  }
+
+  return NULL;
+}
+
 void _opf_parse_metadata(struct opf *opf, xmlTextReaderPtr reader) {
   int ret;
-  struct metadata *meta;
   const xmlChar *local;
   xmlChar *string;
   
@@ -125,7 +560,6 @@ void _opf_parse_metadata(struct opf *opf, xmlTextReaderPtr reader) {
   
   // must have title, identifier and language
   _opf_init_metadata(opf);
-  meta = opf->metadata;
   
   ret = xmlTextReaderRead(reader);
   while (ret == 1 && 
@@ -138,117 +572,17 @@ void _opf_parse_metadata(struct opf *opf, xmlTextReaderPtr reader) {
     }
     
     local = xmlTextReaderConstLocalName(reader);
-    string = (xmlChar *)xmlTextReaderReadString(reader);
-
-    if (xmlStrcasecmp(local, (xmlChar *)"identifier") == 0) {
-      struct id *new = malloc(sizeof(struct id));
-      new->string = string;
-      new->scheme = _get_possible_namespace(reader, (xmlChar *)"scheme",
-                                                (xmlChar *)"opf");
-      new->id = xmlTextReaderGetAttribute(reader, (xmlChar *)"id");
-      
-      AddNode(meta->id, NewListNode(meta->id, new));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "identifier %s(%s) is: %s", 
-                        new->id, new->scheme, new->string);
-    } else if (xmlStrcasecmp(local, (xmlChar *)"title") == 0) {
-      AddNode(meta->title, NewListNode(meta->title, string));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "title is %s", string);
-        
-    } else if (xmlStrcasecmp(local, (xmlChar *)"creator") == 0) {
-      struct creator *new = malloc(sizeof(struct creator));
-      new->name = string;
-      new->fileAs = 
-        _get_possible_namespace(reader, (xmlChar *)"file-as",
-                                    (xmlChar *)"opf");
-      new->role = 
-        _get_possible_namespace(reader, (xmlChar *)"role",
-                                    (xmlChar *)"opf");
-      AddNode(meta->creator, NewListNode(meta->creator, new));       
-      _epub_print_debug(opf->epub, DEBUG_INFO, "creator - %s: %s (%s)", 
-                        new->role, new->name, new->fileAs);
-        
-    } else if (xmlStrcasecmp(local, (xmlChar *)"contributor") == 0) {
-      struct creator *new = malloc(sizeof(struct creator));
-      new->name = string;
-      new->fileAs = 
-        _get_possible_namespace(reader, (xmlChar *)"file-as",
-                                    (xmlChar *)"opf");
-      new->role = 
-        _get_possible_namespace(reader, (xmlChar *)"role",
-                                    (xmlChar *)"opf");
-      AddNode(meta->contrib, NewListNode(meta->contrib, new));     
-      _epub_print_debug(opf->epub, DEBUG_INFO, "contributor - %s: %s (%s)", 
-                        new->role, new->name, new->fileAs);
-      
-    } else if (xmlStrcasecmp(local, (xmlChar *)"meta") == 0) {
-      struct meta *new = malloc(sizeof(struct meta));
-      new->name = xmlTextReaderGetAttribute(reader, (xmlChar *)"name");
-      new->content = xmlTextReaderGetAttribute(reader, (xmlChar *)"content");
-      new->property = xmlTextReaderGetAttribute(reader, (xmlChar *)"property");
-      new->value = string;
-      
-      AddNode(meta->meta, NewListNode(meta->meta, new));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "meta is %s: %s", 
-                        new->name, new->content); 
-      if (new->property) {
-        _epub_print_debug(opf->epub, DEBUG_INFO, "meta has property %s: %s", 
-                        new->property, new->value); 
-      }
-    } else if (xmlStrcasecmp(local, (xmlChar *)"date") == 0) {
-      struct date *new = malloc(sizeof(struct date));
-      new->date = string;
-      new->event = _get_possible_namespace(reader, (xmlChar *)"event",
-                                               (xmlChar *)"opf");
-      AddNode(meta->date, NewListNode(meta->date, new));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "date of %s: %s", 
-                        new->event, new->date); 
-        
-    } else if (xmlStrcasecmp(local, (xmlChar *)"subject") == 0) {
-      AddNode(meta->subject, NewListNode(meta->subject, string));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "subject is %s", string);
-        
-    } else if (xmlStrcasecmp(local, (xmlChar *)"publisher") == 0) {
-      AddNode(meta->publisher, NewListNode(meta->publisher, string)); 
-      _epub_print_debug(opf->epub, DEBUG_INFO, "publisher is %s", string); 
-        
-    } else if (xmlStrcasecmp(local, (xmlChar *)"description") == 0) {
-      AddNode(meta->description, NewListNode(meta->description, string));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "description is %s", string);
-        
-    } else if (xmlStrcasecmp(local, (xmlChar *)"type") == 0) {
-      AddNode(meta->type, NewListNode(meta->type, string));       
-      _epub_print_debug(opf->epub, DEBUG_INFO, "type is %s", string);
-        
-    } else if (xmlStrcasecmp(local, (xmlChar *)"format") == 0) {
-      AddNode(meta->format, NewListNode(meta->format, string));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "format is %s", string); 
 
-    } else if (xmlStrcasecmp(local, (xmlChar *)"source") == 0) {
-      AddNode(meta->source, NewListNode(meta->source, string));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "source is %s", string); 
-
-    } else if (xmlStrcasecmp(local, (xmlChar *)"language") == 0) {
-      AddNode(meta->lang, NewListNode(meta->lang, string));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "language is %s", string); 
-      
-    } else if (xmlStrcasecmp(local, (xmlChar *)"relation") == 0) {
-      AddNode(meta->relation, NewListNode(meta->relation, string));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "relation is %s", string); 
-
-    } else if (xmlStrcasecmp(local, (xmlChar *)"coverage") == 0) {
-      AddNode(meta->coverage, NewListNode(meta->coverage, string));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "coverage is %s", string); 
-    } else if (xmlStrcasecmp(local, (xmlChar *)"rights") == 0) {
-      AddNode(meta->rights, NewListNode(meta->rights, string));
-      _epub_print_debug(opf->epub, DEBUG_INFO, "rights is %s", string);
-    } else if (string) {
-      if (xmlStrcasecmp(local, (xmlChar *)"dc-metadata") != 0 &&
-          xmlStrcasecmp(local, (xmlChar *)"x-metadata") != 0)
-        _epub_print_debug(opf->epub, DEBUG_INFO,
-                          "unsupported local %s: %s", local, string); 
-      free(string);
+    // the text of these is that of all the elements in them
+    if (xmlStrcasecmp(local, (xmlChar *)"dc-metadata") == 0 ||
+        xmlStrcasecmp(local, (xmlChar *)"x-metadata") == 0) {
+      ret = xmlTextReaderRead(reader);
+      continue;
     }
 
+    string = (xmlChar *)xmlTextReaderReadString(reader);
+    _opf_add_metadata(opf, local, string, _opf_reader_attribute, reader);
+
     ret = xmlTextReaderRead(reader);
   }
 }
@@ -258,8 +592,7 @@ struct toc *_opf_init_toc() {
   struct toc *toc = malloc(sizeof(struct toc));
   memset(toc, 0, sizeof(struct toc));
 
-  toc->playOrder = NewListAlloc(LIST, NULL, NULL, 
-                                (NodeCompareFunc)_list_cmp_toc_by_playorder);
+  toc->playOrder = NewVector((NodeCompareFunc)_list_cmp_toc_by_playorder);
 
   return toc;
 }
@@ -268,37 +601,42 @@ struct tocCategory *_opf_init_toc_category() {
   struct tocCategory *tc = malloc(sizeof(struct tocCategory));
   memset(tc, 0, sizeof(struct tocCategory));
 
-  tc->info = NewListAlloc(LIST, NULL, NULL, NULL); //tocLabel
-  tc->label = NewListAlloc(LIST, NULL, NULL, NULL); //tocLabel
-  tc->items = NewListAlloc(LIST, NULL, NULL, NULL); //tocItem
+  tc->info = NewVector(NULL); //tocLabel
+  tc->label = NewVector(NULL); //tocLabel
+  tc->items = NewVector(NULL); //tocItem
 
   return tc;
 }
 
-void _opf_free_toc_category(struct tocCategory *tc) {
-  if (tc->id)
+void _opf_free_toc_category(struct opf *opf, struct tocCategory *tc) {
+  if (tc->id && ! opf->arena)
     free(tc->id);
-  if (tc->class)
+  if (tc->class && ! opf->arena)
     free(tc->class);
   
-  FreeList(tc->info, (ListFreeFunc)_list_free_toc_label);
-  FreeList(tc->label, (ListFreeFunc)_list_free_toc_label);
-  FreeList(tc->items, (ListFreeFunc)_list_free_toc_item);
+  FreeVector(tc->info, 
+             _opf_item_free(opf, (ListFreeFunc)_list_free_toc_label));
+  FreeVector(tc->label, 
+             _opf_item_free(opf, (ListFreeFunc)_list_free_toc_label));
+  FreeVector(tc->items, 
+             _opf_item_free(opf, (ListFreeFunc)_list_free_toc_item));
   
   free(tc);
 }
 
-void _opf_free_toc(struct toc *toc) {
+void _opf_free_toc(struct opf *opf, struct toc *toc) {
   
   if (toc->navMap)
-    _opf_free_toc_category(toc->navMap);
+    _opf_free_toc_category(opf, toc->navMap);
   if (toc->navList)
-    _opf_free_toc_category(toc->navList);
+    _opf_free_toc_category(opf, toc->navList);
   if (toc->pageList)
-    _opf_free_toc_category(toc->pageList);
+    _opf_free_toc_category(opf, toc->pageList);
 
-  // all items are already free, lets free only the struct
-  FreeList(toc->playOrder, NULL);
+  // all items are already free, lets free only the struct, or what the
+  // items in an arena hold outside of it
+  FreeVector(toc->playOrder, opf->arena?
+             (ListFreeFunc)_list_free_toc_item_labels:NULL);
 
   free(toc);
 
@@ -347,13 +685,11 @@ struct tocItem *_opf_init_toc_item(int depth) {
 }
 
 int _get_attribute_as_positive_int(xmlTextReaderPtr reader, const xmlChar *name) {
-  xmlChar *str = xmlTextReaderGetAttribute(reader, name);
+  const xmlChar *str = _get_const_attribute(reader, name);
   int ret = -1;
 
-  if (str) { 
+  if (str)
     ret = atoi((char *)str);
-    free(str);
-  } 
 
   return ret;
 }
@@ -380,8 +716,8 @@ void _opf_parse_navmap(struct opf *opf, xmlTextReaderPtr reader) {
           _epub_print_debug(opf->epub, DEBUG_INFO, 
                             "adding nav point item->%s %s (d:%d,p:%d)", 
                             item->id, item->src, item->depth, item->playOrder);
-          AddNode(tc->items, NewListNode(tc->items, item));
-          AddNode(opf->toc->playOrder, NewListNode(opf->toc->playOrder, item));
+          AddItem(tc->items, item);
+          AddItem(opf->toc->playOrder, item);
           item = NULL;
         }
 
@@ -401,8 +737,8 @@ void _opf_parse_navmap(struct opf *opf, xmlTextReaderPtr reader) {
           _epub_print_debug(opf->epub, DEBUG_INFO, 
                             "adding nav point item->%s %s (d:%d,p:%d)", 
                             item->id, item->src, item->depth, item->playOrder);
-          AddNode(tc->items, NewListNode(tc->items, item)); 
-          AddNode(opf->toc->playOrder, NewListNode(opf->toc->playOrder, item));
+          AddItem(tc->items, item); 
+          AddItem(opf->toc->playOrder, item);
           item = NULL;
         }
         depth--;
@@ -418,16 +754,13 @@ void _opf_parse_navmap(struct opf *opf, xmlTextReaderPtr reader) {
     if (! xmlStrcasecmp(xmlTextReaderConstName(reader),(xmlChar *)"navLabel")) {
       if (item) {
         if (! item->label)
-          item->label = NewListAlloc(LIST, NULL, NULL, NULL); //tocLabel
-        AddNode(item->label, NewListNode(item->label, 
-                                         _opf_parse_navlabel(opf, reader)));
+          item->label = NewVector(NULL); //tocLabel
+        AddItem(item->label, _opf_parse_navlabel(opf, reader));
       } else { // Not inside navpoint
-        AddNode(tc->label, NewListNode(tc->label, 
-                                       _opf_parse_navlabel(opf, reader)));
+        AddItem(tc->label, _opf_parse_navlabel(opf, reader));
       }
     } else if (! xmlStrcasecmp(xmlTextReaderConstName(reader),(xmlChar *)"navInfo")) {
-        AddNode(tc->info, NewListNode(tc->info, 
-                                      _opf_parse_navlabel(opf, reader)));
+        AddItem(tc->info, _opf_parse_navlabel(opf, reader));
         if (item)
           _epub_print_debug(opf->epub, DEBUG_WARNING, 
                             "nav info inside nav point element");
@@ -479,8 +812,8 @@ void _opf_parse_navlist(struct opf *opf, xmlTextReaderPtr reader) {
           _epub_print_debug(opf->epub, DEBUG_INFO, 
                             "adding nav target item->%s %s (d:%d,p:%d)", 
                             item->id, item->src, item->depth, item->playOrder);
-          AddNode(tc->items, NewListNode(tc->items, item)); 
-          AddNode(opf->toc->playOrder, NewListNode(opf->toc->playOrder, item));
+          AddItem(tc->items, item); 
+          AddItem(opf->toc->playOrder, item);
           item = NULL;
         } else {
           _epub_print_debug(opf->epub, DEBUG_ERROR, "empty item in nav list"); 
@@ -497,16 +830,13 @@ void _opf_parse_navlist(struct opf *opf, xmlTextReaderPtr reader) {
     if (! xmlStrcasecmp(xmlTextReaderConstName(reader),(xmlChar *)"navLabel")) {
       if (item) {
         if (! item->label)
-          item->label = NewListAlloc(LIST, NULL, NULL, NULL); //tocLabel
-        AddNode(item->label, NewListNode(item->label, 
-                                         _opf_parse_navlabel(opf, reader)));
+          item->label = NewVector(NULL); //tocLabel
+        AddItem(item->label, _opf_parse_navlabel(opf, reader));
       } else { // Not inside navpoint
-        AddNode(tc->label, NewListNode(tc->label, 
-                                       _opf_parse_navlabel(opf, reader)));
+        AddItem(tc->label, _opf_parse_navlabel(opf, reader));
       }
     } else if (! xmlStrcasecmp(xmlTextReaderConstName(reader),(xmlChar *)"navInfo")) {
-      AddNode(tc->info, NewListNode(tc->info, 
-                                    _opf_parse_navlabel(opf, reader)));
+      AddItem(tc->info, _opf_parse_navlabel(opf, reader));
       if (item)
         _epub_print_debug(opf->epub, DEBUG_WARNING, 
                           "nav info inside nav target element");
@@ -558,8 +888,8 @@ void _opf_parse_pagelist(struct opf *opf, xmlTextReaderPtr reader) {
           _epub_print_debug(opf->epub, DEBUG_INFO, 
                             "adding page target item->%s %s (d:%d,p:%d)", 
                             item->id, item->src, item->depth, item->playOrder);
-          AddNode(tc->items, NewListNode(tc->items, item)); 
-          AddNode(opf->toc->playOrder, NewListNode(opf->toc->playOrder, item));
+          AddItem(tc->items, item); 
+          AddItem(opf->toc->playOrder, item);
           item = NULL;
         } else {
           _epub_print_debug(opf->epub, DEBUG_ERROR, "empty item in nav list"); 
@@ -576,16 +906,13 @@ void _opf_parse_pagelist(struct opf *opf, xmlTextReaderPtr reader) {
     if (! xmlStrcasecmp(xmlTextReaderConstName(reader),(xmlChar *)"navLabel")) {
       if (item) {
         if (! item->label)
-          item->label = NewListAlloc(LIST, NULL, NULL, NULL); //tocLabel
-        AddNode(item->label, NewListNode(item->label, 
-                                         _opf_parse_navlabel(opf, reader)));
+          item->label = NewVector(NULL); //tocLabel
+        AddItem(item->label, _opf_parse_navlabel(opf, reader));
       } else { // Not inside navpoint
-        AddNode(tc->label, NewListNode(tc->label, 
-                                       _opf_parse_navlabel(opf, reader)));
+        AddItem(tc->label, _opf_parse_navlabel(opf, reader));
       }
     } else if (! xmlStrcasecmp(xmlTextReaderConstName(reader),(xmlChar *)"navInfo")) {
-      AddNode(tc->info, NewListNode(tc->info, 
-                                    _opf_parse_navlabel(opf, reader)));
+      AddItem(tc->info, _opf_parse_navlabel(opf, reader));
       if (item)
         _epub_print_debug(opf->epub, DEBUG_WARNING, 
                           "nav info inside page target element");
@@ -601,7 +928,7 @@ void _opf_parse_pagelist(struct opf *opf, xmlTextReaderPtr reader) {
     ret = xmlTextReaderRead(reader);
   }
   
-  opf->toc->navList = tc;
+  opf->toc->pageList = tc;
   _epub_print_debug(opf->epub, DEBUG_INFO, "finished parsing page list");
     
 }
@@ -617,7 +944,7 @@ void _opf_parse_toc(struct opf *opf, char *tocStr, int size) {
   
   _epub_print_debug(opf->epub, DEBUG_INFO, "parsing toc");
   
-  reader = xmlReaderForMemory(tocStr, size, "TOC", NULL, 0);
+  reader = _epub_reader_new(tocStr, size, "TOC");
   
   if (reader != NULL) {
     ret = xmlTextReaderRead(reader);
@@ -637,7 +964,7 @@ void _opf_parse_toc(struct opf *opf, char *tocStr, int size) {
       ret = xmlTextReaderRead(reader);
     }
 
-    xmlFreeTextReader(reader);
+    _epub_reader_free(reader);
     if (ret != 0) {
       _epub_print_debug(opf->epub, DEBUG_ERROR, "failed to parse toc");
     }
@@ -645,17 +972,17 @@ void _opf_parse_toc(struct opf *opf, char *tocStr, int size) {
     _epub_print_debug(opf->epub, DEBUG_ERROR, "unable to open toc reader");
   }
 
-  SortList(opf->toc->playOrder);
+  SortVector(opf->toc->playOrder);
   _epub_print_debug(opf->epub, DEBUG_INFO, "finished parsing toc");
 }      
 
 void _opf_parse_spine(struct opf *opf, xmlTextReaderPtr reader) {
   int ret;
-  xmlChar *linear, *properties;
+  const xmlChar *linear, *properties;
 
   _epub_print_debug(opf->epub, DEBUG_INFO, "parsing spine");
   
-  opf->spine = NewListAlloc(LIST, NULL, NULL, NULL); 
+  opf->spine = NewVector(NULL); 
   opf->tocName = xmlTextReaderGetAttribute(reader, (xmlChar *)"toc");
   
   if (opf->tocName) { 
@@ -701,7 +1028,7 @@ void _opf_parse_spine(struct opf *opf, xmlTextReaderPtr reader) {
 	memset(item, 0, sizeof(struct spine));
 
     item->idref = xmlTextReaderGetAttribute(reader, (xmlChar *)"idref");
-    linear = xmlTextReaderGetAttribute(reader, (xmlChar *)"linear");
+    linear = _get_const_attribute(reader, (xmlChar *)"linear");
     if (linear && xmlStrcasecmp(linear, (xmlChar *)"no") == 0) {
       item->linear = 0;
     } else {
@@ -709,10 +1036,7 @@ void _opf_parse_spine(struct opf *opf, xmlTextReaderPtr reader) {
         opf->linearCount++;
     }
 
-    if(linear)
-        free(linear);
-
-    properties = xmlTextReaderGetAttribute(reader, (xmlChar *)"properties");
+    properties = _get_const_attribute(reader, (xmlChar *)"properties");
     if (properties) {
       if (xmlStrcasecmp(properties, (xmlChar *)"rendition:page-spread-center") == 0) {
         item->spreadPosition = PAGE_SPREAD_CENTER;
@@ -727,10 +1051,7 @@ void _opf_parse_spine(struct opf *opf, xmlTextReaderPtr reader) {
       item->spreadPosition = PAGE_SPREAD_UNKNOWN;
     }
 
-    if(properties)
-        free(properties);
-
-     AddNode(opf->spine, NewListNode(opf->spine, item));
+     AddItem(opf->spine, item);
      
     // decide what to do with non linear items
     _epub_print_debug(opf->epub, DEBUG_INFO, "found item %s", item->idref);
@@ -744,8 +1065,7 @@ void _opf_parse_manifest(struct opf *opf, xmlTextReaderPtr reader) {
   
   _epub_print_debug(opf->epub, DEBUG_INFO, "parsing manifest");
 
-  opf->manifest = NewListAlloc(LIST, NULL, NULL, 
-                               (NodeCompareFunc)_list_cmp_manifest_by_id );
+  opf->manifest = NewVector((NodeCompareFunc)_list_cmp_manifest_by_id );
 
   ret = xmlTextReaderRead(reader);
 
@@ -771,12 +1091,14 @@ void _opf_parse_manifest(struct opf *opf, xmlTextReaderPtr reader) {
       xmlTextReaderGetAttribute(reader, (xmlChar *)"required-namespace");
     item->modules = 
       xmlTextReaderGetAttribute(reader, (xmlChar *)"required-modules");
+    item->properties = 
+      xmlTextReaderGetAttribute(reader, (xmlChar *)"properties");
     
     _epub_print_debug(opf->epub, DEBUG_INFO, 
                       "manifest item %s href %s media-type %s", 
                       item->id, item->href, item->type);
 
-    AddNode(opf->manifest, NewListNode(opf->manifest, item));
+    AddItem(opf->manifest, item);
 
     ret = xmlTextReaderRead(reader);
   }
@@ -786,21 +1108,306 @@ struct manifest *_opf_manifest_get_by_id(struct opf *opf, xmlChar* id) {
   struct manifest data;
   data.id = id;
   
-  return FindNode(opf->manifest, &data);
+  return FindItem(opf->manifest, &data);
   
 }
 
+struct manifest *_opf_manifest_get_by_href(struct opf *opf, const char *href) {
+  struct manifest *item;
+  int i;
+
+  for (i = 0; i < opf->manifest->Size; i++) {
+    item = GetItem(opf->manifest, i);
+    if (item && item->href && strcmp((char *)item->href, href) == 0)
+      return item;
+  }
+
+  return NULL;
+}
+
+// Returns whether the space separated list has the token
+static int _opf_has_token(const xmlChar *list, const char *token) {
+  const char *p = (const char *)list;
+  int len = strlen(token);
+
+  while (p && *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+      p++;
+    if (strncmp(p, token, len) == 0 &&
+        (p[len] == 0 || p[len] == ' ' || p[len] == '\t' ||
+         p[len] == '\n' || p[len] == '\r'))
+      return 1;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+      p++;
+  }
+
+  return 0;
+}
+
+static int _opf_is_image(struct manifest *item) {
+  return (item && item->type &&
+          xmlStrncasecmp(item->type, (xmlChar *)"image/", 6) == 0);
+}
+
+// Returns the manifest item of the first image a cover page shows
+static struct manifest *_opf_cover_from_page(struct opf *opf, 
+                                             const char *href) {
+  struct manifest *item = NULL;
+  char *data, *tag, *end, *attr, *path;
+  char quote;
+  int size;
+
+  size = _ocf_get_data_file(opf->epub->ocf, href, &data);
+  if (size <= 0 || ! data) {
+    free(data);
+    return NULL;
+  }
+
+  // <img src="..."/> or an svg <image xlink:href="..."/>
+  for (tag = strchr(data, '<'); tag && ! item; tag = strchr(tag + 1, '<')) {
+    tag++;
+    if (strncmp(tag, "svg:", 4) == 0)
+      tag += 4;
+    if (strncmp(tag, "img", 3) == 0)
+      tag += 3;
+    else if (strncmp(tag, "image", 5) == 0)
+      tag += 5;
+    else
+      continue;
+    if (*tag != ' ' && *tag != '\t' && *tag != '\n' && *tag != '\r')
+      continue;
+
+    end = strchr(tag, '>');
+    if (! end)
+      break;
+    *end = 0;
+    attr = strstr(tag, "src=");
+    if (! attr && (attr = strstr(tag, "href=")))
+      attr++;
+    if (attr && (attr[4] == '"' || attr[4] == '\'')) {
+      quote = attr[4];
+      attr += 5;
+      if ((end = strchr(attr, quote)) &&
+          (path = _opf_link_path(opf, href, attr, end - attr))) {
+        item = _opf_manifest_get_by_href(opf, path);
+        free(path);
+      }
+    }
+    tag = attr?attr:tag;
+  }
+
+  free(data);
+  return _opf_is_image(item)?item:NULL;
+}
+
+// Returns the cover image from the cover-image property, the cover meta
+// data, the cover guide reference or the name of an image in that order
+struct manifest *_opf_get_cover(struct opf *opf) {
+  struct manifest *item;
+  struct meta *meta;
+  struct guide *guide;
+  int i;
+
+  // all of them are found in the manifest
+  if (! opf->manifest)
+    return NULL;
+
+  for (i = 0; i < opf->manifest->Size; i++) {
+    item = GetItem(opf->manifest, i);
+    if (item && _opf_has_token(item->properties, "cover-image"))
+      return item;
+  }
+
+  for (i = 0; opf->metadata && i < opf->metadata->meta->Size; i++) {
+    meta = GetItem(opf->metadata->meta, i);
+    if (! meta || ! meta->name || ! meta->content ||
+        xmlStrcmp(meta->name, (xmlChar *)"cover") != 0)
+      continue;
+
+    // some books give the image's href instead of its id
+    item = _opf_manifest_get_by_id(opf, meta->content);
+    if (! item)
+      item = _opf_manifest_get_by_href(opf, (char *)meta->content);
+    if (_opf_is_image(item))
+      return item;
+    if (item && item->href && (item = _opf_cover_from_page(opf, (char *)item->href)))
+      return item;
+  }
+
+  for (i = 0; opf->guide && i < opf->guide->Size; i++) {
+    guide = GetItem(opf->guide, i);
+    if (! guide || ! guide->type || ! guide->href ||
+        xmlStrcasecmp(guide->type, (xmlChar *)"cover") != 0)
+      continue;
+
+    item = _opf_manifest_get_by_href(opf, (char *)guide->href);
+    if (_opf_is_image(item))
+      return item;
+    if ((item = _opf_cover_from_page(opf, (char *)guide->href)))
+      return item;
+  }
+
+  for (i = 0; i < opf->manifest->Size; i++) {
+    item = GetItem(opf->manifest, i);
+    if (_opf_is_image(item) &&
+        ((item->id && xmlStrcasestr(item->id, (xmlChar *)"cover")) ||
+         (item->href && xmlStrcasestr(item->href, (xmlChar *)"cover"))))
+      return item;
+  }
+
+  return NULL;
+}
+
+int _opf_cmp_spine_href(const void *a, const void *b) {
+  const struct spineHref *h1 = a, *h2 = b;
+  int res = strcmp((char *)h1->href, (char *)h2->href);
+
+  return res?res:(h1->index - h2->index);
+}
+
+void _opf_build_spine_index(struct opf *opf) {
+  struct manifest *item;
+  struct spine *spine;
+  int i;
+
+  opf->spineHrefs = malloc((opf->spine->Size?opf->spine->Size:1) *
+                           sizeof(struct spineHref));
+  if (! opf->spineHrefs) {
+    _epub_err_set_oom(&opf->epub->error);
+    return;
+  }
+
+  for (i = 0; i < opf->spine->Size; i++) {
+    spine = GetItem(opf->spine, i);
+    item = _opf_manifest_get_by_id(opf, spine->idref);
+    if (! item || ! item->href)
+      continue;
+
+    opf->spineHrefs[opf->spineHrefCount].href = item->href;
+    opf->spineHrefs[opf->spineHrefCount].index = i;
+    opf->spineHrefCount++;
+  }
+
+  qsort(opf->spineHrefs, opf->spineHrefCount, sizeof(struct spineHref),
+        _opf_cmp_spine_href);
+}
+
+// Returns the spine index of the document whose href is the first len
+// bytes of href or -1. 
+int _opf_spine_index_by_href(struct opf *opf, const char *href, int len) {
+  int low = 0, high = opf->spineHrefCount - 1, mid, res;
+  const char *curr;
+
+  // find the first entry not smaller than href
+  while (low <= high) {
+    mid = (low + high) / 2;
+    curr = (char *)opf->spineHrefs[mid].href;
+    res = strncmp(curr, href, len);
+    if (res == 0 && curr[len])
+      res = 1;
+    
+    if (res < 0)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+
+  if (low < opf->spineHrefCount) {
+    curr = (char *)opf->spineHrefs[low].href;
+    if (strncmp(curr, href, len) == 0 && ! curr[len])
+      return opf->spineHrefs[low].index;
+  }
+
+  return -1;
+}
+
+// Returns link (its first len bytes) resolved relative to the directory
+// of base, with "./" segments dropped and "dir/../" folded, or NULL
+char *_opf_link_path(struct opf *opf, const char *base, const char *link,
+                     int len) {
+  const char *sep;
+  char *path, *src, *dst;
+  int baseLen = 0;
+
+  if (base && (sep = strrchr(base, '/')))
+    baseLen = sep - base + 1;
+
+  path = malloc(baseLen + len + 1);
+  if (! path) {
+    _epub_err_set_oom(&opf->epub->error);
+    return NULL;
+  }
+  memcpy(path, base, baseLen);
+  memcpy(path + baseLen, link, len);
+  path[baseLen + len] = 0;
+
+  src = dst = path;
+  while (*src) {
+    if (src[0] == '.' && src[1] == '/') {
+      src += 2;
+    } else if (src[0] == '.' && src[1] == '.' && src[2] == '/') {
+      src += 3;
+      if (dst > path) {
+        dst--;
+        while (dst > path && dst[-1] != '/')
+          dst--;
+      }
+    } else {
+      while (*src && *src != '/')
+        *dst++ = *src++;
+      if (*src)
+        *dst++ = *src++;
+    }
+  }
+  *dst = 0;
+
+  return path;
+}
+
+// Resolves link relative to the directory of base (both relative to
+// the data path) and returns the spine index of the linked document or
+// -1. If fragment is given it is set to the link's fragment or NULL.
+int _opf_spine_index_by_link(struct opf *opf, const char *base,
+                             const char *link, const char **fragment) {
+  const char *hash;
+  char *path;
+  int linkLen, res;
+
+  if (fragment)
+    *fragment = NULL;
+
+  if (! link)
+    return -1;
+
+  hash = strchr(link, '#');
+  linkLen = hash?(int)(hash - link):(int)strlen(link);
+  if (fragment && hash && hash[1])
+    *fragment = hash + 1;
+
+  // the common case, a link relative to the data path
+  if ((! base || ! strchr(base, '/')) && ! strstr(link, "./")) 
+    return _opf_spine_index_by_href(opf, link, linkLen);
+
+  if (! (path = _opf_link_path(opf, base, link, linkLen)))
+    return -1;
+
+  res = _opf_spine_index_by_href(opf, path, strlen(path));
+  free(path);
+
+  return res;
+}
+
 void _opf_parse_guide(struct opf *opf, xmlTextReaderPtr reader) {
   int ret;
   struct guide *item;
 
   _epub_print_debug(opf->epub, DEBUG_INFO, "parsing guides");
 
-  opf->guide = NewListAlloc(LIST, NULL, NULL, NULL);
+  opf->guide = NewVector(NULL);
 
   ret = xmlTextReaderRead(reader);
   while (ret == 1 && 
-         xmlStrcasecmp(xmlTextReaderConstLocalName(reader),(xmlChar *)"guides")) {
+         xmlStrcasecmp(xmlTextReaderConstLocalName(reader),(xmlChar *)"guide")) {
 
     // ignore non starting tags
     if (xmlTextReaderNodeType(reader) != 1) {
@@ -816,14 +1423,14 @@ void _opf_parse_guide(struct opf *opf, xmlTextReaderPtr reader) {
     _epub_print_debug(opf->epub, DEBUG_INFO, 
                       "guide item: %s href: %s type: %s", 
                       item->title, item->href, item->type);
-    AddNode(opf->guide, NewListNode(opf->guide, item));
+    AddItem(opf->guide, item);
     ret = xmlTextReaderRead(reader);
   }
 }
 
-listPtr _opf_parse_tour(struct opf *opf, xmlTextReaderPtr reader) {
+vectorPtr _opf_parse_tour(struct opf *opf, xmlTextReaderPtr reader) {
   int ret;
-  listPtr tour = NewListAlloc(LIST, NULL, NULL, NULL);
+  vectorPtr tour = NewVector(NULL);
   struct site *item;
 
   ret = xmlTextReaderRead(reader);
@@ -843,7 +1450,7 @@ listPtr _opf_parse_tour(struct opf *opf, xmlTextReaderPtr reader) {
     _epub_print_debug(opf->epub, DEBUG_INFO, 
                       "site: %s href: %s", 
                       item->title, item->href);
-    AddNode(tour, NewListNode(tour, item));
+    AddItem(tour, item);
 
     ret = xmlTextReaderRead(reader);
   }
@@ -857,7 +1464,7 @@ void _opf_parse_tours(struct opf *opf, xmlTextReaderPtr reader) {
 
   _epub_print_debug(opf->epub, DEBUG_INFO, "parsing tours");
 
-  opf->tours = NewListAlloc(LIST, NULL, NULL, NULL);
+  opf->tours = NewVector(NULL);
 
   ret = xmlTextReaderRead(reader);
   
@@ -878,70 +1485,81 @@ void _opf_parse_tours(struct opf *opf, xmlTextReaderPtr reader) {
                       "tour: %s id: %s", 
                       item->title, item->id);
     item->sites = _opf_parse_tour(opf, reader);
-    AddNode(opf->tours, NewListNode(opf->tours, item));
+    AddItem(opf->tours, item);
 
     ret = xmlTextReaderRead(reader);
   }
 }
 
-xmlChar *_opf_label_get_by_lang(struct opf *opf, listPtr label, char *lang) {
+xmlChar *_opf_label_get_by_lang(struct opf *opf, vectorPtr label, char *lang) {
   struct tocLabel data, *tmp;
   data.lang = (xmlChar *)lang;
   label->compare = (NodeCompareFunc)_list_cmp_label_by_lang;
-  tmp =  FindNode(label, &data);
+  tmp =  FindItem(label, &data);
   return (tmp?tmp->text:NULL);
   
 }
 
-xmlChar *_opf_label_get_by_doc_lang(struct opf *opf, listPtr label) {
-  opf->metadata->lang->Current = opf->metadata->lang->Head;
+xmlChar *_opf_label_get_by_doc_lang(struct opf *opf, vectorPtr label) {
   return _opf_label_get_by_lang(opf, label, 
-                                (char *)GetNode(opf->metadata->lang));
+                                (char *)GetItem(opf->metadata->lang, 0));
 }
 
 void _opf_dump(struct opf *opf) {
   if (opf->metadata) {
     printf("Title(s):\n   ");
-    DumpList(opf->metadata->title, (ListDumpFunc)_list_dump_string);
+    DumpVector(opf->metadata->title, (ListDumpFunc)_list_dump_string);
     printf("Creator(s):\n   ");
-    DumpList(opf->metadata->creator, (ListDumpFunc)_list_dump_creator);
+    DumpVector(opf->metadata->creator, (ListDumpFunc)_list_dump_creator);
     printf("Identifier(s):\n   ");
-    DumpList(opf->metadata->id, (ListDumpFunc)_list_dump_id);
+    DumpVector(opf->metadata->id, (ListDumpFunc)_list_dump_id);
     if (opf->metadata->meta->Size != 0) {
       printf("Extra local metadata:\n");
-      DumpList(opf->metadata->meta, (ListDumpFunc)_list_dump_meta);
+      DumpVector(opf->metadata->meta, (ListDumpFunc)_list_dump_meta);
     }
   }
   if (opf->spine) {
     printf("Reading order:\n");
-    DumpList(opf->spine, (ListDumpFunc)_list_dump_spine);
+    DumpVector(opf->spine, (ListDumpFunc)_list_dump_spine);
     printf("\n");
   }
   
   if (opf->guide) {
     printf("Guide:\n");
-    DumpList(opf->guide, (ListDumpFunc)_list_dump_guide);
+    DumpVector(opf->guide, (ListDumpFunc)_list_dump_guide);
   }
 
   if (opf->tours)
-    DumpList(opf->tours, (ListDumpFunc)_list_dump_tour);
+    DumpVector(opf->tours, (ListDumpFunc)_list_dump_tour);
   
 }
 
 void _opf_close(struct opf *opf) {
+  _toc_free_flat(opf->tocFlat[TITERATOR_NAVMAP]);
+  _toc_free_flat(opf->tocFlat[TITERATOR_GUIDE]);
+  _toc_free_flat(opf->tocFlat[TITERATOR_PAGES]);
+  _toc_free_index(opf->tocIndex);
+  _toc_free_page_index(opf->pageIndex);
+  if (opf->spineHrefs)
+    free(opf->spineHrefs);
   if (opf->metadata)
-    _opf_free_metadata(opf->metadata);
+    _opf_free_metadata(opf, opf->metadata);
   if (opf->toc)
-    _opf_free_toc(opf->toc);
+    _opf_free_toc(opf, opf->toc);
   if (opf->spine)
-    FreeList(opf->spine, (ListFreeFunc)_list_free_spine);
-  if (opf->tocName)
+    FreeVector(opf->spine, 
+               _opf_item_free(opf, (ListFreeFunc)_list_free_spine));
+  if (opf->tocName && ! opf->arena)
     free(opf->tocName);
   if (opf->manifest)
-    FreeList(opf->manifest, (ListFreeFunc)_list_free_manifest);
+    FreeVector(opf->manifest, 
+               _opf_item_free(opf, (ListFreeFunc)_list_free_manifest));
   if (opf->guide)
-    FreeList(opf->guide, (ListFreeFunc)_list_free_guide);
+    FreeVector(opf->guide, 
+               _opf_item_free(opf, (ListFreeFunc)_list_free_guide));
   if (opf->tours)
-    FreeList(opf->tours, (ListFreeFunc)_list_free_tours);
+    FreeVector(opf->tours, opf->arena?(ListFreeFunc)_list_free_tour_sites:
+               (ListFreeFunc)_list_free_tours);
+  _arena_free(opf->arena);
   free(opf);
 }
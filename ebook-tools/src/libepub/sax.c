@@ -0,0 +1,1024 @@
+#include "epublib.h"
+#include <libxml/SAX2.h>
+
+// The opf and its toc parsed with SAX2 straight into the opf structures,
+// which are allocated in an arena with the attributes they keep copied
+// once. The callbacks are fed to state machines that follow the loops of
+// the reader based parser in opf.c node for node, so that both build the
+// same structures from the same document. Documents declaring entities
+// or attributes are left to the reader: SAX replays the entities without
+// telling, and the reader only applies the attribute defaults to some of
+// the attributes it reads.
+
+enum saxState {
+  SAX_TOP,
+  SAX_METADATA,
+  SAX_MANIFEST,
+  SAX_SPINE,
+  SAX_GUIDE,
+  SAX_TOURS,
+  SAX_TOUR,
+  SAX_TOC_TOP,
+  SAX_NAVMAP,
+  SAX_NAVLIST,
+  SAX_PAGELIST,
+  SAX_LABEL
+};
+
+// A node as the reader would have returned it
+struct saxNode {
+  int type; // as given by xmlTextReaderNodeType
+  const xmlChar *local; // with the prefix if it is not bound
+  const xmlChar *name; // qualified
+  const xmlChar **attrs; // SAX2 attributes, five pointers each
+  int attrCount;
+  int empty; // an empty element tag, with no end node
+};
+
+// An attribute of a metadata element, kept until its text is read
+struct saxAttr {
+  const xmlChar *local;
+  const xmlChar *prefix;
+  xmlChar *value;
+};
+
+// An element whose text the reader would have read as it started: a
+// metadata element, or the text of a toc label
+struct saxText {
+  int depth;
+  int parent; // the element's innermost open ancestor in the texts
+  int start; // its text in the parser's text buffer
+  int end; // -1 while it is open
+  int children; // the text is NULL without any
+  const xmlChar *local; // of the metadata element
+  struct saxAttr *attrs;
+  int attrCount;
+  struct tocLabel *label; // set for a label's text
+};
+
+struct saxParser {
+  struct opf *opf;
+  xmlParserCtxtPtr ctxt;
+  enum saxState state;
+  int depth;
+  int empty; // the element just started has no end node
+  int fallback; // the document is left to the reader
+
+  // the texts being read, in the order the reader would have read them
+  struct saxText *texts;
+  int textCount;
+  int textAlloc;
+  int current; // the innermost open one, -1 if none
+  xmlBufferPtr text;
+
+  struct tour *tour;
+
+  // the toc category being read, with its current item and label
+  struct tocCategory *tc;
+  struct tocItem *item;
+  int tocDepth;
+  struct tocLabel *label;
+  vectorPtr labels; // the vector the label goes to
+  enum saxState labelReturn;
+};
+
+// What a toc category is made of
+struct saxTocKind {
+  const char *category;
+  const char *target;
+  const char *name; // of the target in messages
+  const char *finished;
+};
+
+static const struct saxTocKind _sax_toc_kinds[] = {
+  { "navMap", "navPoint", "nav point", "finished parsing nav map" },
+  { "navList", "navTarget", "nav target", "finished parsing nav list" },
+  { "pageList", "pageTarget", "page target", "finished parsing page list" }
+};
+
+// Returns the value of the attribute name without a namespace, the way
+// xmlTextReaderGetAttribute finds it, and sets end to its end
+static const xmlChar *_sax_raw_attribute(struct saxNode *node,
+                                         const char *name,
+                                         const xmlChar **end) {
+  int i;
+
+  for (i = 0; i < node->attrCount * 5; i += 5)
+    if (! node->attrs[i + 1] && ! node->attrs[i + 2] &&
+        xmlStrEqual(node->attrs[i], (xmlChar *)name)) {
+      *end = node->attrs[i + 4];
+      return node->attrs[i + 3];
+    }
+
+  return NULL;
+}
+
+// Copies an attribute value into the arena. SAX leaves the ampersands in
+// values as character references, which the reader's values don't have.
+static xmlChar *_sax_value(struct saxParser *p, const xmlChar *value,
+                           const xmlChar *end) {
+  xmlChar *ret = _arena_strndup(p->opf->arena, value, end - value);
+  xmlChar *in, *out;
+
+  if (! ret || ! memchr(ret, '&', end - value))
+    return ret;
+
+  for (in = out = ret; *in; out++) {
+    if (xmlStrncmp(in, (xmlChar *)"&#38;", 5) == 0) {
+      *out = '&';
+      in += 5;
+    } else {
+      *out = *in++;
+    }
+  }
+  *out = 0;
+
+  return ret;
+}
+
+// Copies the attributes without a namespace named in names to fields in
+// one pass over the attributes of the element
+static void _sax_attributes(struct saxParser *p, struct saxNode *node,
+                            const char **names, xmlChar ***fields,
+                            int count) {
+  const xmlChar **attrs = node->attrs;
+  int i, j;
+
+  for (j = 0; j < count; j++)
+    *fields[j] = NULL;
+
+  for (i = 0; i < node->attrCount * 5; i += 5) {
+    if (attrs[i + 1] || attrs[i + 2])
+      continue;
+    for (j = 0; j < count; j++)
+      if (! *fields[j] && xmlStrEqual(attrs[i], (xmlChar *)names[j])) {
+        *fields[j] = _sax_value(p, attrs[i + 3], attrs[i + 4]);
+        break;
+      }
+  }
+}
+
+static xmlChar *_sax_attribute(struct saxParser *p, struct saxNode *node,
+                               const char *name) {
+  xmlChar *value;
+  xmlChar **fields[1];
+
+  fields[0] = &value;
+  _sax_attributes(p, node, &name, fields, 1);
+  return value;
+}
+
+// Whether an attribute is there and matches str ignoring case, compared
+// where it is
+static int _sax_attribute_is(struct saxNode *node, const char *name,
+                             const char *str) {
+  const xmlChar *end;
+  const xmlChar *value = _sax_raw_attribute(node, name, &end);
+  int len = strlen(str);
+
+  return value && end - value == len &&
+    xmlStrncasecmp(value, (xmlChar *)str, len) == 0;
+}
+
+// An attribute read as atoi would, or -1 if it is missing
+static int _sax_int_attribute(struct saxNode *node, const char *name) {
+  const xmlChar *end;
+  const xmlChar *value = _sax_raw_attribute(node, name, &end);
+  char buf[32];
+  int len;
+
+  if (! value)
+    return -1;
+
+  while (value < end && (*value == ' ' || *value == '\t' ||
+                         *value == '\n' || *value == '\r'))
+    value++;
+  len = end - value;
+  if (len > (int)sizeof(buf) - 1)
+    len = sizeof(buf) - 1;
+  memcpy(buf, value, len);
+  buf[len] = 0;
+
+  return atoi(buf);
+}
+
+// Gets an attribute of a metadata element kept in its text, the way
+// _get_possible_namespace and xmlTextReaderGetAttribute would
+static xmlChar *_sax_meta_attribute(void *source, const char *name,
+                                    int opf) {
+  struct saxText *text = source;
+  xmlChar *ret = NULL;
+  int i;
+
+  for (i = 0; i < text->attrCount; i++) {
+    if (! xmlStrEqual(text->attrs[i].local, (xmlChar *)name))
+      continue;
+    if (opf && text->attrs[i].prefix &&
+        xmlStrEqual(text->attrs[i].prefix, (xmlChar *)"opf"))
+      return text->attrs[i].value;
+    if (! text->attrs[i].prefix && ! ret)
+      ret = text->attrs[i].value;
+  }
+
+  return ret;
+}
+
+// Hands the texts read to their elements, in the order they started
+static void _sax_text_flush(struct saxParser *p) {
+  const xmlChar *content = xmlBufferContent(p->text);
+  struct saxText *text;
+  xmlChar *string;
+  int i;
+
+  for (i = 0; i < p->textCount; i++) {
+    text = &p->texts[i];
+    string = NULL;
+    if (text->children)
+      string = _arena_strndup(p->opf->arena, content + text->start,
+                              text->end - text->start);
+
+    if (text->label)
+      text->label->text = string;
+    else
+      _opf_add_metadata(p->opf, text->local, string, _sax_meta_attribute,
+                        text);
+  }
+
+  p->textCount = 0;
+  xmlBufferEmpty(p->text);
+}
+
+// Closes the innermost text if it is that of the element ending
+static void _sax_text_end(struct saxParser *p) {
+  struct saxText *text;
+
+  if (p->current < 0 || p->texts[p->current].depth != p->depth)
+    return;
+
+  text = &p->texts[p->current];
+  text->end = xmlBufferLength(p->text);
+  p->current = text->parent;
+  if (p->current < 0)
+    _sax_text_flush(p);
+}
+
+// Starts reading the text of the element of node, for the metadata
+// element local or for label
+static void _sax_text_start(struct saxParser *p, struct saxNode *node,
+                            const xmlChar *local, struct tocLabel *label) {
+  struct saxText *text;
+  const xmlChar **attrs = node->attrs;
+  int i;
+
+  if (p->textCount == p->textAlloc) {
+    int alloc = p->textAlloc?p->textAlloc * 2:8;
+    struct saxText *texts = realloc(p->texts, alloc * sizeof(struct saxText));
+
+    if (! texts)
+      return;
+    p->texts = texts;
+    p->textAlloc = alloc;
+  }
+
+  text = &p->texts[p->textCount];
+  text->depth = p->depth;
+  text->parent = p->current;
+  text->start = xmlBufferLength(p->text);
+  text->end = -1;
+  text->children = 0;
+  text->local = local;
+  text->label = label;
+  text->attrs = NULL;
+  text->attrCount = 0;
+
+  if (local && node->attrCount > 0) {
+    text->attrs = _arena_alloc(p->opf->arena,
+                               node->attrCount * sizeof(struct saxAttr));
+    for (i = 0; text->attrs && i < node->attrCount * 5; i += 5) {
+      struct saxAttr *attr = &text->attrs[text->attrCount++];
+
+      attr->local = attrs[i];
+      attr->prefix = attrs[i + 1];
+      if (attrs[i + 1] && ! attrs[i + 2]) {
+        attr->local = xmlDictQLookup(p->ctxt->dict, attrs[i + 1], attrs[i]);
+        attr->prefix = NULL;
+      }
+      attr->value = _sax_value(p, attrs[i + 3], attrs[i + 4]);
+    }
+  }
+
+  p->current = p->textCount++;
+  if (node->empty)
+    _sax_text_end(p);
+}
+
+// Notes a child of the element whose text is being read
+static void _sax_text_child(struct saxParser *p) {
+  if (p->current >= 0)
+    p->texts[p->current].children = 1;
+}
+
+static void _sax_toc_parse(struct saxParser *p, char *tocStr, int size);
+static int _sax_parse(struct saxParser *p, struct opf *opf,
+                      const char *buffer, int size, const char *url,
+                      enum saxState state);
+
+static void _sax_spine(struct saxParser *p, struct saxNode *node) {
+  struct opf *opf = p->opf;
+
+  _epub_print_debug(opf->epub, DEBUG_INFO, "parsing spine");
+
+  if (opf->spine)
+    FreeVector(opf->spine, NULL);
+  opf->spine = NewVector(NULL);
+  opf->tocName = _sax_attribute(p, node, "toc");
+
+  if (opf->tocName) {
+    char *tocStr = NULL;
+    struct manifest *item;
+    int size;
+
+    _epub_print_debug(opf->epub, DEBUG_INFO, "toc is %s", opf->tocName);
+
+    item = _opf_manifest_get_by_id(opf, opf->tocName);
+    if (item != NULL) {
+      size = _ocf_get_data_file(opf->epub->ocf, (char *)item->href, &tocStr);
+
+      if (size <= 0)
+        _epub_print_debug(opf->epub, DEBUG_ERROR, "Faulty toc file %s",
+                          opf->tocName);
+      else
+        _sax_toc_parse(p, tocStr, size);
+      free(tocStr);
+    } else {
+      _epub_print_debug(opf->epub, DEBUG_ERROR, "Toc not in manifest (-) %s",
+                        opf->tocName);
+    }
+  } else {
+    _epub_print_debug(opf->epub, DEBUG_WARNING, "toc not found (-)");
+    if (opf->toc)
+      _opf_free_toc(opf, opf->toc);
+    opf->toc = NULL;
+  }
+}
+
+static void _sax_spine_item(struct saxParser *p, struct saxNode *node) {
+  struct opf *opf = p->opf;
+  struct spine *item = _arena_alloc(opf->arena, sizeof(struct spine));
+
+  item->idref = _sax_attribute(p, node, "idref");
+  if (_sax_attribute_is(node, "linear", "no")) {
+    item->linear = 0;
+  } else {
+    item->linear = 1;
+    opf->linearCount++;
+  }
+
+  if (_sax_attribute_is(node, "properties", "rendition:page-spread-center"))
+    item->spreadPosition = PAGE_SPREAD_CENTER;
+  else if (_sax_attribute_is(node, "properties", "page-spread-left"))
+    item->spreadPosition = PAGE_SPREAD_LEFT;
+  else if (_sax_attribute_is(node, "properties", "page-spread-right"))
+    item->spreadPosition = PAGE_SPREAD_RIGHT;
+  else
+    item->spreadPosition = PAGE_SPREAD_UNKNOWN;
+
+  AddItem(opf->spine, item);
+  _epub_print_debug(opf->epub, DEBUG_INFO, "found item %s", item->idref);
+}
+
+static void _sax_manifest_item(struct saxParser *p, struct saxNode *node) {
+  static const char *names[] = {
+    "id", "href", "media-type", "fallback", "fallback-style",
+    "required-namespace", "required-modules", "properties"
+  };
+  struct opf *opf = p->opf;
+  struct manifest *item = _arena_alloc(opf->arena, sizeof(struct manifest));
+  xmlChar **fields[8];
+
+  fields[0] = &item->id;
+  fields[1] = &item->href;
+  fields[2] = &item->type;
+  fields[3] = &item->fallback;
+  fields[4] = &item->fbStyle;
+  fields[5] = &item->nspace;
+  fields[6] = &item->modules;
+  fields[7] = &item->properties;
+  _sax_attributes(p, node, names, fields, 8);
+
+  _epub_print_debug(opf->epub, DEBUG_INFO,
+                    "manifest item %s href %s media-type %s",
+                    item->id, item->href, item->type);
+
+  AddItem(opf->manifest, item);
+}
+
+static void _sax_guide_item(struct saxParser *p, struct saxNode *node) {
+  static const char *names[] = { "type", "title", "href" };
+  struct opf *opf = p->opf;
+  struct guide *item = _arena_alloc(opf->arena, sizeof(struct guide));
+  xmlChar **fields[3];
+
+  fields[0] = &item->type;
+  fields[1] = &item->title;
+  fields[2] = &item->href;
+  _sax_attributes(p, node, names, fields, 3);
+
+  _epub_print_debug(opf->epub, DEBUG_INFO,
+                    "guide item: %s href: %s type: %s",
+                    item->title, item->href, item->type);
+  AddItem(opf->guide, item);
+}
+
+static void _sax_tour(struct saxParser *p, struct saxNode *node) {
+  static const char *names[] = { "title", "id" };
+  struct opf *opf = p->opf;
+  struct tour *item = _arena_alloc(opf->arena, sizeof(struct tour));
+  xmlChar **fields[2];
+
+  fields[0] = &item->title;
+  fields[1] = &item->id;
+  _sax_attributes(p, node, names, fields, 2);
+
+  _epub_print_debug(opf->epub, DEBUG_INFO,
+                    "tour: %s id: %s",
+                    item->title, item->id);
+  item->sites = NewVector(NULL);
+  AddItem(opf->tours, item);
+  p->tour = item;
+}
+
+static void _sax_site(struct saxParser *p, struct saxNode *node) {
+  static const char *names[] = { "title", "href" };
+  struct site *item = _arena_alloc(p->opf->arena, sizeof(struct site));
+  xmlChar **fields[2];
+
+  fields[0] = &item->title;
+  fields[1] = &item->href;
+  _sax_attributes(p, node, names, fields, 2);
+
+  _epub_print_debug(p->opf->epub, DEBUG_INFO,
+                    "site: %s href: %s",
+                    item->title, item->href);
+  AddItem(p->tour->sites, item);
+}
+
+// Follows _opf_parse and the section parsers it calls
+static void _sax_opf_node(struct saxParser *p, struct saxNode *node) {
+  struct opf *opf = p->opf;
+
+  switch (p->state) {
+  case SAX_TOP:
+    if (xmlStrcmp(node->local, (xmlChar *)"metadata") == 0) {
+      _epub_print_debug(opf->epub, DEBUG_INFO, "parsing metadata");
+      if (opf->metadata)
+        _opf_free_metadata(opf, opf->metadata);
+      _opf_init_metadata(opf);
+      p->state = SAX_METADATA;
+    } else if (xmlStrcmp(node->local, (xmlChar *)"manifest") == 0) {
+      _epub_print_debug(opf->epub, DEBUG_INFO, "parsing manifest");
+      if (opf->manifest)
+        FreeVector(opf->manifest, NULL);
+      opf->manifest = NewVector((NodeCompareFunc)_list_cmp_manifest_by_id);
+      p->state = SAX_MANIFEST;
+    } else if (xmlStrcmp(node->local, (xmlChar *)"spine") == 0) {
+      _sax_spine(p, node);
+      p->state = SAX_SPINE;
+    } else if (xmlStrcmp(node->local, (xmlChar *)"guide") == 0) {
+      _epub_print_debug(opf->epub, DEBUG_INFO, "parsing guides");
+      if (opf->guide)
+        FreeVector(opf->guide, NULL);
+      opf->guide = NewVector(NULL);
+      p->state = SAX_GUIDE;
+    } else if (xmlStrcmp(node->local, (xmlChar *)"tours") == 0) {
+      _epub_print_debug(opf->epub, DEBUG_INFO, "parsing tours");
+      if (opf->tours)
+        FreeVector(opf->tours, (ListFreeFunc)_list_free_tour_sites);
+      opf->tours = NewVector(NULL);
+      p->state = SAX_TOURS;
+    }
+    break;
+
+  case SAX_METADATA:
+    if (xmlStrcasecmp(node->local, (xmlChar *)"metadata") == 0)
+      p->state = SAX_TOP;
+    else if (node->type == 1 &&
+             xmlStrcasecmp(node->local, (xmlChar *)"dc-metadata") != 0 &&
+             xmlStrcasecmp(node->local, (xmlChar *)"x-metadata") != 0)
+      _sax_text_start(p, node, node->local, NULL);
+    break;
+
+  case SAX_MANIFEST:
+    if (xmlStrcasecmp(node->local, (xmlChar *)"manifest") == 0)
+      p->state = SAX_TOP;
+    else if (node->type == 1)
+      _sax_manifest_item(p, node);
+    break;
+
+  case SAX_SPINE:
+    if (xmlStrcasecmp(node->local, (xmlChar *)"spine") == 0)
+      p->state = SAX_TOP;
+    else if (node->type == 1)
+      _sax_spine_item(p, node);
+    break;
+
+  case SAX_GUIDE:
+    if (xmlStrcasecmp(node->local, (xmlChar *)"guide") == 0)
+      p->state = SAX_TOP;
+    else if (node->type == 1)
+      _sax_guide_item(p, node);
+    break;
+
+  case SAX_TOURS:
+    if (xmlStrcasecmp(node->local, (xmlChar *)"tours") == 0) {
+      p->state = SAX_TOP;
+    } else if (node->type == 1) {
+      _sax_tour(p, node);
+      p->state = SAX_TOUR;
+    }
+    break;
+
+  case SAX_TOUR:
+    if (xmlStrcasecmp(node->local, (xmlChar *)"tour") == 0)
+      p->state = SAX_TOURS;
+    else if (node->type == 1)
+      _sax_site(p, node);
+    break;
+
+  default:
+    break;
+  }
+}
+
+static const struct saxTocKind *_sax_toc_kind(enum saxState state) {
+  return &_sax_toc_kinds[state - SAX_NAVMAP];
+}
+
+static struct tocCategory **_sax_toc_slot(struct saxParser *p,
+                                          enum saxState state) {
+  if (state == SAX_NAVMAP)
+    return &p->opf->toc->navMap;
+  if (state == SAX_NAVLIST)
+    return &p->opf->toc->navList;
+  return &p->opf->toc->pageList;
+}
+
+// Drops an item that the reader would have lost track of
+static void _sax_toc_drop_item(struct saxParser *p) {
+  if (p->item)
+    FreeVector(p->item->label, NULL);
+  p->item = NULL;
+}
+
+static void _sax_toc_category(struct saxParser *p, struct saxNode *node,
+                              enum saxState state) {
+  static const char *parsing[] = {
+    "parsing nav map", "parsing nav list", "parsing page list"
+  };
+  static const char *names[] = { "id", "class" };
+  struct tocCategory *tc = _opf_init_toc_category();
+  xmlChar **fields[2];
+
+  fields[0] = &tc->id;
+  fields[1] = &tc->class;
+  _sax_attributes(p, node, names, fields, state == SAX_NAVMAP?1:2);
+  _epub_print_debug(p->opf->epub, DEBUG_INFO, "%s",
+                    parsing[state - SAX_NAVMAP]);
+
+  p->tc = tc;
+  p->item = NULL;
+  p->tocDepth = 0;
+  p->state = state;
+}
+
+static void _sax_toc_category_end(struct saxParser *p) {
+  struct tocCategory **slot = _sax_toc_slot(p, p->state);
+
+  // a second category of the same kind replaces the first, as with the
+  // reader, while the first one's items stay in the play order
+  _sax_toc_drop_item(p);
+  if (*slot)
+    _opf_free_toc_category(p->opf, *slot);
+  *slot = p->tc;
+  p->tc = NULL;
+
+  _epub_print_debug(p->opf->epub, DEBUG_INFO, "%s",
+                    _sax_toc_kind(p->state)->finished);
+  p->state = SAX_TOC_TOP;
+}
+
+static void _sax_toc_add(struct saxParser *p) {
+  struct tocItem *item = p->item;
+
+  _epub_print_debug(p->opf->epub, DEBUG_INFO,
+                    "adding %s item->%s %s (d:%d,p:%d)",
+                    _sax_toc_kind(p->state)->name, item->id, item->src,
+                    item->depth, item->playOrder);
+  AddItem(p->tc->items, item);
+  AddItem(p->opf->toc->playOrder, item);
+  p->item = NULL;
+}
+
+static void _sax_toc_item(struct saxParser *p, struct saxNode *node,
+                          int depth) {
+  static const char *names[] = { "id", "class", "type" };
+  struct tocItem *item = _arena_alloc(p->opf->arena, sizeof(struct tocItem));
+  xmlChar **fields[3];
+
+  memset(item, 0, sizeof(struct tocItem));
+  item->depth = depth;
+
+  fields[0] = &item->id;
+  fields[1] = &item->class;
+  fields[2] = &item->type;
+  _sax_attributes(p, node, names, fields, p->state == SAX_PAGELIST?3:2);
+
+  item->playOrder = _sax_int_attribute(node, "playOrder");
+  if (item->playOrder == -1) {
+    _epub_print_debug(p->opf->epub, DEBUG_WARNING,
+                      "- missing play order in %s element",
+                      _sax_toc_kind(p->state)->name);
+  }
+  item->value = -1;
+  if (p->state != SAX_NAVMAP)
+    item->value = _sax_int_attribute(node, "value");
+
+  p->item = item;
+}
+
+static void _sax_label(struct saxParser *p, struct saxNode *node,
+                       vectorPtr labels) {
+  static const char *names[] = { "lang", "dir" };
+  struct tocLabel *label = _arena_alloc(p->opf->arena,
+                                        sizeof(struct tocLabel));
+  xmlChar **fields[2];
+
+  fields[0] = &label->lang;
+  fields[1] = &label->dir;
+  _sax_attributes(p, node, names, fields, 2);
+  label->text = NULL;
+
+  p->label = label;
+  p->labels = labels;
+  p->labelReturn = p->state;
+  p->state = SAX_LABEL;
+}
+
+// Follows _opf_parse_navmap, _opf_parse_navlist and _opf_parse_pagelist
+static void _sax_toc_target(struct saxParser *p, struct saxNode *node) {
+  const struct saxTocKind *kind = _sax_toc_kind(p->state);
+  struct tocItem *item;
+
+  if (xmlStrcasecmp(node->name, (xmlChar *)kind->category) == 0) {
+    _sax_toc_category_end(p);
+    return;
+  }
+
+  if (xmlStrcasecmp(node->name, (xmlChar *)kind->target) == 0) {
+    if (node->type == 1) {
+      if (p->state == SAX_NAVMAP) {
+        if (p->item)
+          _sax_toc_add(p);
+        p->tocDepth++;
+      }
+      _sax_toc_drop_item(p);
+      _sax_toc_item(p, node, p->state == SAX_NAVMAP?p->tocDepth:1);
+    } else if (node->type == 15) {
+      if (p->item)
+        _sax_toc_add(p);
+      else if (p->state != SAX_NAVMAP)
+        _epub_print_debug(p->opf->epub, DEBUG_ERROR,
+                          "empty item in nav list");
+      if (p->state == SAX_NAVMAP)
+        p->tocDepth--;
+    }
+  }
+
+  if (node->type != 1)
+    return;
+
+  item = p->item;
+  if (xmlStrcasecmp(node->name, (xmlChar *)"navLabel") == 0) {
+    if (item) {
+      if (! item->label)
+        item->label = NewVector(NULL); //tocLabel
+      _sax_label(p, node, item->label);
+    } else { // Not inside navpoint
+      _sax_label(p, node, p->tc->label);
+    }
+  } else if (xmlStrcasecmp(node->name, (xmlChar *)"navInfo") == 0) {
+    _sax_label(p, node, p->tc->info);
+    if (item)
+      _epub_print_debug(p->opf->epub, DEBUG_WARNING,
+                        "nav info inside %s element", kind->name);
+  } else if (xmlStrcasecmp(node->name, (xmlChar *)"content") == 0) {
+    if (item)
+      item->src = _sax_attribute(p, node, "src");
+    else
+      _epub_print_debug(p->opf->epub, DEBUG_WARNING,
+                        "content not inside %s element", kind->name);
+  }
+}
+
+// Follows _opf_parse_toc and the category and label parsers it calls
+static void _sax_toc_node(struct saxParser *p, struct saxNode *node) {
+  switch (p->state) {
+  case SAX_TOC_TOP:
+    if (xmlStrcasecmp(node->name, (xmlChar *)"navList") == 0)
+      _sax_toc_category(p, node, SAX_NAVLIST);
+    else if (xmlStrcasecmp(node->name, (xmlChar *)"navMap") == 0)
+      _sax_toc_category(p, node, SAX_NAVMAP);
+    else if (xmlStrcasecmp(node->name, (xmlChar *)"pageList") == 0)
+      _sax_toc_category(p, node, SAX_PAGELIST);
+    break;
+
+  case SAX_LABEL:
+    if (xmlStrcasecmp(node->name, (xmlChar *)"navLabel") == 0 ||
+        xmlStrcasecmp(node->name, (xmlChar *)"navInfo") == 0) {
+      _epub_print_debug(p->opf->epub, DEBUG_INFO,
+                        "parsing label/info %s(%s/%s)",
+                        p->label->text, p->label->lang, p->label->dir);
+      AddItem(p->labels, p->label);
+      p->label = NULL;
+      p->state = p->labelReturn;
+    } else if (xmlStrcasecmp(node->name, (xmlChar *)"text") == 0 &&
+               node->type == 1) {
+      _sax_text_start(p, node, NULL, p->label);
+    }
+    break;
+
+  default:
+    _sax_toc_target(p, node);
+    break;
+  }
+}
+
+static void _sax_node(struct saxParser *p, struct saxNode *node) {
+  if (p->state >= SAX_TOC_TOP)
+    _sax_toc_node(p, node);
+  else
+    _sax_opf_node(p, node);
+}
+
+static void _sax_start_element(void *ctx, const xmlChar *localname,
+                               const xmlChar *prefix, const xmlChar *URI,
+                               int nb_namespaces, const xmlChar **namespaces,
+                               int nb_attributes, int nb_defaulted,
+                               const xmlChar **attributes) {
+  xmlParserCtxtPtr ctxt = ctx;
+  struct saxParser *p = ctxt->_private;
+  struct saxNode node;
+
+  _sax_text_child(p);
+
+  node.type = 1;
+  node.local = node.name = localname;
+  if (prefix) {
+    node.name = xmlDictQLookup(ctxt->dict, prefix, localname);
+    if (! node.name)
+      node.name = localname;
+    else if (! URI)
+      node.local = node.name;
+  }
+  node.attrs = attributes;
+  node.attrCount = nb_attributes;
+  node.empty = ctxt->input->cur[0] == '/' && ctxt->input->cur[1] == '>';
+
+  p->depth++;
+  p->empty = node.empty;
+  _sax_node(p, &node);
+}
+
+static void _sax_end_element(void *ctx, const xmlChar *localname,
+                             const xmlChar *prefix, const xmlChar *URI) {
+  xmlParserCtxtPtr ctxt = ctx;
+  struct saxParser *p = ctxt->_private;
+  struct saxNode node;
+
+  _sax_text_end(p);
+  p->depth--;
+
+  // the reader has no end node for an empty element tag
+  if (p->empty) {
+    p->empty = 0;
+    return;
+  }
+
+  node.type = 15;
+  node.local = node.name = localname;
+  if (prefix) {
+    node.name = xmlDictQLookup(ctxt->dict, prefix, localname);
+    if (! node.name)
+      node.name = localname;
+    else if (! URI)
+      node.local = node.name;
+  }
+  node.attrs = NULL;
+  node.attrCount = 0;
+  node.empty = 0;
+
+  _sax_node(p, &node);
+}
+
+static void _sax_characters(void *ctx, const xmlChar *ch, int len) {
+  struct saxParser *p = ((xmlParserCtxtPtr)ctx)->_private;
+
+  if (p->current < 0)
+    return;
+
+  _sax_text_child(p);
+  xmlBufferAdd(p->text, ch, len);
+}
+
+static void _sax_comment(void *ctx, const xmlChar *value) {
+  struct saxParser *p = ((xmlParserCtxtPtr)ctx)->_private;
+
+  _sax_text_child(p);
+}
+
+static void _sax_processing_instruction(void *ctx, const xmlChar *target,
+                                        const xmlChar *data) {
+  struct saxParser *p = ((xmlParserCtxtPtr)ctx)->_private;
+  struct saxNode node;
+
+  _sax_text_child(p);
+
+  memset(&node, 0, sizeof(struct saxNode));
+  node.type = 7;
+  node.local = node.name = target;
+  _sax_node(p, &node);
+}
+
+static void _sax_reference(void *ctx, const xmlChar *name) {
+  struct saxParser *p = ((xmlParserCtxtPtr)ctx)->_private;
+  struct saxNode node;
+
+  _sax_text_child(p);
+
+  memset(&node, 0, sizeof(struct saxNode));
+  node.type = 5;
+  node.local = node.name = name;
+  _sax_node(p, &node);
+}
+
+// Leaves a document declaring entities or attributes to the reader
+static void _sax_fallback(void *ctx) {
+  xmlParserCtxtPtr ctxt = ctx;
+  struct saxParser *p = ctxt->_private;
+
+  p->fallback = 1;
+  xmlStopParser(ctxt);
+}
+
+static void _sax_entity_decl(void *ctx, const xmlChar *name, int type,
+                             const xmlChar *publicId,
+                             const xmlChar *systemId, xmlChar *content) {
+  _sax_fallback(ctx);
+}
+
+static void _sax_unparsed_entity_decl(void *ctx, const xmlChar *name,
+                                      const xmlChar *publicId,
+                                      const xmlChar *systemId,
+                                      const xmlChar *notationName) {
+  _sax_fallback(ctx);
+}
+
+static void _sax_attribute_decl(void *ctx, const xmlChar *elem,
+                                const xmlChar *fullname, int type, int def,
+                                const xmlChar *defaultValue,
+                                xmlEnumerationPtr tree) {
+  xmlFreeEnumeration(tree);
+  _sax_fallback(ctx);
+}
+
+// Parses buffer starting in state, returns 0 if it is well formed. It is
+// pushed to the parser like the reader does, for the same errors.
+static int _sax_parse(struct saxParser *p, struct opf *opf,
+                      const char *buffer, int size, const char *url,
+                      enum saxState state) {
+  xmlSAXHandler sax;
+  xmlParserCtxtPtr ctxt;
+  int ret = -1;
+
+  memset(p, 0, sizeof(struct saxParser));
+  p->opf = opf;
+  p->state = state;
+  p->current = -1;
+
+  ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, url);
+  p->text = xmlBufferCreate();
+  if (ctxt && p->text) {
+    xmlCtxtUseOptions(ctxt, 0);
+
+    xmlSAXVersion(&sax, 2);
+    sax.startElementNs = _sax_start_element;
+    sax.endElementNs = _sax_end_element;
+    sax.characters = _sax_characters;
+    sax.ignorableWhitespace = _sax_characters;
+    sax.cdataBlock = _sax_characters;
+    sax.comment = _sax_comment;
+    sax.processingInstruction = _sax_processing_instruction;
+    sax.reference = _sax_reference;
+    sax.entityDecl = _sax_entity_decl;
+    sax.unparsedEntityDecl = _sax_unparsed_entity_decl;
+    sax.attributeDecl = _sax_attribute_decl;
+    memcpy(ctxt->sax, &sax, sizeof(xmlSAXHandler));
+    ctxt->_private = p;
+    p->ctxt = ctxt;
+
+    xmlParseChunk(ctxt, buffer, size, 1);
+    if (ctxt->wellFormed)
+      ret = 0;
+    xmlFreeDoc(ctxt->myDoc);
+    ctxt->myDoc = NULL;
+  }
+
+  if (ctxt)
+    xmlFreeParserCtxt(ctxt);
+  p->ctxt = NULL;
+  xmlBufferFree(p->text);
+  free(p->texts);
+
+  return ret;
+}
+
+static void _sax_toc_parse(struct saxParser *p, char *tocStr, int size) {
+  struct opf *opf = p->opf;
+  struct saxParser toc;
+  int ret;
+
+  _epub_print_debug(opf->epub, DEBUG_INFO, "building toc");
+
+  if (opf->toc)
+    _opf_free_toc(opf, opf->toc);
+  opf->toc = _opf_init_toc();
+
+  _epub_print_debug(opf->epub, DEBUG_INFO, "parsing toc");
+
+  ret = _sax_parse(&toc, opf, tocStr, size, "TOC", SAX_TOC_TOP);
+
+  // what the reader makes of a broken toc depends on how far it read
+  // ahead, so it reads those itself
+  if (toc.fallback || ret != 0) {
+    _sax_toc_drop_item(&toc);
+    if (toc.tc)
+      _opf_free_toc_category(opf, toc.tc);
+    p->fallback = 1;
+    xmlStopParser(p->ctxt);
+    return;
+  }
+
+  // the toc ended in a label or a category
+  if (toc.state == SAX_LABEL) {
+    AddItem(toc.labels, NULL);
+    toc.state = toc.labelReturn;
+  }
+  if (toc.state != SAX_TOC_TOP)
+    _sax_toc_category_end(&toc);
+
+  SortVector(opf->toc->playOrder);
+  _epub_print_debug(opf->epub, DEBUG_INFO, "finished parsing toc");
+}
+
+struct opf *_sax_parse_opf(struct epub *epub, char *opfStr) {
+  struct saxParser p;
+  struct opf *opf;
+  int ret;
+
+  _epub_print_debug(epub, DEBUG_INFO, "building opf struct");
+
+  opf = malloc(sizeof(struct opf));
+  if (!opf) {
+    _epub_err_set_oom(&epub->error);
+    return NULL;
+  }
+  memset(opf, 0, sizeof(struct opf));
+  opf->epub = epub;
+  opf->arena = _arena_new();
+  if (! opf->arena) {
+    free(opf);
+    _epub_err_set_oom(&epub->error);
+    return NULL;
+  }
+
+  ret = _sax_parse(&p, opf, opfStr, strlen(opfStr), "OPF", SAX_TOP);
+
+  if (p.fallback) {
+    _opf_close(opf);
+    _epub_print_debug(epub, DEBUG_INFO, "opf or toc left to the reader");
+    return _opf_parse(epub, opfStr);
+  }
+  if (ret != 0) {
+    _epub_print_debug(epub, DEBUG_ERROR, "failed to parse OPF");
+    _opf_close(opf);
+    return NULL;
+  } else if (! opf->spine) {
+    _epub_print_debug(epub, DEBUG_ERROR, "Ilegal OPF no spine found");
+    _opf_close(opf);
+    return NULL;
+  }
+
+  _opf_build_indexes(opf);
+
+  return opf;
+}
@@ -0,0 +1,204 @@
+#include "epub.h"
+#include "epublib.h"
+
+// Bytes of context reported on each side of a match
+#define SEARCH_CONTEXT 40
+
+// A document's text as far as it is still needed
+struct searchState {
+  struct epub *epub;
+  const char *pattern;
+  int patternLen;
+  int flags;
+  epub_search_callback callback;
+  void *data;
+
+  int spine;
+  char *buf;
+  int len;
+  int from; // where in buf the search goes on
+  int base; // text offset of buf[0] in the document
+  char *context;
+  int count;
+  int stop;
+};
+
+static char _search_lower(char c) {
+  return (c >= 'A' && c <= 'Z')?c - 'A' + 'a':c;
+}
+
+static int _search_equal(struct searchState *s, const char *str) {
+  int i;
+
+  if (! (s->flags & EPUB_SEARCH_CASELESS))
+    return memcmp(str, s->pattern, s->patternLen) == 0;
+
+  for (i = 0; i < s->patternLen; i++)
+    if (_search_lower(str[i]) != s->pattern[i])
+      return 0;
+
+  return 1;
+}
+
+// Returns the first match in buf[from, len) or -1. memchr finds the
+// candidates, which libc does a word or vector at a time.
+static int _search_find(struct searchState *s, int from) {
+  const char *end = s->buf + s->len - s->patternLen + 1;
+  const char *str = s->buf + from;
+  char first = s->pattern[0];
+  char upper = (first >= 'a' && first <= 'z')?first - 'a' + 'A':first;
+  const char *hit, *other;
+
+  while (str < end) {
+    hit = memchr(str, first, end - str);
+    if ((s->flags & EPUB_SEARCH_CASELESS) && upper != first) {
+      other = memchr(str, upper, (hit?hit:end) - str);
+      if (other)
+        hit = other;
+    }
+    if (! hit)
+      return -1;
+
+    if (_search_equal(s, hit))
+      return hit - s->buf;
+    str = hit + 1;
+  }
+
+  return -1;
+}
+
+static void _search_report(struct searchState *s, int match) {
+  struct epub_search_result result;
+  int start = match - SEARCH_CONTEXT;
+  int end = match + s->patternLen + SEARCH_CONTEXT;
+  int i;
+
+  if (start < 0)
+    start = 0;
+  if (end > s->len)
+    end = s->len;
+
+  // don't cut utf-8 characters
+  while (start < match && (s->buf[start] & 0xC0) == 0x80)
+    start++;
+  while (end > match + s->patternLen && end < s->len &&
+         (s->buf[end] & 0xC0) == 0x80)
+    end--;
+
+  for (i = start; i < end; i++)
+    s->context[i - start] = (s->buf[i] == '\n')?' ':s->buf[i];
+  s->context[end - start] = 0;
+
+  result.spine = s->spine;
+  result.offset = s->base + match;
+  result.context = s->context;
+  result.contextOffset = match - start;
+
+  s->count++;
+  if (s->callback(&result, s->data))
+    s->stop = 1;
+}
+
+// Reports the matches in the buffered text. Unless the document ended
+// it keeps what later matches and their context need.
+static void _search_run(struct searchState *s, int final) {
+  int match = -1, keep;
+
+  while (! s->stop && (match = _search_find(s, s->from)) >= 0) {
+    if (! final && match + s->patternLen + SEARCH_CONTEXT > s->len) {
+      s->from = match;
+      break;
+    }
+    _search_report(s, match);
+    s->from = match + s->patternLen;
+  }
+
+  if (final || s->stop) {
+    s->base += s->len;
+    s->len = 0;
+    s->from = 0;
+    return;
+  }
+
+  if (match < 0 && s->from < s->len - s->patternLen + 1)
+    s->from = s->len - s->patternLen + 1;
+  if (s->from < 0)
+    s->from = 0;
+
+  keep = s->from - SEARCH_CONTEXT;
+  if (keep > 0) {
+    memmove(s->buf, s->buf + keep, s->len - keep);
+    s->len -= keep;
+    s->from -= keep;
+    s->base += keep;
+  }
+}
+
+int epub_search(struct epub *epub, const char *pattern, int flags,
+                epub_search_callback callback, void *data) {
+  struct searchState s;
+  struct textiterator *it;
+  const char *text;
+  char *pat;
+  int len, i;
+
+  if (!epub || !pattern || !callback) {
+    return -1;
+  }
+
+  memset(&s, 0, sizeof(struct searchState));
+  s.epub = epub;
+  s.patternLen = strlen(pattern);
+  s.flags = flags;
+  s.callback = callback;
+  s.data = data;
+  s.spine = -1;
+
+  if (s.patternLen == 0)
+    return 0;
+
+  it = epub_get_text_iterator(epub, EITERATOR_SPINE, 0);
+  if (! it)
+    return -1;
+
+  pat = malloc(s.patternLen + 1);
+  s.buf = malloc(2 * SEARCH_CONTEXT + s.patternLen +
+                 TEXT_OUT_SIZE(TEXT_CHUNK_SIZE));
+  s.context = malloc(2 * SEARCH_CONTEXT + s.patternLen + 1);
+  if (! pat || ! s.buf || ! s.context) {
+    _epub_err_set_oom(&epub->error);
+    free(pat);
+    free(s.buf);
+    free(s.context);
+    epub_free_text_iterator(it);
+    return -1;
+  }
+
+  for (i = 0; i < s.patternLen; i++)
+    pat[i] = (flags & EPUB_SEARCH_CASELESS)?_search_lower(pattern[i]):pattern[i];
+  pat[s.patternLen] = 0;
+  s.pattern = pat;
+
+  while (! s.stop && (text = epub_text_it_next(it, &len))) {
+    int spine = epub_text_it_get_curr_index(it);
+
+    if (spine != s.spine) {
+      _search_run(&s, 1);
+      s.spine = spine;
+      s.base = 0;
+    }
+
+    memcpy(s.buf + s.len, text, len);
+    s.len += len;
+    _search_run(&s, 0);
+  }
+  if (! s.stop)
+    _search_run(&s, 1);
+
+  epub_free_text_iterator(it);
+  free(pat);
+  free(s.buf);
+  free(s.context);
+
+  return s.count;
+}
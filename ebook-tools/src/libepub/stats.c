@@ -0,0 +1,107 @@
+#include "epub.h"
+#include "epublib.h"
+
+// Words read in a minute for the reading time
+#define STATS_WORDS_PER_MINUTE 250
+
+// Counts the characters and words of a piece of a document's text
+static void _stats_count(struct epub_spine_stats *stats, int *inWord,
+                         const char *text, int len) {
+  int i;
+
+  for (i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)text[i];
+
+    if ((c & 0xC0) != 0x80)
+      stats->chars++;
+
+    // words are separated by whitespace and have a letter or digit
+    if (c == ' ' || c == '\n' || c == '\t' || c == '\r') {
+      *inWord = 0;
+    } else if (! *inWord && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                             (c >= '0' && c <= '9') || c >= 0x80)) {
+      *inWord = 1;
+      stats->words++;
+    }
+  }
+}
+
+// Reads one spine document through the text extractor
+int _stats_document(struct epub *epub, int index, char *in, char *out,
+                     struct epub_spine_stats *stats) {
+  struct textparser parser;
+  struct textdoc *doc;
+  zip_int64_t size;
+  int inWord = 0, len;
+
+  doc = _text_open(epub, index);
+  if (! doc)
+    return 0;
+
+  _text_init(&parser);
+  while ((size = _text_read(doc, in, TEXT_CHUNK_SIZE)) > 0) {
+    stats->size += size;
+    len = _text_parse(&parser, in, size, out);
+    _stats_count(stats, &inWord, out, len);
+  }
+  stats->images = parser.images;
+
+  _text_close(doc);
+  return (size == 0);
+}
+
+struct epub_stats *epub_compute_stats(struct epub *epub, int opt) {
+  struct epub_stats *stats;
+  char *in, *out;
+  int i;
+
+  (void)opt;
+  if (!epub) {
+    return NULL;
+  }
+
+  stats = calloc(1, sizeof(struct epub_stats));
+  in = malloc(TEXT_CHUNK_SIZE);
+  out = malloc(TEXT_OUT_SIZE(TEXT_CHUNK_SIZE));
+  if (stats) {
+    stats->spineCount = epub->opf->spine->Size;
+    stats->spine = calloc(stats->spineCount + 1,
+                          sizeof(struct epub_spine_stats));
+  }
+  if (! stats || ! stats->spine || ! in || ! out) {
+    _epub_err_set_oom(&epub->error);
+    epub_free_stats(stats);
+    free(in);
+    free(out);
+    return NULL;
+  }
+
+  for (i = 0; i < stats->spineCount; i++) {
+    struct epub_spine_stats *doc = &stats->spine[i];
+
+    if (! _stats_document(epub, i, in, out, doc))
+      _epub_print_debug(epub, DEBUG_WARNING,
+                        "failed reading spine document %d", i);
+
+    stats->total.size += doc->size;
+    stats->total.chars += doc->chars;
+    stats->total.words += doc->words;
+    stats->total.images += doc->images;
+  }
+
+  stats->readingMinutes =
+    (stats->total.words + STATS_WORDS_PER_MINUTE - 1) / STATS_WORDS_PER_MINUTE;
+
+  free(in);
+  free(out);
+  return stats;
+}
+
+void epub_free_stats(struct epub_stats *stats) {
+  if (!stats) {
+    return;
+  }
+
+  free(stats->spine);
+  free(stats);
+}
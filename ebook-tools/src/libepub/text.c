@@ -0,0 +1,746 @@
+#include "epublib.h"
+
+// Where the text extractor is in the markup
+enum {
+  TEXT_DATA,
+  TEXT_ENTITY, // after '&'
+  TEXT_TAG_OPEN, // after '<'
+  TEXT_TAG_NAME,
+  TEXT_TAG_ATTRS,
+  TEXT_TAG_QUOTE, // inside an attribute value
+  TEXT_DECL, // after "<!"
+  TEXT_COMMENT,
+  TEXT_CDATA,
+  TEXT_PI, // after "<?"
+  TEXT_BOGUS // doctype and other declarations
+};
+
+// Separators pending before the next text
+enum {
+  TEXT_SPACE_NONE,
+  TEXT_SPACE_WORD,
+  TEXT_SPACE_LINE
+};
+
+// How elements change the text flow
+enum {
+  TEXT_TAG_INLINE,
+  TEXT_TAG_BLOCK, // on a line of its own
+  TEXT_TAG_CELL, // separated by a space
+  TEXT_TAG_PRE, // on a line of its own, keeping its whitespace
+  TEXT_TAG_SKIP, // its content is no text
+  TEXT_TAG_IMAGE // counted in images
+};
+
+struct textTag {
+  const char *name;
+  int kind;
+};
+
+// sorted by name
+static const struct textTag _text_tags[] = {
+  {"address", TEXT_TAG_BLOCK},
+  {"article", TEXT_TAG_BLOCK},
+  {"aside", TEXT_TAG_BLOCK},
+  {"blockquote", TEXT_TAG_BLOCK},
+  {"br", TEXT_TAG_BLOCK},
+  {"caption", TEXT_TAG_BLOCK},
+  {"dd", TEXT_TAG_BLOCK},
+  {"div", TEXT_TAG_BLOCK},
+  {"dl", TEXT_TAG_BLOCK},
+  {"dt", TEXT_TAG_BLOCK},
+  {"figcaption", TEXT_TAG_BLOCK},
+  {"figure", TEXT_TAG_BLOCK},
+  {"footer", TEXT_TAG_BLOCK},
+  {"h1", TEXT_TAG_BLOCK},
+  {"h2", TEXT_TAG_BLOCK},
+  {"h3", TEXT_TAG_BLOCK},
+  {"h4", TEXT_TAG_BLOCK},
+  {"h5", TEXT_TAG_BLOCK},
+  {"h6", TEXT_TAG_BLOCK},
+  {"head", TEXT_TAG_SKIP},
+  {"header", TEXT_TAG_BLOCK},
+  {"hr", TEXT_TAG_BLOCK},
+  {"image", TEXT_TAG_IMAGE},
+  {"img", TEXT_TAG_IMAGE},
+  {"li", TEXT_TAG_BLOCK},
+  {"nav", TEXT_TAG_BLOCK},
+  {"ol", TEXT_TAG_BLOCK},
+  {"p", TEXT_TAG_BLOCK},
+  {"pre", TEXT_TAG_PRE},
+  {"script", TEXT_TAG_SKIP},
+  {"section", TEXT_TAG_BLOCK},
+  {"style", TEXT_TAG_SKIP},
+  {"table", TEXT_TAG_BLOCK},
+  {"td", TEXT_TAG_CELL},
+  {"th", TEXT_TAG_CELL},
+  {"title", TEXT_TAG_SKIP},
+  {"tr", TEXT_TAG_BLOCK},
+  {"ul", TEXT_TAG_BLOCK}
+};
+
+struct textEntity {
+  const char *name;
+  unsigned long code;
+};
+
+// sorted by name, the xml ones and the common typographic ones
+static const struct textEntity _text_entities[] = {
+  {"amp", 38},
+  {"apos", 39},
+  {"bull", 8226},
+  {"copy", 169},
+  {"deg", 176},
+  {"emsp", 8195},
+  {"ensp", 8194},
+  {"euro", 8364},
+  {"gt", 62},
+  {"hellip", 8230},
+  {"iexcl", 161},
+  {"iquest", 191},
+  {"laquo", 171},
+  {"ldquo", 8220},
+  {"lsaquo", 8249},
+  {"lsquo", 8216},
+  {"lt", 60},
+  {"mdash", 8212},
+  {"middot", 183},
+  {"nbsp", 160},
+  {"ndash", 8211},
+  {"para", 182},
+  {"quot", 34},
+  {"raquo", 187},
+  {"rdquo", 8221},
+  {"reg", 174},
+  {"rsaquo", 8250},
+  {"rsquo", 8217},
+  {"sect", 167},
+  {"shy", 173},
+  {"thinsp", 8201},
+  {"times", 215},
+  {"trade", 8482},
+  {"zwj", 8205},
+  {"zwnj", 8204}
+};
+
+#define TEXT_COUNT(array) ((int)(sizeof(array) / sizeof((array)[0])))
+
+static int _text_is_space(char c) {
+  return (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f');
+}
+
+static int _text_is_name_start(char c) {
+  return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          c == '_' || c == ':' || (unsigned char)c >= 0x80);
+}
+
+static int _text_is_entity_char(char c) {
+  return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') || c == '#');
+}
+
+static int _text_tag_kind(struct textparser *p) {
+  int low = 0, high = TEXT_COUNT(_text_tags) - 1, mid, res;
+
+  if (p->nameLen > TEXT_NAME_MAX)
+    return TEXT_TAG_INLINE;
+
+  p->name[p->nameLen] = 0;
+  while (low <= high) {
+    mid = (low + high) / 2;
+    res = strcmp(_text_tags[mid].name, p->name);
+    if (res == 0)
+      return _text_tags[mid].kind;
+    if (res < 0)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+
+  return TEXT_TAG_INLINE;
+}
+
+// Writes c as utf-8 and returns its length, 0 if it is no character
+static int _text_utf8(unsigned long c, char *out) {
+  if (c == 0 || (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+    return 0;
+
+  if (c < 0x80) {
+    out[0] = (char)c;
+    return 1;
+  }
+  if (c < 0x800) {
+    out[0] = (char)(0xC0 | (c >> 6));
+    out[1] = (char)(0x80 | (c & 0x3F));
+    return 2;
+  }
+  if (c < 0x10000) {
+    out[0] = (char)(0xE0 | (c >> 12));
+    out[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (c & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (c >> 18));
+  out[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (c & 0x3F));
+  return 4;
+}
+
+// Decodes the collected entity into out, returns its length or 0
+static int _text_decode_entity(struct textparser *p, char *out) {
+  unsigned long code = 0;
+  int i, low, high, mid, res;
+
+  p->entity[p->entityLen] = 0;
+
+  if (p->entity[0] == '#') {
+    int hex = (p->entity[1] == 'x' || p->entity[1] == 'X');
+
+    i = hex?2:1;
+    if (i >= p->entityLen)
+      return 0;
+
+    for (; i < p->entityLen; i++) {
+      char c = p->entity[i];
+
+      if (c >= '0' && c <= '9')
+        code = code * (hex?16:10) + (c - '0');
+      else if (hex && c >= 'a' && c <= 'f')
+        code = code * 16 + (c - 'a' + 10);
+      else if (hex && c >= 'A' && c <= 'F')
+        code = code * 16 + (c - 'A' + 10);
+      else
+        return 0;
+
+      if (code > 0x10FFFF)
+        return 0;
+    }
+
+    return _text_utf8(code, out);
+  }
+
+  low = 0;
+  high = TEXT_COUNT(_text_entities) - 1;
+  while (low <= high) {
+    mid = (low + high) / 2;
+    res = strcmp(_text_entities[mid].name, p->entity);
+    if (res == 0)
+      return _text_utf8(_text_entities[mid].code, out);
+    if (res < 0)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+
+  return 0;
+}
+
+// Writes text, collapsing whitespace unless inside a pre element
+static char *_text_chars(struct textparser *p, char *out,
+                         const char *str, const char *end) {
+  const char *run;
+
+  if (! p->root || p->skip)
+    return out;
+
+  while (str < end) {
+    if (! p->pre && _text_is_space(*str)) {
+      if (p->space == TEXT_SPACE_NONE)
+        p->space = TEXT_SPACE_WORD;
+      str++;
+      continue;
+    }
+
+    run = str + 1;
+    if (p->pre)
+      run = end;
+    else
+      while (run < end && ! _text_is_space(*run))
+        run++;
+
+    if (p->started && p->space != TEXT_SPACE_NONE)
+      *out++ = (p->space == TEXT_SPACE_LINE)?'\n':' ';
+    p->space = TEXT_SPACE_NONE;
+    p->started = 1;
+
+    memcpy(out, str, run - str);
+    out += run - str;
+    str = run;
+  }
+
+  return out;
+}
+
+// Writes what an unknown entity stood for
+static char *_text_entity_literal(struct textparser *p, char *out, int term) {
+  char amp = '&', semi = ';';
+
+  out = _text_chars(p, out, &amp, &amp + 1);
+  out = _text_chars(p, out, p->entity, p->entity + p->entityLen);
+  if (term)
+    out = _text_chars(p, out, &semi, &semi + 1);
+
+  return out;
+}
+
+static void _text_end_tag(struct textparser *p) {
+  int kind = _text_tag_kind(p);
+
+  if (! p->closing)
+    p->root = 1;
+
+  if (kind == TEXT_TAG_SKIP) {
+    if (p->closing) {
+      if (p->skip > 0)
+        p->skip--;
+    } else if (! p->empty) {
+      p->skip++;
+    }
+  } else if (kind == TEXT_TAG_PRE) {
+    if (p->closing) {
+      if (p->pre > 0)
+        p->pre--;
+    } else if (! p->empty) {
+      p->pre++;
+    }
+  }
+
+  if (kind == TEXT_TAG_IMAGE && ! p->closing && ! p->skip)
+    p->images++;
+
+  if (kind == TEXT_TAG_BLOCK || kind == TEXT_TAG_PRE)
+    p->space = TEXT_SPACE_LINE;
+  else if (kind == TEXT_TAG_CELL && p->space == TEXT_SPACE_NONE)
+    p->space = TEXT_SPACE_WORD;
+}
+
+void _text_init(struct textparser *p) {
+  memset(p, 0, sizeof(struct textparser));
+  p->state = TEXT_DATA;
+}
+
+// Prepares for the next spine document, whose text stands on its own
+void _text_new_document(struct textparser *p) {
+  _text_init(p);
+}
+
+// Strips the markup of len bytes of an xhtml document, which may be
+// any piece of it, decodes entities and collapses whitespace. Writes
+// at most TEXT_OUT_SIZE(len) bytes of utf-8 text to out and returns
+// how many.
+int _text_parse(struct textparser *p, const char *in, int len, char *out) {
+  const char *end = in + len;
+  const char *stop;
+  char *start = out;
+  char c;
+
+  while (in < end) {
+    switch (p->state) {
+    case TEXT_DATA:
+      // memchr is the fast way past the text and skipped content
+      stop = memchr(in, '<', end - in);
+      if (! stop)
+        stop = end;
+      if (p->root && ! p->skip) {
+        const char *amp = memchr(in, '&', stop - in);
+
+        if (amp)
+          stop = amp;
+        out = _text_chars(p, out, in, stop);
+      }
+      in = stop;
+      if (in < end) {
+        if (*in == '&') {
+          p->entityLen = 0;
+          p->state = TEXT_ENTITY;
+        } else {
+          p->state = TEXT_TAG_OPEN;
+        }
+        in++;
+      }
+      break;
+
+    case TEXT_ENTITY:
+      c = *in;
+      if (c == ';') {
+        char code[4];
+        int size = _text_decode_entity(p, code);
+
+        if (size)
+          out = _text_chars(p, out, code, code + size);
+        else
+          out = _text_entity_literal(p, out, 1);
+        p->state = TEXT_DATA;
+        in++;
+      } else if (_text_is_entity_char(c) && p->entityLen < TEXT_ENTITY_MAX) {
+        p->entity[p->entityLen++] = c;
+        in++;
+      } else {
+        out = _text_entity_literal(p, out, 0);
+        p->state = TEXT_DATA;
+      }
+      break;
+
+    case TEXT_TAG_OPEN:
+      c = *in;
+      p->nameLen = 0;
+      p->empty = 0;
+      if (c == '/') {
+        p->closing = 1;
+        p->state = TEXT_TAG_NAME;
+        in++;
+      } else if (c == '!') {
+        p->entityLen = 0;
+        p->state = TEXT_DECL;
+        in++;
+      } else if (c == '?') {
+        p->marks = 0;
+        p->state = TEXT_PI;
+        in++;
+      } else if (_text_is_name_start(c)) {
+        p->closing = 0;
+        p->state = TEXT_TAG_NAME;
+      } else {
+        // a stray '<' is text
+        char lt = '<';
+
+        out = _text_chars(p, out, &lt, &lt + 1);
+        p->state = TEXT_DATA;
+      }
+      break;
+
+    case TEXT_TAG_NAME:
+      c = *in;
+      if (_text_is_space(c) || c == '/' || c == '>') {
+        p->state = TEXT_TAG_ATTRS;
+        break;
+      }
+      // the local name is enough
+      if (c == ':')
+        p->nameLen = 0;
+      else if (p->nameLen <= TEXT_NAME_MAX)
+        p->name[p->nameLen++] = (c >= 'A' && c <= 'Z')?c - 'A' + 'a':c;
+      in++;
+      break;
+
+    case TEXT_TAG_ATTRS:
+      c = *in++;
+      if (c == '>') {
+        _text_end_tag(p);
+        p->state = TEXT_DATA;
+      } else if (c == '"' || c == '\'') {
+        p->quote = c;
+        p->empty = 0;
+        p->state = TEXT_TAG_QUOTE;
+      } else if (c == '/') {
+        p->empty = 1;
+      } else if (! _text_is_space(c)) {
+        p->empty = 0;
+      }
+      break;
+
+    case TEXT_TAG_QUOTE:
+      stop = memchr(in, p->quote, end - in);
+      if (stop) {
+        p->state = TEXT_TAG_ATTRS;
+        in = stop + 1;
+      } else {
+        in = end;
+      }
+      break;
+
+    case TEXT_DECL:
+      c = *in++;
+      p->entity[p->entityLen++] = c;
+      if (p->entityLen == 2 && memcmp(p->entity, "--", 2) == 0) {
+        p->marks = 0;
+        p->state = TEXT_COMMENT;
+      } else if (memcmp(p->entity, "[CDATA[", p->entityLen) == 0) {
+        if (p->entityLen == 7) {
+          p->marks = 0;
+          p->state = TEXT_CDATA;
+        }
+      } else if (p->entityLen > 1 || c != '-') {
+        p->state = (c == '>')?TEXT_DATA:TEXT_BOGUS;
+      }
+      break;
+
+    case TEXT_COMMENT:
+      if (! p->marks) {
+        stop = memchr(in, '-', end - in);
+        if (! stop) {
+          in = end;
+          break;
+        }
+        in = stop;
+      }
+      c = *in++;
+      if (c == '-')
+        p->marks++;
+      else if (c == '>' && p->marks >= 2)
+        p->state = TEXT_DATA;
+      else
+        p->marks = 0;
+      break;
+
+    case TEXT_CDATA:
+      if (! p->marks) {
+        stop = memchr(in, ']', end - in);
+        if (! stop)
+          stop = end;
+        out = _text_chars(p, out, in, stop);
+        in = stop;
+        if (in == end)
+          break;
+      }
+      c = *in;
+      if (c == ']') {
+        // a third ']' and on are text
+        if (p->marks == 2)
+          out = _text_chars(p, out, in, in + 1);
+        else
+          p->marks++;
+        in++;
+      } else if (c == '>' && p->marks == 2) {
+        p->state = TEXT_DATA;
+        in++;
+      } else {
+        const char brackets[] = "]]";
+
+        out = _text_chars(p, out, brackets, brackets + p->marks);
+        p->marks = 0;
+      }
+      break;
+
+    case TEXT_PI:
+      c = *in++;
+      if (c == '>' && p->marks)
+        p->state = TEXT_DATA;
+      else
+        p->marks = (c == '?');
+      break;
+
+    case TEXT_BOGUS:
+      stop = memchr(in, '>', end - in);
+      if (stop) {
+        p->state = TEXT_DATA;
+        in = stop + 1;
+      } else {
+        in = end;
+      }
+      break;
+    }
+  }
+
+  return out - start;
+}
+
+// Returns the encoding named by the xml declaration at the start of
+// the document, or NULL if it names none
+static char *_text_declared_encoding(const char *head, int len,
+                                     char *name, int size) {
+  const char *end, *p;
+  char quote;
+  int n;
+
+  if (len < 5 || memcmp(head, "<?xml", 5) != 0)
+    return NULL;
+  end = memchr(head, '>', len);
+  if (! end)
+    return NULL;
+
+  for (p = head + 5; p + 8 < end; p++)
+    if (memcmp(p, "encoding", 8) == 0)
+      break;
+  if (p + 8 >= end)
+    return NULL;
+  for (p += 8; p < end && (_text_is_space(*p) || *p == '='); p++)
+    ;
+  if (p == end || (*p != '"' && *p != '\''))
+    return NULL;
+
+  quote = *p++;
+  for (n = 0; p + n < end && p[n] != quote; n++)
+    ;
+  if (p + n == end || n == 0 || n >= size)
+    return NULL;
+  memcpy(name, p, n);
+  name[n] = 0;
+
+  return name;
+}
+
+// Looks at the start of the document for a byte order mark or an xml
+// declaration naming another encoding than utf-8. Returns 0 if it is in
+// one libxml2 can't decode.
+static int _text_find_encoder(struct textdoc *doc) {
+  const unsigned char *head = (unsigned char *)doc->head;
+  xmlCharEncoding enc;
+  char name[64];
+
+  enc = xmlDetectCharEncoding(head, doc->headLen);
+  if (enc == XML_CHAR_ENCODING_NONE || enc == XML_CHAR_ENCODING_UTF8) {
+    // an 8 bit document, which can't declare itself utf-16 or ucs-4
+    if (! _text_declared_encoding(doc->head, doc->headLen, name,
+                                  sizeof(name)))
+      return 1;
+    enc = xmlParseCharEncoding(name);
+    if (enc == XML_CHAR_ENCODING_UTF8 || enc == XML_CHAR_ENCODING_ASCII ||
+        enc == XML_CHAR_ENCODING_UTF16LE || enc == XML_CHAR_ENCODING_UTF16BE ||
+        enc == XML_CHAR_ENCODING_UCS4LE || enc == XML_CHAR_ENCODING_UCS4BE)
+      return 1;
+    doc->encoder = xmlFindCharEncodingHandler(name);
+  } else {
+    doc->encoder = xmlGetCharEncodingHandler(enc);
+
+    // the utf-16 byte order mark is no text
+    if ((head[0] == 0xFF && head[1] == 0xFE) ||
+        (head[0] == 0xFE && head[1] == 0xFF)) {
+      doc->headLen -= 2;
+      memmove(doc->head, doc->head + 2, doc->headLen);
+    }
+  }
+
+  return (doc->encoder != NULL);
+}
+
+void _text_close(struct textdoc *doc) {
+  if (! doc)
+    return;
+
+  if (doc->file)
+    zip_fclose(doc->file);
+  if (doc->encoder)
+    xmlCharEncCloseFunc(doc->encoder);
+  if (doc->raw)
+    xmlBufferFree(doc->raw);
+  if (doc->decoded)
+    xmlBufferFree(doc->decoded);
+  free(doc);
+}
+
+// Decodes what it can of the raw bytes
+static int _text_decode(struct textdoc *doc) {
+  int before, ret;
+
+  while ((before = xmlBufferLength(doc->raw)) > 0) {
+    // no encoding makes more than 3 bytes of utf-8 of a byte
+    if (xmlBufferGrow(doc->decoded, 3 * before + 4) < 0)
+      return 0;
+    ret = xmlCharEncInFunc(doc->encoder, doc->decoded, doc->raw);
+    if (xmlBufferLength(doc->raw) < before)
+      continue;
+
+    // a byte that isn't in the encoding becomes U+FFFD; otherwise the
+    // rest is the start of a character
+    if (ret != -2)
+      break;
+    xmlBufferShrink(doc->raw, 1);
+    xmlBufferAdd(doc->decoded, (xmlChar *)"\xEF\xBF\xBD", 3);
+  }
+
+  return 1;
+}
+
+// Opens a spine document for reading its markup as utf-8. Returns NULL
+// if it can't be read or is in an encoding libxml2 doesn't know.
+struct textdoc *_text_open(struct epub *epub, int index) {
+  struct textdoc *doc;
+  zip_int64_t size;
+
+  doc = malloc(sizeof(struct textdoc));
+  if (! doc) {
+    _epub_err_set_oom(&epub->error);
+    return NULL;
+  }
+  memset(doc, 0, sizeof(struct textdoc));
+  doc->epub = epub;
+  doc->index = index;
+
+  doc->file = _ocf_open_data_file(epub->ocf, _get_spine_url(epub, index));
+  if (! doc->file) {
+    _text_close(doc);
+    return NULL;
+  }
+
+  size = zip_fread(doc->file, doc->head, TEXT_DETECT_SIZE);
+  if (size < 0) {
+    _text_close(doc);
+    return NULL;
+  }
+  doc->headLen = size;
+
+  if (! _text_find_encoder(doc)) {
+    _epub_print_debug(epub, DEBUG_WARNING,
+                      "skipping spine document %d in an unknown encoding",
+                      index);
+    _text_close(doc);
+    return NULL;
+  }
+
+  if (doc->encoder) {
+    _epub_print_debug(epub, DEBUG_INFO, "decoding spine document %d",
+                      index);
+    doc->raw = xmlBufferCreate();
+    doc->decoded = xmlBufferCreate();
+    if (! doc->raw || ! doc->decoded ||
+        xmlBufferAdd(doc->raw, (xmlChar *)doc->head, doc->headLen) != 0 ||
+        ! _text_decode(doc)) {
+      _epub_err_set_oom(&epub->error);
+      _text_close(doc);
+      return NULL;
+    }
+    doc->headLen = 0;
+  }
+
+  return doc;
+}
+
+// Reads up to len bytes of the document as utf-8 to buf, returns how
+// many, 0 at its end and -1 on error
+zip_int64_t _text_read(struct textdoc *doc, char *buf, int len) {
+  zip_int64_t size;
+  int n;
+
+  if (! doc->encoder) {
+    n = (doc->headLen < len)?doc->headLen:len;
+    memcpy(buf, doc->head, n);
+    doc->headLen -= n;
+    memmove(doc->head, doc->head + n, doc->headLen);
+    if (n == len)
+      return n;
+
+    size = zip_fread(doc->file, buf + n, len - n);
+    if (size < 0 && n == 0)
+      return -1;
+    return n + ((size > 0)?size:0);
+  }
+
+  while (xmlBufferLength(doc->decoded) == 0) {
+    size = zip_fread(doc->file, buf, len);
+    if (size < 0)
+      return -1;
+    if (size == 0) {
+      if (xmlBufferLength(doc->raw) > 0)
+        _epub_print_debug(doc->epub, DEBUG_WARNING,
+                          "spine document %d ends inside a character",
+                          doc->index);
+      return 0;
+    }
+
+    if (xmlBufferAdd(doc->raw, (xmlChar *)buf, size) != 0 ||
+        ! _text_decode(doc)) {
+      _epub_err_set_oom(&doc->epub->error);
+      return -1;
+    }
+  }
+
+  n = xmlBufferLength(doc->decoded);
+  if (n > len)
+    n = len;
+  memcpy(buf, xmlBufferContent(doc->decoded), n);
+  xmlBufferShrink(doc->decoded, n);
+
+  return n;
+}
@@ -0,0 +1,492 @@
+#include "epublib.h"
+
+// One row of a toc category before it is compiled
+struct tocRow {
+  const xmlChar *label;
+  const xmlChar *link;
+  int depth;
+};
+
+static int _toc_add_row(struct tocRow *rows, int size, const xmlChar *label,
+                        const xmlChar *link, int depth) {
+  rows[size].label = label;
+  rows[size].link = link;
+  rows[size].depth = depth;
+  return size + 1;
+}
+
+static const xmlChar *_toc_label(struct opf *opf, vectorPtr label) {
+  char *lang = NULL;
+
+  if (! label || label->Size == 0)
+    return NULL;
+
+  if (opf->metadata)
+    lang = (char *)GetItem(opf->metadata->lang, 0);
+
+  return _opf_label_get_by_lang(opf, label, lang);
+}
+
+// Collects the rows of a navMap or pageList, the category label first
+static int _toc_category_rows(struct opf *opf, struct tocCategory *tc,
+                              int labelDepth, struct tocRow *rows) {
+  const xmlChar *label;
+  struct tocItem *ti;
+  int i, size = 0;
+
+  label = _toc_label(opf, tc->label);
+  if (label)
+    size = _toc_add_row(rows, size, label, NULL, labelDepth);
+
+  for (i = 0; i < tc->items->Size; i++) {
+    ti = GetItem(tc->items, i);
+    label = _toc_label(opf, ti->label);
+    size = _toc_add_row(rows, size, label?label:ti->id, ti->src, ti->depth);
+  }
+
+  return size;
+}
+
+static int _toc_guide_rows(struct opf *opf, struct tocRow *rows) {
+  struct guide *guide;
+  int i, size = 0;
+
+  for (i = 0; i < opf->guide->Size; i++) {
+    guide = GetItem(opf->guide, i);
+    size = _toc_add_row(rows, size, guide->title, guide->href, 1);
+  }
+
+  return size;
+}
+
+static const char *_toc_blob_copy(char **pos, const xmlChar *str) {
+  const char *res = *pos;
+  int len;
+
+  if (! str)
+    return NULL;
+
+  len = xmlStrlen(str) + 1;
+  memcpy(*pos, str, len);
+  *pos += len;
+
+  return res;
+}
+
+// Compiles rows into entries, computing parents and subtree ends
+static struct tocFlat *_toc_compile(struct opf *opf, struct tocRow *rows,
+                                    int size) {
+  struct tocFlat *flat;
+  int *stack = NULL;
+  int i, top = 0;
+  size_t len = 0;
+  char *pos;
+
+  flat = malloc(sizeof(struct tocFlat));
+  if (! flat) {
+    _epub_err_set_oom(&opf->epub->error);
+    return NULL;
+  }
+
+  for (i = 0; i < size; i++) {
+    if (rows[i].label)
+      len += xmlStrlen(rows[i].label) + 1;
+    if (rows[i].link)
+      len += xmlStrlen(rows[i].link) + 1;
+  }
+
+  flat->size = size;
+  flat->entries = malloc((size?size:1) * sizeof(struct epub_toc_entry));
+  flat->strings = malloc(len?len:1);
+  stack = malloc((size?size:1) * sizeof(int));
+  if (! flat->entries || ! flat->strings || ! stack) {
+    _epub_err_set_oom(&opf->epub->error);
+    free(stack);
+    _toc_free_flat(flat);
+    return NULL;
+  }
+
+  pos = flat->strings;
+  for (i = 0; i < size; i++) {
+    struct epub_toc_entry *entry = &flat->entries[i];
+
+    entry->label = _toc_blob_copy(&pos, rows[i].label);
+    entry->link = _toc_blob_copy(&pos, rows[i].link);
+    entry->depth = rows[i].depth;
+
+    // close the entries this one is not nested in
+    while (top > 0 && flat->entries[stack[top - 1]].depth >= entry->depth)
+      flat->entries[stack[--top]].end = i;
+
+    entry->parent = (top > 0)?stack[top - 1]:-1;
+    stack[top++] = i;
+  }
+
+  while (top > 0)
+    flat->entries[stack[--top]].end = size;
+
+  free(stack);
+  return flat;
+}
+
+static struct tocFlat *_toc_build_flat_type(struct opf *opf,
+                                            enum titerator_type type) {
+  struct tocFlat *flat;
+  struct tocRow *rows;
+  int size = 0;
+
+  switch (type) {
+  case TITERATOR_NAVMAP:
+    if (! opf->toc || ! opf->toc->navMap)
+      return NULL;
+    size = opf->toc->navMap->items->Size + 1;
+    break;
+  case TITERATOR_GUIDE:
+    if (! opf->guide)
+      return NULL;
+    size = opf->guide->Size;
+    break;
+  case TITERATOR_PAGES:
+    if (! opf->toc || ! opf->toc->pageList)
+      return NULL;
+    size = opf->toc->pageList->items->Size + 1;
+    break;
+  }
+
+  rows = malloc((size?size:1) * sizeof(struct tocRow));
+  if (! rows) {
+    _epub_err_set_oom(&opf->epub->error);
+    return NULL;
+  }
+
+  switch (type) {
+  case TITERATOR_NAVMAP:
+    size = _toc_category_rows(opf, opf->toc->navMap, 0, rows);
+    break;
+  case TITERATOR_GUIDE:
+    size = _toc_guide_rows(opf, rows);
+    break;
+  case TITERATOR_PAGES:
+    size = _toc_category_rows(opf, opf->toc->pageList, 1, rows);
+    break;
+  }
+
+  flat = _toc_compile(opf, rows, size);
+  free(rows);
+
+  return flat;
+}
+
+void _toc_build_flat(struct opf *opf) {
+  _epub_print_debug(opf->epub, DEBUG_INFO, "flattening toc");
+
+  opf->tocFlat[TITERATOR_NAVMAP] =
+    _toc_build_flat_type(opf, TITERATOR_NAVMAP);
+  opf->tocFlat[TITERATOR_GUIDE] =
+    _toc_build_flat_type(opf, TITERATOR_GUIDE);
+  opf->tocFlat[TITERATOR_PAGES] =
+    _toc_build_flat_type(opf, TITERATOR_PAGES);
+}
+
+struct tocFlat *_toc_get_flat(struct opf *opf, enum titerator_type type) {
+  switch (type) {
+  case TITERATOR_NAVMAP:
+  case TITERATOR_GUIDE:
+  case TITERATOR_PAGES:
+    return opf->tocFlat[type];
+  }
+
+  return NULL;
+}
+
+void _toc_free_flat(struct tocFlat *flat) {
+  if (! flat)
+    return;
+
+  free(flat->entries);
+  free(flat->strings);
+  free(flat);
+}
+
+static int _toc_cmp_position(const void *a, const void *b) {
+  const struct tocPosition *p1 = a, *p2 = b;
+
+  if (p1->spine != p2->spine)
+    return (p1->spine < p2->spine)?-1:1;
+  if (p1->order != p2->order)
+    return (p1->order < p2->order)?-1:1;
+  return p1->entry - p2->entry;
+}
+
+static int _toc_cmp_fragment(const void *a, const void *b) {
+  const struct tocPosition *p1 = *(struct tocPosition * const *)a;
+  const struct tocPosition *p2 = *(struct tocPosition * const *)b;
+  int res;
+
+  if (p1->spine != p2->spine)
+    return (p1->spine < p2->spine)?-1:1;
+  res = strcmp(p1->fragment, p2->fragment);
+  if (res)
+    return res;
+  return _toc_cmp_position(p1, p2);
+}
+
+static void _toc_sort_fragments(struct tocIndex *index) {
+  int i;
+
+  index->fragmentCount = 0;
+  for (i = 0; i < index->size; i++)
+    if (index->positions[i].fragment)
+      index->fragments[index->fragmentCount++] = &index->positions[i];
+
+  qsort(index->fragments, index->fragmentCount, 
+        sizeof(struct tocPosition *), _toc_cmp_fragment);
+}
+
+// Builds the (spine index, fragment order) -> navMap entry index.
+// Entries linking into the same document are taken to be in document
+// order, so a fragment's order is its rank among that document's
+// fragments in the toc.
+void _toc_build_index(struct opf *opf) {
+  struct tocFlat *flat = opf->tocFlat[TITERATOR_NAVMAP];
+  struct tocIndex *index;
+  struct manifest *ncx = NULL;
+  const char *base = NULL, *fragment;
+  int *counters;
+  int i, spine;
+
+  if (! flat)
+    return;
+
+  if (opf->tocName)
+    ncx = _opf_manifest_get_by_id(opf, opf->tocName);
+  if (ncx)
+    base = (char *)ncx->href;
+
+  index = malloc(sizeof(struct tocIndex));
+  counters = calloc(opf->spine->Size + 1, sizeof(int));
+  if (index) {
+    index->positions = malloc((flat->size?flat->size:1) * 
+                              sizeof(struct tocPosition));
+    index->fragments = malloc((flat->size?flat->size:1) * 
+                              sizeof(struct tocPosition *));
+  }
+  if (! index || ! counters || ! index->positions || ! index->fragments) {
+    _epub_err_set_oom(&opf->epub->error);
+    free(counters);
+    _toc_free_index(index);
+    return;
+  }
+
+  index->size = 0;
+  for (i = 0; i < flat->size; i++) {
+    struct tocPosition *pos = &index->positions[index->size];
+    
+    spine = _opf_spine_index_by_link(opf, base, flat->entries[i].link,
+                                     &fragment);
+    if (spine < 0)
+      continue;
+
+    pos->spine = spine;
+    pos->entry = i;
+    pos->fragment = fragment;
+    pos->order = fragment?++counters[spine]:0;
+    index->size++;
+  }
+  free(counters);
+
+  // entries linking to the same fragment share its first order
+  _toc_sort_fragments(index);
+  for (i = 1; i < index->fragmentCount; i++) {
+    struct tocPosition *prev = index->fragments[i - 1];
+    struct tocPosition *curr = index->fragments[i];
+
+    if (prev->spine == curr->spine && 
+        strcmp(prev->fragment, curr->fragment) == 0)
+      curr->order = prev->order;
+  }
+
+  qsort(index->positions, index->size, sizeof(struct tocPosition),
+        _toc_cmp_position);
+  _toc_sort_fragments(index);
+
+  opf->tocIndex = index;
+  _epub_print_debug(opf->epub, DEBUG_INFO, "indexed %d toc positions",
+                    index->size);
+}
+
+// Returns the last navMap entry starting at or before the given spine
+// document and fragment, which is the deepest one enclosing it, or -1.
+int _toc_entry_for_position(struct opf *opf, int spine, const char *fragment) {
+  struct tocIndex *index = opf->tocIndex;
+  int low, high, mid, res, order = 0;
+
+  if (! index)
+    return -1;
+
+  if (fragment && *fragment) {
+    struct tocPosition *pos;
+
+    low = 0;
+    high = index->fragmentCount - 1;
+    while (low <= high) {
+      mid = (low + high) / 2;
+      pos = index->fragments[mid];
+      if (pos->spine != spine)
+        res = (pos->spine < spine)?-1:1;
+      else
+        res = strcmp(pos->fragment, fragment);
+
+      if (res < 0)
+        low = mid + 1;
+      else
+        high = mid - 1;
+    }
+
+    // unknown fragments are taken as the document's start
+    if (low < index->fragmentCount) {
+      pos = index->fragments[low];
+      if (pos->spine == spine && strcmp(pos->fragment, fragment) == 0)
+        order = pos->order;
+    }
+  }
+
+  // find the last position not after (spine, order)
+  low = 0;
+  high = index->size - 1;
+  while (low <= high) {
+    struct tocPosition *pos;
+
+    mid = (low + high) / 2;
+    pos = &index->positions[mid];
+    if (pos->spine < spine || (pos->spine == spine && pos->order <= order))
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+
+  return (high >= 0)?index->positions[high].entry:-1;
+}
+
+void _toc_free_index(struct tocIndex *index) {
+  if (! index)
+    return;
+
+  free(index->positions);
+  free(index->fragments);
+  free(index);
+}
+
+static int _toc_cmp_page_label(const void *a, const void *b) {
+  const struct epub_toc_entry *e1 = *(struct epub_toc_entry * const *)a;
+  const struct epub_toc_entry *e2 = *(struct epub_toc_entry * const *)b;
+  int res = strcmp(e1->label, e2->label);
+
+  // keep page list order among equal keys
+  if (res)
+    return res;
+  return (e1 < e2)?-1:(e1 > e2);
+}
+
+static int _toc_cmp_page_link(const void *a, const void *b) {
+  const struct epub_toc_entry *e1 = *(struct epub_toc_entry * const *)a;
+  const struct epub_toc_entry *e2 = *(struct epub_toc_entry * const *)b;
+  int res = strcmp(e1->link, e2->link);
+
+  if (res)
+    return res;
+  return (e1 < e2)?-1:(e1 > e2);
+}
+
+// Builds the label -> link and link -> label maps of the pageList
+void _toc_build_page_index(struct opf *opf) {
+  struct tocFlat *flat = opf->tocFlat[TITERATOR_PAGES];
+  struct pageIndex *index;
+  int i;
+
+  if (! flat)
+    return;
+
+  index = malloc(sizeof(struct pageIndex));
+  if (index) {
+    index->byLabel = malloc((flat->size?flat->size:1) * 
+                            sizeof(struct epub_toc_entry *));
+    index->byLink = malloc((flat->size?flat->size:1) * 
+                           sizeof(struct epub_toc_entry *));
+  }
+  if (! index || ! index->byLabel || ! index->byLink) {
+    _epub_err_set_oom(&opf->epub->error);
+    _toc_free_page_index(index);
+    return;
+  }
+
+  // the category label has no link and is no page
+  index->size = 0;
+  for (i = 0; i < flat->size; i++) {
+    if (! flat->entries[i].link || ! flat->entries[i].label)
+      continue;
+    index->byLabel[index->size] = &flat->entries[i];
+    index->byLink[index->size] = &flat->entries[i];
+    index->size++;
+  }
+
+  qsort(index->byLabel, index->size, sizeof(struct epub_toc_entry *),
+        _toc_cmp_page_label);
+  qsort(index->byLink, index->size, sizeof(struct epub_toc_entry *),
+        _toc_cmp_page_link);
+
+  opf->pageIndex = index;
+  _epub_print_debug(opf->epub, DEBUG_INFO, "indexed %d pages", index->size);
+}
+
+// Returns the first entry of the sorted array whose key equals str
+static struct epub_toc_entry *_toc_page_search(struct epub_toc_entry **entries,
+                                               int size, int byLink,
+                                               const char *str) {
+  int low = 0, high = size - 1, mid;
+
+  while (low <= high) {
+    mid = (low + high) / 2;
+    if (strcmp(byLink?entries[mid]->link:entries[mid]->label, str) < 0)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+
+  if (low < size && 
+      strcmp(byLink?entries[low]->link:entries[low]->label, str) == 0)
+    return entries[low];
+
+  return NULL;
+}
+
+const char *_toc_page_target(struct opf *opf, const char *label) {
+  struct epub_toc_entry *entry;
+
+  if (! opf->pageIndex)
+    return NULL;
+
+  entry = _toc_page_search(opf->pageIndex->byLabel, opf->pageIndex->size,
+                           0, label);
+  return entry?entry->link:NULL;
+}
+
+const char *_toc_page_for_target(struct opf *opf, const char *link) {
+  struct epub_toc_entry *entry;
+
+  if (! opf->pageIndex)
+    return NULL;
+
+  entry = _toc_page_search(opf->pageIndex->byLink, opf->pageIndex->size,
+                           1, link);
+  return entry?entry->label:NULL;
+}
+
+void _toc_free_page_index(struct pageIndex *index) {
+  if (! index)
+    return;
+
+  free(index->byLabel);
+  free(index->byLink);
+  free(index);
+}
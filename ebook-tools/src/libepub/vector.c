@@ -0,0 +1,140 @@
+/* vector.c -- growable array container for libepub */
+
+#include "vector.h"
+#include <string.h>
+
+#define VECTOR_FIRST_ALLOC 8
+
+vectorPtr NewVector(NodeCompareFunc Cfunc)
+{
+  vectorPtr Vector;
+
+  if ((Vector = (vectorPtr)malloc(sizeof(struct Vector))) != NULL)
+    {
+      Vector->Items   = NULL;
+      Vector->Size    = 0;
+      Vector->Alloc   = 0;
+      Vector->compare = Cfunc;
+    }
+
+  return Vector;
+} /* NewVector() */
+
+int AddItem(vectorPtr Vector, void *Data)
+{
+  void **Items;
+  int  Alloc;
+
+  if (Vector == NULL) return LLIST_NULL;
+
+  if (Vector->Size == Vector->Alloc)
+    {
+      Alloc = (Vector->Alloc == 0) ? VECTOR_FIRST_ALLOC : Vector->Alloc * 2;
+      Items = (void **)realloc(Vector->Items, Alloc * sizeof(void *));
+      if (Items == NULL)
+	return LLIST_ERROR;
+
+      Vector->Items = Items;
+      Vector->Alloc = Alloc;
+    }
+
+  Vector->Items[Vector->Size++] = Data;
+
+  return LLIST_NOERROR;
+} /* AddItem() */
+
+void *GetItem(vectorPtr Vector, int Index)
+{
+  if ((Vector == NULL) || (Index < 0) || (Index >= Vector->Size))
+    return NULL;
+
+  return Vector->Items[Index];
+} /* GetItem() */
+
+void *FindItem(vectorPtr Vector, void *Data)
+{
+  int Index;
+
+  if ((Vector == NULL) || (Vector->compare == NULL))
+    return NULL;
+
+  for (Index = 0; Index < Vector->Size; Index++)
+    if ((Vector->compare)(Vector->Items[Index], Data) == 0)
+      return Vector->Items[Index];
+
+  return NULL;
+} /* FindItem() */
+
+static void MergeSort(void **Items, void **Temp, int Size, 
+		      NodeCompareFunc Cfunc)
+{
+  int Half, Left, Right, Out;
+
+  if (Size < 2)
+    return;
+
+  Half = Size / 2;
+  MergeSort(Items, Temp, Half, Cfunc);
+  MergeSort(Items + Half, Temp, Size - Half, Cfunc);
+
+  /* Already in order, nothing to merge */
+  if ((Cfunc)(Items[Half - 1], Items[Half]) <= 0)
+    return;
+
+  memcpy(Temp, Items, Half * sizeof(void *));
+  Left = 0;
+  Right = Half;
+  Out = 0;
+  while ((Left < Half) && (Right < Size))
+    {
+      if ((Cfunc)(Temp[Left], Items[Right]) <= 0)
+	Items[Out++] = Temp[Left++];
+      else
+	Items[Out++] = Items[Right++];
+    }
+  while (Left < Half)
+    Items[Out++] = Temp[Left++];
+} /* MergeSort() */
+
+void SortVector(vectorPtr Vector)
+{
+  void **Temp;
+
+  if ((Vector == NULL) || (Vector->compare == NULL) || (Vector->Size < 2))
+    return;
+
+  if ((Temp = (void **)malloc((Vector->Size / 2) * sizeof(void *))) == NULL)
+    return;
+
+  MergeSort(Vector->Items, Temp, Vector->Size, Vector->compare);
+  free(Temp);
+} /* SortVector() */
+
+int FreeVector(vectorPtr Vector, ListFreeFunc DataFree)
+{
+  int Index;
+
+  if (Vector == NULL) return LLIST_NULL;
+
+  if (DataFree != NULL)
+    for (Index = 0; Index < Vector->Size; Index++)
+      if (Vector->Items[Index] != NULL)
+	DataFree(Vector->Items[Index]);
+
+  free(Vector->Items);
+  free(Vector);
+
+  return LLIST_NOERROR;
+} /* FreeVector() */
+
+int DumpVector(vectorPtr Vector, ListDumpFunc DataDump)
+{
+  int Index;
+
+  if (Vector == NULL) return LLIST_BADVALUE;
+
+  for (Index = 0; Index < Vector->Size; Index++)
+    DataDump(Vector->Items[Index]);
+
+  return LLIST_NOERROR;
+} /* DumpVector() */
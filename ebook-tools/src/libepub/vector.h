@@ -0,0 +1,61 @@
+/* vector.h -- growable array container for libepub
+
+   A vector holds pointers to user data in one contiguous, growable
+   array.  It replaces the linked lists for collections that are filled
+   once while parsing and then read many times: elements can be reached
+   by index in constant time and walking a vector does not chase a
+   pointer per element.
+
+   The compare, free and dump function types are the ones used by
+   linklist.h so element helpers work with both containers.
+*/
+#ifndef __c_VECTOR__
+#define __c_VECTOR__
+
+#include "linklist.h"
+
+typedef struct Vector* vectorPtr;
+typedef struct Vector
+{
+  void         **Items;   /* The stored data pointers */
+  int          Size,      /* Number of items in the vector */
+               Alloc;     /* Number of item slots allocated */
+  NodeCompareFunc compare; /* Function to use to compare items */
+} vector;
+
+vectorPtr NewVector(NodeCompareFunc Cfunc);
+/* Create a new empty vector.  If "Cfunc" is NULL, don't do comparisons.
+   Returns
+        Pointer to a new vector
+        NULL on error (malloc failed) */
+
+int AddItem(vectorPtr Vector, void *Data);
+/* Appends Data at the end of the vector, growing it if needed.
+   Returns
+        LLIST_NOERROR on success
+        LLIST_NULL if Vector is NULL
+        LLIST_ERROR if the vector could not grow */
+
+void *GetItem(vectorPtr Vector, int Index);
+/* Returns the data at position "Index" (the first item is index 0), or NULL
+   if Vector is NULL or Index is out of range */
+
+void *FindItem(vectorPtr Vector, void *Data);
+/* Finds the first item for which the vector compare function returns 0
+   when compared with "Data".
+   Returns
+       Pointer to the item data
+       NULL if no compare function or no item matches */
+
+void SortVector(vectorPtr Vector);
+/* Stable sort of the vector using its compare function.  Items that compare
+   equal keep their relative order. */
+
+int FreeVector(vectorPtr Vector, ListFreeFunc DataFree);
+/* Frees the vector.  "DataFree" is an optional function used to free the
+   data of every non NULL item. */
+
+int DumpVector(vectorPtr Vector, ListDumpFunc DataDump);
+/* Print vector data using the DataDump function for every item */
+
+#endif  /* __c_VECTOR__ */
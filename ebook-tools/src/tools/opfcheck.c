@@ -0,0 +1,329 @@
+/* opfcheck -- checks the SAX opf parser against the reader based one
+
+   Parses the opf and toc of each book given with both parsers, compares
+   everything they build and times them. A developer tool, it uses the
+   library's internals and is not installed.
+*/
+#include <stdio.h>
+#include <time.h>
+#include <epub.h>
+#include "epublib.h"
+
+static void dump(xmlBufferPtr buf, const char *field, const xmlChar *value) {
+  xmlBufferCCat(buf, field);
+  xmlBufferCCat(buf, ": ");
+  xmlBufferCat(buf, value?value:(xmlChar *)"(null)");
+  xmlBufferCCat(buf, "\n");
+}
+
+static void dump_int(xmlBufferPtr buf, const char *field, int value) {
+  char str[32];
+
+  snprintf(str, sizeof(str), "%d", value);
+  dump(buf, field, (xmlChar *)str);
+}
+
+static void dump_strings(xmlBufferPtr buf, const char *field, vectorPtr v) {
+  int i;
+
+  dump_int(buf, field, v?v->Size:-1);
+  for (i = 0; v && i < v->Size; i++)
+    dump(buf, field, GetItem(v, i));
+}
+
+static void dump_meta(xmlBufferPtr buf, struct meta *meta) {
+  dump(buf, "meta name", meta->name);
+  dump(buf, "meta content", meta->content);
+  dump(buf, "meta property", meta->property);
+  dump(buf, "meta value", meta->value);
+  dump(buf, "meta refines", meta->refines);
+  dump(buf, "meta id", meta->id);
+}
+
+static void dump_metadata(xmlBufferPtr buf, struct metadata *meta) {
+  int i;
+
+  if (! meta) {
+    dump(buf, "metadata", NULL);
+    return;
+  }
+
+  dump_int(buf, "ids", meta->id->Size);
+  for (i = 0; i < meta->id->Size; i++) {
+    struct id *id = GetItem(meta->id, i);
+    dump(buf, "id string", id->string);
+    dump(buf, "id scheme", id->scheme);
+    dump(buf, "id id", id->id);
+  }
+  dump_strings(buf, "title", meta->title);
+  for (i = 0; i < meta->creator->Size; i++) {
+    struct creator *creator = GetItem(meta->creator, i);
+    dump(buf, "creator name", creator->name);
+    dump(buf, "creator file-as", creator->fileAs);
+    dump(buf, "creator role", creator->role);
+  }
+  for (i = 0; i < meta->contrib->Size; i++) {
+    struct creator *creator = GetItem(meta->contrib, i);
+    dump(buf, "contributor name", creator->name);
+    dump(buf, "contributor file-as", creator->fileAs);
+    dump(buf, "contributor role", creator->role);
+  }
+  dump_strings(buf, "subject", meta->subject);
+  dump_strings(buf, "publisher", meta->publisher);
+  dump_strings(buf, "description", meta->description);
+  for (i = 0; i < meta->date->Size; i++) {
+    struct date *date = GetItem(meta->date, i);
+    dump(buf, "date", date->date);
+    dump(buf, "date event", date->event);
+  }
+  dump_strings(buf, "type", meta->type);
+  dump_strings(buf, "format", meta->format);
+  dump_strings(buf, "source", meta->source);
+  dump_strings(buf, "language", meta->lang);
+  dump_strings(buf, "relation", meta->relation);
+  dump_strings(buf, "coverage", meta->coverage);
+  dump_strings(buf, "rights", meta->rights);
+  dump_int(buf, "metas", meta->meta->Size);
+  for (i = 0; i < meta->meta->Size; i++)
+    dump_meta(buf, GetItem(meta->meta, i));
+
+  dump_int(buf, "element ids", meta->ids->Size);
+  for (i = 0; i < meta->ids->Size; i++) {
+    struct metadataId *id = GetItem(meta->ids, i);
+    dump(buf, "element id", id->id);
+    dump_int(buf, "element type", id->type);
+    dump_int(buf, "element index", id->index);
+    dump_int(buf, "element refinements", id->refinements);
+    dump_int(buf, "element first refinement", id->firstRefinement);
+  }
+  dump_int(buf, "refines", meta->refines->Size);
+  for (i = 0; i < meta->refines->Size; i++)
+    dump_meta(buf, GetItem(meta->refines, i));
+  for (i = 0; i < meta->elementIds->Size; i++)
+    dump(buf, "by element", ((struct metadataId *)
+                             GetItem(meta->elementIds, i))->id);
+}
+
+static void dump_labels(xmlBufferPtr buf, const char *field, vectorPtr v) {
+  struct tocLabel *label;
+  int i;
+
+  dump_int(buf, field, v?v->Size:-1);
+  for (i = 0; v && i < v->Size; i++) {
+    label = GetItem(v, i);
+    if (! label) {
+      dump(buf, field, NULL);
+      continue;
+    }
+    dump(buf, "label text", label->text);
+    dump(buf, "label lang", label->lang);
+    dump(buf, "label dir", label->dir);
+  }
+}
+
+static void dump_item(xmlBufferPtr buf, struct tocItem *item) {
+  dump(buf, "item id", item->id);
+  dump(buf, "item src", item->src);
+  dump(buf, "item class", item->class);
+  dump(buf, "item type", item->type);
+  dump_int(buf, "item depth", item->depth);
+  dump_int(buf, "item play order", item->playOrder);
+  dump_int(buf, "item value", item->value);
+  dump_labels(buf, "item labels", item->label);
+}
+
+static void dump_category(xmlBufferPtr buf, const char *field,
+                          struct tocCategory *tc) {
+  int i;
+
+  dump(buf, field, tc?(xmlChar *)"":NULL);
+  if (! tc)
+    return;
+
+  dump(buf, "category id", tc->id);
+  dump(buf, "category class", tc->class);
+  dump_labels(buf, "category info", tc->info);
+  dump_labels(buf, "category labels", tc->label);
+  dump_int(buf, "items", tc->items->Size);
+  for (i = 0; i < tc->items->Size; i++)
+    dump_item(buf, GetItem(tc->items, i));
+}
+
+static void dump_opf(xmlBufferPtr buf, struct opf *opf) {
+  int i;
+
+  if (! opf) {
+    dump(buf, "opf", NULL);
+    return;
+  }
+
+  dump_metadata(buf, opf->metadata);
+
+  dump_int(buf, "manifest", opf->manifest?opf->manifest->Size:-1);
+  for (i = 0; opf->manifest && i < opf->manifest->Size; i++) {
+    struct manifest *item = GetItem(opf->manifest, i);
+    dump(buf, "manifest id", item->id);
+    dump(buf, "manifest href", item->href);
+    dump(buf, "manifest type", item->type);
+    dump(buf, "manifest fallback", item->fallback);
+    dump(buf, "manifest fallback-style", item->fbStyle);
+    dump(buf, "manifest required-namespace", item->nspace);
+    dump(buf, "manifest required-modules", item->modules);
+    dump(buf, "manifest properties", item->properties);
+  }
+
+  dump_int(buf, "spine", opf->spine?opf->spine->Size:-1);
+  for (i = 0; opf->spine && i < opf->spine->Size; i++) {
+    struct spine *item = GetItem(opf->spine, i);
+    dump(buf, "spine idref", item->idref);
+    dump_int(buf, "spine linear", item->linear);
+    dump_int(buf, "spine spread", item->spreadPosition);
+  }
+  dump_int(buf, "linear", opf->linearCount);
+  dump(buf, "toc name", opf->tocName);
+
+  dump_int(buf, "guide", opf->guide?opf->guide->Size:-1);
+  for (i = 0; opf->guide && i < opf->guide->Size; i++) {
+    struct guide *item = GetItem(opf->guide, i);
+    dump(buf, "guide type", item->type);
+    dump(buf, "guide title", item->title);
+    dump(buf, "guide href", item->href);
+  }
+
+  dump_int(buf, "tours", opf->tours?opf->tours->Size:-1);
+  for (i = 0; opf->tours && i < opf->tours->Size; i++) {
+    struct tour *tour = GetItem(opf->tours, i);
+    int j;
+
+    dump(buf, "tour id", tour->id);
+    dump(buf, "tour title", tour->title);
+    for (j = 0; j < tour->sites->Size; j++) {
+      struct site *site = GetItem(tour->sites, j);
+      dump(buf, "site title", site->title);
+      dump(buf, "site href", site->href);
+    }
+  }
+
+  dump(buf, "toc", opf->toc?(xmlChar *)"":NULL);
+  if (opf->toc) {
+    dump_category(buf, "nav map", opf->toc->navMap);
+    dump_category(buf, "nav list", opf->toc->navList);
+    dump_category(buf, "page list", opf->toc->pageList);
+    dump_int(buf, "play order", opf->toc->playOrder->Size);
+    for (i = 0; i < opf->toc->playOrder->Size; i++)
+      dump_item(buf, GetItem(opf->toc->playOrder, i));
+  }
+  dump_int(buf, "spine hrefs", opf->spineHrefCount);
+}
+
+// Prints the first line where the dumps differ
+static void report(const char *a, const char *b) {
+  int line = 1;
+  const char *start = a;
+
+  for (; *a && *a == *b; a++, b++)
+    if (*a == '\n') {
+      line++;
+      start = a + 1;
+    }
+
+  fprintf(stderr, "  line %d, reader: %.*s\n", line,
+          (int)strcspn(start, "\n"), start);
+  b -= a - start;
+  fprintf(stderr, "  line %d, sax:    %.*s\n", line,
+          (int)strcspn(b, "\n"), b);
+}
+
+static double run(struct epub *epub, char *opfStr, int sax, int runs) {
+  clock_t start = clock();
+  struct opf *opf;
+  int i;
+
+  for (i = 0; i < runs; i++) {
+    opf = sax?_sax_parse_opf(epub, opfStr):_opf_parse(epub, opfStr);
+    if (opf)
+      _opf_close(opf);
+  }
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / runs;
+}
+
+int main(int argc, char **argv) {
+  struct epub *epub;
+  struct opf *reader, *sax;
+  xmlBufferPtr a, b;
+  char *opfName, *opfStr;
+  double readerTime, saxTime, readerTotal = 0, saxTotal = 0;
+  int i, runs = 0, failed = 0;
+
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    runs = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc < 2) {
+    fprintf(stderr, "Usage: opfcheck [-n <runs>] <filename>...\n");
+    return 1;
+  }
+
+  for (i = 1; i < argc; i++) {
+    epub = epub_open_metadata(argv[i], 0);
+    if (! epub) {
+      fprintf(stderr, "%s: can't open\n", argv[i]);
+      continue;
+    }
+
+    opfName = _ocf_root_fullpath_by_type(epub->ocf,
+                                         "application/oebps-package+xml");
+    opfStr = NULL;
+    if (opfName)
+      _ocf_get_file(epub->ocf, opfName, &opfStr);
+    free(opfName);
+    if (! opfStr) {
+      fprintf(stderr, "%s: no opf\n", argv[i]);
+      epub_close(epub);
+      continue;
+    }
+
+    reader = _opf_parse(epub, opfStr);
+    sax = _sax_parse_opf(epub, opfStr);
+    a = xmlBufferCreate();
+    b = xmlBufferCreate();
+    dump_opf(a, reader);
+    dump_opf(b, sax);
+
+    if (strcmp((char *)xmlBufferContent(a), (char *)xmlBufferContent(b))) {
+      printf("%s: differs\n", argv[i]);
+      report((char *)xmlBufferContent(a), (char *)xmlBufferContent(b));
+      failed++;
+    } else {
+      printf("%s: same%s\n", argv[i],
+             sax && ! sax->arena?" (left to the reader)":"");
+    }
+
+    if (runs > 0) {
+      readerTime = run(epub, opfStr, 0, runs);
+      saxTime = run(epub, opfStr, 1, runs);
+      readerTotal += readerTime;
+      saxTotal += saxTime;
+      printf("  reader %.1f us, sax %.1f us\n", readerTime * 1e6,
+             saxTime * 1e6);
+    }
+
+    xmlBufferFree(a);
+    xmlBufferFree(b);
+    if (reader)
+      _opf_close(reader);
+    if (sax)
+      _opf_close(sax);
+    free(opfStr);
+    epub_close(epub);
+  }
+
+  if (runs > 0 && saxTotal > 0)
+    printf("total: reader %.1f us, sax %.1f us, %.2fx\n", readerTotal * 1e6,
+           saxTotal * 1e6, readerTotal / saxTotal);
+
+  epub_cleanup();
+  return failed?2:0;
+}